@@ -0,0 +1,853 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+/**
+ * @brief Google Benchmark suite of the SDK hot paths, fed with recorded data
+ *
+ * Usage: lidar_benchmarks [--input=<file>] [benchmark flags]
+ *  - <file> is a log written by unilidar_recorder, whose raw MavLink bytes are replayed, or a raw
+ *    dump of the serial port; LIDAR_BENCH_INPUT is used when --input is not given. Without
+ *    input, a synthetic stream of 100 clouds is generated so the suite still runs without a lidar.
+ *  - The output is JSON unless --benchmark_format is given; the input and the dataset sizes are
+ *    reported in the context of the JSON output.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "udp_handler.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+#include "unitree_lidar_sdk_frame_decoder.h"
+#include "unitree_lidar_sdk_scan_kernel.h"
+#include "unitree_lidar_sdk_recorder.h"
+#include "unitree_lidar_sdk_shm.h"
+#include "unitree_lidar_sdk_detector.h"
+#include "unitree_lidar_sdk_spsc_ring.h"
+#include "unitree_lidar_sdk_range_image.h"
+#include "unitree_lidar_sdk_scan_filter.h"
+#ifdef UNITREE_BENCHMARK_PCL
+#include "unitree_lidar_sdk_pcl.h"
+#endif
+
+using namespace unitree_lidar_sdk;
+
+namespace{
+
+const uint16_t CLOUD_SCAN_NUM = 18;
+const int SYNTHETIC_PACKETS = 1800;
+
+/**
+ * @brief Everything the benchmarks run on, built once from the input
+ */
+typedef struct{
+  std::string source;                       // input file, or "synthetic"
+  std::vector<uint8_t> bytes;               // serial stream
+  std::vector<mavlink_ret_lidar_auxiliary_data_packet_t> aux;
+  std::vector<mavlink_ret_lidar_distance_data_packet_t> range;   // matched with aux
+  std::vector<ScanUnitree> scans;
+  std::vector<PointCloudUnitree> clouds;    // CLOUD_SCAN_NUM scans each
+  uint64_t points;                          // valid points of the scans
+}Dataset;
+
+std::string g_input;
+
+/**
+ * @brief Synthetic serial stream: a rotating wall with a small target, and an IMU message every 4 packets
+ */
+std::vector<uint8_t> synthesizeStream(int packets){
+  std::vector<uint8_t> out;
+  uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+  mavlink_message_t msg;
+  for (int p = 0; p < packets; p++){
+    uint8_t reflect[POINTS_NUM_OF_SCAN];
+    uint8_t point_data[POINTS_NUM_OF_SCAN * 2];
+    float yaw = fmodf(p * 2.0f, 360.0f);
+    for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+      uint16_t r = (uint16_t)(6000 + 2000 * sinf(j * 0.05f + p * 0.01f));
+      bool target = (yaw >= 40 && yaw < 46 && j >= 60 && j < 66);
+      if (target){
+        r = 3000;
+      }
+      else if (j % 17 == 0){
+        r = 0;    // no return
+      }
+      reflect[j] = target ? 200 : (uint8_t)(j * 2);
+      point_data[2 * j] = r & 0xff;
+      point_data[2 * j + 1] = r >> 8;
+    }
+    uint32_t us = (p * 5555) % 1000000;
+    uint32_t s = 1000 + (p * 5555) / 1000000;
+    mavlink_msg_ret_lidar_auxiliary_data_packet_pack(1, 1, &msg, 1, (uint16_t)p, POINTS_NUM_OF_SCAN, 0, s, us,
+        100000, 5000, yaw, 2.0f, -10.0f, 1.5f, 30, 0, 35, 1, 1, 5, 0, 0, 0, 0, 0, 0, reflect);
+    out.insert(out.end(), buf, buf + mavlink_msg_to_send_buffer(buf, &msg));
+    mavlink_msg_ret_lidar_distance_data_packet_pack(1, 1, &msg, (uint16_t)p, 1, sizeof(point_data), point_data);
+    out.insert(out.end(), buf, buf + mavlink_msg_to_send_buffer(buf, &msg));
+    if (p % 4 == 0){
+      float q[4] = {0, 0, sinf(p * 0.01f), cosf(p * 0.01f)};
+      float w[3] = {0.1f, 0.2f, 0.3f};
+      float a[3] = {0, 0, 9.8f};
+      mavlink_msg_ret_imu_attitude_data_packet_pack(1, 1, &msg, (uint16_t)p, q, w, a);
+      out.insert(out.end(), buf, buf + mavlink_msg_to_send_buffer(buf, &msg));
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Read the serial stream of a log, or the whole file if it is not a log
+ */
+int loadStream(const std::string& path, std::vector<uint8_t>& bytes){
+  bytes.clear();
+  LogReader log;
+  if (log.open(path) == 0){
+    LogRecordView record;
+    while (log.next(&record) == 0){
+      if (record.type == LOG_RECORD_MAVLINK){
+        bytes.insert(bytes.end(), record.data, record.data + record.size);
+      }
+    }
+    return bytes.empty() ? -1 : 0;
+  }
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file){
+    return -1;
+  }
+  bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return bytes.empty() ? -1 : 0;
+}
+
+/**
+ * @brief Time of a packet on the lidar clock, in second
+ */
+double lidarTime(const mavlink_ret_lidar_auxiliary_data_packet_t& aux){
+  return aux.time_stamp_s_step + aux.time_stamp_us_step * 1e-6;
+}
+
+/**
+ * @brief Decode the stream into packet pairs, scans and clouds, as UnitreeLidarEventReader does
+ */
+int buildDataset(Dataset& d){
+  d.source = g_input.empty() ? "synthetic" : g_input;
+  if (g_input.empty()){
+    d.bytes = synthesizeStream(SYNTHETIC_PACKETS);
+  }
+  else if (loadStream(g_input, d.bytes) != 0){
+    return -1;
+  }
+
+  MavlinkFrameDecoder decoder;
+  mavlink_ret_lidar_auxiliary_data_packet_t aux;
+  bool aux_valid = false;
+  decoder.decode(d.bytes.data(), d.bytes.size(), [&](const MavlinkFrameView& frame){
+    if (frame.msgid == MAVLINK_MSG_ID_RET_LIDAR_AUXILIARY_DATA_PACKET){
+      decodeFrame(frame, &aux);
+      aux_valid = true;
+    }
+    else if (frame.msgid == MAVLINK_MSG_ID_RET_LIDAR_DISTANCE_DATA_PACKET){
+      mavlink_ret_lidar_distance_data_packet_t range;
+      decodeFrame(frame, &range);
+      if (aux_valid && aux.packet_id == range.packet_id){
+        d.aux.push_back(aux);
+        d.range.push_back(range);
+      }
+    }
+  });
+
+  ScanConverter converter;
+  ScanUnitree scan;
+  PointCloudUnitree cloud;
+  double cloud_start = 0;
+  d.points = 0;
+  for (size_t i = 0; i < d.aux.size(); i++){
+    double t = lidarTime(d.aux[i]);
+    if (i % CLOUD_SCAN_NUM == 0){
+      cloud_start = t;
+      cloud.stamp = t;
+      cloud.id = (uint32_t)d.clouds.size();
+      cloud.ringNum = 1;
+      cloud.points.clear();
+    }
+    double dt = i > 0 ? t - lidarTime(d.aux[i - 1]) : 0;
+    float time_step = (dt > 0 && dt < 0.01) ? (float)(dt / POINTS_NUM_OF_SCAN) : 0;
+    converter.convert(d.aux[i], d.range[i], scan, (float)(t - cloud_start), time_step);
+    scan.stamp = t;
+    d.scans.push_back(scan);
+    d.points += scan.validPointsNum;
+    cloud.points.insert(cloud.points.end(), scan.points, scan.points + scan.validPointsNum);
+    if (i % CLOUD_SCAN_NUM == CLOUD_SCAN_NUM - 1u){
+      d.clouds.push_back(cloud);
+    }
+  }
+  return d.scans.empty() ? -1 : 0;
+}
+
+Dataset g_dataset;
+
+const Dataset& dataset(){
+  return g_dataset;
+}
+
+/**
+ * @brief Round-trip times of a benchmark, reported as percentiles and log2 buckets
+ */
+class LatencyHistogram{
+
+public:
+
+  void add(double seconds){
+    samples_.push_back(seconds);
+  }
+
+  /**
+   * @brief Report p50/p90/p99/max in microseconds and the count of every non-empty bucket, named
+   *  after its upper bound: lt_<2^k>us holds the samples in [2^(k-1), 2^k) microseconds
+   */
+  void report(benchmark::State& state){
+    if (samples_.empty()){
+      return;
+    }
+    std::sort(samples_.begin(), samples_.end());
+    state.counters["p50_us"] = percentile(0.50) * 1e6;
+    state.counters["p90_us"] = percentile(0.90) * 1e6;
+    state.counters["p99_us"] = percentile(0.99) * 1e6;
+    state.counters["max_us"] = samples_.back() * 1e6;
+
+    std::vector<uint64_t> buckets(32, 0);
+    for (size_t i = 0; i < samples_.size(); i++){
+      double us = samples_[i] * 1e6;
+      int k = us < 1 ? 0 : std::min(31, (int)floor(log2(us)) + 1);
+      buckets[k]++;
+    }
+    for (int k = 0; k < 32; k++){
+      if (buckets[k]){
+        state.counters["lt_" + std::to_string(1ull << k) + "us"] = (double)buckets[k];
+      }
+    }
+  }
+
+private:
+
+  double percentile(double p) const{
+    size_t i = (size_t)(p * (samples_.size() - 1) + 0.5);
+    return samples_[i];
+  }
+
+  std::vector<double> samples_;
+};
+
+double secondsSince(uint64_t start_ns){
+  return (detail::monotonicNs() - start_ns) * 1e-9;
+}
+
+/**
+ * @brief Message of a round trip: 0 an IMU message, 1 a scan message
+ */
+uint32_t encodeRoundTripMessage(int64_t kind, char* buffer){
+  const Dataset& d = dataset();
+  if (kind == 0){
+    IMUUnitree imu;
+    memset(&imu, 0, sizeof(imu));
+    return dataStructToUDPBuffer<IMUUnitree>(imu, UDP_MSG_TYPE_IMU, buffer);
+  }
+  return dataStructToUDPBuffer<ScanUnitree>(d.scans[0], UDP_MSG_TYPE_SCAN, buffer);
+}
+
+} // end of namespace
+
+/**
+ * @brief MavLink frame decoding of the serial stream, in bytes/s
+ */
+static void BM_MavlinkDecode(benchmark::State& state){
+  const Dataset& d = dataset();
+  MavlinkFrameDecoder decoder;
+  uint64_t frames = 0;
+  for (auto _ : state){
+    size_t n = 0;
+    decoder.decode(d.bytes.data(), d.bytes.size(), [&n](const MavlinkFrameView& frame){
+      n += frame.msgid;
+    });
+    benchmark::DoNotOptimize(n);
+  }
+  frames = decoder.getStats().frames;
+  state.SetBytesProcessed((int64_t)(state.iterations() * d.bytes.size()));
+  state.counters["frames"] = benchmark::Counter((double)frames, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_MavlinkDecode);
+
+/**
+ * @brief The byte-by-byte mavlink_parse_char() decoding, for comparison with BM_MavlinkDecode
+ */
+static void BM_MavlinkParseChar(benchmark::State& state){
+  const Dataset& d = dataset();
+  mavlink_message_t msg;
+  mavlink_status_t status;
+  uint64_t frames = 0;
+  for (auto _ : state){
+    for (size_t i = 0; i < d.bytes.size(); i++){
+      frames += mavlink_parse_char(MAVLINK_COMM_0, d.bytes[i], &msg, &status);
+    }
+  }
+  state.SetBytesProcessed((int64_t)(state.iterations() * d.bytes.size()));
+  state.counters["frames"] = benchmark::Counter((double)frames, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_MavlinkParseChar);
+
+namespace{
+
+/**
+ * @brief Typed handler of BM_MavlinkDispatch, reading one field of each received message
+ */
+struct PacketIdSum{
+  size_t n = 0;
+  void operator()(const mavlink_ret_imu_attitude_data_packet_t& packet){ n += packet.packet_id; }
+  void operator()(const mavlink_ret_lidar_auxiliary_data_packet_t& packet){ n += packet.packet_id; }
+  void operator()(const mavlink_ret_lidar_distance_data_packet_t& packet){ n += packet.packet_id; }
+  template <typename Packet>
+  void operator()(const Packet&){}
+};
+
+} // end of namespace
+
+/**
+ * @brief Frame decoding with the payloads handed to typed handlers, in bytes/s
+ * @note Arg 0 copies every payload with decodeFrame(), arg 1 uses dispatchSysMavlink().
+ */
+static void BM_MavlinkDispatch(benchmark::State& state){
+  const Dataset& d = dataset();
+  MavlinkFrameDecoder decoder;
+  PacketIdSum sum;
+  for (auto _ : state){
+    if (state.range(0) == 0){
+      decoder.decode(d.bytes.data(), d.bytes.size(), [&sum](const MavlinkFrameView& frame){
+        if (frame.msgid == MAVLINK_MSG_ID_RET_IMU_ATTITUDE_DATA_PACKET){
+          mavlink_ret_imu_attitude_data_packet_t packet;
+          decodeFrame(frame, &packet);
+          sum(packet);
+        }
+        else if (frame.msgid == MAVLINK_MSG_ID_RET_LIDAR_AUXILIARY_DATA_PACKET){
+          mavlink_ret_lidar_auxiliary_data_packet_t packet;
+          decodeFrame(frame, &packet);
+          sum(packet);
+        }
+        else if (frame.msgid == MAVLINK_MSG_ID_RET_LIDAR_DISTANCE_DATA_PACKET){
+          mavlink_ret_lidar_distance_data_packet_t packet;
+          decodeFrame(frame, &packet);
+          sum(packet);
+        }
+      });
+    }
+    else{
+      decoder.decode(d.bytes.data(), d.bytes.size(), [&sum](const MavlinkFrameView& frame){
+        dispatchSysMavlink(frame, sum);
+      });
+    }
+    benchmark::DoNotOptimize(sum.n);
+  }
+  state.SetBytesProcessed((int64_t)(state.iterations() * d.bytes.size()));
+  state.counters["frames"] = benchmark::Counter((double)decoder.getStats().frames, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_MavlinkDispatch)->Arg(0)->Arg(1);
+
+/**
+ * @brief Distance packets to XYZ points, in points/s
+ */
+static void BM_ScanConvert(benchmark::State& state){
+  const Dataset& d = dataset();
+  ScanConverter converter;
+  ScanUnitree scan;
+  size_t i = 0;
+  uint64_t points = 0;
+  for (auto _ : state){
+    points += converter.convert(d.aux[i], d.range[i], scan);
+    benchmark::DoNotOptimize(scan.points);
+    i = (i + 1 == d.aux.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)points);
+  state.SetLabel(scanKernelIsa());
+}
+BENCHMARK(BM_ScanConvert);
+
+/**
+ * @brief ScanFilter::apply() of the lanes of each packet with every stage enabled, in points/s
+ */
+static void BM_ScanFilter(benchmark::State& state){
+  const Dataset& d = dataset();
+  ScanConverter converter;
+  std::vector<ScanLanes> lanes(d.aux.size());
+  for (size_t i = 0; i < lanes.size(); i++){
+    converter.computeLanes(d.aux[i], d.range[i].point_data, &lanes[i]);
+  }
+  ScanFilterConfig config = defaultScanFilterConfig();
+  config.enabled = true;
+  config.min_intensity = 5;
+  ScanFilter filter(config);
+  ScanLanes scan;
+  size_t i = 0;
+  uint64_t removed = 0;
+  for (auto _ : state){
+    scan = lanes[i];
+    ScanFilterCounts counts = filter.apply(scan);
+    removed += counts.intensity + counts.dust + counts.isolated;
+    benchmark::DoNotOptimize(scan.valid);
+    i = (i + 1 == lanes.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)(state.iterations() * POINTS_NUM_OF_SCAN));
+  state.counters["removed"] = benchmark::Counter((double)removed, benchmark::Counter::kAvgIterations);
+  state.SetLabel(scanKernelIsa());
+}
+BENCHMARK(BM_ScanFilter);
+
+/**
+ * @brief dataStructToUDPBuffer() of scans, in bytes/s of UDP message
+ */
+static void BM_UDPEncodeScan(benchmark::State& state){
+  const Dataset& d = dataset();
+  std::vector<char> buffer(sizeof(ScanUnitree) + UDP_MSG_HEADER_SIZE);
+  size_t i = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state){
+    bytes += dataStructToUDPBuffer<ScanUnitree>(d.scans[i], UDP_MSG_TYPE_SCAN, buffer.data());
+    benchmark::ClobberMemory();
+    i = (i + 1 == d.scans.size()) ? 0 : i + 1;
+  }
+  state.SetBytesProcessed((int64_t)bytes);
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_UDPEncodeScan);
+
+/**
+ * @brief Parsing of the messages written by dataStructToUDPBuffer() back into scans, in bytes/s
+ */
+static void BM_UDPDecodeScan(benchmark::State& state){
+  const Dataset& d = dataset();
+  const size_t stride = sizeof(ScanUnitree) + UDP_MSG_HEADER_SIZE;
+  const size_t count = std::min<size_t>(d.scans.size(), 256);
+  std::vector<char> buffers(count * stride);
+  std::vector<uint32_t> lengths(count);
+  for (size_t i = 0; i < count; i++){
+    lengths[i] = dataStructToUDPBuffer<ScanUnitree>(d.scans[i], UDP_MSG_TYPE_SCAN, &buffers[i * stride]);
+  }
+  ScanUnitree scan;
+  size_t i = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state){
+    forEachUDPMessage(&buffers[i * stride], (int)lengths[i], [&scan](uint32_t msgType, const char* data, uint32_t size){
+      if (msgType == UDP_MSG_TYPE_SCAN){
+        memcpy(&scan, data, std::min<uint32_t>(size, sizeof(ScanUnitree)));
+      }
+    });
+    benchmark::DoNotOptimize(scan);
+    bytes += lengths[i];
+    i = (i + 1 == count) ? 0 : i + 1;
+  }
+  state.SetBytesProcessed((int64_t)bytes);
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_UDPDecodeScan);
+
+/**
+ * @brief compactScanToUDPBuffer() of scans, for comparison with BM_UDPEncodeScan
+ */
+static void BM_CompactEncodeScan(benchmark::State& state){
+  const Dataset& d = dataset();
+  std::vector<char> buffer(UDP_MSG_HEADER_SIZE + compactScanDataSize(POINTS_NUM_OF_SCAN));
+  size_t i = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state){
+    bytes += compactScanToUDPBuffer(d.scans[i], (uint32_t)i, buffer.data());
+    benchmark::ClobberMemory();
+    i = (i + 1 == d.scans.size()) ? 0 : i + 1;
+  }
+  state.SetBytesProcessed((int64_t)bytes);
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_CompactEncodeScan);
+
+static void BM_CompactDecodeScan(benchmark::State& state){
+  const Dataset& d = dataset();
+  const size_t stride = UDP_MSG_HEADER_SIZE + compactScanDataSize(POINTS_NUM_OF_SCAN);
+  const size_t count = std::min<size_t>(d.scans.size(), 256);
+  std::vector<char> buffers(count * stride);
+  std::vector<uint32_t> lengths(count);
+  for (size_t i = 0; i < count; i++){
+    lengths[i] = compactScanToUDPBuffer(d.scans[i], (uint32_t)i, &buffers[i * stride]);
+  }
+  ScanUnitree scan;
+  size_t i = 0;
+  uint64_t bytes = 0;
+  for (auto _ : state){
+    int n = udpBufferToCompactScan(&buffers[i * stride] + UDP_MSG_HEADER_SIZE, lengths[i] - UDP_MSG_HEADER_SIZE, scan);
+    benchmark::DoNotOptimize(n);
+    benchmark::DoNotOptimize(scan);
+    bytes += lengths[i];
+    i = (i + 1 == count) ? 0 : i + 1;
+  }
+  state.SetBytesProcessed((int64_t)bytes);
+  state.SetItemsProcessed((int64_t)state.iterations());
+}
+BENCHMARK(BM_CompactDecodeScan);
+
+/**
+ * @brief Round trip of a message through a UDP echo on the loopback, arg 0 for IMU, 1 for scan
+ */
+static void BM_UDPRoundTrip(benchmark::State& state){
+  const unsigned short echo_port = (unsigned short)(20000 + getpid() % 20000);
+  const unsigned short client_port = echo_port + 1;
+  UDPHandler echo(echo_port);
+  UDPHandler client(client_port);
+  if (echo.CreateSocket() < 0 || !echo.Bind() || client.CreateSocket() < 0 || !client.Bind()){
+    state.SkipWithError("cannot bind the loopback sockets");
+    return;
+  }
+  echo.SetRecvTimeout(1);
+  client.SetRecvTimeout(1);
+
+  std::atomic<bool> stop(false);
+  std::thread thread([&](){
+    std::vector<char> buf(65536);
+    sockaddr_in from;
+    while (!stop.load()){
+      int n = echo.Recv(buf.data(), (int)buf.size(), &from);
+      if (n > 0){
+        echo.Send(buf.data(), n, inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+      }
+    }
+  });
+
+  std::vector<char> message(sizeof(ScanUnitree) + UDP_MSG_HEADER_SIZE);
+  std::vector<char> reply(65536);
+  uint32_t length = encodeRoundTripMessage(state.range(0), message.data());
+  char ip[] = "127.0.0.1";
+  sockaddr_in from;
+  LatencyHistogram histogram;
+  for (auto _ : state){
+    uint64_t start = detail::monotonicNs();
+    client.Send(message.data(), (int)length, ip, echo_port);
+    if (client.Recv(reply.data(), (int)reply.size(), &from) != (int)length){
+      state.SkipWithError("echo lost");
+      break;
+    }
+    double rtt = secondsSince(start);
+    state.SetIterationTime(rtt);
+    histogram.add(rtt);
+  }
+  stop = true;
+  thread.join();
+  echo.Close();
+  client.Close();
+  histogram.report(state);
+  state.SetBytesProcessed((int64_t)(state.iterations() * length));
+}
+BENCHMARK(BM_UDPRoundTrip)->Arg(0)->Arg(1)->UseManualTime();
+
+/**
+ * @brief Round trip of a message through two shared memory rings, arg 0 for IMU, 1 for scan
+ */
+static void BM_ShmRoundTrip(benchmark::State& state){
+  const std::string ping_name = "/unilidar_bench_ping_" + std::to_string(getpid());
+  const std::string pong_name = "/unilidar_bench_pong_" + std::to_string(getpid());
+  ShmRingPublisher ping, pong;
+  ShmRingSubscriber ping_sub, pong_sub;
+  if (ping.open(ping_name, 16) != 0 || pong.open(pong_name, 16) != 0 ||
+      ping_sub.open(ping_name) != 0 || pong_sub.open(pong_name) != 0){
+    ShmRingPublisher::unlink(ping_name);
+    ShmRingPublisher::unlink(pong_name);
+    state.SkipWithError("cannot open the shared memory rings");
+    return;
+  }
+
+  std::atomic<bool> stop(false);
+  std::thread thread([&](){
+    std::vector<char> buf(sizeof(ScanUnitree));
+    ShmMessageInfo info;
+    while (!stop.load()){
+      if (ping_sub.receive(&info, buf.data(), (uint32_t)buf.size(), 100) == 1){
+        pong.publish(info.msgType, buf.data(), info.size);
+      }
+    }
+  });
+
+  const Dataset& d = dataset();
+  IMUUnitree imu;
+  memset(&imu, 0, sizeof(imu));
+  std::vector<char> reply(sizeof(ScanUnitree));
+  ShmMessageInfo info;
+  LatencyHistogram histogram;
+  uint64_t bytes = 0;
+  for (auto _ : state){
+    uint64_t start = detail::monotonicNs();
+    if (state.range(0) == 0){
+      ping.publishIMU(imu);
+    }
+    else{
+      ping.publishScan(d.scans[0]);
+    }
+    if (pong_sub.receive(&info, reply.data(), (uint32_t)reply.size(), 1000) != 1){
+      state.SkipWithError("echo lost");
+      break;
+    }
+    double rtt = secondsSince(start);
+    state.SetIterationTime(rtt);
+    histogram.add(rtt);
+    bytes += info.size;
+  }
+  stop = true;
+  thread.join();
+  ShmRingPublisher::unlink(ping_name);
+  ShmRingPublisher::unlink(pong_name);
+  histogram.report(state);
+  state.SetBytesProcessed((int64_t)bytes);
+}
+BENCHMARK(BM_ShmRoundTrip)->Arg(0)->Arg(1)->UseManualTime();
+
+/**
+ * @brief Round trip of a scan through two SpscRing queues between threads, as between pipeline stages
+ */
+static void BM_SpscRingRoundTrip(benchmark::State& state){
+  SpscRing<ScanUnitree> ping(16, BLOCK), pong(16, BLOCK);
+  std::thread thread([&](){
+    ScanUnitree scan;
+    while (ping.waitPop(&scan, -1)){
+      pong.push(scan);
+    }
+  });
+
+  const Dataset& d = dataset();
+  ScanUnitree reply;
+  LatencyHistogram histogram;
+  for (auto _ : state){
+    uint64_t start = detail::monotonicNs();
+    ping.push(d.scans[0]);
+    if (!pong.waitPop(&reply, 1000)){
+      state.SkipWithError("echo lost");
+      break;
+    }
+    double rtt = secondsSince(start);
+    state.SetIterationTime(rtt);
+    histogram.add(rtt);
+  }
+  ping.close();
+  thread.join();
+  histogram.report(state);
+  state.SetBytesProcessed((int64_t)state.iterations() * sizeof(ScanUnitree));
+}
+BENCHMARK(BM_SpscRingRoundTrip)->UseManualTime();
+
+#ifdef UNITREE_BENCHMARK_PCL
+/**
+ * @brief transformUnitreeCloudToPCL() of the clouds, in points/s
+ */
+static void BM_TransformToPCL(benchmark::State& state){
+  const Dataset& d = dataset();
+  pcl::PointCloud<PointType>::Ptr out(new pcl::PointCloud<PointType>());
+  size_t i = 0;
+  uint64_t points = 0;
+  for (auto _ : state){
+    transformUnitreeCloudToPCL(d.clouds[i], out);
+    benchmark::DoNotOptimize(out->points.data());
+    points += d.clouds[i].points.size();
+    i = (i + 1 == d.clouds.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)points);
+}
+BENCHMARK(BM_TransformToPCL);
+
+/**
+ * @brief Copy of the clouds into PointUnitreePCL clouds, which have the layout of PointUnitree
+ */
+static void BM_TransformToPCLUnitree(benchmark::State& state){
+  const Dataset& d = dataset();
+  pcl::PointCloud<PointUnitreePCL> out;
+  size_t i = 0;
+  uint64_t points = 0;
+  for (auto _ : state){
+    transformUnitreeCloudToPCL(d.clouds[i], out);
+    benchmark::DoNotOptimize(out.points.data());
+    points += d.clouds[i].points.size();
+    i = (i + 1 == d.clouds.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)points);
+}
+BENCHMARK(BM_TransformToPCLUnitree);
+#endif
+
+/**
+ * @brief DroneDetector::detect() of the clouds, per frame
+ */
+static void BM_DetectFrame(benchmark::State& state){
+  const Dataset& d = dataset();
+  if (d.clouds.empty()){
+    state.SkipWithError("no complete cloud in the input");
+    return;
+  }
+  DroneDetector detector;
+  std::vector<Detection> detections;
+  size_t i = 0;
+  uint64_t points = 0, found = 0;
+  for (auto _ : state){
+    detector.detect(d.clouds[i], detections);
+    found += detections.size();
+    points += d.clouds[i].points.size();
+    i = (i + 1 == d.clouds.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)points);
+  state.counters["frame_time"] = benchmark::Counter((double)state.iterations(),
+                                                    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  state.counters["detections"] = benchmark::Counter((double)found, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_DetectFrame);
+
+/**
+ * @brief RangeImageFilter::process() of the range images of the clouds: median denoise, ground and clusters
+ */
+static void BM_RangeImageFilter(benchmark::State& state){
+  const Dataset& d = dataset();
+  if (d.clouds.empty()){
+    state.SkipWithError("no complete cloud in the input");
+    return;
+  }
+  ScanConverter converter;
+  ScanLanes lanes;
+  std::vector<RangeImage> images(d.clouds.size());
+  for (size_t i = 0; i < images.size() * CLOUD_SCAN_NUM; i++){
+    converter.computeLanes(d.aux[i], d.range[i].point_data, &lanes, 0, 0);
+    images[i / CLOUD_SCAN_NUM].appendScan(d.aux[i], lanes);
+  }
+  RangeImageFilter filter;
+  std::vector<RangeImageCluster> clusters;
+  RangeImage image;
+  size_t i = 0;
+  uint64_t pixels = 0, found = 0;
+  for (auto _ : state){
+    state.PauseTiming();
+    image = images[i];
+    state.ResumeTiming();
+    found += filter.process(image, clusters);
+    pixels += image.size();
+    i = (i + 1 == images.size()) ? 0 : i + 1;
+  }
+  state.SetItemsProcessed((int64_t)pixels);
+  state.counters["frame_time"] = benchmark::Counter((double)state.iterations(),
+                                                    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+  state.counters["clusters"] = benchmark::Counter((double)found, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_RangeImageFilter);
+
+/**
+ * @brief Serial bytes to detections: frame decoding, scan conversion and detection of every cloud
+ */
+static void BM_EndToEndFrame(benchmark::State& state){
+  const Dataset& d = dataset();
+  if (d.clouds.empty()){
+    state.SkipWithError("no complete cloud in the input");
+    return;
+  }
+  MavlinkFrameDecoder decoder;
+  ScanConverter converter;
+  ScanLanes lanes;
+  DroneDetector detector;
+  std::vector<Detection> detections;
+  PointCloudUnitree cloud;
+  cloud.points.reserve(CLOUD_SCAN_NUM * POINTS_NUM_OF_SCAN);
+  mavlink_ret_lidar_auxiliary_data_packet_t aux;
+  uint64_t frames = 0;
+  for (auto _ : state){
+    bool aux_valid = false;
+    uint16_t scans = 0;
+    double cloud_start = 0;
+    cloud.points.clear();
+    decoder.decode(d.bytes.data(), d.bytes.size(), [&](const MavlinkFrameView& frame){
+      if (frame.msgid == MAVLINK_MSG_ID_RET_LIDAR_AUXILIARY_DATA_PACKET){
+        decodeFrame(frame, &aux);
+        aux_valid = true;
+        return;
+      }
+      if (frame.msgid != MAVLINK_MSG_ID_RET_LIDAR_DISTANCE_DATA_PACKET){
+        return;
+      }
+      mavlink_ret_lidar_distance_data_packet_t range;
+      decodeFrame(frame, &range);
+      if (!aux_valid || aux.packet_id != range.packet_id){
+        return;
+      }
+      double t = lidarTime(aux);
+      if (scans == 0){
+        cloud_start = t;
+        cloud.stamp = t;
+      }
+      converter.computeLanes(aux, range.point_data, &lanes, (float)(t - cloud_start), 0);
+      size_t size = cloud.points.size();
+      cloud.points.resize(size + POINTS_NUM_OF_SCAN);
+      cloud.points.resize(size + ScanConverter::compactLanes(lanes, &cloud.points[size]));
+      if (++scans == CLOUD_SCAN_NUM){
+        detector.detect(cloud, detections);
+        cloud.points.clear();
+        scans = 0;
+        frames++;
+      }
+    });
+  }
+  state.SetBytesProcessed((int64_t)(state.iterations() * d.bytes.size()));
+  state.SetItemsProcessed((int64_t)frames);
+  state.counters["frame_time"] = benchmark::Counter((double)frames,
+                                                    benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_EndToEndFrame)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char** argv){
+  // --input is read here, every other flag is left to Google Benchmark; JSON by default
+  std::vector<char*> args;
+  bool has_format = false;
+  for (int i = 0; i < argc; i++){
+    if (i > 0 && strncmp(argv[i], "--input=", 8) == 0){
+      g_input = argv[i] + 8;
+      continue;
+    }
+    has_format = has_format || strncmp(argv[i], "--benchmark_format=", 19) == 0;
+    args.push_back(argv[i]);
+  }
+  std::string json_format = "--benchmark_format=json";
+  if (!has_format){
+    args.push_back(&json_format[0]);
+  }
+  int n = (int)args.size();
+  args.push_back(nullptr);
+  benchmark::Initialize(&n, args.data());
+  if (benchmark::ReportUnrecognizedArguments(n, args.data())){
+    return 1;
+  }
+
+  if (g_input.empty() && getenv("LIDAR_BENCH_INPUT")){
+    g_input = getenv("LIDAR_BENCH_INPUT");
+  }
+  if (buildDataset(g_dataset) != 0){
+    fprintf(stderr, "cannot read lidar packets from %s\n", g_input.c_str());
+    return 1;
+  }
+  const Dataset& d = dataset();
+  benchmark::AddCustomContext("input", d.source);
+  benchmark::AddCustomContext("input_bytes", std::to_string(d.bytes.size()));
+  benchmark::AddCustomContext("scans", std::to_string(d.scans.size()));
+  benchmark::AddCustomContext("clouds", std::to_string(d.clouds.size()));
+  benchmark::AddCustomContext("points", std::to_string(d.points));
+  benchmark::AddCustomContext("scan_kernel", scanKernelIsa());
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,392 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+// Python bindings of the native drone detector, used by drone_detector.py when they are built,
+// and of the native decoding of the lidar data, used by lidar_udp_receiver.py
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <chrono>
+#include <stdexcept>
+
+#include "unitree_lidar_sdk_detector.h"
+#include "unitree_lidar_sdk_event_reader.h"
+#include "unitree_lidar_sdk_udp_cloud.h"
+
+namespace py = pybind11;
+using namespace unitree_lidar_sdk;
+
+namespace{
+
+/**
+ * @brief Read-only structured array of the points of a pooled cloud, without copying them
+ * @note The array keeps the handle: the buffer goes back to its pool when the array is released.
+ */
+py::array cloudPoints(PoolHandle<PointCloudUnitree> cloud){
+  PoolHandle<PointCloudUnitree>* owner = new PoolHandle<PointCloudUnitree>(std::move(cloud));
+  py::capsule base(owner, [](void* p){ delete static_cast<PoolHandle<PointCloudUnitree>*>(p); });
+  const std::vector<PointUnitree>& points = (*owner)->points;
+  py::array_t<PointUnitree> array({(py::ssize_t)points.size()}, {(py::ssize_t)sizeof(PointUnitree)},
+                                  points.data(), base);
+  array.attr("setflags")(py::arg("write") = false);
+  return array;
+}
+
+/**
+ * @brief (points, stamp, id) of a pooled cloud, None if the handle is empty
+ */
+py::object cloudTuple(PoolHandle<PointCloudUnitree> cloud){
+  if (!cloud){
+    return py::none();
+  }
+  double stamp = cloud->stamp;
+  uint32_t id = cloud->id;
+  return py::make_tuple(cloudPoints(std::move(cloud)), stamp, id);
+}
+
+/**
+ * @brief A float32 array as is if its strides are whole floats, otherwise a C-contiguous float32 copy
+ */
+py::array floatArray(py::object obj){
+  if (py::isinstance<py::array_t<float> >(obj)){
+    py::array array = py::reinterpret_borrow<py::array>(obj);
+    bool strided = true;
+    for (py::ssize_t d = 0; d < array.ndim(); d++){
+      strided = strided && array.strides(d) >= 0 && array.strides(d) % (py::ssize_t)sizeof(float) == 0;
+    }
+    if (strided){
+      return array;
+    }
+  }
+  py::array array = py::array_t<float, py::array::c_style | py::array::forcecast>::ensure(obj);
+  if (!array){
+    throw std::invalid_argument("expected an array of numbers");
+  }
+  return array;
+}
+
+/**
+ * @brief Call wait(slice_ms) without the GIL until it returns true or timeout_ms expires
+ * @note The wait is cut into 100 ms slices with the GIL taken back in between, so that Ctrl-C
+ *  interrupts it with a KeyboardInterrupt even when timeout_ms is negative, i.e. unbounded.
+ */
+template <typename Wait>
+bool waitInterruptible(int timeout_ms, Wait wait){
+  const int slice_ms = 100;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true){
+    int wait_ms = slice_ms;
+    if (timeout_ms >= 0){
+      auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()).count();
+      wait_ms = remain < slice_ms ? (remain > 0 ? (int)remain : 0) : slice_ms;
+    }
+    bool done;
+    {
+      py::gil_scoped_release release;
+      done = wait(wait_ms);
+    }
+    if (done){
+      return true;
+    }
+    if (PyErr_CheckSignals() != 0){
+      throw py::error_already_set();
+    }
+    if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline){
+      return false;
+    }
+  }
+}
+
+py::dict imuDict(const IMUUnitree& imu){
+  py::dict d;
+  d["stamp"] = imu.stamp;
+  d["id"] = imu.id;
+  d["quaternion"] = py::make_tuple(imu.quaternion[0], imu.quaternion[1], imu.quaternion[2], imu.quaternion[3]);
+  d["angular_velocity"] = py::make_tuple(imu.angular_velocity[0], imu.angular_velocity[1], imu.angular_velocity[2]);
+  d["linear_acceleration"] = py::make_tuple(imu.linear_acceleration[0], imu.linear_acceleration[1], imu.linear_acceleration[2]);
+  return d;
+}
+
+/**
+ * @brief Native decoding of the datagrams of unilidar_publisher_udp into clouds
+ */
+class PyUDPCloudAssembler{
+
+public:
+
+  PyUDPCloudAssembler(uint32_t scans_per_cloud, uint32_t queue_size){
+    UDPCloudConfig config = defaultUDPCloudConfig();
+    config.scans_per_cloud = scans_per_cloud;
+    config.queue_size = queue_size;
+    assembler_.setConfig(config);
+  }
+
+  /**
+   * @brief Decode a received datagram, e.g. a bytearray filled by socket.recv_into()
+   * @return the number of clouds it completed, -1 if it is truncated
+   */
+  int addDatagram(py::buffer data, py::ssize_t size){
+    py::buffer_info info = data.request();
+    py::ssize_t bytes = info.size * info.itemsize;
+    if (size < 0 || size > bytes){
+      size = bytes;
+    }
+    py::gil_scoped_release release;
+    return assembler_.addDatagram(static_cast<const char*>(info.ptr), (int)size);
+  }
+
+  /**
+   * @brief Oldest complete cloud as (points, stamp, id), None if none is queued
+   */
+  py::object popCloud(){
+    PoolHandle<PointCloudUnitree> cloud;
+    assembler_.popCloud(&cloud);
+    return cloudTuple(std::move(cloud));
+  }
+
+  uint64_t imuCount() const{
+    return assembler_.imuCount();
+  }
+
+  py::object latestIMU() const{
+    if (assembler_.imuCount() == 0){
+      return py::none();
+    }
+    return imuDict(assembler_.getIMU());
+  }
+
+  py::dict stats() const{
+    const UDPCloudStats& s = assembler_.getStats();
+    py::dict d;
+    d["datagrams"] = s.datagrams;
+    d["truncated"] = s.truncated;
+    d["scans"] = s.scans;
+    d["imu_messages"] = s.imu_messages;
+    d["clouds"] = s.clouds;
+    d["dropped_clouds"] = s.dropped_clouds;
+    d["lost_messages"] = s.lost_messages;
+    return d;
+  }
+
+private:
+  UDPCloudAssembler assembler_;
+};
+
+/**
+ * @brief The lidar read straight from its serial port, without the publisher
+ */
+class PySerialReader{
+
+public:
+
+  int initialize(const std::string& port, uint16_t cloud_scan_num, uint32_t baudrate){
+    return reader_.initialize(cloud_scan_num, port, baudrate);
+  }
+
+  void setWorkingMode(int mode){
+    reader_.setLidarWorkingMode((LidarWorkingMode)mode);
+  }
+
+  /**
+   * @brief Parse until a message is complete, without holding the GIL; Ctrl-C interrupts the wait
+   * @return "imu", "pointcloud", "version", ... or None on timeout
+   */
+  py::object waitForMessage(int timeout_ms){
+    MessageType type = NONE;
+    waitInterruptible(timeout_ms, [this, &type](int wait_ms){
+      type = reader_.waitForMessage(wait_ms);
+      return type != NONE;
+    });
+    switch (type){
+      case IMU: return py::str("imu");
+      case POINTCLOUD: return py::str("pointcloud");
+      case RANGE: return py::str("range");
+      case AUXILIARY: return py::str("auxiliary");
+      case VERSION: return py::str("version");
+      case TIMESYNC: return py::str("timesync");
+      default: return py::none();
+    }
+  }
+
+  bool waitForLinkState(int state, int timeout_ms){
+    return waitInterruptible(timeout_ms, [this, state](int wait_ms){
+      return reader_.waitForLinkState((LinkState)state, wait_ms);
+    });
+  }
+
+  /**
+   * @brief Latest cloud as (points, stamp, id), None before the first one
+   */
+  py::object cloud() const{
+    return cloudTuple(reader_.getCloudHandle());
+  }
+
+  py::dict imu() const{
+    return imuDict(reader_.getIMU());
+  }
+
+  std::string linkState() const{
+    return linkStateName(reader_.getLinkState());
+  }
+
+  std::string version() const{
+    return reader_.getVersionOfFirmware();
+  }
+
+  double dirtyPercentage() const{
+    return reader_.getDirtyPercentage();
+  }
+
+private:
+  UnitreeLidarEventReader reader_;
+};
+
+class PyDroneDetector{
+
+public:
+
+  PyDroneDetector(const DetectionConfig& config) : detector_(config){}
+
+  /**
+   * @brief Detect the clusters of an (n, 3) array of points and an optional (n,) array of intensities
+   * @note float32 arrays are read in place with their strides, e.g. the views of cloudPoints();
+   *  other arrays are converted first.
+   * @return (detections, labels), with a dict per cluster and the cluster label of every point
+   */
+  py::tuple detect(py::object points, py::object intensities){
+    py::array xyz_array = floatArray(points);
+    if (xyz_array.ndim() != 2 || xyz_array.shape(1) != 3){
+      throw std::invalid_argument("points must be an (n, 3) array");
+    }
+    const size_t n = xyz_array.shape(0);
+    py::array intensity_array;
+    const bool has_intensity = !intensities.is_none();
+    if (has_intensity){
+      intensity_array = floatArray(intensities);
+      if (intensity_array.ndim() != 1 || (size_t)intensity_array.shape(0) != n){
+        throw std::invalid_argument("intensities must be an (n,) array");
+      }
+    }
+
+    const float* xyz = static_cast<const float*>(xyz_array.data());
+    const size_t stride = xyz_array.strides(0) / sizeof(float);
+    const size_t column = xyz_array.strides(1) / sizeof(float);
+    const float* in = has_intensity ? static_cast<const float*>(intensity_array.data()) : nullptr;
+    const size_t in_stride = has_intensity ? intensity_array.strides(0) / sizeof(float) : 1;
+    {
+      py::gil_scoped_release release;
+      detector_.detect(xyz, xyz + column, xyz + 2 * column, stride, in, n, detections_, in_stride);
+    }
+
+    py::list detections;
+    for (size_t k = 0; k < detections_.size(); k++){
+      const Detection& d = detections_[k];
+      py::dict item;
+      item["center"] = py::make_tuple(d.center[0], d.center[1], d.center[2]);
+      item["size"] = py::make_tuple(d.size[0], d.size[1], d.size[2]);
+      item["min_bound"] = py::make_tuple(d.min_bound[0], d.min_bound[1], d.min_bound[2]);
+      item["max_bound"] = py::make_tuple(d.max_bound[0], d.max_bound[1], d.max_bound[2]);
+      item["distance"] = d.distance;
+      item["point_count"] = d.point_count;
+      item["mean_intensity"] = d.mean_intensity;
+      item["intensity_variance"] = d.intensity_variance;
+      item["principal_sigma"] = py::make_tuple(d.principal_sigma[0], d.principal_sigma[1], d.principal_sigma[2]);
+      item["principal_axis"] = py::make_tuple(d.principal_axis[0], d.principal_axis[1], d.principal_axis[2]);
+      item["confidence"] = d.confidence;
+      item["label"] = d.label;
+      item["is_drone_like"] = d.is_drone;
+      detections.append(item);
+    }
+
+    const std::vector<int32_t>& labels = detector_.getLabels();
+    py::array_t<int32_t> label_array(labels.size());
+    if (!labels.empty()){
+      memcpy(label_array.mutable_data(), labels.data(), labels.size() * sizeof(int32_t));
+    }
+    return py::make_tuple(detections, label_array);
+  }
+
+  py::dict stats() const{
+    const DetectionStats& s = detector_.getStats();
+    py::dict d;
+    d["input_points"] = s.input_points;
+    d["candidate_points"] = s.candidate_points;
+    d["voxels"] = s.voxels;
+    d["core_voxels"] = s.core_voxels;
+    d["clusters"] = s.clusters;
+    d["drones"] = s.drones;
+    return d;
+  }
+
+  DetectionConfig getConfig() const{
+    return detector_.getConfig();
+  }
+
+  void setConfig(const DetectionConfig& config){
+    detector_.setConfig(config);
+  }
+
+private:
+  DroneDetector detector_;
+  std::vector<Detection> detections_;
+};
+
+} // namespace
+
+PYBIND11_MODULE(catcher_native, m){
+  m.doc() = "Native voxel grid, outlier removal, clustering and gating of drone candidates, "
+            "and native decoding of the lidar clouds into NumPy arrays";
+
+  py::class_<DetectionConfig>(m, "DetectionConfig")
+    .def(py::init([](){ return defaultDetectionConfig(); }))
+    .def_readwrite("voxel_size", &DetectionConfig::voxel_size)
+    .def_readwrite("clustering_distance", &DetectionConfig::clustering_distance)
+    .def_readwrite("min_neighbors", &DetectionConfig::min_neighbors)
+    .def_readwrite("min_points_per_cluster", &DetectionConfig::min_points_per_cluster)
+    .def_readwrite("max_points_per_cluster", &DetectionConfig::max_points_per_cluster)
+    .def_readwrite("drone_size_min", &DetectionConfig::drone_size_min)
+    .def_readwrite("drone_size_max_xy", &DetectionConfig::drone_size_max_xy)
+    .def_readwrite("drone_size_max_z", &DetectionConfig::drone_size_max_z)
+    .def_readwrite("distance_min", &DetectionConfig::distance_min)
+    .def_readwrite("distance_max", &DetectionConfig::distance_max)
+    .def_readwrite("min_height", &DetectionConfig::min_height)
+    .def_readwrite("min_intensity", &DetectionConfig::min_intensity);
+
+  py::class_<PyDroneDetector>(m, "DroneDetector")
+    .def(py::init<const DetectionConfig&>(), py::arg("config") = defaultDetectionConfig())
+    .def("detect", &PyDroneDetector::detect, py::arg("points"), py::arg("intensities") = py::none())
+    .def("stats", &PyDroneDetector::stats)
+    .def_property("config", &PyDroneDetector::getConfig, &PyDroneDetector::setConfig);
+
+  PYBIND11_NUMPY_DTYPE(PointUnitree, x, y, z, intensity, time, ring);
+  m.attr("POINT_DTYPE") = py::dtype::of<PointUnitree>();
+  m.attr("NORMAL") = (int)NORMAL;
+  m.attr("STANDBY") = (int)STANDBY;
+  m.attr("LINK_DISCONNECTED") = (int)LINK_DISCONNECTED;
+  m.attr("LINK_WAITING") = (int)LINK_WAITING;
+  m.attr("LINK_STANDBY") = (int)LINK_STANDBY;
+  m.attr("LINK_STREAMING") = (int)LINK_STREAMING;
+
+  py::class_<PyUDPCloudAssembler>(m, "UDPCloudAssembler")
+    .def(py::init<uint32_t, uint32_t>(), py::arg("scans_per_cloud") = 1, py::arg("queue_size") = 8)
+    .def("add_datagram", &PyUDPCloudAssembler::addDatagram, py::arg("data"), py::arg("size") = -1)
+    .def("pop_cloud", &PyUDPCloudAssembler::popCloud)
+    .def("latest_imu", &PyUDPCloudAssembler::latestIMU)
+    .def("imu_count", &PyUDPCloudAssembler::imuCount)
+    .def("stats", &PyUDPCloudAssembler::stats);
+
+  py::class_<PySerialReader>(m, "SerialReader")
+    .def(py::init<>())
+    .def("initialize", &PySerialReader::initialize, py::arg("port") = "/dev/ttyUSB0",
+         py::arg("cloud_scan_num") = 18, py::arg("baudrate") = 2000000)
+    .def("set_working_mode", &PySerialReader::setWorkingMode, py::arg("mode"))
+    .def("wait_for_message", &PySerialReader::waitForMessage, py::arg("timeout_ms") = -1)
+    .def("wait_for_link_state", &PySerialReader::waitForLinkState, py::arg("state"), py::arg("timeout_ms") = -1)
+    .def("cloud", &PySerialReader::cloud)
+    .def("imu", &PySerialReader::imu)
+    .def("link_state", &PySerialReader::linkState)
+    .def("version", &PySerialReader::version)
+    .def("dirty_percentage", &PySerialReader::dirtyPercentage);
+}
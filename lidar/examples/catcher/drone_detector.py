@@ -4,6 +4,12 @@ import time
 import random
 from threading import Thread
 
+# 原生检测模块 (由CMake在找到pybind11时编译到本目录), 不可用时回退到Open3D实现
+try:
+    import catcher_native
+except ImportError:
+    catcher_native = None
+
 # 激光雷达原始数据类（存储单帧点云数据）
 class LidarPointCloud:
     def __init__(self):
@@ -149,6 +155,23 @@ class DroneDetector:
             'min_z': 0, 'max_z': 0.5,
             'min_points': 50, 'max_points': 300
         }
+
+        # 原生检测器: 体素滤波、离群点移除、聚类和尺寸判断在C++中一次完成
+        self.native = None
+        if catcher_native is not None:
+            config = catcher_native.DetectionConfig()
+            config.voxel_size = self.voxel_size
+            config.clustering_distance = self.dbscan_eps
+            config.min_neighbors = self.dbscan_min_points
+            config.min_points_per_cluster = self.drone_size_range['min_points']
+            config.max_points_per_cluster = self.drone_size_range['max_points']
+            config.drone_size_min = 0
+            config.drone_size_max_xy = self.drone_size_range['max_x']
+            config.drone_size_max_z = self.drone_size_range['max_z']
+            config.distance_min = 0
+            config.distance_max = 0
+            config.min_height = -1e6
+            self.native = catcher_native.DroneDetector(config)
         
     def raw_data_to_point_cloud(self, raw_data):
         """将原始点数据转换为Open3D点云对象"""
@@ -196,6 +219,9 @@ class DroneDetector:
         """从原始数据中检测无人机"""
         if raw_data is None or raw_data.points is None or len(raw_data.points) == 0:
             return [], None
+
+        if self.native is not None:
+            return self._detect_drones_native(raw_data)
         
         # 转换为Open3D点云
         pcd = self.raw_data_to_point_cloud(raw_data)
@@ -227,6 +253,38 @@ class DroneDetector:
         
         return drone_clusters, processed_pcd
         
+    def _detect_drones_native(self, raw_data):
+        """
+        使用原生检测模块检测无人机, 不创建任何Open3D对象
+
+        返回 (无人机检测结果字典列表, 每个点的聚类标签), 显示时再用 display_geometry() 生成点云
+        """
+        detections, labels = self.native.detect(raw_data.points, raw_data.intensities)
+        print(f"检测到 {len(detections)} 个聚类")
+        drones = [detection for detection in detections if detection['is_drone_like']]
+        return drones, labels
+
+    def display_geometry(self, raw_data, drones, labels):
+        """为原生检测结果创建显示用的 (背景点云, 无人机点云列表), 一次遍历收集所有无人机点"""
+        pcd = self.raw_data_to_point_cloud(raw_data)
+        if not drones:
+            return pcd, []
+
+        drone_labels = np.array([drone['label'] for drone in drones], dtype=labels.dtype)
+        indices = np.flatnonzero(np.isin(labels, drone_labels))
+        order = np.argsort(labels[indices], kind='stable')
+        indices = indices[order]
+        sorted_labels = labels[indices]
+        splits = np.flatnonzero(np.diff(sorted_labels)) + 1
+
+        points = np.asarray(raw_data.points)
+        drone_clusters = []
+        for cluster_indices in np.split(indices, splits):
+            cluster_pcd = o3d.geometry.PointCloud()
+            cluster_pcd.points = o3d.utility.Vector3dVector(points[cluster_indices])
+            drone_clusters.append(cluster_pcd)
+        return pcd, drone_clusters
+
     def _is_drone(self, cluster_pcd):
         """判断聚类是否为无人机"""
         # 获取点云边界框
@@ -337,8 +395,8 @@ def main():
                 time.sleep(0.1)
                 continue
                 
-            # 检测无人机
-            drones, processed_pcd = detector.detect_drones(raw_data)
+            # 检测无人机 (原生检测时 result 为聚类标签, 否则为预处理后的点云)
+            drones, result = detector.detect_drones(raw_data)
             
             # 显示检测结果
             if drones:
@@ -346,8 +404,13 @@ def main():
             else:
                 print("未检测到无人机")
                 
-            # 更新可视化
-            visualizer.update_visualization(processed_pcd, drones)
+            # 更新可视化, 原生检测结果在这里才转换为Open3D点云
+            if detector.native is not None:
+                background_pcd, drone_clusters = detector.display_geometry(raw_data, drones, result)
+            else:
+                background_pcd, drone_clusters = result, drones
+            if background_pcd is not None:
+                visualizer.update_visualization(background_pcd, drone_clusters)
             
             time.sleep(0.1)  # 控制检测频率
             
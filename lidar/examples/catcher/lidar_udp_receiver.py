@@ -14,6 +14,19 @@ import time
 import threading
 from typing import Optional, Tuple, List
 
+# 原生解码模块 (由CMake在找到pybind11时编译到本目录), 不可用时回退到NumPy解析
+try:
+    import catcher_native
+except ImportError:
+    catcher_native = None
+
+# PointUnitree 的内存布局 (24 字节), 与 catcher_native.POINT_DTYPE 相同
+POINT_DTYPE = np.dtype([
+    ("x", "<f4"), ("y", "<f4"), ("z", "<f4"),
+    ("intensity", "<f4"), ("time", "<f4"), ("ring", "<u4"),
+])
+SCAN_HEADER_SIZE = 24  # 消息头 8 字节 + stamp, id, validPointsNum
+
 
 class PointUnitree:
     """Unitree 激光雷达点数据结构"""
@@ -27,8 +40,8 @@ class PointUnitree:
 
 
 class ScanUnitree:
-    """Unitree 激光雷达扫描数据结构"""
-    def __init__(self, stamp: float, id: int, validPointsNum: int, points: List[PointUnitree]):
+    """Unitree 激光雷达扫描数据结构, points 为 POINT_DTYPE 结构化数组"""
+    def __init__(self, stamp: float, id: int, validPointsNum: int, points: np.ndarray):
         self.stamp = stamp
         self.id = id
         self.validPointsNum = validPointsNum
@@ -54,6 +67,21 @@ class LidarPointCloud:
         self.timestamp = None  # 时间戳
 
 
+def structured_to_point_cloud(points: np.ndarray, stamp: float) -> LidarPointCloud:
+    """
+    将 POINT_DTYPE 结构化数组转换为 LidarPointCloud, 不复制数据
+
+    points 与 intensities 都是 points 的视图 (只读, 非连续), 原生模块返回的数组
+    直接引用 SDK 缓冲池中的点云, 释放最后一个视图后缓冲区才归还缓冲池。
+    catcher_native.DroneDetector.detect() 按步长直接读取这些视图, 同样不复制。
+    """
+    cloud = LidarPointCloud()
+    cloud.timestamp = stamp
+    cloud.points = points.view(np.float32).reshape(-1, 6)[:, :3]
+    cloud.intensities = points["intensity"]
+    return cloud
+
+
 class LidarUDPReceiver:
     """
     Unitree 激光雷达 UDP 数据接收器
@@ -62,18 +90,23 @@ class LidarUDPReceiver:
     - 接收 UDP 激光雷达数据
     - 解析点云和 IMU 数据
     - 转换为标准格式供其他模块使用
+
+    编译了 catcher_native 时由 C++ 解码所有消息类型 (包括批量和压缩消息),
+    并可将 scans_per_cloud 个扫描累积为一帧点云; 否则用 NumPy 解析 101/102 消息。
     """
 
-    def __init__(self, udp_ip: str = "0.0.0.0", udp_port: int = 12345):
+    def __init__(self, udp_ip: str = "0.0.0.0", udp_port: int = 12345, scans_per_cloud: int = 1):
         """
         初始化 UDP 接收器
 
         Args:
             udp_ip: UDP 监听 IP 地址
             udp_port: UDP 监听端口
+            scans_per_cloud: 累积为一帧点云的扫描数 (仅原生模块可用)
         """
         self.udp_ip = udp_ip
         self.udp_port = udp_port
+        self.scans_per_cloud = scans_per_cloud
         self.socket = None
         self.running = False
         self.thread = None
@@ -87,12 +120,17 @@ class LidarUDPReceiver:
         # 数据结构大小计算
         self.imu_data_str = "=dI4f3f3f"
         self.imu_data_size = struct.calcsize(self.imu_data_str)
-        self.point_data_str = "=fffffI"
-        self.point_size = struct.calcsize(self.point_data_str)
+        self.point_size = POINT_DTYPE.itemsize
+
+        # 原生解码器
+        self.assembler = None
+        if catcher_native is not None:
+            self.assembler = catcher_native.UDPCloudAssembler(scans_per_cloud=scans_per_cloud)
 
         print(f"LidarUDPReceiver 初始化完成")
         print(f"监听地址: {self.udp_ip}:{self.udp_port}")
         print(f"数据结构大小: point={self.point_size}, imu={self.imu_data_size}")
+        print(f"解码方式: {'catcher_native' if self.assembler is not None else 'numpy'}")
 
     def connect(self) -> bool:
         """
@@ -160,6 +198,9 @@ class LidarUDPReceiver:
 
     def _data_receiving_loop(self):
         """数据接收循环"""
+        if self.assembler is not None:
+            self._native_receiving_loop()
+            return
         while self.running:
             try:
                 # 接收 UDP 数据
@@ -184,6 +225,52 @@ class LidarUDPReceiver:
                     print(f"数据接收错误: {e}")
                 break
 
+    def _native_receiving_loop(self):
+        """原生数据接收循环: 数据报接收到预分配缓冲区, 由 C++ 解码为缓冲池中的点云"""
+        buffer = bytearray(65536)
+        imu_count = 0
+        while self.running:
+            try:
+                size = self.socket.recv_into(buffer)
+            except socket.timeout:
+                continue
+            except Exception as e:
+                if self.running:
+                    print(f"数据接收错误: {e}")
+                break
+
+            if self.assembler.add_datagram(buffer, size) > 0:
+                # 只保留最新一帧, 旧帧的缓冲区随即归还缓冲池
+                latest = None
+                while True:
+                    item = self.assembler.pop_cloud()
+                    if item is None:
+                        break
+                    latest = item
+                points, stamp, id = latest
+                point_cloud = structured_to_point_cloud(points, stamp)
+                scan_msg = ScanUnitree(stamp, id, len(points), points)
+                with self.data_lock:
+                    self.latest_scan = scan_msg
+                    self.latest_point_cloud = point_cloud
+
+            if self.assembler.imu_count() != imu_count:
+                imu_count = self.assembler.imu_count()
+                imu = self.assembler.latest_imu()
+                imu_msg = IMUUnitree(
+                    stamp=imu["stamp"],
+                    id=imu["id"],
+                    quaternion=imu["quaternion"],
+                    angular_velocity=imu["angular_velocity"],
+                    linear_acceleration=imu["linear_acceleration"]
+                )
+                with self.data_lock:
+                    self.latest_imu = imu_msg
+
+    def get_stats(self) -> dict:
+        """获取原生解码器的统计信息, NumPy 解析时为空"""
+        return self.assembler.stats() if self.assembler is not None else {}
+
     def _parse_imu_message(self, data: bytes):
         """解析 IMU 消息"""
         try:
@@ -207,23 +294,12 @@ class LidarUDPReceiver:
     def _parse_scan_message(self, data: bytes):
         """解析点云扫描消息"""
         try:
-            length = struct.unpack("=I", data[4:8])[0]
-            stamp = struct.unpack("=d", data[8:16])[0]
-            id = struct.unpack("=I", data[16:20])[0]
-            valid_points_num = struct.unpack("=I", data[20:24])[0]
-
-            # 解析点云数据
-            scan_points = []
-            point_start_addr = 24
-
-            for i in range(valid_points_num):
-                point_data = struct.unpack(
-                    self.point_data_str,
-                    data[point_start_addr:point_start_addr + self.point_size]
-                )
-                point_start_addr += self.point_size
-                point = PointUnitree(*point_data)
-                scan_points.append(point)
+            stamp, id, valid_points_num = struct.unpack_from("=dII", data, 8)
+
+            # 解析点云数据: 一次映射所有点, 不逐点解包
+            valid_points_num = min(valid_points_num, (len(data) - SCAN_HEADER_SIZE) // self.point_size)
+            scan_points = np.frombuffer(data, dtype=POINT_DTYPE, count=valid_points_num,
+                                        offset=SCAN_HEADER_SIZE)
 
             scan_msg = ScanUnitree(stamp, id, valid_points_num, scan_points)
 
@@ -247,25 +323,93 @@ class LidarUDPReceiver:
         Returns:
             LidarPointCloud: 转换后的点云数据
         """
-        cloud = LidarPointCloud()
-        cloud.timestamp = scan_msg.stamp
+        return structured_to_point_cloud(scan_msg.points, scan_msg.stamp)
+
+
+class LidarSerialReceiver(LidarUDPReceiver):
+    """
+    直接从串口读取激光雷达 (需要 catcher_native), 无需运行 unilidar_publisher_udp
+
+    与 LidarUDPReceiver 接口相同; 等待数据时释放 GIL, 点云为缓冲池中点云的零拷贝视图。
+    """
+
+    def __init__(self, port: str = "/dev/ttyUSB0", cloud_scan_num: int = 18):
+        """
+        初始化串口接收器
+
+        Args:
+            port: 激光雷达串口
+            cloud_scan_num: 累积为一帧点云的扫描数
+        """
+        if catcher_native is None:
+            raise ImportError("LidarSerialReceiver 需要编译 catcher_native 模块")
+        self.port = port
+        self.cloud_scan_num = cloud_scan_num
+        self.reader = catcher_native.SerialReader()
+        self.connected = False
+        self.running = False
+        self.thread = None
+        self.latest_scan = None
+        self.latest_imu = None
+        self.latest_point_cloud = None
+        self.data_lock = threading.Lock()
 
-        if scan_msg.validPointsNum > 0:
-            # 提取坐标和强度
-            points = []
-            intensities = []
+    def connect(self) -> bool:
+        """打开串口并启动雷达"""
+        if self.reader.initialize(self.port, self.cloud_scan_num) != 0:
+            print(f"串口打开失败: {self.port}")
+            return False
+        self.reader.set_working_mode(catcher_native.NORMAL)
+        self.connected = True
+        print(f"串口打开成功: {self.port}")
+        return True
 
-            for point in scan_msg.points:
-                points.append([point.x, point.y, point.z])
-                intensities.append(point.intensity)
+    def start_streaming(self) -> bool:
+        """开始接收数据流"""
+        if not self.connected:
+            print("请先调用 connect() 方法")
+            return False
 
-            cloud.points = np.array(points, dtype=np.float32)
-            cloud.intensities = np.array(intensities, dtype=np.float32)
-        else:
-            cloud.points = np.empty((0, 3), dtype=np.float32)
-            cloud.intensities = np.empty(0, dtype=np.float32)
+        self.running = True
+        self.thread = threading.Thread(target=self._data_receiving_loop)
+        self.thread.daemon = True
+        self.thread.start()
+        print("开始接收激光雷达数据...")
+        return True
 
-        return cloud
+    def stop_streaming(self):
+        """停止接收数据流"""
+        self.running = False
+        if self.thread and self.thread.is_alive():
+            self.thread.join(timeout=2.0)
+        print("已停止接收激光雷达数据")
+
+    def get_stats(self) -> dict:
+        """串口接收器没有解码统计"""
+        return {}
+
+    def _data_receiving_loop(self):
+        """串口数据接收循环, 每 200ms 检查一次是否停止"""
+        while self.running:
+            message = self.reader.wait_for_message(200)
+            if message == "pointcloud":
+                points, stamp, id = self.reader.cloud()
+                point_cloud = structured_to_point_cloud(points, stamp)
+                scan_msg = ScanUnitree(stamp, id, len(points), points)
+                with self.data_lock:
+                    self.latest_scan = scan_msg
+                    self.latest_point_cloud = point_cloud
+            elif message == "imu":
+                imu = self.reader.imu()
+                imu_msg = IMUUnitree(
+                    stamp=imu["stamp"],
+                    id=imu["id"],
+                    quaternion=imu["quaternion"],
+                    angular_velocity=imu["angular_velocity"],
+                    linear_acceleration=imu["linear_acceleration"]
+                )
+                with self.data_lock:
+                    self.latest_imu = imu_msg
 
 
 def create_lidar_receiver(udp_ip: str = "0.0.0.0", udp_port: int = 12345) -> LidarUDPReceiver:
@@ -2,14 +2,14 @@
  Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
 ***********************************************************************/
 
-#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_event_reader.h"
 
 using namespace unitree_lidar_sdk;
 
 int main(){
 
   // Initialize Lidar Object
-  UnitreeLidarReader* lreader = createUnitreeLidarReader();
+  UnitreeLidarEventReader* lreader = createUnitreeLidarEventReader();
   int cloud_scan_num = 18;
   std::string port_name = "/dev/ttyUSB0";
 
@@ -23,29 +23,29 @@ int main(){
   // Set Lidar Working Mode
   printf("Set Lidar working mode to: STANDBY ... \n");
   lreader->setLidarWorkingMode(STANDBY);
-  sleep(1);
+  lreader->waitForLinkState(LINK_STANDBY, 1000);
 
+  // Returns as soon as the motor has spun up and the first range packet arrives
   printf("Set Lidar working mode to: NORMAL ... \n");
   lreader->setLidarWorkingMode(NORMAL);
-  sleep(1);
+  if (!lreader->waitForLinkState(LINK_STREAMING, lreader->getConnectionConfig().spinup_timeout_ms)){
+    printf("No range data from the lidar yet, still waiting ...\n");
+  }
 
   printf("\n");
 
-  // Print Lidar Version
-  while(true){
-    if (lreader->runParse() == VERSION){
-      printf("lidar firmware version = %s\n", lreader->getVersionOfFirmware().c_str() );
-      break;
-    }
-    usleep(500);
+  // Print Lidar Version, requested once by initialize() and usually already answered
+  double version_deadline = get_host_timestamp() + 1.0;
+  while (lreader->getVersionOfFirmware().empty() && get_host_timestamp() < version_deadline){
+    lreader->waitForMessage(100);
   }
+  printf("lidar firmware version = %s\n", lreader->getVersionOfFirmware().c_str() );
   printf("lidar sdk version = %s\n\n", lreader->getVersionOfSDK().c_str());
-  sleep(2);
 
   // Check lidar dirty percentange
   int count_percentage = 0;
   while(true){
-    if( lreader->runParse() == AUXILIARY){
+    if( lreader->waitForMessage(1000) == AUXILIARY){
       printf("Dirty Percentage = %f %%\n", lreader->getDirtyPercentage());
       if (++count_percentage > 2){
         break;
@@ -55,7 +55,6 @@ int main(){
         // exit(0);
       }
     }
-    usleep(500);
   }
   printf("\n");
   sleep(2);
@@ -95,7 +94,7 @@ int main(){
   std::string version;
   while (true)
   {
-    result = lreader->runParse(); // You need to call this function at least 1500Hz
+    result = lreader->waitForMessage(); // Sleep until the next message arrives
 
     switch (result)
     {
@@ -132,8 +131,6 @@ int main(){
     default:
       break;
     }
-
-    usleep(500);
   }
 
   return 0;
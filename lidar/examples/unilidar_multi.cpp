@@ -0,0 +1,117 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#include "unitree_lidar_sdk_multi_lidar.h"
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+using namespace unitree_lidar_sdk;
+
+/**
+ * @brief Parse <serial_port>[,roll,pitch,yaw,x,y,z], angles in degree and position in meter
+ */
+bool parseDevice(const std::string& arg, LidarDeviceConfig* device){
+  size_t comma = arg.find(',');
+  *device = defaultLidarDeviceConfig(arg.substr(0, comma));
+  if (comma == std::string::npos){
+    return true;
+  }
+  float values[6] = {0, 0, 0, 0, 0, 0};
+  int n = 0;
+  const char* p = arg.c_str() + comma + 1;
+  while (n < 6 && *p){
+    char* end;
+    values[n++] = strtof(p, &end);
+    if (end == p || (*end != ',' && *end != '\0')){
+      return false;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  LidarExtrinsics e = {values[0], values[1], values[2], values[3], values[4], values[5]};
+  device->extrinsics = e;
+  return n == 6;
+}
+
+int main(int argc, char *argv[]){
+
+  if (argc < 2){
+    std::cout << "Usage: this_executable <serial_port>[,roll,pitch,yaw,x,y,z] ... [-t <threads>] [-s <seconds>]" << std::endl;
+    std::cout << "   e.g. this_executable /dev/ttyUSB0 /dev/ttyUSB1,0,0,180,2.5,0,0" << std::endl;
+    return -1;
+  }
+
+  MultiLidarConfig config = defaultMultiLidarConfig();
+  double duration = 0;
+  std::vector<LidarDeviceConfig> devices;
+  for (int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if ((arg == "-t" || arg == "-s") && i + 1 < argc){
+      if (arg == "-t"){
+        config.threads = (uint32_t)atoi(argv[++i]);
+      }
+      else{
+        duration = atof(argv[++i]);
+      }
+      continue;
+    }
+    LidarDeviceConfig device;
+    if (!parseDevice(arg, &device)){
+      printf("Invalid lidar %s, expected <serial_port>[,roll,pitch,yaw,x,y,z]\n", arg.c_str());
+      return -1;
+    }
+    devices.push_back(device);
+  }
+
+  MultiLidarEngine engine(config);
+  for (size_t i = 0; i < devices.size(); i++){
+    if (engine.addDevice(devices[i]) < 0){
+      printf("Too many lidars, at most %d\n", MultiLidarEngine::MAX_DEVICES);
+      return -1;
+    }
+  }
+
+  // points of each lidar in the merged clouds of the last second
+  std::mutex mutex;
+  std::vector<uint64_t> points(devices.size(), 0);
+  uint64_t clouds = 0;
+  engine.setCloudCallback([&](const PoolHandle<MultiLidarCloud>& cloud){
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t k = 0; k < cloud->device.size(); k++){
+      points[cloud->device[k]]++;
+    }
+    clouds++;
+  });
+
+  int failed = engine.initialize();
+  if (failed != 0){
+    printf("%d of %zu lidars could not be opened, they are retried in the background\n", failed, devices.size());
+  }
+  engine.setLidarWorkingMode(NORMAL);
+  if (engine.start() != 0){
+    printf("Cannot start the lidars! Exit here!\n");
+    return -1;
+  }
+  printf("Merging %zu lidars ...\n", devices.size());
+
+  double start = get_host_timestamp();
+  while (duration <= 0 || get_host_timestamp() - start < duration){
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::lock_guard<std::mutex> lock(mutex);
+    printf("\t%lu merged clouds/s\n", (unsigned long)clouds);
+    for (size_t i = 0; i < devices.size(); i++){
+      printf("\t\tlidar %zu (%s, %s): %lu points/s\n", i, devices[i].port.c_str(),
+             linkStateName(engine.getReader((int)i).getLinkState()), (unsigned long)points[i]);
+      points[i] = 0;
+    }
+    clouds = 0;
+  }
+
+  engine.stop();
+  MultiLidarStats stats = engine.getStats();
+  printf("lidar clouds = %lu, merged = %lu, partial = %lu, dropped = %lu\n",
+         (unsigned long)stats.device_clouds, (unsigned long)stats.merged_clouds,
+         (unsigned long)stats.partial_clouds, (unsigned long)stats.dropped_clouds);
+  return 0;
+}
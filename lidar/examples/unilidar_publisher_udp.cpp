@@ -1,19 +1,77 @@
 /**********************************************************************
  Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
 ***********************************************************************/
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
-#include "unitree_lidar_sdk.h"
+#include <memory>
+#include "unitree_lidar_sdk_event_reader.h"
 #include "udp_handler.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+#include "unitree_lidar_sdk_shm.h"
+#include "unitree_lidar_sdk_pipeline.h"
+#include "unitree_lidar_sdk_sink.h"
 using namespace unitree_lidar_sdk;
 
+/**
+ * @brief Print the command lines of this example
+ */
+void printUsage()
+{
+  std::cout << "usage 1: this_executable <serial_port> <destination_ip> <destination_port>" << std::endl;
+  std::cout << "usage 2: this_executable <serial_port> " << std::endl;
+  std::cout << "   where the default sever_ip = 127.0.0.1, <destination_port> = 12345" << std::endl;
+  std::cout << "usage 3: this_executable <serial_port> <destination_ip> <destination_port> <mode>" << std::endl;
+  std::cout << "   where <mode> = batch: pack only valid points and several messages into MTU-sized datagrams (msgType 103)" << std::endl;
+  std::cout << "                  compact: send quantized scan / IMU messages with a sequence counter (msgType 104 / 105)" << std::endl;
+  std::cout << "                  batch-compact: both" << std::endl;
+  std::cout << "                  pipeline / pipeline-compact: read, decode and send on three threads" << std::endl;
+  std::cout << "                  (pinned to the cores listed in UNILIDAR_PIPELINE_CPUS, e.g. 1,2,3)" << std::endl;
+  std::cout << "                  the same stream also goes to the sinks set in the environment:" << std::endl;
+  std::cout << "                  UNILIDAR_RECORD=<file>, UNILIDAR_SHM=<shm_name>, UNILIDAR_DETECT=<scans per frame>" << std::endl;
+  std::cout << "usage 4: this_executable <serial_port> shm [<shm_name>]" << std::endl;
+  std::cout << "   publish to local subscribers through shared memory, where the default <shm_name> = " << SHM_DEFAULT_NAME << std::endl;
+}
+
 int main(int argc, char *argv[])
 {
   // Config from terminal
   std::string serial_port;
   std::string destination_ip;
-  unsigned short destination_port;
+  unsigned short destination_port = 12345;
+  bool batch_mode = false;
+  bool compact_mode = false;
+  bool shm_mode = false;
+  bool pipeline_mode = false;
+  std::string shm_name = SHM_DEFAULT_NAME;
 
-  if (argc == 2)
+  if ((argc == 3 || argc == 4) && std::string(argv[2]) == "shm")
+  {
+    serial_port = argv[1];
+    shm_mode = true;
+    if (argc == 4)
+    {
+      shm_name = argv[3];
+    }
+  }
+  else if (argc == 5)
+  {
+    serial_port = argv[1];
+    destination_ip = argv[2];
+    destination_port = std::atoi(argv[3]);
+    std::string mode = argv[4];
+    if (mode != "batch" && mode != "compact" && mode != "batch-compact" &&
+        mode != "pipeline" && mode != "pipeline-compact")
+    {
+      std::cout << "Unknown mode: " << mode << std::endl;
+      printUsage();
+      return -1;
+    }
+    batch_mode = (mode == "batch" || mode == "batch-compact");
+    compact_mode = (mode == "compact" || mode == "batch-compact" || mode == "pipeline-compact");
+    pipeline_mode = (mode == "pipeline" || mode == "pipeline-compact");
+  }
+  else if (argc == 2)
   {
     serial_port = argv[1];
     destination_ip = "127.0.0.1";
@@ -28,9 +86,7 @@ int main(int argc, char *argv[])
   else
   {
 
-    std::cout << "usage 1: this_executable <serial_port> <destination_ip> <destination_port>" << std::endl;
-    std::cout << "usage 2: this_executable <serial_port> " << std::endl;
-    std::cout << "   where the default sever_ip = 127.0.0.1, <destination_port> = 12345" << std::endl;
+    printUsage();
 
     std::cout << "Input Serial Port: ";
     std::cin >> serial_port;
@@ -44,14 +100,31 @@ int main(int argc, char *argv[])
 
   std::cout << "Unilidar Configuration: "
             << "\n\tserial_port = " << serial_port
+            << "\n\tshm_mode = " << shm_mode
+            << "\n\tshm_name = " << shm_name
             << "\n\tdestination_ip = " << destination_ip
             << "\n\tdestination_port = " << destination_port
+            << "\n\tbatch_mode = " << batch_mode
+            << "\n\tcompact_mode = " << compact_mode
+            << "\n\tpipeline_mode = " << pipeline_mode
             << std::endl;
 
-  // Initialize Lidar Object
-  UnitreeLidarReader *lreader = createUnitreeLidarReader();
+  // Initialize Lidar Object, run by the threads of a pipeline in the pipeline modes
+  LidarPipeline *pipeline = nullptr;
+  if (pipeline_mode)
+  {
+    PipelineConfig pipelineConfig = defaultPipelineConfig();
+    const char *cpus_env = getenv("UNILIDAR_PIPELINE_CPUS");
+    if (cpus_env)
+    {
+      sscanf(cpus_env, "%d,%d,%d", &pipelineConfig.reader_cpu, &pipelineConfig.decoder_cpu, &pipelineConfig.output_cpu);
+    }
+    static LidarPipeline pipelineInstance(pipelineConfig); // static storage keeps the cache-line alignment of its rings
+    pipeline = &pipelineInstance;
+  }
+  UnitreeLidarEventReader *lreader = pipeline_mode ? &pipeline->getReader() : createUnitreeLidarEventReader();
   int cloud_scan_num = 1;
-  if (lreader->initialize(cloud_scan_num, serial_port))
+  if (pipeline_mode ? pipeline->initialize(cloud_scan_num, serial_port) : lreader->initialize(cloud_scan_num, serial_port))
   {
     printf("Unilidar initialization failed! Exit here!\n");
     exit(-1);
@@ -61,90 +134,326 @@ int main(int argc, char *argv[])
     printf("Unilidar initialization succeed!\n");
   }
 
-  // Set Lidar Working Mode
-  printf("Set Lidar working mode to: NORMAL ... \n");
-  lreader->setLidarWorkingMode(NORMAL);
+  // Filter weak, dust and isolated returns of every scan when UNILIDAR_SCAN_FILTER=1
+  const char *filter_env = getenv("UNILIDAR_SCAN_FILTER");
+  if (filter_env && atoi(filter_env) != 0)
+  {
+    ScanFilterConfig filterConfig = defaultScanFilterConfig();
+    filterConfig.enabled = true;
+    lreader->setScanFilterConfig(filterConfig);
+    printf("Scan filter enabled\n");
+  }
 
-  // Print Lidar Version
-  while (true)
+  // Report the link: streaming once the motor has spun up, and the serial port reopened if it is replugged
+  lreader->setLinkStateCallback([&](LinkState state)
   {
-    if (lreader->runParse() == VERSION)
+    printf("lidar link: %s\n", linkStateName(state));
+    if (state == LINK_STREAMING && !pipeline_mode && !lreader->getVersionOfFirmware().empty())
     {
       printf("lidar firmware version = %s\n", lreader->getVersionOfFirmware().c_str());
-      break;
     }
-    usleep(500);
-  }
+  });
+
+  // Set Lidar Working Mode
+  printf("Set Lidar working mode to: NORMAL ... \n");
+  lreader->setLidarWorkingMode(NORMAL);
   printf("lidar sdk version = %s\n", lreader->getVersionOfSDK().c_str());
 
   // UDP
   UDPHandler client;
   client.CreateSocket();
+  UDPBatchConfig batchConfig = defaultUDPBatchConfig();
+  batchConfig.compact = compact_mode;
+  UDPBatchPublisher batcher(client, destination_ip, destination_port, batchConfig);
 
   // Parse PointCloud and IMU data
   MessageType result;
   std::string version;
-  PointCloudUnitree cloudMsg;
+  PoolHandle<PointCloudUnitree> cloudMsg;
   ScanUnitree scanMsg;
   char buffer[10000];
   uint32_t length = 0;
   bool imuMsgSent = false;
   bool scanMsgSent = false;
-  uint32_t imuMsgType = 101;
-  uint32_t scanMsgType = 102;
+  uint32_t imuMsgType = compact_mode ? UDP_MSG_TYPE_COMPACT_IMU : UDP_MSG_TYPE_IMU;
+  uint32_t scanMsgType = compact_mode ? UDP_MSG_TYPE_COMPACT_SCAN : UDP_MSG_TYPE_SCAN;
+  uint32_t sequence = 0;
 
   printf("Data type size: \n");
   printf("\tsizeof(PointUnitree) = %ld\n", sizeof(PointUnitree));
   printf("\tsizeof(ScanUnitree) = %ld\n", sizeof(ScanUnitree));
   printf("\tsizeof(IMUUnitree) = %ld\n", sizeof(IMUUnitree));
+
+  // Reader stats are printed every UNILIDAR_STATS_INTERVAL seconds (10 by default, 0 to disable)
+  const char *interval_env = getenv("UNILIDAR_STATS_INTERVAL");
+  double stats_interval = interval_env ? atof(interval_env) : 10;
+  double next_stats = get_host_timestamp() + stats_interval;
+  auto printStatsIfDue = [&]()
+  {
+    double now = get_host_timestamp();
+    if (stats_interval <= 0 || now < next_stats)
+    {
+      return;
+    }
+    next_stats = now + stats_interval;
+    printReaderStats(lreader->getStats());
+    lreader->resetLatencyStats(); // percentiles over the last interval, counters since the start
+  };
+
+  // The mapping of the lidar clock to the host clock is sent once per second (msgType 107)
+  uint32_t clock_sync_sequence = 0;
+  double next_clock_sync = get_host_timestamp() + 1.0;
+  auto clockSyncDue = [&](const ClockSyncState &state)
+  {
+    double now = get_host_timestamp();
+    if (now < next_clock_sync || !state.valid)
+    {
+      return false;
+    }
+    next_clock_sync = now + 1.0;
+    return true;
+  };
   
-  while (true)
+  if (shm_mode)
   {
-    result = lreader->runParse(); // You need to call this function at least 1500Hz
+    ShmRingPublisher shm;
+    if (shm.open(shm_name))
+    {
+      printf("Failed to open shared memory %s! Exit here!\n", shm_name.c_str());
+      exit(-1);
+    }
+    printf("Shared memory mode: IMUUnitree (msgType %d) and ScanUnitree with valid points only (msgType %d) in %s\n",
+           UDP_MSG_TYPE_IMU, UDP_MSG_TYPE_SCAN, shm_name.c_str());
 
-    switch (result)
+    while (true)
     {
-    case NONE:
-      break;
+      result = lreader->waitForMessage(1000); // Sleep until the next message arrives
 
-    case IMU:
-      length = dataStructToUDPBuffer<IMUUnitree>(lreader->getIMU(), imuMsgType, buffer);
-      client.Send(buffer, length, (char *)destination_ip.c_str(), destination_port); // 发送数据
+      if (result == IMU)
+      {
+        shm.publishIMU(lreader->getIMU());
+      }
+      else if (result == POINTCLOUD)
+      {
+        cloudMsg = lreader->getCloudHandle();
+        shm.publishCloud(*cloudMsg);
+        cloudMsg.reset();
+      }
+      if (clockSyncDue(lreader->getClockSyncState()))
+      {
+        length = clockSyncToUDPBuffer(lreader->getClockSyncState(), clock_sync_sequence++, buffer);
+        shm.publish(UDP_MSG_TYPE_CLOCK_SYNC, buffer + UDP_MSG_HEADER_SIZE, length - UDP_MSG_HEADER_SIZE);
+      }
+      printStatsIfDue();
+    }
+  }
 
-      if (imuMsgSent == false)
+  if (batch_mode)
+  {
+    printf("Batch mode: | uint32_t msgType=%d | uint32_t dataSize | messages |, up to %d bytes per datagram\n",
+           UDP_MSG_TYPE_BATCH, batcher.getConfig().datagram_size);
+    printf("\tEach message: | uint32_t msgType | uint32_t dataSize | %s |\n",
+           compact_mode ? "compact IMU or compact scan" : "IMUUnitree or ScanUnitree with valid points only");
+
+    while (true)
+    {
+      // Sleep until the next message arrives or the pending datagrams are due
+      result = lreader->waitForMessage(batcher.getFlushTimeoutMs());
+
+      if (result == IMU)
+      {
+        batcher.addIMU(lreader->getIMU());
+      }
+      else if (result == POINTCLOUD)
+      {
+        cloudMsg = lreader->getCloudHandle();
+        batcher.addCloud(*cloudMsg);
+        cloudMsg.reset();
+      }
+      if (clockSyncDue(lreader->getClockSyncState()))
       {
-        imuMsgSent = true;
-        printf("IMU message is sending!\n");
-        printf("\tData format: | uint32_t msgType | uint32_t dataSize | IMUUnitree data |\n");
-        printf("\tMsgType = %d, SentSize=%d, DataSize = %ld\n", imuMsgType, length, sizeof(IMUUnitree));
+        batcher.addClockSync(lreader->getClockSyncState(), clock_sync_sequence++);
       }
+      batcher.flushIfDue();
+      printStatsIfDue();
+    }
+  }
 
-      break;
+  auto sendIMU = [&](const IMUUnitree &imu)
+  {
+    if (compact_mode)
+    {
+      length = compactIMUToUDPBuffer(imu, sequence++, buffer);
+    }
+    else
+    {
+      length = dataStructToUDPBuffer<IMUUnitree>(imu, imuMsgType, buffer);
+    }
+    client.Send(buffer, length, (char *)destination_ip.c_str(), destination_port); // 发送数据
 
-    case POINTCLOUD:
-      cloudMsg = lreader->getCloud();
-      scanMsg.id = cloudMsg.id;
-      scanMsg.stamp = cloudMsg.stamp;
-      scanMsg.validPointsNum = cloudMsg.points.size();
-      memcpy(scanMsg.points, cloudMsg.points.data(), cloudMsg.points.size() * sizeof(PointUnitree));
+    if (imuMsgSent == false)
+    {
+      imuMsgSent = true;
+      printf("IMU message is sending!\n");
+      printf("\tData format: | uint32_t msgType | uint32_t dataSize | %sIMUUnitree data |\n",
+             compact_mode ? "CompactIMUHeader | " : "");
+      printf("\tMsgType = %d, SentSize=%d, DataSize = %ld\n", imuMsgType, length, sizeof(IMUUnitree));
+    }
+  };
 
+  auto sendCloud = [&](const PointCloudUnitree &cloud)
+  {
+    uint32_t num = (uint32_t)std::min<size_t>(cloud.points.size(), 120);
+    if (compact_mode)
+    {
+      // Encoded straight from the points of the cloud
+      length = compactScanToUDPBuffer(cloud.points.data(), num, cloud.stamp, cloud.id, sequence++, buffer);
+    }
+    else
+    {
+      scanMsg.id = cloud.id;
+      scanMsg.stamp = cloud.stamp;
+      scanMsg.validPointsNum = num;
+      memcpy(scanMsg.points, cloud.points.data(), num * sizeof(PointUnitree));
       length = dataStructToUDPBuffer<ScanUnitree>(scanMsg, scanMsgType, buffer);
-      client.Send(buffer, length, (char *)destination_ip.c_str(), destination_port); // 发送数据
+    }
+    client.Send(buffer, length, (char *)destination_ip.c_str(), destination_port); // 发送数据
 
-      if (scanMsgSent == false)
+    if (scanMsgSent == false)
+    {
+      scanMsgSent = true;
+      printf("Scan message is sending!\n");
+      printf("\tData format: | uint32_t msgType| uint32_t dataSize | %s |\n",
+             compact_mode ? "CompactScanHeader | int16 x[n] y[n] z[n] | uint16 time[n] | uint8 intensity[n]" : "ScanUnitree data");
+      printf("\tMsgType = %d, SentSize=%d, DataSize = %ld\n", scanMsgType, length, sizeof(ScanUnitree));
+    }
+  };
+
+  auto sendClockSyncIfDue = [&](const ClockSyncState &state)
+  {
+    if (clockSyncDue(state))
+    {
+      length = clockSyncToUDPBuffer(state, clock_sync_sequence++, buffer);
+      client.Send(buffer, length, (char *)destination_ip.c_str(), destination_port);
+    }
+  };
+
+  if (pipeline_mode)
+  {
+    // One decode, fanned out to every sink: UDP on the output thread, the others on their own threads
+    SinkFanout fanout;
+    UDPSink udpSink(client, destination_ip, destination_port, false, batchConfig);
+    SinkConfig inlineConfig = defaultSinkConfig();
+    inlineConfig.threaded = false;
+    fanout.addSink(&udpSink, inlineConfig);
+
+    LogRecorder recorder;
+    RecorderSink recorderSink(recorder);
+    const char *record_env = getenv("UNILIDAR_RECORD");
+    if (record_env)
+    {
+      if (recorder.open(record_env))
+      {
+        printf("Failed to open the log %s! Exit here!\n", record_env);
+        exit(-1);
+      }
+      fanout.addSink(&recorderSink);
+      printf("Recording to %s\n", record_env);
+    }
+
+    ShmRingPublisher shm;
+    ShmSink shmSink(shm);
+    const char *shm_env = getenv("UNILIDAR_SHM");
+    if (shm_env)
+    {
+      if (shm.open(shm_env))
       {
-        scanMsgSent = true;
-        printf("Scan message is sending!\n");
-        printf("\tData format: | uint32_t msgType| uint32_t dataSize | ScanUnitree data |\n");
-        printf("\tMsgType = %d, SentSize=%d, DataSize = %ld\n", scanMsgType, length, sizeof(ScanUnitree));
+        printf("Failed to open shared memory %s! Exit here!\n", shm_env);
+        exit(-1);
       }
+      fanout.addSink(&shmSink);
+      printf("Publishing to shared memory %s\n", shm_env);
+    }
+
+    std::unique_ptr<DroneDetector> detector;
+    std::unique_ptr<DetectorSink> detectorSink;
+    const char *detect_env = getenv("UNILIDAR_DETECT");
+    if (detect_env)
+    {
+      detector.reset(new DroneDetector());
+      detectorSink.reset(new DetectorSink(*detector, std::max(1, atoi(detect_env)),
+                                          [](const PointCloudUnitree &frame, const std::vector<Detection> &detections)
+                                          {
+                                            for (size_t i = 0; i < detections.size(); i++)
+                                            {
+                                              if (detections[i].is_drone)
+                                              {
+                                                printf("drone at %.2f %.2f %.2f, confidence = %.2f, stamp = %.6f\n",
+                                                       detections[i].center[0], detections[i].center[1], detections[i].center[2],
+                                                       detections[i].confidence, frame.stamp);
+                                              }
+                                            }
+                                          }));
+      fanout.addSink(detectorSink.get());
+    }
+
+    // Sending happens on the output thread, so a slow sendto() never delays the serial reads
+    pipeline->setOutputCallback([&](const PipelineMessage &msg)
+    {
+      fanout.publish(msg);
+    });
+    if (fanout.start() || pipeline->start())
+    {
+      printf("Failed to start the pipeline! Exit here!\n");
+      exit(-1);
+    }
+
+    bool versionPrinted = false;
+    while (true)
+    {
+      usleep(100000);
+      if (!versionPrinted && !pipeline->getVersionOfFirmware().empty())
+      {
+        versionPrinted = true;
+        printf("lidar firmware version = %s\n", pipeline->getVersionOfFirmware().c_str());
+      }
+      double now = get_host_timestamp();
+      if (stats_interval > 0 && now >= next_stats)
+      {
+        PipelineStats stats = pipeline->getStats();
+        printf("pipeline rings: chunks queued = %lu, dropped = %lu, high water = %u / %u; "
+               "messages queued = %lu, dropped = %lu, high water = %u / %u\n",
+               (unsigned long)stats.chunks.pushed, (unsigned long)stats.chunks.dropped, stats.chunks.high_water, stats.chunks.capacity,
+               (unsigned long)stats.messages.pushed, (unsigned long)stats.messages.dropped, stats.messages.high_water, stats.messages.capacity);
+        printSinkStats(fanout.getStats());
+      }
+      printStatsIfDue();
+    }
+  }
+
+  while (true)
+  {
+    result = lreader->waitForMessage(1000); // Sleep until the next message arrives
+    printStatsIfDue();
+    sendClockSyncIfDue(lreader->getClockSyncState());
+
+    switch (result)
+    {
+    case NONE:
+      break;
+
+    case IMU:
+      sendIMU(lreader->getIMU());
+      break;
+
+    case POINTCLOUD:
+      cloudMsg = lreader->getCloudHandle(); // no copy of the cloud
+      sendCloud(*cloudMsg);
       break;
 
     default:
       break;
     }
-
-    usleep(500);
   }
 
   return 0;
@@ -0,0 +1,148 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#include "unitree_lidar_sdk_event_reader.h"
+#include "unitree_lidar_sdk_recorder.h"
+#include "unitree_lidar_sdk_replay.h"
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+using namespace unitree_lidar_sdk;
+
+/**
+ * @brief Print the content of a log
+ */
+int printLog(const std::string& path){
+  LogReader reader;
+  if (reader.open(path) != 0){
+    printf("Cannot open the log %s\n", path.c_str());
+    return -1;
+  }
+  uint64_t counts[5] = {0, 0, 0, 0, 0};
+  uint64_t points = 0, bytes = 0;
+  LogRecordView record;
+  while (reader.next(&record) == 0){
+    switch (record.type){
+      case LOG_RECORD_IMU: counts[0]++; break;
+      case LOG_RECORD_SCAN: counts[1]++; points += (record.size - offsetof(ScanUnitree, points)) / sizeof(PointUnitree); break;
+      case LOG_RECORD_CLOUD: counts[2]++; points += (record.size - sizeof(LogCloudHeader)) / sizeof(PointUnitree); break;
+      case LOG_RECORD_MAVLINK: counts[3]++; bytes += record.size; break;
+      case LOG_RECORD_CLOCK_SYNC: counts[4]++; break;
+      default: break;
+    }
+  }
+  printf("%s:\n", path.c_str());
+  printf("\tchunks = %zu, records = %lu\n", reader.chunkCount(), (unsigned long)reader.recordCount());
+  printf("\tduration = %.3f s (%.6f -> %.6f)\n", reader.endStamp() - reader.startStamp(),
+         reader.startStamp(), reader.endStamp());
+  printf("\timu = %lu, scans = %lu, clouds = %lu, points = %lu\n",
+         (unsigned long)counts[0], (unsigned long)counts[1], (unsigned long)counts[2], (unsigned long)points);
+  printf("\tmavlink chunks = %lu, bytes = %lu\n", (unsigned long)counts[3], (unsigned long)bytes);
+  printf("\tclock syncs = %lu\n", (unsigned long)counts[4]);
+  return 0;
+}
+
+/**
+ * @brief Parse a recorded stream like the live port and print the message rates
+ */
+int replayLog(const std::string& path, double speed){
+  ReplayConfig config = defaultReplayConfig();
+  config.speed = speed;
+  UnitreeLidarReplayReader* lreader = createUnitreeLidarReplayReader(path, config);
+  if (lreader == nullptr || lreader->initialize(18)){
+    printf("Cannot replay %s\n", path.c_str());
+    delete lreader;
+    return -1;
+  }
+  uint64_t clouds = 0, imus = 0, points = 0;
+  double first_stamp = -1, last_stamp = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (!lreader->isFinished()){
+    MessageType result = lreader->waitForMessage(100);
+    if (result == POINTCLOUD){
+      const PointCloudUnitree& cloud = lreader->getCloud();
+      clouds++;
+      points += cloud.points.size();
+      if (first_stamp < 0){
+        first_stamp = cloud.stamp;
+      }
+      last_stamp = cloud.stamp;
+    }
+    else if (result == IMU){
+      imus++;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%s replayed in %.3f s:\n", path.c_str(), seconds);
+  printf("\tclouds = %lu, points = %lu, imu = %lu\n", (unsigned long)clouds, (unsigned long)points, (unsigned long)imus);
+  printf("\trecorded span = %.3f s, %.1f clouds/s\n", last_stamp - first_stamp, seconds > 0 ? clouds / seconds : 0);
+  delete lreader;
+  return 0;
+}
+
+int main(int argc, char *argv[]){
+
+  if (argc == 3 && std::string(argv[1]) == "info"){
+    return printLog(argv[2]) == 0 ? 0 : -1;
+  }
+  if ((argc == 3 || argc == 4) && std::string(argv[1]) == "replay"){
+    return replayLog(argv[2], argc == 4 ? atof(argv[3]) : 0) == 0 ? 0 : -1;
+  }
+  if (argc < 3){
+    std::cout << "Usage: this_executable <serial_port> <log_file> [<seconds>] [<cloud_scan_num>]" << std::endl;
+    std::cout << "   or: this_executable info <log_file>" << std::endl;
+    std::cout << "   or: this_executable replay <log_file> [<speed>, 0 for as fast as possible]" << std::endl;
+    return -1;
+  }
+  std::string port_name = argv[1];
+  std::string log_path = argv[2];
+  double duration = argc > 3 ? atof(argv[3]) : 0;
+  int cloud_scan_num = argc > 4 ? atoi(argv[4]) : 1;
+
+  LogRecorder recorder;
+  if (recorder.open(log_path, get_host_timestamp()) != 0){
+    printf("Cannot create the log %s\n", log_path.c_str());
+    return -1;
+  }
+
+  UnitreeLidarEventReader* lreader = createUnitreeLidarEventReader();
+  if (lreader->initialize(cloud_scan_num, port_name)){
+    printf("Unilidar initialization failed! Exit here!\n");
+    exit(-1);
+  }
+  printf("Unilidar initialization succeed!\n");
+  printf("Recording %s into %s ...\n", port_name.c_str(), log_path.c_str());
+
+  // the raw stream can be replayed through the parser, the decoded messages are read without it
+  lreader->setRawDataCallback([&](const uint8_t* data, size_t size){
+    recorder.writeMavlink(get_host_timestamp(), data, size);
+  });
+
+  double start = get_host_timestamp(), last_print = start;
+  while (duration <= 0 || get_host_timestamp() - start < duration){
+    MessageType result = lreader->waitForMessage(100);
+    if (result == IMU){
+      recorder.writeIMU(lreader->getIMU());
+    }
+    else if (result == POINTCLOUD){
+      recorder.writeCloud(lreader->getCloud());
+    }
+
+    double now = get_host_timestamp();
+    if (now - last_print >= 1.0){
+      printf("\t%.0f s, %lu records, %.1f MB written\n", now - start,
+             (unsigned long)recorder.recordCount(), recorder.bytesWritten() / 1e6);
+      last_print = now;
+    }
+  }
+
+  lreader->setRawDataCallback(UnitreeLidarEventReader::RawDataCallback());
+  delete lreader;
+  if (recorder.close() != 0){
+    printf("Failed to write the log %s\n", log_path.c_str());
+    return -1;
+  }
+  return printLog(log_path) == 0 ? 0 : -1;
+}
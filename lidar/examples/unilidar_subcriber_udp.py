@@ -56,19 +56,29 @@ pointSize = struct.calcsize(pointDataStr)
 scanDataStr = "=dII" + 120 * "fffffI"
 scanDataSize = struct.calcsize(scanDataStr)
 
-print("pointSize = " +str(pointSize) + ", scanDataSize = " + str(scanDataSize) + ", imuDataSize = " + str(imuDataSize))
+# Compact messages (msgType 104 / 105), version 1
+compactScanHeaderStr = "=HHIdIffI"  # version, point_num, sequence, stamp, id, position_scale, time_scale, reserved
+compactScanHeaderSize = struct.calcsize(compactScanHeaderStr)
+compactIMUHeaderStr = "=HHI"        # version, reserved, sequence
+compactIMUHeaderSize = struct.calcsize(compactIMUHeaderStr)
+# Clock sync message (msgType 107), version 1: host = host_reference + (lidar - lidar_reference) * (1 + drift)
+clockSyncStr = "=HHIdddfI"          # version, flags, sequence, lidar_reference, host_reference, drift, jitter, resets
+clockSyncSize = struct.calcsize(clockSyncStr)
+lastSequence = None
+
+def checkSequence(sequence):
+    global lastSequence
+    if lastSequence is not None and sequence - lastSequence > 1:
+        print("\tlost", sequence - lastSequence - 1, "messages before sequence", sequence)
+    lastSequence = sequence
 
-while True:
-    # Recv data
-    data, addr = sock.recvfrom(10000)
-    print(f"Received data from {addr[0]}:{addr[1]}")
+print("pointSize = " +str(pointSize) + ", scanDataSize = " + str(scanDataSize) + ", imuDataSize = " + str(imuDataSize))
 
-    msgType = struct.unpack("=I", data[:4])[0]
+def handleMessage(msgType, payload):
     print("msgType =", msgType)
 
     if msgType == 101:  # IMU Message
-        length = struct.unpack("=I", data[4:8])[0]
-        imuData = struct.unpack(imuDataStr, data[8:8+imuDataSize])
+        imuData = struct.unpack(imuDataStr, payload[:imuDataSize])
         imuMsg = IMUUnitree(imuData[0], imuData[1], imuData[2:6], imuData[6:9], imuData[9:12])
 
         print("An IMU msg is parsed!")
@@ -79,14 +89,13 @@ while True:
         print("\n")
 
     elif msgType == 102:  # Scan Message
-        length = struct.unpack("=I", data[4:8])[0]
-        stamp = struct.unpack("=d", data[8:16])[0]
-        id = struct.unpack("=I", data[16:20])[0]
-        validPointsNum = struct.unpack("=I", data[20:24])[0]
+        stamp = struct.unpack("=d", payload[0:8])[0]
+        id = struct.unpack("=I", payload[8:12])[0]
+        validPointsNum = struct.unpack("=I", payload[12:16])[0]
         scanPoints = []
-        pointStartAddr = 24
+        pointStartAddr = 16
         for i in range(validPointsNum):
-            pointData = struct.unpack(pointDataStr, data[pointStartAddr: pointStartAddr+pointSize])
+            pointData = struct.unpack(pointDataStr, payload[pointStartAddr: pointStartAddr+pointSize])
             pointStartAddr = pointStartAddr + pointSize
             point = PointUnitree(*pointData)
             scanPoints.append(point)
@@ -94,4 +103,63 @@ while True:
 
         solve(scanMsg)
 
+    elif msgType == 105:  # Compact IMU Message
+        version, _, sequence = struct.unpack(compactIMUHeaderStr, payload[:compactIMUHeaderSize])
+        if version != 1:
+            return
+        checkSequence(sequence)
+        imuData = struct.unpack(imuDataStr, payload[compactIMUHeaderSize:compactIMUHeaderSize+imuDataSize])
+        imuMsg = IMUUnitree(imuData[0], imuData[1], imuData[2:6], imuData[6:9], imuData[9:12])
+
+        print("A compact IMU msg is parsed! sequence =", sequence)
+        print("\tstamp =", imuMsg.stamp, "id =", imuMsg.id)
+        print("\tquaternion (x, y, z, w) =", imuMsg.quaternion)
+        print("\n")
+
+    elif msgType == 104:  # Compact Scan Message: int16 xyz in position_scale, uint16 time in time_scale, uint8 intensity
+        version, n, sequence, stamp, id, positionScale, timeScale, _ = \
+            struct.unpack(compactScanHeaderStr, payload[:compactScanHeaderSize])
+        if version != 1:
+            return
+        checkSequence(sequence)
+        pos = compactScanHeaderSize
+        xs = struct.unpack("=%dh" % n, payload[pos:pos+2*n]); pos += 2 * n
+        ys = struct.unpack("=%dh" % n, payload[pos:pos+2*n]); pos += 2 * n
+        zs = struct.unpack("=%dh" % n, payload[pos:pos+2*n]); pos += 2 * n
+        ts = struct.unpack("=%dH" % n, payload[pos:pos+2*n]); pos += 2 * n
+        intensities = payload[pos:pos+n]
+        scanPoints = [PointUnitree(xs[i] * positionScale, ys[i] * positionScale, zs[i] * positionScale,
+                                   intensities[i], ts[i] * timeScale, 0) for i in range(n)]
+        scanMsg = ScanUnitree(stamp, id, n, scanPoints)
+
+        print("sequence =", sequence)
+        solve(scanMsg)
+
+    elif msgType == 107:  # Clock Sync Message
+        version, flags, sequence, lidarReference, hostReference, drift, jitter, resets = \
+            struct.unpack(clockSyncStr, payload[:clockSyncSize])
+        if version != 1:
+            return
+        print("A clock sync msg is parsed! sequence =", sequence, "valid =", flags & 1)
+        print("\thost = %f + (lidar - %f) * (1 + %.2e), jitter = %.1f us, resets = %d" %
+              (hostReference, lidarReference, drift, jitter * 1e6, resets))
+        print("\n")
+
+while True:
+    # Recv data
+    data, addr = sock.recvfrom(65536)
+    print(f"Received data from {addr[0]}:{addr[1]}")
+
+    msgType, length = struct.unpack("=II", data[:8])
+
+    if msgType == 103:  # Batch Message: | msgType | dataSize | data | repeated, scans hold valid points only
+        pos = 8
+        end = 8 + length
+        while pos + 8 <= end:
+            subType, subLength = struct.unpack("=II", data[pos:pos+8])
+            handleMessage(subType, data[pos+8:pos+8+subLength])
+            pos = pos + 8 + subLength
+    else:
+        handleMessage(msgType, data[8:])
+
 sock.close()
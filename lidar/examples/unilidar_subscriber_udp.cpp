@@ -5,6 +5,10 @@
 #include "unitree_lidar_sdk.h"
 
 #include "udp_handler.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+#include "unitree_lidar_sdk_udp_receiver.h"
+#include "unitree_lidar_sdk_shm.h"
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <cstring>
@@ -15,9 +19,19 @@ using namespace std;
 int main(int argc, char *argv[])
 {
   // Config from terminal
-  unsigned short port;
+  unsigned short port = 0;
+  bool shm_mode = false;
+  std::string shm_name = SHM_DEFAULT_NAME;
 
-  if (argc == 1){
+  if ((argc == 2 || argc == 3) && std::string(argv[1]) == "shm")
+  {
+    shm_mode = true;
+    if (argc == 3)
+    {
+      shm_name = argv[2];
+    }
+  }
+  else if (argc == 1){
     std::cout << "Usage: this_executable <udp_port>" << std::endl;
     port = 12345;
     sleep(1);
@@ -29,44 +43,49 @@ int main(int argc, char *argv[])
   else
   {
     std::cout << "Usage: this_executable <udp_port>" << std::endl;
+    std::cout << "   or: this_executable shm [<shm_name>]" << std::endl;
     std::cout << "Input UDP Port: ";
     std::cin >> port;
   }
 
   std::cout << "Unilidar Configuration: "
             << "\n\tport = " << port
+            << "\n\tshm_mode = " << shm_mode
+            << "\n\tshm_name = " << shm_name
             << std::endl;
 
-  UDPHandler server(port);
-  server.CreateSocket();
-  server.Bind();
-
-  char recv_buf[10000];
-  sockaddr_in client_addr;
-  memset(&client_addr, 0, sizeof(client_addr));
-
-  ScanUnitree scanMsg;
   IMUUnitree imuMsg;
-  uint32_t msgType;
-  uint32_t length;
-  while (true)
+  UDPScanView scanView;
+  PointCloudUnitree compactCloud;
+  UDPSequenceTracker sequenceTracker;
+  uint32_t sequence = 0;
+  auto printScan = [](const UDPScanView &view)
   {
-    int len = server.Recv(recv_buf, sizeof(recv_buf), &client_addr);
-    if (len <= 0)
-    {
-      cout << "recv error" << endl;
-      break;
+    printf("A Scan msg is parsed! \n");
+    printf("\tstamp = %f, id = %d\n", view.stamp, view.id);
+    printf("\tScan size  = %d \n", view.validPointsNum);
+    printf("\tfirst 10 points (x,y,z,intensity,time,ring) = \n");
+    for (uint32_t i = 0; i < std::min<uint32_t>(10, view.validPointsNum); i++)
+    { // print the first 10 points
+      printf("\t  (%f, %f, %f, %f, %f, %d)\n",
+             view.points[i].x,
+             view.points[i].y,
+             view.points[i].z,
+             view.points[i].intensity,
+             view.points[i].time,
+             view.points[i].ring);
     }
-    cout << "received data from " << inet_ntoa(client_addr.sin_addr) << ":" << ntohs(client_addr.sin_port) << endl;
-
-    memcpy(&msgType, recv_buf, 4);
+    printf("\n");
+  };
 
+  ClockSyncMessage clockSyncMsg;
+  auto handleMessage = [&](uint32_t msgType, const char *data, uint32_t length)
+  {
     cout << "msgType = " << msgType << endl;
 
-    if (msgType == 101)
+    if (msgType == UDP_MSG_TYPE_IMU)
     {
-      memcpy(&length, recv_buf + 4, 4);
-      memcpy(&imuMsg, recv_buf + 8, sizeof(IMUUnitree));
+      memcpy(&imuMsg, data, std::min<uint32_t>(length, sizeof(IMUUnitree)));
 
       printf("An IMU msg is parsed!\n");
       printf("\tstamp = %f, id = %d\n", imuMsg.stamp, imuMsg.id);
@@ -75,29 +94,106 @@ int main(int argc, char *argv[])
              imuMsg.quaternion[2], imuMsg.quaternion[3]);
       printf("\n");
     }
-    else if (msgType == 102)
+    else if (msgType == UDP_MSG_TYPE_COMPACT_IMU && udpBufferToCompactIMU(data, length, imuMsg, &sequence) == 0)
     {
-      memcpy(&length, recv_buf + 4, 4);
-      memcpy(&scanMsg, recv_buf + 8, sizeof(ScanUnitree));
-
-      printf("A Scan msg is parsed! \n");
-      printf("\tstamp = %f, id = %d\n", scanMsg.stamp, scanMsg.id);
-      printf("\tScan size  = %d \n", scanMsg.validPointsNum);
-      printf("\tfirst 10 points (x,y,z,intensity,time,ring) = \n");
-      for (int i = 0; i < 10; i++)
-      { // print the first 10 points
-        printf("\t  (%f, %f, %f, %f, %f, %d)\n",
-               scanMsg.points[i].x,
-               scanMsg.points[i].y,
-               scanMsg.points[i].z,
-               scanMsg.points[i].intensity,
-               scanMsg.points[i].time,
-               scanMsg.points[i].ring);
-      }
+      uint32_t lost = sequenceTracker.update(sequence);
+      printf("A compact IMU msg is parsed! sequence = %u, lost before = %u\n", sequence, lost);
+      printf("\tstamp = %f, id = %d\n", imuMsg.stamp, imuMsg.id);
+      printf("\n");
+    }
+    else if (msgType == UDP_MSG_TYPE_COMPACT_SCAN && udpBufferToCompactScan(data, length, compactCloud, &sequence) >= 0)
+    {
+      uint32_t lost = sequenceTracker.update(sequence);
+      scanView.stamp = compactCloud.stamp;
+      scanView.id = compactCloud.id;
+      scanView.validPointsNum = compactCloud.points.size();
+      scanView.points = compactCloud.points.data();
+      printf("A compact Scan msg is parsed! sequence = %u, lost before = %u\n", sequence, lost);
+      printScan(scanView);
+    }
+    else if (msgType == UDP_MSG_TYPE_CLOCK_SYNC && udpBufferToClockSync(data, length, clockSyncMsg) == 0)
+    {
+      // lidar times, e.g. of a recording of the serial port, map to the publisher's host clock
+      printf("A clock sync msg is parsed! sequence = %u, valid = %d\n",
+             clockSyncMsg.sequence, (clockSyncMsg.flags & CLOCK_SYNC_FLAG_VALID) ? 1 : 0);
+      printf("\thost = %f + (lidar - %f) * (1 + %.2e), jitter = %.1f us, resets = %u\n",
+             clockSyncMsg.host_reference, clockSyncMsg.lidar_reference, clockSyncMsg.drift,
+             clockSyncMsg.jitter * 1e6, clockSyncMsg.resets);
       printf("\n");
     }
+    else if (msgType == UDP_MSG_TYPE_SCAN && viewScanMessage(data, length, &scanView) == 0)
+    {
+      // the points are read in place from the receive ring
+      printScan(scanView);
+    }
+  };
+
+  if (shm_mode)
+  {
+    // Messages are copied straight out of the publisher's shared memory
+    ShmRingSubscriber shm;
+    while (shm.open(shm_name))
+    {
+      printf("Waiting for shared memory %s ...\n", shm_name.c_str());
+      sleep(1);
+    }
+
+    union
+    {
+      IMUUnitree imu;
+      ScanUnitree scan;
+    } shmMsg;
+    ShmMessageInfo info;
+    uint64_t lost = 0;
+    while (true)
+    {
+      if (shm.receive(&info, &shmMsg, sizeof(shmMsg), 1000) <= 0)
+      {
+        continue;
+      }
+      uint64_t now_ns = detail::monotonicNs();
+      printf("received message %lu from shared memory after %.1f us\n",
+             info.sequence, (now_ns - info.publish_ns) * 1e-3);
+      handleMessage(info.msgType, (const char *)&shmMsg, info.size);
+
+      if (shm.getLost() != lost)
+      {
+        lost = shm.getLost();
+        printf("lost messages: %lu\n", lost);
+      }
+    }
+  }
+
+  UDPHandler server(port);
+  server.CreateSocket();
+  server.Bind();
+
+  // Datagrams are received in batches on one thread and parsed on another
+  UDPBatchReceiver receiver(server);
+  receiver.start([&](const UDPDatagram &datagram)
+  {
+    cout << "received data from " << inet_ntoa(datagram.from.sin_addr) << ":" << ntohs(datagram.from.sin_port) << endl;
+
+    if (forEachUDPMessage(datagram.data, datagram.size, handleMessage) < 0)
+    {
+      cout << "truncated datagram" << endl;
+    }
+  });
+  printf("UDP receive buffer size = %d\n", receiver.getStats().recv_buffer_size);
+
+  uint64_t lost = 0;
+  while (true)
+  {
+    sleep(1);
+    UDPReceiverStats stats = receiver.getStats();
+    if (stats.dropped + stats.truncated != lost)
+    {
+      lost = stats.dropped + stats.truncated;
+      printf("dropped datagrams: ring full = %lu, too large = %lu\n", stats.dropped, stats.truncated);
+    }
   }
 
+  receiver.stop();
   server.Close();
   return 0;
 }
\ No newline at end of file
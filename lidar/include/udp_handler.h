@@ -6,12 +6,19 @@
    typedef unsigned int uint32_t;
 #else
   #include <arpa/inet.h>
+  #include <poll.h>
+  #include <sys/socket.h>
   #include <unistd.h>
   #	define closesocket close
 #endif
 
 #include <vector>
 #include <cstring>
+#include <cerrno>
+#include <cmath>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_clock_sync.h"
 
 /**
  * @brief UDP Handler
@@ -29,6 +36,58 @@ public:
   int Send(const char *buf, int size, char *ip, unsigned short port);
   int Recv(char *buf, int bufsize, sockaddr_in *from);
 
+#ifdef __linux__
+  /**
+   * @brief Send several datagrams with a single sendmmsg() call
+   * @return the number of datagrams sent, or -1 on error
+   */
+  int SendBatch(struct mmsghdr *msgs, unsigned int count)
+  {
+    return sendmmsg(usock, msgs, count, 0);
+  }
+
+  /**
+   * @brief Receive up to count datagrams with a single recvmmsg() call
+   * @param timeout_ms time to wait for the first datagram, -1 to wait forever
+   * @return the number of datagrams received, 0 on timeout, or -1 on error
+   */
+  int RecvBatch(struct mmsghdr *msgs, unsigned int count, int timeout_ms = -1)
+  {
+    struct pollfd pfd;
+    pfd.fd = usock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0)
+    {
+      return ret;
+    }
+    ret = recvmmsg(usock, msgs, count, MSG_DONTWAIT, NULL);
+    return (ret < 0 && errno == EAGAIN) ? 0 : ret;
+  }
+
+  /**
+   * @brief Enlarge the kernel receive buffer, so that bursts are not dropped by the socket
+   * @note The size is capped by net.core.rmem_max unless the process has CAP_NET_ADMIN.
+   * @return the buffer size reported by the kernel, or -1 on error
+   */
+  int SetRecvBufferSize(int bytes)
+  {
+    if (setsockopt(usock, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) != 0 &&
+        setsockopt(usock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) != 0)
+    {
+      return -1;
+    }
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    if (getsockopt(usock, SOL_SOCKET, SO_RCVBUF, &actual, &len) != 0)
+    {
+      return -1;
+    }
+    return actual;
+  }
+#endif
+
   int SetRecvTimeout(int sec);
   int SetSendTimeout(int sec);
 
@@ -48,4 +107,379 @@ private:
  * @return uint32_t the total bytes sent through udp
  */
 template <typename DataStruct>
-uint32_t dataStructToUDPBuffer(const DataStruct &data, uint32_t msgType, char *buffer);
\ No newline at end of file
+uint32_t dataStructToUDPBuffer(const DataStruct &data, uint32_t msgType, char *buffer);
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Message types of the UDP wire format
+ *
+ * Every message starts with | uint32_t msgType | uint32_t dataSize | followed by dataSize bytes.
+ *  - 101 / 102 carry a raw IMUUnitree / ScanUnitree, as written by dataStructToUDPBuffer().
+ *  - 103 is a batch datagram carrying a sequence of messages as its data. Inside a batch, a scan
+ *    message only holds the first validPointsNum points of its ScanUnitree.
+ *  - 104 / 105 are the versioned compact scan / IMU messages below, with a sequence counter.
+ *  - 107 is a ClockSyncMessage mapping the lidar clock to the host clock of the sender.
+ */
+const uint32_t UDP_MSG_TYPE_IMU = 101;
+const uint32_t UDP_MSG_TYPE_SCAN = 102;
+const uint32_t UDP_MSG_TYPE_BATCH = 103;
+const uint32_t UDP_MSG_TYPE_COMPACT_SCAN = 104;
+const uint32_t UDP_MSG_TYPE_COMPACT_IMU = 105;
+const uint32_t UDP_MSG_TYPE_CLOCK_SYNC = 107;
+
+const uint32_t UDP_MSG_HEADER_SIZE = 8;
+
+const uint16_t UDP_COMPACT_VERSION = 1;
+
+/**
+ * @brief Header of a compact scan message
+ *
+ * It is followed by the points in structure-of-arrays order:
+ * | int16_t x[point_num] | int16_t y[point_num] | int16_t z[point_num] | uint16_t time[point_num] |
+ * uint8_t intensity[point_num] | padding to 4 bytes |.
+ * Coordinates are multiples of position_scale (1 mm, or coarser for a scan reaching beyond
+ * +-32.767 m) and point times are multiples of time_scale from the scan stamp. The rings are not sent.
+ */
+typedef struct{
+  uint16_t version;         // UDP_COMPACT_VERSION
+  uint16_t point_num;
+  uint32_t sequence;        // incremented by the sender for every compact message
+  double stamp;             // cloud timestamp
+  uint32_t id;              // sequence id of the cloud
+  float position_scale;     // meter per unit of x/y/z
+  float time_scale;         // second per unit of time
+  uint32_t reserved;
+}CompactScanHeader;
+
+/**
+ * @brief Header of a compact IMU message, followed by the IMUUnitree data
+ */
+typedef struct{
+  uint16_t version;         // UDP_COMPACT_VERSION
+  uint16_t reserved;
+  uint32_t sequence;        // incremented by the sender for every compact message
+}CompactIMUHeader;
+
+/**
+ * @brief Clock sync message: host_time = host_reference + (lidar_time - lidar_reference) * (1 + drift)
+ * @note Sent periodically by a publisher stamping with a ClockSync, so that a receiver can map
+ *  lidar times, e.g. of its own recordings, onto the host clock of the sender.
+ */
+typedef struct{
+  uint16_t version;         // UDP_COMPACT_VERSION
+  uint16_t flags;           // CLOCK_SYNC_FLAG_*
+  uint32_t sequence;        // incremented by the sender for every clock sync message
+  double lidar_reference;   // lidar time of the reference point, second
+  double host_reference;    // host time at lidar_reference, second
+  double drift;             // relative rate error of the lidar clock
+  float jitter;             // second, RMS residual of the fit
+  uint32_t resets;          // restarts of the estimation since the sender started
+}ClockSyncMessage;
+
+const uint16_t CLOCK_SYNC_FLAG_VALID = 1;
+
+const float UDP_COMPACT_POSITION_SCALE = 0.001;  // finest position_scale, meter
+const float UDP_COMPACT_MIN_TIME_SCALE = 1e-6;
+
+/**
+ * @brief Bytes of the data of a compact scan message with num points, without the message header
+ */
+inline uint32_t compactScanDataSize(uint32_t num){
+  return (uint32_t)((sizeof(CompactScanHeader) + num * 9 + 3) & ~3u);
+}
+
+namespace detail{
+
+inline int16_t quantizeInt16(float value, float inv_scale){
+  if (!std::isfinite(value)){
+    return 0;
+  }
+  float q = std::nearbyint(value * inv_scale);
+  q = q < -32768.0f ? -32768.0f : (q > 32767.0f ? 32767.0f : q);
+  return (int16_t)q;
+}
+
+inline uint16_t quantizeUint16(float value, float inv_scale){
+  float q = std::nearbyint(value * inv_scale);
+  q = q < 0.0f ? 0.0f : (q > 65535.0f ? 65535.0f : q);
+  return (uint16_t)q;
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Encode points into a compact scan message
+ * @note position_scale and time_scale are chosen so that the farthest coordinate and the largest
+ *  point time fit into 16 bits, with 1 mm and 1 us resolution at least. Non-finite coordinates
+ *  are sent as 0.
+ * @param num at most 65535 points
+ * @return uint32_t the total bytes to send, 0 if num is too large
+ */
+inline uint32_t compactScanToUDPBuffer(const PointUnitree* points, uint32_t num, double stamp, uint32_t id,
+                                       uint32_t sequence, char* buffer){
+  if (num > 65535){
+    return 0;
+  }
+  float max_time = 0;
+  float max_position = 0;
+  for (uint32_t i = 0; i < num; i++){
+    max_time = points[i].time > max_time ? points[i].time : max_time;
+    const float coords[3] = {std::fabs(points[i].x), std::fabs(points[i].y), std::fabs(points[i].z)};
+    for (int k = 0; k < 3; k++){
+      max_position = std::isfinite(coords[k]) && coords[k] > max_position ? coords[k] : max_position;
+    }
+  }
+
+  CompactScanHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = UDP_COMPACT_VERSION;
+  header.point_num = (uint16_t)num;
+  header.sequence = sequence;
+  header.stamp = stamp;
+  header.id = id;
+  header.position_scale = max_position / 32767.0f > UDP_COMPACT_POSITION_SCALE ? max_position / 32767.0f : UDP_COMPACT_POSITION_SCALE;
+  header.time_scale = max_time / 65535.0f > UDP_COMPACT_MIN_TIME_SCALE ? max_time / 65535.0f : UDP_COMPACT_MIN_TIME_SCALE;
+
+  uint32_t dataSize = compactScanDataSize(num);
+  memcpy(buffer, &UDP_MSG_TYPE_COMPACT_SCAN, 4);
+  memcpy(buffer + 4, &dataSize, 4);
+  char* p = buffer + UDP_MSG_HEADER_SIZE;
+  memcpy(p, &header, sizeof(header));
+
+  char* xs = p + sizeof(header);
+  char* ys = xs + 2 * num;
+  char* zs = ys + 2 * num;
+  char* ts = zs + 2 * num;
+  char* is = ts + 2 * num;
+  const float inv_position = 1.0f / header.position_scale;
+  const float inv_time = 1.0f / header.time_scale;
+  for (uint32_t i = 0; i < num; i++){
+    int16_t x = detail::quantizeInt16(points[i].x, inv_position);
+    int16_t y = detail::quantizeInt16(points[i].y, inv_position);
+    int16_t z = detail::quantizeInt16(points[i].z, inv_position);
+    uint16_t t = detail::quantizeUint16(points[i].time, inv_time);
+    float intensity = std::nearbyint(points[i].intensity);
+    memcpy(xs + 2 * i, &x, 2);
+    memcpy(ys + 2 * i, &y, 2);
+    memcpy(zs + 2 * i, &z, 2);
+    memcpy(ts + 2 * i, &t, 2);
+    is[i] = (char)(uint8_t)(intensity < 0 ? 0 : (intensity > 255 ? 255 : intensity));
+  }
+  memset(is + num, 0, p + dataSize - (is + num));
+  return UDP_MSG_HEADER_SIZE + dataSize;
+}
+
+/**
+ * @brief Encode the valid points of a scan into a compact scan message
+ */
+inline uint32_t compactScanToUDPBuffer(const ScanUnitree& scan, uint32_t sequence, char* buffer){
+  uint32_t num = scan.validPointsNum < 120 ? scan.validPointsNum : 120;
+  return compactScanToUDPBuffer(scan.points, num, scan.stamp, scan.id, sequence, buffer);
+}
+
+/**
+ * @brief Encode an IMU sample into a compact IMU message
+ * @return uint32_t the total bytes to send
+ */
+inline uint32_t compactIMUToUDPBuffer(const IMUUnitree& imu, uint32_t sequence, char* buffer){
+  CompactIMUHeader header;
+  memset(&header, 0, sizeof(header));
+  header.version = UDP_COMPACT_VERSION;
+  header.sequence = sequence;
+
+  uint32_t dataSize = sizeof(header) + sizeof(IMUUnitree);
+  memcpy(buffer, &UDP_MSG_TYPE_COMPACT_IMU, 4);
+  memcpy(buffer + 4, &dataSize, 4);
+  memcpy(buffer + UDP_MSG_HEADER_SIZE, &header, sizeof(header));
+  memcpy(buffer + UDP_MSG_HEADER_SIZE + sizeof(header), &imu, sizeof(IMUUnitree));
+  return UDP_MSG_HEADER_SIZE + dataSize;
+}
+
+/**
+ * @brief Decode the data of a compact scan message
+ * @param data the dataSize bytes following the message header
+ * @param header filled with the message header
+ * @param points receives at most max_points points, with ring 0
+ * @return the number of points decoded, or -1 if the version is unknown or the data is truncated
+ */
+inline int udpBufferToCompactScan(const char* data, uint32_t dataSize, CompactScanHeader* header,
+                                  PointUnitree* points, uint32_t max_points){
+  if (dataSize < sizeof(CompactScanHeader)){
+    return -1;
+  }
+  memcpy(header, data, sizeof(CompactScanHeader));
+  if (header->version != UDP_COMPACT_VERSION){
+    return -1;
+  }
+  uint32_t num = header->point_num;
+  if (dataSize < sizeof(CompactScanHeader) + num * 9){
+    return -1;
+  }
+
+  const char* xs = data + sizeof(CompactScanHeader);
+  const char* ys = xs + 2 * num;
+  const char* zs = ys + 2 * num;
+  const char* ts = zs + 2 * num;
+  const uint8_t* is = (const uint8_t*)(ts + 2 * num);
+  uint32_t n = num < max_points ? num : max_points;
+  for (uint32_t i = 0; i < n; i++){
+    int16_t x, y, z;
+    uint16_t t;
+    memcpy(&x, xs + 2 * i, 2);
+    memcpy(&y, ys + 2 * i, 2);
+    memcpy(&z, zs + 2 * i, 2);
+    memcpy(&t, ts + 2 * i, 2);
+    points[i].x = x * header->position_scale;
+    points[i].y = y * header->position_scale;
+    points[i].z = z * header->position_scale;
+    points[i].time = t * header->time_scale;
+    points[i].intensity = is[i];
+    points[i].ring = 0;
+  }
+  return (int)n;
+}
+
+/**
+ * @brief Decode the data of a compact scan message into a scan of at most 120 points
+ */
+inline int udpBufferToCompactScan(const char* data, uint32_t dataSize, ScanUnitree& scan, uint32_t* sequence = NULL){
+  CompactScanHeader header;
+  int n = udpBufferToCompactScan(data, dataSize, &header, scan.points, 120);
+  if (n < 0){
+    return -1;
+  }
+  scan.stamp = header.stamp;
+  scan.id = header.id;
+  scan.validPointsNum = (uint32_t)n;
+  if (sequence){
+    *sequence = header.sequence;
+  }
+  return n;
+}
+
+/**
+ * @brief Decode the data of a compact scan message into a cloud, reusing its capacity
+ */
+inline int udpBufferToCompactScan(const char* data, uint32_t dataSize, PointCloudUnitree& cloud, uint32_t* sequence = NULL){
+  CompactScanHeader header;
+  if (dataSize < sizeof(header)){
+    return -1;
+  }
+  memcpy(&header, data, sizeof(header));
+  cloud.points.resize(header.point_num);
+  int n = udpBufferToCompactScan(data, dataSize, &header, cloud.points.data(), header.point_num);
+  if (n < 0){
+    cloud.points.clear();
+    return -1;
+  }
+  cloud.stamp = header.stamp;
+  cloud.id = header.id;
+  cloud.ringNum = 1;
+  if (sequence){
+    *sequence = header.sequence;
+  }
+  return n;
+}
+
+/**
+ * @brief Decode the data of a compact IMU message
+ * @return 0 on success, -1 if the version is unknown or the data is truncated
+ */
+inline int udpBufferToCompactIMU(const char* data, uint32_t dataSize, IMUUnitree& imu, uint32_t* sequence = NULL){
+  CompactIMUHeader header;
+  if (dataSize < sizeof(header) + sizeof(IMUUnitree)){
+    return -1;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.version != UDP_COMPACT_VERSION){
+    return -1;
+  }
+  memcpy(&imu, data + sizeof(header), sizeof(IMUUnitree));
+  if (sequence){
+    *sequence = header.sequence;
+  }
+  return 0;
+}
+
+/**
+ * @brief Encode the state of the ClockSync of the lidar clock into a clock sync message
+ * @return uint32_t the total bytes to send
+ */
+inline uint32_t clockSyncToUDPBuffer(const ClockSyncState& state, uint32_t sequence, char* buffer){
+  ClockSyncMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.version = UDP_COMPACT_VERSION;
+  msg.flags = state.valid ? CLOCK_SYNC_FLAG_VALID : 0;
+  msg.sequence = sequence;
+  msg.lidar_reference = state.device_reference;
+  msg.host_reference = state.host_reference;
+  msg.drift = state.scale - 1;
+  msg.jitter = (float)state.jitter;
+  msg.resets = state.resets;
+
+  uint32_t dataSize = sizeof(msg);
+  memcpy(buffer, &UDP_MSG_TYPE_CLOCK_SYNC, 4);
+  memcpy(buffer + 4, &dataSize, 4);
+  memcpy(buffer + UDP_MSG_HEADER_SIZE, &msg, sizeof(msg));
+  return UDP_MSG_HEADER_SIZE + dataSize;
+}
+
+/**
+ * @brief Decode the data of a clock sync message
+ * @return 0 on success, -1 if the version is unknown or the data is truncated
+ */
+inline int udpBufferToClockSync(const char* data, uint32_t dataSize, ClockSyncMessage& msg){
+  if (dataSize < sizeof(msg)){
+    return -1;
+  }
+  memcpy(&msg, data, sizeof(msg));
+  return msg.version == UDP_COMPACT_VERSION ? 0 : -1;
+}
+
+/**
+ * @brief Host time of a lidar time according to a valid clock sync message
+ */
+inline double clockSyncToHost(const ClockSyncMessage& msg, double lidar_time){
+  return msg.host_reference + (lidar_time - msg.lidar_reference) * (1 + msg.drift);
+}
+
+/**
+ * @brief Detect gaps in the sequence counters of compact messages
+ */
+class UDPSequenceTracker{
+
+public:
+
+  /**
+   * @brief Account for a received sequence number
+   * @return the number of messages lost right before this one
+   */
+  uint32_t update(uint32_t sequence){
+    uint32_t lost = 0;
+    if (received_ > 0){
+      uint32_t delta = sequence - last_;
+      if (delta == 0 || delta > 0x80000000u){
+        reordered_++;   // duplicate or late message
+        return 0;
+      }
+      lost = delta - 1;
+    }
+    last_ = sequence;
+    received_++;
+    lost_ += lost;
+    return lost;
+  }
+
+  uint64_t getReceived() const { return received_; }
+  uint64_t getLost() const { return lost_; }
+  uint64_t getReordered() const { return reordered_; }
+
+private:
+  uint32_t last_ = 0;
+  uint64_t received_ = 0;
+  uint64_t lost_ = 0;
+  uint64_t reordered_ = 0;
+};
+
+} // end of namespace unitree_lidar_sdk
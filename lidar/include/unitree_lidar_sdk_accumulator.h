@@ -0,0 +1,343 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief One scan stored in a ScanHistory
+ * @note points stay valid until the scan is evicted from the history.
+ */
+typedef struct{
+  uint64_t seq;                 // position of the scan in the stream, starting from 0
+  double stamp;                 // scan timestamp
+  uint32_t id;                  // sequence id of the scan
+  uint32_t size;                // number of points
+  const PointUnitree* points;   // point times are relative to the scan stamp
+}ScanSpan;
+
+/**
+ * @brief Ring of the most recent scans of a stream
+ *
+ * Each scan is copied once, contiguously, into a preallocated point ring; when the ring is full
+ * the oldest scans are evicted. Nothing is moved or reallocated afterwards, so pushing a scan
+ * costs the copy of its own points only. Any number of CloudWindow consumers can look at the
+ * same history with their own window. Not thread-safe: push and read from the same thread,
+ * e.g. the reader callback, or guard the history with a lock.
+ */
+class ScanHistory{
+
+public:
+
+  /**
+   * @param max_scans number of scans kept at most
+   * @param max_points number of points kept at most
+   */
+  ScanHistory(uint32_t max_scans = 512, uint32_t max_points = 512 * 120)
+    : records_(max_scans > 0 ? max_scans : 1), points_(max_points > 0 ? max_points : 1){}
+
+  /**
+   * @brief Append a scan, evicting the oldest ones as needed
+   * @return 0 on success, -1 if the scan has more points than the history can hold
+   */
+  int push(double stamp, uint32_t id, const PointUnitree* points, uint32_t num){
+    const uint32_t capacity = (uint32_t)points_.size();
+    if (num > capacity){
+      return -1;
+    }
+    if (count_ == records_.size()){
+      evictOldest();
+    }
+
+    uint32_t offset = write_pos_;
+    if (offset + num > capacity){
+      offset = 0;   // keep every scan contiguous, the tail of the ring stays unused for a while
+    }
+    while (count_ > 0 && overlaps(oldest(), offset, num)){
+      evictOldest();
+    }
+
+    memcpy(points_.data() + offset, points, num * sizeof(PointUnitree));
+    Record& r = records_[(first_ + count_) % records_.size()];
+    r.seq = end_seq_++;
+    r.stamp = stamp;
+    r.id = id;
+    r.offset = offset;
+    r.size = num;
+    count_++;
+    point_count_ += num;
+    write_pos_ = offset + num;
+    return 0;
+  }
+
+  int push(const ScanUnitree& scan){
+    uint32_t n = scan.validPointsNum < 120 ? scan.validPointsNum : 120;
+    return push(scan.stamp, scan.id, scan.points, n);
+  }
+
+  /**
+   * @brief Append a cloud as one scan, e.g. the clouds of a reader initialized with cloud_scan_num = 1
+   */
+  int push(const PointCloudUnitree& cloud){
+    return push(cloud.stamp, cloud.id, cloud.points.data(), (uint32_t)cloud.points.size());
+  }
+
+  void clear(){
+    first_ = 0;
+    count_ = 0;
+    point_count_ = 0;
+    write_pos_ = 0;
+    begin_seq_ = end_seq_;
+  }
+
+  /**
+   * @brief Sequence number of the oldest scan kept
+   */
+  uint64_t beginSeq() const{
+    return begin_seq_;
+  }
+
+  /**
+   * @brief Sequence number the next pushed scan will get
+   */
+  uint64_t endSeq() const{
+    return end_seq_;
+  }
+
+  uint32_t scanCount() const{
+    return count_;
+  }
+
+  size_t pointCount() const{
+    return point_count_;
+  }
+
+  /**
+   * @brief Get a scan by its sequence number
+   * @return 0 on success, -1 if the scan is not in the history
+   */
+  int getScan(uint64_t seq, ScanSpan* span) const{
+    if (seq < begin_seq_ || seq >= end_seq_){
+      return -1;
+    }
+    const Record& r = records_[(first_ + (seq - begin_seq_)) % records_.size()];
+    span->seq = r.seq;
+    span->stamp = r.stamp;
+    span->id = r.id;
+    span->size = r.size;
+    span->points = points_.data() + r.offset;
+    return 0;
+  }
+
+  /**
+   * @brief Stamp of a scan, which must be in the history
+   */
+  double getStamp(uint64_t seq) const{
+    return records_[(first_ + (seq - begin_seq_)) % records_.size()].stamp;
+  }
+
+  uint32_t getSize(uint64_t seq) const{
+    return records_[(first_ + (seq - begin_seq_)) % records_.size()].size;
+  }
+
+private:
+
+  typedef struct{
+    uint64_t seq;
+    double stamp;
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+  }Record;
+
+  const Record& oldest() const{
+    return records_[first_];
+  }
+
+  static bool overlaps(const Record& r, uint32_t offset, uint32_t num){
+    return r.offset < offset + num && offset < r.offset + r.size;
+  }
+
+  void evictOldest(){
+    point_count_ -= records_[first_].size;
+    first_ = (first_ + 1) % records_.size();
+    count_--;
+    begin_seq_++;
+    if (count_ == 0){
+      write_pos_ = 0;
+    }
+  }
+
+  std::vector<Record> records_;
+  std::vector<PointUnitree> points_;
+  uint32_t first_ = 0;
+  uint32_t count_ = 0;
+  size_t point_count_ = 0;
+  uint32_t write_pos_ = 0;
+  uint64_t begin_seq_ = 0;
+  uint64_t end_seq_ = 0;
+};
+
+/**
+ * @brief How many scans a CloudWindow merges
+ * @note A limit of 0 is disabled; with both limits set, the smaller window wins.
+ */
+typedef struct{
+  uint32_t max_scans;   // number of the most recent scans
+  double max_span;      // second, scans whose stamp is within max_span of the newest stamp
+}CloudWindowConfig;
+
+inline CloudWindowConfig defaultCloudWindowConfig(){
+  CloudWindowConfig config = {18, 0};
+  return config;
+}
+
+/**
+ * @brief Sliding window over a ScanHistory, exposing the merged cloud of the selected scans
+ *
+ * update() only moves the window bounds: it reports how many scans entered at the new end and
+ * how many left at the old end, so that a consumer keeping derived state (a voxel grid, a
+ * background model, ...) can add and remove just those scans. The merged cloud is read scan
+ * by scan with getScan(), or copied into a PointCloudUnitree with copyTo().
+ */
+class CloudWindow{
+
+public:
+
+  CloudWindow(const CloudWindowConfig& config = defaultCloudWindowConfig()) : config_(config){}
+
+  /**
+   * @note A wider window only grows at the end, consumers keeping derived state should rebuild it.
+   */
+  void setConfig(const CloudWindowConfig& config){
+    config_ = config;
+  }
+
+  const CloudWindowConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Move the window to the newest scans of the history
+   * @return the number of scans that entered the window
+   */
+  uint32_t update(const ScanHistory& history){
+    uint64_t end = history.endSeq();
+    uint64_t begin = history.beginSeq();
+    if (config_.max_scans > 0 && end - begin > config_.max_scans){
+      begin = end - config_.max_scans;
+    }
+    if (config_.max_span > 0 && end > begin){
+      double newest = history.getStamp(end - 1);
+      while (begin < end - 1 && newest - history.getStamp(begin) > config_.max_span){
+        begin++;
+      }
+    }
+
+    uint64_t old_end = end_seq_ > begin ? end_seq_ : begin;
+    uint64_t kept_from = begin < end_seq_ ? begin : end_seq_;
+    added_ = (uint32_t)(end - old_end);
+    evicted_ = kept_from > begin_seq_ ? (uint32_t)(kept_from - begin_seq_) : 0;
+
+    begin_seq_ = begin;
+    end_seq_ = end;
+    point_count_ = 0;
+    for (uint64_t seq = begin; seq < end; seq++){
+      point_count_ += history.getSize(seq);
+    }
+    return added_;
+  }
+
+  /**
+   * @brief Scans added at the end by the last update()
+   */
+  uint32_t getAdded() const{
+    return added_;
+  }
+
+  /**
+   * @brief Scans of the previous window dropped at the front by the last update()
+   */
+  uint32_t getEvicted() const{
+    return evicted_;
+  }
+
+  uint64_t beginSeq() const{
+    return begin_seq_;
+  }
+
+  uint64_t endSeq() const{
+    return end_seq_;
+  }
+
+  uint32_t scanCount() const{
+    return (uint32_t)(end_seq_ - begin_seq_);
+  }
+
+  size_t pointCount() const{
+    return point_count_;
+  }
+
+  /**
+   * @brief Get the i-th scan of the window, 0 being the oldest
+   */
+  int getScan(const ScanHistory& history, uint32_t i, ScanSpan* span) const{
+    if (i >= scanCount()){
+      return -1;
+    }
+    return history.getScan(begin_seq_ + i, span);
+  }
+
+  /**
+   * @brief Copy the merged cloud, reusing the capacity of cloud
+   * @note The cloud stamp is the stamp of the oldest scan and the point times are made relative to it.
+   * @return the number of points
+   */
+  size_t copyTo(const ScanHistory& history, PointCloudUnitree& cloud) const{
+    cloud.points.resize(point_count_);
+    cloud.ringNum = 1;
+    cloud.stamp = 0;
+    cloud.id = 0;
+    size_t n = 0;
+    bool first = true;
+    ScanSpan span;
+    memset(&span, 0, sizeof(span));
+    for (uint64_t seq = begin_seq_; seq < end_seq_; seq++){
+      if (history.getScan(seq, &span) != 0 || n + span.size > cloud.points.size()){
+        continue;   // evicted from the history since update()
+      }
+      if (first){
+        cloud.stamp = span.stamp;
+        first = false;
+      }
+      cloud.id = span.id;
+      float offset = (float)(span.stamp - cloud.stamp);
+      PointUnitree* out = cloud.points.data() + n;
+      for (uint32_t j = 0; j < span.size; j++){
+        out[j] = span.points[j];
+        out[j].time += offset;
+      }
+      n += span.size;
+    }
+    cloud.points.resize(n);
+    return n;
+  }
+
+private:
+  CloudWindowConfig config_;
+  uint64_t begin_seq_ = 0;
+  uint64_t end_seq_ = 0;
+  uint32_t added_ = 0;
+  uint32_t evicted_ = 0;
+  size_t point_count_ = 0;
+};
+
+} // end of namespace unitree_lidar_sdk
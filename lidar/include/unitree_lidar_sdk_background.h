@@ -0,0 +1,251 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_voxel_grid.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a BackgroundModel
+ */
+typedef struct{
+  float voxel_size;       // meter
+  double learn_time;      // second, a voxel occupied for this long becomes background
+  double forget_time;     // second, a voxel not hit for this long is empty again
+  bool dilate;            // points next to a background voxel are background too
+  uint32_t max_voxels;    // voxels the model can hold
+}BackgroundConfig;
+
+inline BackgroundConfig defaultBackgroundConfig(){
+  BackgroundConfig config = {0.2, 2.0, 5.0, false, 131072};
+  return config;
+}
+
+/**
+ * @brief Counters of a BackgroundModel
+ */
+typedef struct{
+  uint64_t points;          // points learnt
+  uint32_t voxels;          // voxels in the model, including the ones forgotten since the last compaction
+  uint32_t compactions;     // times the forgotten voxels were removed to make room
+  uint64_t overflows;       // points not learnt because the model was full of live voxels
+}BackgroundStats;
+
+/**
+ * @brief Persistent occupancy model of the static part of the scene
+ *
+ * Every voxel hit by a scan remembers when its current occupancy started and when it was last
+ * hit. A voxel hit without a gap longer than forget_time for at least learn_time is background:
+ * walls, ground and trees become background learn_time after startup, while anything moving
+ * through a voxel stays foreground. Learning costs one hash lookup per point of each new scan,
+ * and nothing is done for the voxels a scan does not hit.
+ *
+ * The model clock is the stamp of the newest learnt scan: isBackground() answers for that time,
+ * so classify a cloud right after learning its scans. When the model is full, the voxels not hit
+ * for forget_time are removed in one pass, at most once per forget_time; points of new voxels
+ * are not learnt meanwhile. Not thread-safe.
+ */
+class BackgroundModel{
+
+public:
+
+  BackgroundModel(const BackgroundConfig& config = defaultBackgroundConfig())
+    : config_(config), grid_(config.voxel_size, config.max_voxels){
+    state_.reserve(config.max_voxels);
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  const BackgroundConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Forget everything
+   */
+  void reset(){
+    grid_.clear();
+    state_.clear();
+    now_ = 0;
+    compacted_at_ = -1e300;
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  /**
+   * @brief Learn the points of a scan
+   * @param stamp scan stamp; point times are ignored, a scan lasts much less than learn_time
+   */
+  void update(double stamp, const PointUnitree* points, uint32_t num){
+    if (stamp > now_){
+      now_ = stamp;
+    }
+    for (uint32_t i = 0; i < num; i++){
+      const PointUnitree& p = points[i];
+      int32_t v = voxelOf(p.x, p.y, p.z);
+      if (v < 0){
+        continue;
+      }
+      State& s = state_[v];
+      if (stamp - s.last_seen > config_.forget_time){
+        s.first_seen = stamp;   // empty for a while, a new occupancy starts
+      }
+      if (stamp > s.last_seen){
+        s.last_seen = stamp;
+      }
+    }
+    stats_.points += num;
+  }
+
+  void update(const ScanUnitree& scan){
+    update(scan.stamp, scan.points, scan.validPointsNum < 120 ? scan.validPointsNum : 120);
+  }
+
+  void update(const PointCloudUnitree& cloud){
+    update(cloud.stamp, cloud.points.data(), (uint32_t)cloud.points.size());
+  }
+
+  /**
+   * @brief Stamp of the newest learnt scan
+   */
+  double getTime() const{
+    return now_;
+  }
+
+  bool isBackground(float x, float y, float z) const{
+    if (!grid_.isValidPoint(x, y, z)){
+      return false;
+    }
+    int32_t v = grid_.findPoint(x, y, z);
+    if (v >= 0 && isBackgroundVoxel(v)){
+      return true;
+    }
+    if (!config_.dilate){
+      return false;
+    }
+    const int32_t ix = grid_.voxelCoord(x), iy = grid_.voxelCoord(y), iz = grid_.voxelCoord(z);
+    for (int dx = -1; dx <= 1; dx++){
+      for (int dy = -1; dy <= 1; dy++){
+        for (int dz = -1; dz <= 1; dz++){
+          int32_t u = grid_.find(ix + dx, iy + dy, iz + dz);
+          if (u >= 0 && isBackgroundVoxel(u)){
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Copy the foreground points of a cloud, reusing the capacity of cloudOut
+   * @return the number of foreground points
+   */
+  size_t extractForeground(const PointCloudUnitree& cloudIn, PointCloudUnitree& cloudOut) const{
+    cloudOut.stamp = cloudIn.stamp;
+    cloudOut.id = cloudIn.id;
+    cloudOut.ringNum = cloudIn.ringNum;
+    cloudOut.points.clear();
+    for (size_t i = 0; i < cloudIn.points.size(); i++){
+      const PointUnitree& p = cloudIn.points[i];
+      if (!isBackground(p.x, p.y, p.z)){
+        cloudOut.points.push_back(p);
+      }
+    }
+    return cloudOut.points.size();
+  }
+
+  /**
+   * @brief Voxels that are background at the model time
+   * @note Visits every voxel, meant for monitoring.
+   */
+  uint32_t backgroundVoxelCount() const{
+    uint32_t count = 0;
+    for (uint32_t v = 0; v < state_.size(); v++){
+      count += isBackgroundVoxel(v);
+    }
+    return count;
+  }
+
+  BackgroundStats getStats() const{
+    BackgroundStats stats = stats_;
+    stats.voxels = (uint32_t)state_.size();
+    return stats;
+  }
+
+private:
+
+  typedef struct{
+    double first_seen;    // start of the current occupancy
+    double last_seen;
+  }State;
+
+  bool isBackgroundVoxel(uint32_t v) const{
+    const State& s = state_[v];
+    return now_ - s.last_seen <= config_.forget_time && s.last_seen - s.first_seen >= config_.learn_time;
+  }
+
+  int32_t voxelOf(float x, float y, float z){
+    if (!grid_.isValidPoint(x, y, z)){
+      return -1;
+    }
+    int32_t ix = grid_.voxelCoord(x), iy = grid_.voxelCoord(y), iz = grid_.voxelCoord(z);
+    int32_t v = grid_.findOrInsert(ix, iy, iz);
+    if (v < 0 && now_ - compacted_at_ > config_.forget_time){
+      compact();
+      v = grid_.findOrInsert(ix, iy, iz);
+    }
+    if (v < 0){
+      stats_.overflows++;
+      return -1;
+    }
+    if ((size_t)v == state_.size()){
+      State s = {-1e300, -1e300};
+      state_.push_back(s);
+    }
+    return v;
+  }
+
+  /**
+   * @brief Rebuild the model without the voxels that are empty again
+   */
+  void compact(){
+    scratch_.clear();
+    for (uint32_t v = 0; v < state_.size(); v++){
+      if (now_ - state_[v].last_seen <= config_.forget_time){
+        const VoxelCell& c = grid_.getVoxel(v);
+        Kept k = {c.ix, c.iy, c.iz, state_[v]};
+        scratch_.push_back(k);
+      }
+    }
+    grid_.clear();
+    state_.clear();
+    for (size_t i = 0; i < scratch_.size(); i++){
+      grid_.findOrInsert(scratch_[i].ix, scratch_[i].iy, scratch_[i].iz);
+      state_.push_back(scratch_[i].state);
+    }
+    compacted_at_ = now_;
+    stats_.compactions++;
+  }
+
+  typedef struct{
+    int32_t ix, iy, iz;
+    State state;
+  }Kept;
+
+  BackgroundConfig config_;
+  VoxelHashGrid grid_;
+  std::vector<State> state_;      // indexed like the voxels of grid_
+  std::vector<Kept> scratch_;
+  double now_ = 0;
+  double compacted_at_ = -1e300;
+  BackgroundStats stats_;
+};
+
+} // end of namespace unitree_lidar_sdk
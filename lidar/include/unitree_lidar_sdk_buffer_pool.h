@@ -0,0 +1,217 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace unitree_lidar_sdk{
+
+template <typename T> class BufferPool;
+
+namespace detail{
+
+template <typename T> struct PoolStorage;
+
+template <typename T>
+struct PoolSlot{
+  T value;
+  std::atomic<int> refs{0};
+  int index = 0;
+  PoolStorage<T>* storage = nullptr;
+};
+
+/**
+ * @brief Slots shared by a pool and the handles it gave out
+ * @note It is deleted when both the pool and the last outstanding slot are released,
+ *  so handles may outlive their pool.
+ */
+template <typename T>
+struct PoolStorage{
+  static const int MAX_SLOTS = 64;
+
+  std::unique_ptr<PoolSlot<T>> slots[MAX_SLOTS];
+  std::atomic<uint64_t> free_mask{0};
+  std::atomic<int> refs{1};
+  std::atomic<int> size{0};
+  std::mutex grow_mutex;
+
+  void releaseSlot(PoolSlot<T>* slot){
+    free_mask.fetch_or(uint64_t(1) << slot->index, std::memory_order_release);
+    unref();
+  }
+
+  void unref(){
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+      delete this;
+    }
+  }
+};
+
+} // end of namespace detail
+
+/**
+ * @brief Reference-counted handle of a pooled object
+ *
+ * Copying a handle only increments an atomic counter. When the last handle is destroyed the
+ * object goes back to its pool untouched, so its memory (e.g. the capacity of a vector) is
+ * reused by the next acquire() without any heap allocation.
+ */
+template <typename T>
+class PoolHandle{
+
+public:
+
+  PoolHandle(){}
+
+  PoolHandle(const PoolHandle& other) : slot_(other.slot_){
+    if (slot_){
+      slot_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  PoolHandle(PoolHandle&& other) noexcept : slot_(other.slot_){
+    other.slot_ = nullptr;
+  }
+
+  ~PoolHandle(){ reset(); }
+
+  PoolHandle& operator=(const PoolHandle& other){
+    PoolHandle(other).swap(*this);
+    return *this;
+  }
+
+  PoolHandle& operator=(PoolHandle&& other) noexcept{
+    PoolHandle(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  void swap(PoolHandle& other) noexcept{
+    std::swap(slot_, other.slot_);
+  }
+
+  /**
+   * @brief Drop this reference, and give the object back to its pool if it was the last one
+   */
+  void reset(){
+    if (slot_ && slot_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+      slot_->storage->releaseSlot(slot_);
+    }
+    slot_ = nullptr;
+  }
+
+  T* get() const { return slot_ ? &slot_->value : nullptr; }
+  T& operator*() const { return slot_->value; }
+  T* operator->() const { return &slot_->value; }
+  explicit operator bool() const { return slot_ != nullptr; }
+
+  /**
+   * @brief Number of handles sharing the object
+   */
+  int useCount() const { return slot_ ? slot_->refs.load(std::memory_order_relaxed) : 0; }
+
+private:
+
+  friend class BufferPool<T>;
+
+  explicit PoolHandle(detail::PoolSlot<T>* slot) : slot_(slot){}
+
+  detail::PoolSlot<T>* slot_ = nullptr;
+};
+
+/**
+ * @brief Pool of reusable objects handed out as PoolHandle
+ *
+ * acquire() and the release of handles are lock-free; a new slot is only allocated when every
+ * existing slot is still referenced, up to 64 slots.
+ */
+template <typename T>
+class BufferPool{
+
+public:
+
+  static const int MAX_SLOTS = detail::PoolStorage<T>::MAX_SLOTS;
+
+  /**
+   * @param initial_size number of slots allocated up front
+   */
+  explicit BufferPool(int initial_size = 4) : storage_(new detail::PoolStorage<T>()){
+    for (int i = 0; i < initial_size && i < MAX_SLOTS; i++){
+      addSlot();
+    }
+  }
+
+  ~BufferPool(){
+    storage_->unref();
+  }
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /**
+   * @brief Take a free object out of the pool
+   * @note The object keeps whatever content it had when it was released.
+   * @return an empty handle if all 64 slots are in use
+   */
+  PoolHandle<T> acquire(){
+    detail::PoolStorage<T>* st = storage_;
+    uint64_t mask = st->free_mask.load(std::memory_order_acquire);
+    while (mask != 0){
+      int index = __builtin_ctzll(mask);
+      uint64_t bit = uint64_t(1) << index;
+      if (st->free_mask.compare_exchange_weak(mask, mask & ~bit, std::memory_order_acq_rel)){
+        return handleOf(st->slots[index].get());
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(st->grow_mutex);
+    detail::PoolSlot<T>* slot = addSlot(false);
+    return slot ? handleOf(slot) : PoolHandle<T>();
+  }
+
+  /**
+   * @brief Number of slots allocated so far
+   */
+  int size() const{
+    return storage_->size.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Number of slots currently free
+   */
+  int available() const{
+    return __builtin_popcountll(storage_->free_mask.load(std::memory_order_relaxed));
+  }
+
+private:
+
+  PoolHandle<T> handleOf(detail::PoolSlot<T>* slot){
+    slot->refs.store(1, std::memory_order_relaxed);
+    storage_->refs.fetch_add(1, std::memory_order_relaxed);
+    return PoolHandle<T>(slot);
+  }
+
+  detail::PoolSlot<T>* addSlot(bool mark_free = true){
+    detail::PoolStorage<T>* st = storage_;
+    int index = st->size.load(std::memory_order_relaxed);
+    if (index >= MAX_SLOTS){
+      return nullptr;
+    }
+    st->slots[index].reset(new detail::PoolSlot<T>());
+    st->slots[index]->index = index;
+    st->slots[index]->storage = st;
+    st->size.store(index + 1, std::memory_order_release);
+    if (mark_free){
+      st->free_mask.fetch_or(uint64_t(1) << index, std::memory_order_release);
+    }
+    return st->slots[index].get();
+  }
+
+  detail::PoolStorage<T>* storage_;
+};
+
+} // end of namespace unitree_lidar_sdk
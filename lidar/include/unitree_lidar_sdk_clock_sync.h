@@ -0,0 +1,240 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a ClockSync
+ */
+typedef struct{
+  uint32_t bin_size;          // observations per bin, of which only the least delayed one is kept
+  uint32_t bin_num;           // bins of the sliding window the line is fitted to
+  double bin_threshold;       // second, bins whose least delayed observation is this late on the line are dropped
+  double reset_threshold;     // second, observations this far from the line are ignored...
+  double reset_time;          // second, ...unless they keep coming for this long of host time, then the estimation restarts
+  double max_drift;           // relative, fitted scales further than this from the nominal one are clamped
+}ClockSyncConfig;
+
+inline ClockSyncConfig defaultClockSyncConfig(){
+  ClockSyncConfig config = {64, 64, 0.005, 0.5, 1.0, 1e-3};
+  return config;
+}
+
+/**
+ * @brief Affine mapping from a device clock to the host clock estimated by a ClockSync
+ * @note host_time = host_reference + (device_time - device_reference) * scale
+ */
+typedef struct{
+  double device_reference;    // device time of the reference point
+  double host_reference;      // host time at device_reference, second
+  double scale;               // host seconds per device unit; 1 + drift for a device clock in seconds
+  double jitter;              // second, RMS distance of the kept observations to the line
+  uint64_t observations;      // since the last reset
+  uint32_t resets;
+  bool valid;                 // at least one bin is complete
+}ClockSyncState;
+
+/**
+ * @brief Online estimator of the offset and drift between a device clock and the host clock
+ *
+ * Each observation pairs a device time with the host time its message was received. Transport
+ * and read delays only ever make a message late, so in every bin of bin_size observations only
+ * the earliest one relative to the current line is kept (lower envelope), and a line is fitted by
+ * least squares to the last bin_num of them. toHost() then maps any device time onto that line:
+ * the stamps follow the device clock, with the jitter of the fit instead of the one of the reads.
+ *
+ * The device time can be in seconds, e.g. the lidar time of the auxiliary packets, or any counter
+ * that grows linearly with time, e.g. the unwrapped packet_id of the IMU messages; its unit only
+ * sets the scale. A bin of which even the least delayed observation is bin_threshold late, i.e.
+ * every message was delayed, does not move the line. Observations further than reset_threshold
+ * from the line are ignored: a stalled reader delivers them in a burst once it resumes. A device
+ * time going backwards (device reboot), or such observations received over reset_time (host
+ * clock step), restart the estimation.
+ */
+class ClockSync{
+
+public:
+
+  /**
+   * @param nominal_scale expected host seconds per device unit, 1 for a clock in seconds, 0 if unknown
+   */
+  ClockSync(double nominal_scale = 1.0, const ClockSyncConfig& config = defaultClockSyncConfig())
+    : config_(config), nominal_scale_(nominal_scale){
+    if (config_.bin_size < 1){
+      config_.bin_size = 1;
+    }
+    if (config_.bin_num < 2){
+      config_.bin_num = 2;
+    }
+    bin_.reserve(config_.bin_size);
+    bins_.resize(config_.bin_num);
+    reset();
+  }
+
+  const ClockSyncConfig& getConfig() const{
+    return config_;
+  }
+
+  void reset(){
+    bin_.clear();
+    bin_count_ = 0;
+    bin_head_ = 0;
+    observations_ = 0;
+    outlier_ = false;
+    memset(&state_, 0, sizeof(state_));
+    state_.scale = nominal_scale_;
+  }
+
+  /**
+   * @brief Add a device time and the host time at which it was received
+   */
+  void addObservation(double device_time, double host_time){
+    if (observations_ > 0 && device_time < last_device_time_){
+      reset();
+      resets_++;
+    }
+    if (state_.valid && fabs(host_time - toHost(device_time)) > config_.reset_threshold){
+      if (!outlier_){
+        outlier_ = true;
+        outlier_start_ = host_time;
+      }
+      if (host_time - outlier_start_ < config_.reset_time){
+        return;
+      }
+      reset();
+      resets_++;
+    }
+    outlier_ = false;
+    last_device_time_ = device_time;
+    observations_++;
+
+    Observation o = {device_time, host_time};
+    bin_.push_back(o);
+    if (bin_.size() < config_.bin_size){
+      return;
+    }
+
+    // keep the least delayed observation of the bin, relative to the current slope
+    double scale = state_.valid ? state_.scale : binScale();
+    size_t best = 0;
+    for (size_t i = 1; i < bin_.size(); i++){
+      if (bin_[i].host - scale * bin_[i].device < bin_[best].host - scale * bin_[best].device){
+        best = i;
+      }
+    }
+    if (state_.valid && bin_[best].host - toHost(bin_[best].device) > config_.bin_threshold){
+      bin_.clear();
+      return;
+    }
+    bins_[bin_head_] = bin_[best];
+    bin_head_ = (bin_head_ + 1) % config_.bin_num;
+    if (bin_count_ < config_.bin_num){
+      bin_count_++;
+    }
+    bin_.clear();
+    fit(scale);
+  }
+
+  /**
+   * @brief Host time of a device time; only meaningful once getState().valid is true
+   */
+  double toHost(double device_time) const{
+    return state_.host_reference + (device_time - state_.device_reference) * state_.scale;
+  }
+
+  bool valid() const{
+    return state_.valid;
+  }
+
+  /**
+   * @note resets counts the restarts detected in the observations, not the calls to reset()
+   */
+  ClockSyncState getState() const{
+    ClockSyncState state = state_;
+    state.observations = observations_;
+    state.resets = resets_;
+    return state;
+  }
+
+private:
+
+  typedef struct{
+    double device;
+    double host;
+  }Observation;
+
+  /**
+   * @brief Slope between the first and last observations of the current bin, for the first fit
+   */
+  double binScale() const{
+    if (nominal_scale_ > 0 || bin_.size() < 2){
+      return nominal_scale_;
+    }
+    double dx = bin_.back().device - bin_.front().device;
+    return dx > 0 ? (bin_.back().host - bin_.front().host) / dx : 0;
+  }
+
+  /**
+   * @brief Least squares line through the kept observations, centered for precision
+   */
+  void fit(double scale){
+    const Observation& first = bins_[(bin_head_ + config_.bin_num - bin_count_) % config_.bin_num];
+    double sx = 0, sy = 0;
+    for (uint32_t i = 0; i < bin_count_; i++){
+      const Observation& o = bins_[i];
+      sx += o.device - first.device;
+      sy += o.host - first.host;
+    }
+    double mx = sx / bin_count_, my = sy / bin_count_;
+    double sxx = 0, sxy = 0;
+    for (uint32_t i = 0; i < bin_count_; i++){
+      const Observation& o = bins_[i];
+      double dx = o.device - first.device - mx;
+      double dy = o.host - first.host - my;
+      sxx += dx * dx;
+      sxy += dx * dy;
+    }
+    if (bin_count_ >= 2 && sxx > 0){
+      scale = sxy / sxx;
+    }
+    if (nominal_scale_ > 0){
+      double lo = nominal_scale_ * (1 - config_.max_drift), hi = nominal_scale_ * (1 + config_.max_drift);
+      scale = scale < lo ? lo : (scale > hi ? hi : scale);
+    }
+
+    state_.device_reference = first.device + mx;
+    state_.host_reference = first.host + my;
+    state_.scale = scale;
+    state_.valid = true;
+
+    double sr = 0;
+    for (uint32_t i = 0; i < bin_count_; i++){
+      double r = bins_[i].host - toHost(bins_[i].device);
+      sr += r * r;
+    }
+    state_.jitter = sqrt(sr / bin_count_);
+  }
+
+  ClockSyncConfig config_;
+  double nominal_scale_;
+  std::vector<Observation> bin_;        // observations of the current bin
+  std::vector<Observation> bins_;       // ring of the kept observations
+  uint32_t bin_count_ = 0;
+  uint32_t bin_head_ = 0;
+  uint64_t observations_ = 0;
+  bool outlier_ = false;           // the latest observations were beyond reset_threshold...
+  double outlier_start_ = 0;       // ...since this host time
+  uint32_t resets_ = 0;
+  double last_device_time_ = 0;
+  ClockSyncState state_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,418 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a CloudDeskewer
+ */
+typedef struct{
+  uint32_t imu_buffer_size;     // IMU samples kept
+  float knot_interval;          // second, spacing of the interpolated rotations over a cloud
+  float max_extrapolation;      // second, max time before the first or after the last IMU sample
+  float lidar_to_imu[4];        // quaternion [x,y,z,w] rotating lidar coordinates into imu coordinates
+}DeskewConfig;
+
+inline DeskewConfig defaultDeskewConfig(){
+  DeskewConfig config = {1024, 0.002f, 0.05f, {0, 0, 0, 1}};
+  return config;
+}
+
+namespace detail{
+
+/**
+ * @brief Hamilton product a * b of quaternions [x,y,z,w]
+ */
+inline void quaternionMultiply(const double a[4], const double b[4], double out[4]){
+  double x = a[3] * b[0] + a[0] * b[3] + a[1] * b[2] - a[2] * b[1];
+  double y = a[3] * b[1] - a[0] * b[2] + a[1] * b[3] + a[2] * b[0];
+  double z = a[3] * b[2] + a[0] * b[1] - a[1] * b[0] + a[2] * b[3];
+  double w = a[3] * b[3] - a[0] * b[0] - a[1] * b[1] - a[2] * b[2];
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+  out[3] = w;
+}
+
+inline void quaternionNormalize(double q[4]){
+  double n = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  if (n > 0){
+    for (int i = 0; i < 4; i++){
+      q[i] /= n;
+    }
+  }
+  else{
+    q[0] = q[1] = q[2] = 0;
+    q[3] = 1;
+  }
+}
+
+/**
+ * @brief Row-major rotation matrix of a unit quaternion [x,y,z,w]
+ */
+inline void quaternionToMatrix(const double q[4], double m[9]){
+  const double x = q[0], y = q[1], z = q[2], w = q[3];
+  m[0] = 1 - 2 * (y * y + z * z);
+  m[1] = 2 * (x * y - z * w);
+  m[2] = 2 * (x * z + y * w);
+  m[3] = 2 * (x * y + z * w);
+  m[4] = 1 - 2 * (x * x + z * z);
+  m[5] = 2 * (y * z - x * w);
+  m[6] = 2 * (x * z - y * w);
+  m[7] = 2 * (y * z + x * w);
+  m[8] = 1 - 2 * (x * x + y * y);
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Motion compensation of the clouds of a rotating platform from the IMU orientation
+ *
+ * Every point is measured at stamp + time. deskew() rotates it to where it would have been seen
+ * at a common reference time, with the orientation of the IMU interpolated between its samples
+ * (slerp) and extrapolated with the angular velocity up to max_extrapolation past them. Only the
+ * rotation is compensated; the translation of the platform during a cloud is not observable from
+ * the IMU alone.
+ *
+ * Instead of one slerp per point, the relative rotation is computed at knots every
+ * knot_interval over the time span of the cloud and interpolated linearly in between, and the
+ * points are processed in runs falling between the same two knots. Within a run the loop has no
+ * branch and no gather, so it is vectorized over the SoA arrays. Clouds built from consecutive
+ * scans have increasing point times and thus produce one run per knot interval.
+ * Not thread-safe.
+ */
+class CloudDeskewer{
+
+public:
+
+  CloudDeskewer(const DeskewConfig& config = defaultDeskewConfig()) : config_(config){
+    if (config_.imu_buffer_size < 2){
+      config_.imu_buffer_size = 2;
+    }
+    if (!(config_.knot_interval > 0)){
+      config_.knot_interval = 0.002f;
+    }
+    samples_.resize(config_.imu_buffer_size);
+    double e[4] = {config_.lidar_to_imu[0], config_.lidar_to_imu[1], config_.lidar_to_imu[2], config_.lidar_to_imu[3]};
+    detail::quaternionNormalize(e);
+    memcpy(extrinsic_, e, sizeof(extrinsic_));
+  }
+
+  const DeskewConfig& getConfig() const{
+    return config_;
+  }
+
+  void reset(){
+    head_ = 0;
+    count_ = 0;
+  }
+
+  /**
+   * @brief Keep an IMU sample; samples older than the newest one are ignored
+   */
+  void addIMU(const IMUUnitree& imu){
+    if (count_ > 0 && imu.stamp <= sample(count_ - 1).stamp){
+      return;
+    }
+    Sample s;
+    s.stamp = imu.stamp;
+    for (int i = 0; i < 4; i++){
+      s.q[i] = imu.quaternion[i];
+    }
+    detail::quaternionNormalize(s.q);
+    for (int i = 0; i < 3; i++){
+      s.w[i] = imu.angular_velocity[i];
+    }
+    const uint32_t capacity = (uint32_t)samples_.size();
+    samples_[(head_ + count_) % capacity] = s;
+    if (count_ < capacity){
+      count_++;
+    }
+    else{
+      head_ = (head_ + 1) % capacity;
+    }
+  }
+
+  /**
+   * @brief Number of IMU samples kept
+   */
+  uint32_t imuCount() const{
+    return count_;
+  }
+
+  /**
+   * @brief Orientation of the IMU at stamp, as a quaternion [x,y,z,w]
+   * @return 0 on success, -1 if stamp is farther than max_extrapolation from the samples
+   */
+  int getOrientation(double stamp, double q[4]) const{
+    if (count_ == 0){
+      return -1;
+    }
+    const Sample& first = sample(0);
+    const Sample& last = sample(count_ - 1);
+    if (stamp <= first.stamp){
+      return extrapolate(first, stamp, q);
+    }
+    if (stamp >= last.stamp){
+      return extrapolate(last, stamp, q);
+    }
+
+    // binary search of the samples around stamp
+    uint32_t lo = 0, hi = count_ - 1;
+    while (hi - lo > 1){
+      uint32_t mid = (lo + hi) / 2;
+      if (sample(mid).stamp <= stamp){
+        lo = mid;
+      }
+      else{
+        hi = mid;
+      }
+    }
+    const Sample& a = sample(lo);
+    const Sample& b = sample(hi);
+    slerp(a.q, b.q, (stamp - a.stamp) / (b.stamp - a.stamp), q);
+    return 0;
+  }
+
+  /**
+   * @brief Rotate the points of a cloud, in place, to the orientation at stamp + reference_time
+   * @param reference_time time relative to the cloud stamp the points are moved to; the
+   *  point times are kept
+   * @return 0 on success, -1 if the IMU samples do not cover the cloud (the cloud is unchanged)
+   */
+  int deskew(PointCloudUnitreeSoA& cloud, float reference_time = 0){
+    const size_t n = cloud.size();
+    if (n == 0){
+      return 0;
+    }
+    const float* time = cloud.time.data();
+    float tmin, tmax;
+    const bool sorted = timeRange(time, n, &tmin, &tmax);
+    if (buildKnots(cloud.stamp, reference_time, tmin, tmax) != 0){
+      return -1;
+    }
+
+    float* x = cloud.x.data();
+    float* y = cloud.y.data();
+    float* z = cloud.z.data();
+    const int32_t last_segment = (int32_t)segments_.size() - 1;
+    if (sorted){
+      // the runs are the knot intervals, found by binary search
+      size_t i = 0;
+      for (int32_t k = 0; k <= last_segment && i < n; k++){
+        size_t end = (k == last_segment) ? n
+                     : (size_t)(std::lower_bound(time + i, time + n, segments_[k].end) - time);
+        applySegment(segments_[k], time + i, x + i, y + i, z + i, end - i);
+        i = end;
+      }
+      return 0;
+    }
+
+    const float inv_step = 1.0f / config_.knot_interval;
+    size_t i = 0;
+    while (i < n){
+      int32_t k = (int32_t)((time[i] - tmin) * inv_step);
+      k = std::max(0, std::min(k, last_segment));
+      const Segment& s = segments_[k];
+
+      // run of points between the same two knots
+      size_t end = i + 1;
+      while (end < n && (time[end] >= s.begin || k == 0) && (time[end] < s.end || k == last_segment)){
+        end++;
+      }
+      applySegment(s, time + i, x + i, y + i, z + i, end - i);
+      i = end;
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Number of knots used by the last deskew()
+   */
+  size_t knotCount() const{
+    return segments_.empty() ? 0 : segments_.size() + 1;
+  }
+
+private:
+
+  typedef struct{
+    double stamp;
+    double q[4];          // orientation, imu to world
+    double w[3];          // rad/s, angular velocity in the imu frame
+  }Sample;
+
+  /**
+   * @brief Rotation M(t) = a + b * t between two knots, t being the relative point time
+   */
+  typedef struct{
+    float a[9];
+    float b[9];
+    float begin, end;     // relative time span of the segment
+  }Segment;
+
+  const Sample& sample(uint32_t i) const{
+    return samples_[(head_ + i) % samples_.size()];
+  }
+
+  int extrapolate(const Sample& s, double stamp, double q[4]) const{
+    double dt = stamp - s.stamp;
+    if (fabs(dt) > config_.max_extrapolation){
+      return -1;
+    }
+    // body-frame rotation by w * dt
+    double angle = sqrt(s.w[0] * s.w[0] + s.w[1] * s.w[1] + s.w[2] * s.w[2]) * dt;
+    double d[4] = {0, 0, 0, 1};
+    if (fabs(angle) > 1e-12){
+      double k = sin(angle / 2) / (angle / dt);
+      d[0] = s.w[0] * k;
+      d[1] = s.w[1] * k;
+      d[2] = s.w[2] * k;
+      d[3] = cos(angle / 2);
+    }
+    detail::quaternionMultiply(s.q, d, q);
+    detail::quaternionNormalize(q);
+    return 0;
+  }
+
+  static void slerp(const double a[4], const double b[4], double t, double q[4]){
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    double sign = 1;
+    if (dot < 0){
+      dot = -dot;
+      sign = -1;
+    }
+    double wa = 1 - t, wb = t;
+    if (dot < 0.9995){
+      double theta = acos(dot);
+      double s = sin(theta);
+      wa = sin((1 - t) * theta) / s;
+      wb = sin(t * theta) / s;
+    }
+    for (int i = 0; i < 4; i++){
+      q[i] = wa * a[i] + sign * wb * b[i];
+    }
+    detail::quaternionNormalize(q);
+  }
+
+  /**
+   * @brief Relative rotation in the lidar frame from time t to the reference time
+   */
+  int relativeRotation(const double ref_conj[4], double stamp, double m[9]) const{
+    double q[4], r[4], e[4];
+    if (getOrientation(stamp, q) != 0){
+      return -1;
+    }
+    // lidar(t) -> imu(t) -> world -> imu(ref) -> lidar(ref)
+    double e_conj[4] = {-extrinsic_[0], -extrinsic_[1], -extrinsic_[2], extrinsic_[3]};
+    detail::quaternionMultiply(ref_conj, q, r);
+    detail::quaternionMultiply(r, extrinsic_, e);
+    detail::quaternionMultiply(e_conj, e, r);
+    detail::quaternionToMatrix(r, m);
+    return 0;
+  }
+
+  int buildKnots(double stamp, float reference_time, float tmin, float tmax){
+    double ref[4];
+    if (getOrientation(stamp + reference_time, ref) != 0){
+      return -1;
+    }
+    const double ref_conj[4] = {-ref[0], -ref[1], -ref[2], ref[3]};
+    const float step = config_.knot_interval;
+    const size_t segments = std::max((size_t)1, (size_t)ceilf((tmax - tmin) / step));
+    knots_.resize((segments + 1) * 9);
+    for (size_t k = 0; k <= segments; k++){
+      if (relativeRotation(ref_conj, stamp + tmin + k * (double)step, &knots_[k * 9]) != 0){
+        return -1;
+      }
+    }
+    segments_.resize(segments);
+    for (size_t k = 0; k < segments; k++){
+      Segment& s = segments_[k];
+      s.begin = tmin + k * step;
+      s.end = tmin + (k + 1) * step;
+      const double* m0 = &knots_[k * 9];
+      const double* m1 = &knots_[(k + 1) * 9];
+      for (int j = 0; j < 9; j++){
+        double b = (m1[j] - m0[j]) / step;
+        s.b[j] = (float)b;
+        s.a[j] = (float)(m0[j] - b * s.begin);
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Min and max of the point times, in independent lanes so that the loop is vectorized
+   * @return true if the times are non-decreasing
+   */
+  static bool timeRange(const float* __restrict time, size_t n, float* tmin, float* tmax){
+    enum{ LANES = 8 };
+    float lo[LANES], hi[LANES];
+    uint32_t descents[LANES];
+    for (int j = 0; j < LANES; j++){
+      lo[j] = time[0];
+      hi[j] = time[0];
+      descents[j] = 0;
+    }
+    size_t i = 1;
+    for (; i + LANES <= n; i += LANES){
+      for (int j = 0; j < LANES; j++){
+        const float t = time[i + j];
+        lo[j] = t < lo[j] ? t : lo[j];
+        hi[j] = t > hi[j] ? t : hi[j];
+        descents[j] += (t < time[i + j - 1]);
+      }
+    }
+    for (; i < n; i++){
+      lo[0] = std::min(lo[0], time[i]);
+      hi[0] = std::max(hi[0], time[i]);
+      descents[0] += (time[i] < time[i - 1]);
+    }
+    uint32_t total = 0;
+    for (int j = 0; j < LANES; j++){
+      lo[0] = std::min(lo[0], lo[j]);
+      hi[0] = std::max(hi[0], hi[j]);
+      total += descents[j];
+    }
+    *tmin = lo[0];
+    *tmax = hi[0];
+    return total == 0;
+  }
+
+  static void applySegment(const Segment& s, const float* __restrict time, float* __restrict x,
+                           float* __restrict y, float* __restrict z, size_t n){
+    const float a0 = s.a[0], a1 = s.a[1], a2 = s.a[2], a3 = s.a[3], a4 = s.a[4];
+    const float a5 = s.a[5], a6 = s.a[6], a7 = s.a[7], a8 = s.a[8];
+    const float b0 = s.b[0], b1 = s.b[1], b2 = s.b[2], b3 = s.b[3], b4 = s.b[4];
+    const float b5 = s.b[5], b6 = s.b[6], b7 = s.b[7], b8 = s.b[8];
+    for (size_t i = 0; i < n; i++){
+      const float t = time[i];
+      const float px = x[i], py = y[i], pz = z[i];
+      x[i] = (a0 + b0 * t) * px + (a1 + b1 * t) * py + (a2 + b2 * t) * pz;
+      y[i] = (a3 + b3 * t) * px + (a4 + b4 * t) * py + (a5 + b5 * t) * pz;
+      z[i] = (a6 + b6 * t) * px + (a7 + b7 * t) * py + (a8 + b8 * t) * pz;
+    }
+  }
+
+  DeskewConfig config_;
+  double extrinsic_[4];
+  std::vector<Sample> samples_;     // ring of IMU samples in stamp order
+  uint32_t head_ = 0;
+  uint32_t count_ = 0;
+  std::vector<double> knots_;       // row-major relative rotations at the knots
+  std::vector<Segment> segments_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,628 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+#include "unitree_lidar_sdk_voxel_grid.h"
+#include "unitree_lidar_sdk_background.h"
+#include "unitree_lidar_sdk_thread_pool.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a DroneDetector, with the same meaning as DetectionConfig of examples/catcher/config.py
+ * @note A value of 0 disables max_points_per_cluster, min_intensity and distance_max.
+ */
+typedef struct{
+  float voxel_size;               // meter, points are merged into voxels of this size before clustering
+  float clustering_distance;      // meter, voxels closer than this are neighbours (DBSCAN eps)
+  uint32_t min_neighbors;         // points within clustering_distance for a voxel to seed a cluster; sparser voxels are outliers
+  uint32_t min_points_per_cluster;
+  uint32_t max_points_per_cluster;
+  float drone_size_min;           // meter, min extent of a drone along x, y and z
+  float drone_size_max_xy;        // meter, max extent of a drone along x and y
+  float drone_size_max_z;         // meter, max extent of a drone along z
+  float distance_min;             // meter, horizontal distance of the cluster center
+  float distance_max;
+  float min_height;               // meter, min z of the cluster center
+  float min_intensity;            // points with a lower intensity are ignored
+}DetectionConfig;
+
+inline DetectionConfig defaultDetectionConfig(){
+  DetectionConfig config = {0.05, 0.5, 3, 3, 0, 0.1, 2.0, 1.0, 1.0, 50.0, 0.5, 0};
+  return config;
+}
+
+/**
+ * @brief One cluster found by a DroneDetector
+ */
+typedef struct{
+  float center[3];          // centroid of the points
+  float min_bound[3];       // axis-aligned bounding box
+  float max_bound[3];
+  float size[3];            // max_bound - min_bound
+  float distance;           // horizontal distance of the center
+  float mean_intensity;
+  float intensity_variance;
+  float principal_sigma[3]; // standard deviations along the principal axes, largest first
+  float principal_axis[3];  // unit vector of the largest principal axis
+  float confidence;         // 0 to 1, from the point count and the xy aspect ratio
+  uint32_t point_count;
+  int32_t label;            // cluster index used by DroneDetector::getLabels()
+  bool is_drone;            // passed the size, point count, distance and height gates
+}Detection;
+
+/**
+ * @brief Axis-aligned box of space to cluster, e.g. around the predicted position of a track
+ */
+typedef struct{
+  float min_bound[3];
+  float max_bound[3];
+}RegionOfInterest;
+
+/**
+ * @brief Work done by the last DroneDetector::detect() call
+ */
+typedef struct{
+  uint32_t input_points;
+  uint32_t background_points; // points skipped as background
+  uint32_t outside_points;    // points skipped as outside the regions of interest
+  uint32_t candidate_points;  // points left after the intensity, range, height and background pre-gates
+  uint32_t voxels;
+  uint32_t core_voxels;       // voxels with at least min_neighbors points around them
+  uint32_t clusters;
+  uint32_t drones;
+}DetectionStats;
+
+namespace detail{
+
+/**
+ * @brief Eigen decomposition of a symmetric 3 x 3 matrix with cyclic Jacobi rotations
+ * @param a xx, xy, xz, yy, yz, zz
+ * @param values eigenvalues, largest first
+ * @param vectors vectors[i] is the unit eigenvector of values[i]
+ */
+inline void symmetricEigen3(const double a[6], double values[3], double vectors[3][3]){
+  double m[3][3] = {{a[0], a[1], a[2]}, {a[1], a[3], a[4]}, {a[2], a[4], a[5]}};
+  double v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  for (int sweep = 0; sweep < 16; sweep++){
+    double off = m[0][1] * m[0][1] + m[0][2] * m[0][2] + m[1][2] * m[1][2];
+    if (off < 1e-30){
+      break;
+    }
+    for (int p = 0; p < 2; p++){
+      for (int q = p + 1; q < 3; q++){
+        if (m[p][q] == 0){
+          continue;
+        }
+        double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+        double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+        double c = 1 / sqrt(t * t + 1), s = t * c;
+        for (int k = 0; k < 3; k++){
+          double mkp = m[k][p], mkq = m[k][q];
+          m[k][p] = c * mkp - s * mkq;
+          m[k][q] = s * mkp + c * mkq;
+        }
+        for (int k = 0; k < 3; k++){
+          double mpk = m[p][k], mqk = m[q][k];
+          m[p][k] = c * mpk - s * mqk;
+          m[q][k] = s * mpk + c * mqk;
+        }
+        for (int k = 0; k < 3; k++){
+          double vkp = v[k][p], vkq = v[k][q];
+          v[k][p] = c * vkp - s * vkq;
+          v[k][q] = s * vkp + c * vkq;
+        }
+      }
+    }
+  }
+  int order[3] = {0, 1, 2};
+  for (int i = 0; i < 2; i++){
+    for (int j = i + 1; j < 3; j++){
+      if (m[order[j]][order[j]] > m[order[i]][order[i]]){
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+      }
+    }
+  }
+  for (int i = 0; i < 3; i++){
+    values[i] = m[order[i]][order[i]];
+    for (int k = 0; k < 3; k++){
+      vectors[i][k] = v[k][order[i]];
+    }
+  }
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Drone detection on a point cloud: voxel grid, outlier removal, clustering and gating
+ *
+ * The points are merged into voxels of voxel_size, then clustered with density based clustering
+ * over the voxels, weighted by their point counts: a voxel with at least min_neighbors points
+ * within clustering_distance is a core voxel, core voxels closer than clustering_distance join
+ * the same cluster and the other voxels join a neighbouring cluster, or are dropped as outliers.
+ * Both the voxels and the cells of size clustering_distance used to find the neighbours of a
+ * voxel are VoxelHashGrid indices, built in linear time and reused from cloud to cloud. Finally
+ * every cluster is measured in one pass over its points and gated like DetectionConfig does.
+ *
+ * Points that cannot belong to an accepted cluster (too far, too low, too dark) are skipped
+ * before voxelization, and so are the points of a BackgroundModel and the points outside the
+ * regions of interest when they are set. With a ThreadPool, large clouds count the neighbours of
+ * the voxels and accumulate the cluster statistics in parallel; clustering itself stays serial. All buffers are members that keep their capacity, so after the first
+ * clouds a detection does not allocate memory. Not thread-safe: use one detector per thread.
+ */
+class DroneDetector{
+
+public:
+
+  /**
+   * @param max_points expected cloud size, used to preallocate the buffers
+   */
+  DroneDetector(const DetectionConfig& config = defaultDetectionConfig(), size_t max_points = 18 * 120 * 10)
+    : config_(config), grid_(config.voxel_size, (uint32_t)max_points),
+      cell_grid_(config.clustering_distance, (uint32_t)max_points){
+    candidates_.reserve(max_points);
+    neighbor_begin_.reserve(max_points + 1);
+    neighbor_cells_.reserve(max_points * 4);
+    core_.reserve(max_points);
+    parent_.reserve(max_points);
+    cluster_of_.reserve(max_points);
+    labels_.reserve(max_points);
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void setConfig(const DetectionConfig& config){
+    config_ = config;
+  }
+
+  const DetectionConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Skip the background points of a model before clustering, nullptr to cluster every point
+   * @note The model is only read; keep it alive and learn each scan into it before detect().
+   */
+  void setBackgroundModel(const BackgroundModel* background){
+    background_ = background;
+  }
+
+  /**
+   * @brief Only cluster the points inside these regions until the next call, none to cluster every point
+   */
+  void setRegionsOfInterest(const std::vector<RegionOfInterest>& rois){
+    rois_.assign(rois.begin(), rois.end());
+  }
+
+  void clearRegionsOfInterest(){
+    rois_.clear();
+  }
+
+  /**
+   * @brief Split the work of clouds with at least min_points candidate points over a pool, nullptr for none
+   */
+  void setThreadPool(ThreadPool* pool, size_t min_points = 20000){
+    pool_ = pool;
+    parallel_min_points_ = min_points;
+  }
+
+  /**
+   * @brief Detect the clusters of a cloud
+   * @param detections every cluster with at least min_points_per_cluster points, reusing its capacity
+   * @return the number of clusters flagged as drones
+   */
+  int detect(const PointCloudUnitree& cloud, std::vector<Detection>& detections){
+    const PointUnitree* p = cloud.points.data();
+    const size_t n = cloud.points.size();
+    labels_.assign(n, -1);
+    candidates_.clear();
+    background_points_ = 0;
+    outside_points_ = 0;
+    for (size_t i = 0; i < n; i++){
+      gather(p[i].x, p[i].y, p[i].z, p[i].intensity, (uint32_t)i);
+    }
+    return run(n, detections);
+  }
+
+  int detect(const PointCloudUnitreeSoA& cloud, std::vector<Detection>& detections){
+    return detect(cloud.x.data(), cloud.y.data(), cloud.z.data(), 1, cloud.intensity.data(), cloud.size(), detections);
+  }
+
+  /**
+   * @brief Detect the clusters of n points read with a stride, e.g. an (n, 3) array of floats with stride 3
+   * @param intensity nullptr if there is no intensity
+   * @param intensity_stride floats between two intensities
+   */
+  int detect(const float* x, const float* y, const float* z, size_t stride, const float* intensity,
+             size_t n, std::vector<Detection>& detections, size_t intensity_stride = 1){
+    labels_.assign(n, -1);
+    candidates_.clear();
+    background_points_ = 0;
+    outside_points_ = 0;
+    for (size_t i = 0; i < n; i++){
+      gather(x[i * stride], y[i * stride], z[i * stride], intensity ? intensity[i * intensity_stride] : 0, (uint32_t)i);
+    }
+    return run(n, detections);
+  }
+
+  /**
+   * @brief Cluster label of every input point of the last detection, -1 for skipped and outlier points
+   */
+  const std::vector<int32_t>& getLabels() const{
+    return labels_;
+  }
+
+  const DetectionStats& getStats() const{
+    return stats_;
+  }
+
+private:
+
+  typedef struct{
+    float x, y, z, intensity;
+    uint32_t index;           // index in the input cloud
+    int32_t voxel;
+  }Candidate;
+
+  typedef struct{
+    double sum[3];
+    double sum2[6];           // xx, xy, xz, yy, yz, zz
+    double intensity, intensity2;
+    float min[3], max[3];
+    uint32_t count;
+  }ClusterSums;
+
+  void gather(float x, float y, float z, float intensity, uint32_t index){
+    if (intensity < config_.min_intensity){
+      return;
+    }
+    // a point lower than this always ends in a cluster that is too tall or too low
+    if (z < config_.min_height - config_.drone_size_max_z){
+      return;
+    }
+    // likewise beyond the max distance plus the half diagonal of the largest drone
+    float reach = config_.distance_max + config_.drone_size_max_xy * 1.4143f;
+    float d2 = x * x + y * y;
+    if (config_.distance_max > 0 && d2 > reach * reach){
+      return;
+    }
+    if (!rois_.empty() && !insideRegions(x, y, z)){
+      outside_points_++;
+      return;
+    }
+    if (background_ && background_->isBackground(x, y, z)){
+      background_points_++;
+      return;
+    }
+    Candidate c = {x, y, z, intensity, index, -1};
+    candidates_.push_back(c);
+  }
+
+  bool insideRegions(float x, float y, float z) const{
+    for (size_t i = 0; i < rois_.size(); i++){
+      const RegionOfInterest& r = rois_[i];
+      if (x >= r.min_bound[0] && x <= r.max_bound[0] && y >= r.min_bound[1] && y <= r.max_bound[1]
+          && z >= r.min_bound[2] && z <= r.max_bound[2]){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int run(size_t n, std::vector<Detection>& detections){
+    detections.clear();
+    memset(&stats_, 0, sizeof(stats_));
+    stats_.input_points = (uint32_t)n;
+    stats_.background_points = background_points_;
+    stats_.outside_points = outside_points_;
+    stats_.candidate_points = (uint32_t)candidates_.size();
+    if (candidates_.empty() || config_.voxel_size <= 0 || config_.clustering_distance <= 0){
+      return 0;
+    }
+    buildVoxels();
+    buildCells();
+    clusterVoxels();
+    return measureClusters(detections);
+  }
+
+  void buildVoxels(){
+    const size_t n = candidates_.size();
+    if (grid_.getVoxelSize() != config_.voxel_size || grid_.getCapacity() < n){
+      grid_ = VoxelHashGrid(config_.voxel_size, (uint32_t)std::max<size_t>(n, grid_.getCapacity()));
+    }
+    const Candidate* c = candidates_.data();
+    grid_.build(&c->x, &c->y, &c->z, sizeof(Candidate) / sizeof(float), &c->intensity, n);
+    for (size_t i = 0; i < n; i++){
+      candidates_[i].voxel = grid_.getPointVoxel(i);   // -1 for NaN only, the grid can hold every point
+    }
+    stats_.voxels = grid_.voxelCount();
+  }
+
+  void buildCells(){
+    // index the voxel centroids with cells of size clustering_distance
+    const uint32_t num = grid_.voxelCount();
+    if (num == 0){
+      cell_grid_.clear();
+      neighbor_begin_.assign(1, 0);
+      neighbor_cells_.clear();
+      return;
+    }
+    if (cell_grid_.getVoxelSize() != config_.clustering_distance || cell_grid_.getCapacity() < num){
+      cell_grid_ = VoxelHashGrid(config_.clustering_distance, std::max(num, cell_grid_.getCapacity()));
+    }
+    const VoxelCell* v = &grid_.getVoxel(0);
+    const uint32_t cells = cell_grid_.build(&v->x, &v->y, &v->z, sizeof(VoxelCell) / sizeof(float), nullptr, num);
+
+    // the 27 cells around every cell, looked up once for the three passes of clusterVoxels()
+    neighbor_begin_.resize(cells + 1);
+    neighbor_cells_.clear();
+    for (uint32_t k = 0; k < cells; k++){
+      neighbor_begin_[k] = (uint32_t)neighbor_cells_.size();
+      cell_grid_.forEachNeighbor(k, [&](uint32_t u){ neighbor_cells_.push_back(u); });
+    }
+    neighbor_begin_[cells] = (uint32_t)neighbor_cells_.size();
+  }
+
+  /**
+   * @brief Call f(neighbour) for every voxel within clustering_distance of voxel v, v included
+   */
+  template <typename Func>
+  void forEachNeighbor(uint32_t v, Func f) const{
+    const VoxelCell& a = grid_.getVoxel(v);
+    const float eps2 = config_.clustering_distance * config_.clustering_distance;
+    const uint32_t cell = (uint32_t)cell_grid_.getPointVoxel(v);
+    for (uint32_t k = neighbor_begin_[cell]; k < neighbor_begin_[cell + 1]; k++){
+      uint32_t count;
+      const uint32_t* voxels = cell_grid_.getVoxelPoints(neighbor_cells_[k], &count);
+      for (uint32_t j = 0; j < count; j++){
+        const VoxelCell& b = grid_.getVoxel(voxels[j]);
+        float ex = a.x - b.x, ey = a.y - b.y, ez = a.z - b.z;
+        if (ex * ex + ey * ey + ez * ez <= eps2){
+          f(voxels[j]);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Call func(begin, end, worker) over [0, n), on the pool for large clouds
+   */
+  template <typename Func>
+  void forRange(size_t n, Func func){
+    if (pool_ && candidates_.size() >= parallel_min_points_){
+      pool_->parallelFor(n, func);
+    }
+    else{
+      func(0, n, 0);
+    }
+  }
+
+  uint32_t workers() const{
+    return (pool_ && candidates_.size() >= parallel_min_points_) ? pool_->size() : 1;
+  }
+
+  uint32_t findRoot(uint32_t v){
+    while (parent_[v] != v){
+      parent_[v] = parent_[parent_[v]];
+      v = parent_[v];
+    }
+    return v;
+  }
+
+  void clusterVoxels(){
+    const uint32_t num = grid_.voxelCount();
+    core_.resize(num);
+    forRange(num, [&](size_t begin, size_t end, uint32_t){
+      for (size_t v = begin; v < end; v++){
+        uint32_t count = 0;
+        forEachNeighbor((uint32_t)v, [&](uint32_t u){ count += grid_.getVoxel(u).count; });
+        core_[v] = (count >= config_.min_neighbors);
+      }
+    });
+    for (uint32_t v = 0; v < num; v++){
+      stats_.core_voxels += core_[v];
+    }
+
+    const uint32_t NONE = 0xFFFFFFFF;
+    parent_.resize(num);
+    for (uint32_t v = 0; v < num; v++){
+      parent_[v] = core_[v] ? v : NONE;
+    }
+    for (uint32_t v = 0; v < num; v++){
+      if (core_[v]){
+        forEachNeighbor(v, [&](uint32_t u){
+          if (u < v && core_[u]){
+            uint32_t ru = findRoot(u), rv = findRoot(v);
+            if (ru != rv){
+              parent_[ru < rv ? rv : ru] = ru < rv ? ru : rv;
+            }
+          }
+        });
+      }
+    }
+    // border voxels join the cluster of their first core neighbour
+    for (uint32_t v = 0; v < num; v++){
+      if (!core_[v]){
+        uint32_t border = NONE;
+        forEachNeighbor(v, [&](uint32_t u){
+          if (border == NONE && core_[u]){
+            border = u;
+          }
+        });
+        parent_[v] = border;
+      }
+    }
+
+    // number the clusters in order of their first voxel
+    cluster_of_.assign(num, -1);
+    int32_t clusters = 0;
+    for (uint32_t v = 0; v < num; v++){
+      if (parent_[v] == NONE){
+        continue;
+      }
+      uint32_t root = findRoot(parent_[v]);
+      if (cluster_of_[root] < 0){
+        cluster_of_[root] = clusters++;
+      }
+      cluster_of_[v] = cluster_of_[root];
+    }
+    stats_.clusters = (uint32_t)clusters;
+  }
+
+  /**
+   * @brief Accumulate the statistics of the clusters over candidates [begin, end) into sums
+   */
+  void accumulate(size_t begin, size_t end, ClusterSums* sums){
+    for (size_t i = begin; i < end; i++){
+      const Candidate& c = candidates_[i];
+      int32_t k = c.voxel < 0 ? -1 : cluster_of_[c.voxel];
+      if (k < 0){
+        continue;
+      }
+      labels_[c.index] = k;
+      ClusterSums& s = sums[k];
+      const float q[3] = {c.x, c.y, c.z};
+      const double p[3] = {c.x, c.y, c.z};
+      for (int a = 0; a < 3; a++){
+        s.sum[a] += p[a];
+        s.min[a] = std::min(s.min[a], q[a]);
+        s.max[a] = std::max(s.max[a], q[a]);
+      }
+      s.sum2[0] += p[0] * p[0];
+      s.sum2[1] += p[0] * p[1];
+      s.sum2[2] += p[0] * p[2];
+      s.sum2[3] += p[1] * p[1];
+      s.sum2[4] += p[1] * p[2];
+      s.sum2[5] += p[2] * p[2];
+      s.intensity += c.intensity;
+      s.intensity2 += (double)c.intensity * c.intensity;
+      s.count++;
+    }
+  }
+
+  int measureClusters(std::vector<Detection>& detections){
+    // one pass over the labels, with partial sums per worker merged afterwards
+    const uint32_t clusters = stats_.clusters;
+    const uint32_t threads = workers();
+    ClusterSums empty;
+    memset(&empty, 0, sizeof(empty));
+    for (int a = 0; a < 3; a++){
+      empty.min[a] = INFINITY;
+      empty.max[a] = -INFINITY;
+    }
+    sums_.assign((size_t)clusters * threads, empty);
+    forRange(candidates_.size(), [&](size_t begin, size_t end, uint32_t worker){
+      accumulate(begin, end, sums_.data() + (size_t)worker * clusters);
+    });
+    for (uint32_t w = 1; w < threads; w++){
+      for (uint32_t k = 0; k < clusters; k++){
+        ClusterSums& s = sums_[k];
+        const ClusterSums& o = sums_[(size_t)w * clusters + k];
+        for (int a = 0; a < 3; a++){
+          s.sum[a] += o.sum[a];
+          s.min[a] = std::min(s.min[a], o.min[a]);
+          s.max[a] = std::max(s.max[a], o.max[a]);
+        }
+        for (int a = 0; a < 6; a++){
+          s.sum2[a] += o.sum2[a];
+        }
+        s.intensity += o.intensity;
+        s.intensity2 += o.intensity2;
+        s.count += o.count;
+      }
+    }
+
+    int drones = 0;
+    detections.clear();
+    for (uint32_t k = 0; k < clusters; k++){
+      const ClusterSums& s = sums_[k];
+      if (s.count < config_.min_points_per_cluster || s.count == 0){
+        continue;
+      }
+      Detection d;
+      memset(&d, 0, sizeof(d));
+      const double n = (double)s.count;
+      double mean[3];
+      for (int a = 0; a < 3; a++){
+        mean[a] = s.sum[a] / n;
+        d.center[a] = (float)mean[a];
+        d.min_bound[a] = s.min[a];
+        d.max_bound[a] = s.max[a];
+        d.size[a] = s.max[a] - s.min[a];
+      }
+      const double cov[6] = {
+        s.sum2[0] / n - mean[0] * mean[0], s.sum2[1] / n - mean[0] * mean[1], s.sum2[2] / n - mean[0] * mean[2],
+        s.sum2[3] / n - mean[1] * mean[1], s.sum2[4] / n - mean[1] * mean[2], s.sum2[5] / n - mean[2] * mean[2]};
+      double values[3], vectors[3][3];
+      detail::symmetricEigen3(cov, values, vectors);
+      for (int a = 0; a < 3; a++){
+        d.principal_sigma[a] = (float)sqrt(std::max(values[a], 0.0));
+        d.principal_axis[a] = (float)vectors[0][a];
+      }
+      d.point_count = s.count;
+      d.label = (int32_t)k;
+      d.mean_intensity = (float)(s.intensity / n);
+      d.intensity_variance = (float)std::max(s.intensity2 / n - (s.intensity / n) * (s.intensity / n), 0.0);
+      d.distance = sqrtf(d.center[0] * d.center[0] + d.center[1] * d.center[1]);
+      d.confidence = confidence(d);
+      d.is_drone = isDrone(d);
+      drones += d.is_drone;
+      detections.push_back(d);
+    }
+    stats_.drones = (uint32_t)drones;
+    return drones;
+  }
+
+  bool isDrone(const Detection& d) const{
+    const DetectionConfig& c = config_;
+    return d.size[0] >= c.drone_size_min && d.size[0] <= c.drone_size_max_xy
+           && d.size[1] >= c.drone_size_min && d.size[1] <= c.drone_size_max_xy
+           && d.size[2] >= c.drone_size_min && d.size[2] <= c.drone_size_max_z
+           && d.distance >= c.distance_min && (c.distance_max <= 0 || d.distance <= c.distance_max)
+           && d.center[2] >= c.min_height
+           && (c.max_points_per_cluster == 0 || d.point_count <= c.max_points_per_cluster);
+  }
+
+  /**
+   * @brief Same score as SimpleDroneDetector.calculate_confidence() of the catcher
+   */
+  static float confidence(const Detection& d){
+    float points = std::min(d.point_count / 20.0f, 1.0f);
+    float aspect = std::max(d.size[0], d.size[1]) / (std::min(d.size[0], d.size[1]) + 0.01f);
+    float shape = std::max(0.0f, 1.0f - fabsf(aspect - 1.0f));
+    return (points + shape) / 2;
+  }
+
+  DetectionConfig config_;
+  DetectionStats stats_;
+  const BackgroundModel* background_ = nullptr;
+  uint32_t background_points_ = 0;
+  std::vector<RegionOfInterest> rois_;
+  uint32_t outside_points_ = 0;
+  ThreadPool* pool_ = nullptr;
+  size_t parallel_min_points_ = 20000;
+
+  std::vector<Candidate> candidates_;
+  VoxelHashGrid grid_;          // voxels of voxel_size
+  VoxelHashGrid cell_grid_;     // voxel centroids in cells of clustering_distance
+  std::vector<uint32_t> neighbor_begin_;
+  std::vector<uint32_t> neighbor_cells_;
+  std::vector<uint8_t> core_;
+  std::vector<ClusterSums> sums_;
+  std::vector<uint32_t> parent_;
+  std::vector<int32_t> cluster_of_;
+  std::vector<int32_t> labels_;
+};
+
+} // end of namespace unitree_lidar_sdk
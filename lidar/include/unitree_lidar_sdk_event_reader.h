@@ -0,0 +1,1055 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_serial.h"
+#include "unitree_lidar_sdk_buffer_pool.h"
+#include "unitree_lidar_sdk_clock_sync.h"
+#include "unitree_lidar_sdk_frame_decoder.h"
+#include "unitree_lidar_sdk_link.h"
+#include "unitree_lidar_sdk_range_image.h"
+#include "unitree_lidar_sdk_scan_filter.h"
+#include "unitree_lidar_sdk_scan_kernel.h"
+#include "unitree_lidar_sdk_stats.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Get the system timestamp in seconds.
+ * @note Header-only counterpart of get_system_timestamp(), so this reader does not need the prebuilt library.
+ */
+inline double get_host_timestamp(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/**
+ * @brief Event-driven Unitree Lidar Reader
+ *
+ * Decodes the MavLink stream of the serial port itself with a MavlinkFrameDecoder, so that the
+ * caller can sleep in poll() until bytes arrive instead of calling runParse() at 1500Hz.
+ * Messages can be consumed
+ *  - by calling waitForMessage() in the caller's own loop, or
+ *  - by registering a callback with setMessageCallback() and calling start(), which runs the
+ *    wait loop on a dedicated thread.
+ * The returned MessageType values have the same meaning as the ones of runParse().
+ *
+ * getStats() reports counters and per-stage latency percentiles of the parsing, updated with
+ * relaxed atomics so that any thread can read them while the reader runs.
+ *
+ * Clouds and IMU messages are stamped in host time through a ClockSync per stream: the lidar time
+ * of the auxiliary packets and the packet_id of the IMU messages are fitted against the host time
+ * of the reads that delivered them, so that stamps follow the lidar clock instead of the jitter of
+ * the serial port and of the parsing. Until a fit is available, and with setClockSyncEnabled(false),
+ * messages are stamped with the host time of their read.
+ *
+ * Clouds are cached in buffers of a BufferPool. getCloudHandle() hands the latest cloud over
+ * without copying; the reader then keeps filling another free buffer.
+ * With setCloudLayout() the reader can also, or only, fill PointCloudUnitreeSoA clouds, and
+ * with setRangeImageEnabled() it also lays every cloud out as a RangeImage.
+ *
+ * The link to the lidar is supervised by a LinkSupervisor while parsing: the VERSION request is
+ * sent once and only repeated on timeout, getLinkState() turns STREAMING on the first range
+ * packet, so callers wait for it with waitForLinkState() instead of fixed sleeps, and a serial
+ * port that fails, e.g. a replugged /dev/ttyUSB*, is reopened without losing the clock sync,
+ * the counters or the buffers. See setConnectionConfig().
+ */
+class UnitreeLidarEventReader : public UnitreeLidarReader{
+
+public:
+
+  /**
+   * @brief Layouts of the clouds cached by the reader
+   */
+  enum CloudLayout{
+    CLOUD_AOS = 1,          // PointCloudUnitree, returned by getCloud() and getCloudHandle()
+    CLOUD_SOA = 2,          // PointCloudUnitreeSoA, returned by getCloudSoAHandle()
+    CLOUD_AOS_AND_SOA = 3
+  };
+
+  /**
+   * @brief Callback invoked on the reader thread for every message other than NONE.
+   * @note getCloud() and getIMU() are safe to call from inside the callback.
+   */
+  typedef std::function<void(MessageType)> MessageCallback;
+
+  /**
+   * @brief Callback invoked with every chunk of bytes read from the serial port, before parsing
+   */
+  typedef std::function<void(const uint8_t* data, size_t size)> RawDataCallback;
+
+  /**
+   * @brief Callback invoked on the parsing thread whenever the link state changes
+   */
+  typedef std::function<void(LinkState)> LinkStateCallback;
+
+  UnitreeLidarEventReader(){
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    memset(&aux_, 0, sizeof(aux_));
+    memset(&imu_, 0, sizeof(imu_));
+    empty_cloud_.stamp = 0;
+    empty_cloud_.id = 0;
+    empty_cloud_.ringNum = 1;
+    cloud_building_ = acquireCloud();
+    cloud_soa_building_ = acquireCloudSoA();
+    range_image_building_ = acquireRangeImage();
+  }
+
+  virtual ~UnitreeLidarEventReader(){
+    stop();
+    if (wake_fd_ >= 0){
+      ::close(wake_fd_);
+    }
+  }
+
+  virtual int initialize(
+      uint16_t cloud_scan_num = 18,
+      std::string port = "/dev/ttyUSB0",
+      uint32_t baudrate = 2000000,
+      float rotate_yaw_bias = 0,
+      float range_scale = 0.001,
+      float range_bias = 0,
+      float range_max = 50,
+      float range_min = 0
+  ){
+    cloud_scan_num_ = cloud_scan_num > 0 ? cloud_scan_num : 1;
+    port_ = port;
+    baudrate_ = baudrate;
+    rotate_yaw_bias_ = rotate_yaw_bias;
+    range_scale_ = range_scale;
+    range_bias_ = range_bias;
+    range_max_ = range_max;
+    range_min_ = range_min;
+    ScanConvertConfig config = {rotate_yaw_bias, range_scale, range_bias, range_max, range_min};
+    converter_.setConfig(config);
+
+    if (source_ == &serial_ ? serial_.open(port_, baudrate_) != 0 : !source_->isOpen()){
+      link_.onError(detail::statsNowNs());
+      publishLinkState();
+      return -1;
+    }
+
+    cloud_building_->points.reserve(cloud_scan_num_ * POINTS_NUM_OF_SCAN);
+    if (cloud_layout_ & CLOUD_SOA){
+      cloud_soa_building_->reserve(cloud_scan_num_ * POINTS_NUM_OF_SCAN);
+    }
+    if (range_image_enabled_){
+      range_image_building_->reserve(cloud_scan_num_);
+    }
+    resetParser();
+
+    openLink(detail::statsNowNs());
+    return 0;
+  }
+
+  /**
+   * @brief Parse the bytes already received by the serial port until one message is complete.
+   * @note Never blocks. Returns NONE as soon as the input is exhausted.
+   */
+  virtual MessageType runParse(){
+    superviseLink();
+    MavlinkFrameView frame;
+    bool found;
+    while (true){
+      while (read_pos_ < read_len_){
+        read_pos_ += decoder_.decodeNext(read_buf_ + read_pos_, read_len_ - read_pos_, &frame, &found);
+        if (!found){
+          break;
+        }
+        MessageType result = handleFrame(frame);
+        if (result != NONE){
+          updateDecoderStats();
+          stats_.stage(STAGE_PARSE).recordSince(read_ns_);
+          return result;
+        }
+      }
+      updateDecoderStats();
+
+      // keep the incomplete tail and append the next read behind it
+      if (read_pos_ > 0){
+        memmove(read_buf_, read_buf_ + read_pos_, read_len_ - read_pos_);
+        read_len_ -= read_pos_;
+        read_pos_ = 0;
+      }
+      uint64_t start = detail::statsNowNs();
+      int n = source_->read(read_buf_ + read_len_, sizeof(read_buf_) - read_len_);
+      if (n <= 0){
+        if (n < 0){
+          loseLink();
+        }
+        return NONE;
+      }
+      read_ns_ = detail::statsNowNs();
+      read_stamp_ = get_host_timestamp();
+      stats_.stage(STAGE_READ).record(read_ns_ - start);
+      stats_.add(ReaderStatsCollector::READS);
+      stats_.add(ReaderStatsCollector::BYTES_READ, n);
+      if (raw_callback_){
+        raw_callback_(read_buf_ + read_len_, n);
+      }
+      read_len_ += n;
+    }
+  }
+
+  /**
+   * @brief Sleep until the next message is parsed
+   * @note The sleep is cut by the timeouts of the link supervision, which are handled internally,
+   *  and a disconnected source is reopened while waiting when auto_reconnect is set.
+   * @param timeout_ms timeout in milliseconds, a negative value waits forever
+   * @return the parsed message type, or NONE on timeout, on stop(), on serial errors and when
+   *  the link state changes
+   */
+  MessageType waitForMessage(int timeout_ms = -1){
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    uint64_t link_changes = link_changes_;
+    while (true){
+      MessageType result = runParse();
+      if (result != NONE){
+        return result;
+      }
+      if (link_changes_ != link_changes){
+        return NONE;
+      }
+
+      int wait_ms = -1;
+      if (timeout_ms >= 0){
+        auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (remain <= 0){
+          return NONE;
+        }
+        wait_ms = (int)remain;
+      }
+
+      // wake up for the next timeout of the link supervision too
+      int link_ms = link_.timeoutMs(detail::statsNowNs());
+      bool link_due = link_ms >= 0 && (wait_ms < 0 || link_ms < wait_ms);
+      if (link_due){
+        wait_ms = link_ms;
+      }
+
+      int ready;
+      if (link_.getState() == LINK_DISCONNECTED){
+        // nothing to wait on until the source is reopened
+        if (!link_.getConfig().auto_reconnect || waitWakeFd(wait_ms)){
+          return NONE;
+        }
+        ready = 0;
+      }
+      else{
+        ready = source_->waitReadable(wait_ms, wake_fd_);
+      }
+      if (ready < 0){
+        loseLink();
+        if (!link_.getConfig().auto_reconnect){
+          return NONE;
+        }
+      }
+      else if (ready == 0 && (!link_due || link_.timeoutMs(detail::statsNowNs()) > 0)){
+        // timeout or stop(), not a timeout of the link
+        return NONE;
+      }
+    }
+  }
+
+  /**
+   * @brief Parse until the link reaches a state, e.g. STREAMING after setLidarWorkingMode(NORMAL)
+   * @note Call it from the parsing thread, e.g. between initialize() and the message loop; the
+   *  messages parsed meanwhile are only kept as the latest cloud, IMU and version. With start()
+   *  or a LidarPipeline, use getLinkState() or setLinkStateCallback() instead.
+   * @param timeout_ms timeout in milliseconds, a negative value waits forever
+   * @return true if the state was reached, false on timeout
+   */
+  bool waitForLinkState(LinkState state, int timeout_ms = -1){
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (getLinkState() != state){
+      int wait_ms = -1;
+      if (timeout_ms >= 0){
+        auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (remain <= 0){
+          return false;
+        }
+        wait_ms = (int)remain;
+      }
+      waitForMessage(wait_ms);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Set the callback used by the thread started with start()
+   */
+  void setMessageCallback(MessageCallback callback){
+    callback_ = callback;
+  }
+
+  /**
+   * @brief Set a callback receiving the raw serial stream, e.g. to record it with a LogRecorder
+   * @note Called from runParse(), on the thread parsing the messages.
+   */
+  void setRawDataCallback(RawDataCallback callback){
+    raw_callback_ = callback;
+  }
+
+  /**
+   * @brief Start a dedicated thread that waits for messages and delivers them to the callback
+   * @return Return false if the thread is already running or the serial port is not opened.
+   */
+  bool start(){
+    if (running_ || !source_->isOpen()){
+      return false;
+    }
+    running_ = true;
+    thread_ = std::thread([this](){
+      while (running_){
+        MessageType result = waitForMessage(-1);
+        if (result != NONE && callback_){
+          uint64_t start = detail::statsNowNs();
+          callback_(result);
+          stats_.stage(STAGE_CALLBACK).recordSince(start);
+        }
+        else if (result == NONE && running_ && !link_.getConfig().auto_reconnect && source_->waitReadable(0) < 0){
+          // serial port broken: avoid a hot loop on a dead descriptor
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+      }
+    });
+    return true;
+  }
+
+  /**
+   * @brief Stop the thread started with start(), and interrupt a pending waitForMessage()
+   */
+  void stop(){
+    running_ = false;
+    if (wake_fd_ >= 0){
+      uint64_t one = 1;
+      ssize_t ret = ::write(wake_fd_, &one, sizeof(one));
+      (void)ret;
+    }
+    if (thread_.joinable()){
+      thread_.join();
+    }
+    if (wake_fd_ >= 0){
+      uint64_t count;
+      while (::read(wake_fd_, &count, sizeof(count)) > 0){}
+    }
+  }
+
+  /**
+   * @brief Counters of the MavLink frame decoder
+   */
+  const MavlinkDecoderStats& getDecoderStats() const{
+    return decoder_.getStats();
+  }
+
+  /**
+   * @brief Snapshot of the counters and stage latencies since the last reset
+   * @note Safe to call from any thread; counters of one snapshot may be a few messages apart.
+   */
+  ReaderStats getStats() const{
+    ReaderStats stats;
+    stats_.snapshot(&stats);
+    return stats;
+  }
+
+  /**
+   * @brief Clear the counters and the latency histograms
+   * @note The frame decoder counters restart too; call it from the parsing thread.
+   */
+  void resetStats(){
+    decoder_.resetStats();
+    stats_.reset();
+  }
+
+  /**
+   * @brief Clear the latency histograms only, e.g. after each periodic dump; safe from any thread
+   */
+  void resetLatencyStats(){
+    stats_.resetLatencies();
+  }
+
+  /**
+   * @brief Stamp messages through the clock sync estimators (the default), or with the read time only
+   */
+  void setClockSyncEnabled(bool enabled){
+    clock_sync_enabled_ = enabled;
+  }
+
+  bool isClockSyncEnabled() const{
+    return clock_sync_enabled_;
+  }
+
+  /**
+   * @brief Mapping of the lidar time of the auxiliary packets to the host time, used for the clouds
+   * @note Call it from the parsing thread, e.g. inside the message callback.
+   */
+  ClockSyncState getClockSyncState() const{
+    return lidar_sync_.getState();
+  }
+
+  /**
+   * @brief Mapping of the unwrapped packet_id of the IMU messages to the host time
+   * @note Call it from the parsing thread, e.g. inside the message callback.
+   */
+  ClockSyncState getIMUClockSyncState() const{
+    return imu_sync_.getState();
+  }
+
+  /**
+   * @brief Host time of a lidar time, e.g. time_stamp_s_step + time_stamp_us_step * 1e-6 of an
+   *  auxiliary packet; only meaningful once getClockSyncState().valid is true
+   */
+  double lidarTimeToHost(double lidar_time) const{
+    return lidar_sync_.toHost(lidar_time);
+  }
+
+  /**
+   * @brief Descriptor of the serial port, to be used in an external epoll loop
+   */
+  int getSerialFd() const{
+    return source_->fd();
+  }
+
+  /**
+   * @brief Read another byte source than the serial port, e.g. a recorded stream
+   * @note Call before initialize(), which then expects the source to be opened; nullptr
+   *  restores the serial port. The source must outlive the reader.
+   */
+  void setByteSource(ByteSource* source){
+    source_ = source ? source : &serial_;
+  }
+
+  /**
+   * @brief Set the timeouts and the reconnection of the link supervision
+   * @note Call it before initialize() or start().
+   */
+  void setConnectionConfig(const ConnectionConfig& config){
+    link_.setConfig(config);
+  }
+
+  const ConnectionConfig& getConnectionConfig() const{
+    return link_.getConfig();
+  }
+
+  /**
+   * @brief State of the link to the lidar; safe to call from any thread
+   */
+  LinkState getLinkState() const{
+    return (LinkState)link_state_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Milliseconds until runParse() has a timeout of the link supervision to handle, -1 if none
+   * @note For callers sleeping on getSerialFd() in their own poll loop; call it from the parsing thread.
+   */
+  int getLinkTimeoutMs() const{
+    return link_.timeoutMs(detail::statsNowNs());
+  }
+
+  /**
+   * @brief Set a callback invoked on the parsing thread whenever the link state changes
+   */
+  void setLinkStateCallback(LinkStateCallback callback){
+    link_callback_ = callback;
+  }
+
+  /**
+   * @note Safe to call from any thread; the parser is reset on the parsing thread, before the
+   *  next message is parsed.
+   */
+  virtual void reset(){
+    sendCommand(CMD_LIDAR_REBOOT);
+    reset_requested_.store(true, std::memory_order_release);
+  }
+
+  /**
+   * @note The reference stays valid until the second POINTCLOUD after this one;
+   *  use getCloudHandle() to keep a cloud longer or on another thread.
+   */
+  virtual const PointCloudUnitree& getCloud() const{
+    return cloud_ ? *cloud_ : empty_cloud_;
+  }
+
+  /**
+   * @brief Take a reference on the latest cloud without copying it
+   * @note Call it from the thread that parses (e.g. inside the message callback); the handle
+   *  itself can then be moved to any thread. The buffer goes back to the pool when the last
+   *  handle is released. The cloud must not be modified.
+   * @return an empty handle before the first POINTCLOUD
+   */
+  PoolHandle<PointCloudUnitree> getCloudHandle() const{
+    return cloud_;
+  }
+
+  /**
+   * @brief Take a reference on the latest SoA cloud, with the same rules as getCloudHandle()
+   * @return an empty handle unless CLOUD_SOA is part of the cloud layout
+   */
+  PoolHandle<PointCloudUnitreeSoA> getCloudSoAHandle() const{
+    return cloud_soa_;
+  }
+
+  /**
+   * @brief Choose which cloud layouts are filled; the default is CLOUD_AOS
+   */
+  void setCloudLayout(CloudLayout layout){
+    cloud_layout_ = layout;
+    scan_count_ = 0;
+  }
+
+  CloudLayout getCloudLayout() const{
+    return cloud_layout_;
+  }
+
+  /**
+   * @brief Also lay every cloud out as a RangeImage, one column per scan; disabled by default
+   */
+  void setRangeImageEnabled(bool enabled){
+    range_image_enabled_ = enabled;
+    scan_count_ = 0;
+  }
+
+  bool isRangeImageEnabled() const{
+    return range_image_enabled_;
+  }
+
+  /**
+   * @brief Filter the points of every scan before they join a cloud; disabled by default
+   * @note Call it from the parsing thread, or before start().
+   */
+  void setScanFilterConfig(const ScanFilterConfig& config){
+    scan_filter_.setConfig(config);
+    scan_filter_.reset();
+  }
+
+  const ScanFilterConfig& getScanFilterConfig() const{
+    return scan_filter_.getConfig();
+  }
+
+  /**
+   * @brief Take a reference on the range image of the latest cloud, with the same rules as getCloudHandle()
+   * @return an empty handle unless the range image is enabled
+   */
+  PoolHandle<RangeImage> getRangeImageHandle() const{
+    return range_image_;
+  }
+
+  virtual const IMUUnitree& getIMU() const{
+    return imu_;
+  }
+
+  virtual std::string getVersionOfFirmware() const{
+    return version_firmware_;
+  }
+
+  virtual std::string getVersionOfSDK() const{
+    return unitree_lidar_sdk_VERSION;
+  }
+
+  virtual uint32_t getTimeDelay() const{
+    return time_delay_;
+  }
+
+  /**
+   * @note Reports the dirt index carried by the latest auxiliary packet, computed by the lidar;
+   *  the points removed by the scan filter of the SDK are counted in getStats().
+   */
+  virtual float getDirtyPercentage() const{
+    return dirty_percentage_;
+  }
+
+  /**
+   * @note Safe to call from any thread; the link state follows on the parsing thread.
+   */
+  virtual void setLidarWorkingMode(LidarWorkingMode mode){
+    sendWorkingMode(mode);
+    requested_mode_.store((int)mode, std::memory_order_release);
+  }
+
+  virtual void setLEDDisplayMode(uint8_t led_table[45]){
+    mavlink_message_t msg;
+    mavlink_msg_config_led_ring_table_packet_pack(0, 0, &msg, 0, 0, 0, LED_RING_COMMAND_MODE, led_table);
+    sendMessage(msg);
+  }
+
+  virtual void setLEDDisplayMode(LEDDisplayMode mode){
+    uint8_t led_table[45] = {0};
+    mavlink_message_t msg;
+    mavlink_msg_config_led_ring_table_packet_pack(0, 0, &msg, 0, 0, 0, (uint8_t)mode, led_table);
+    sendMessage(msg);
+  }
+
+  virtual void printConfig(){
+    printf("UnitreeLidarEventReader configuration:\n");
+    printf("\tcloud_scan_num = %d\n", cloud_scan_num_);
+    printf("\tport = %s\n", port_.c_str());
+    printf("\tbaudrate = %d\n", baudrate_);
+    printf("\trotate_yaw_bias = %f\n", rotate_yaw_bias_);
+    printf("\trange_scale = %f\n", range_scale_);
+    printf("\trange_bias = %f\n", range_bias_);
+    printf("\trange_max = %f\n", range_max_);
+    printf("\trange_min = %f\n", range_min_);
+  }
+
+protected:
+
+  /**
+   * @brief Host time at which the bytes being parsed were received
+   * @note Observed by the clock sync estimators, and given to the messages until they are valid.
+   */
+  virtual double messageStamp() const{
+    return read_stamp_;
+  }
+
+  /**
+   * @brief Dispatch one complete MavLink frame
+   */
+  MessageType handleFrame(const MavlinkFrameView& frame){
+    MessageType type = NONE;
+    dispatchSysMavlink(frame, [this, &type](const auto& packet){ type = handlePacket(packet); });
+    return type;
+  }
+
+  MessageType handlePacket(const mavlink_ret_imu_attitude_data_packet_t& packet){
+    imu_.stamp = imuStamp(packet.packet_id);
+    stats_.add(ReaderStatsCollector::IMU_MESSAGES);
+    imu_.id = packet.packet_id;
+    memcpy(imu_.quaternion, packet.quaternion, sizeof(imu_.quaternion));
+    memcpy(imu_.angular_velocity, packet.angular_velocity, sizeof(imu_.angular_velocity));
+    memcpy(imu_.linear_acceleration, packet.linear_acceleration, sizeof(imu_.linear_acceleration));
+    return IMU;
+  }
+
+  MessageType handlePacket(const mavlink_ret_lidar_auxiliary_data_packet_t& packet){
+    aux_ = packet;
+    aux_valid_ = true;
+    if (clock_sync_enabled_){
+      lidar_sync_.addObservation(aux_.time_stamp_s_step + aux_.time_stamp_us_step * 1e-6, messageStamp());
+    }
+    time_delay_ = aux_.lidar_sync_delay_time;
+    dirty_percentage_ = aux_.dirty_index;
+    return AUXILIARY;
+  }
+
+  MessageType handlePacket(const mavlink_ret_lidar_distance_data_packet_t& packet){
+    if (link_.onRange(read_ns_)){
+      publishLinkState();
+    }
+    if (countDroppedPackets(packet.packet_id) > 0){
+      scan_filter_.reset();
+    }
+    if (!aux_valid_ || aux_.packet_id != packet.packet_id){
+      stats_.add(ReaderStatsCollector::UNMATCHED_PACKETS);
+      return RANGE;
+    }
+    return appendScan(packet) ? POINTCLOUD : RANGE;
+  }
+
+  MessageType handlePacket(const mavlink_ret_lidar_version_t& packet){
+    version_firmware_.assign((const char*)packet.sys_soft_version,
+        strnlen((const char*)packet.sys_soft_version, sizeof(packet.sys_soft_version)));
+    link_.onVersion();
+    return VERSION;
+  }
+
+  MessageType handlePacket(const mavlink_ret_lidar_time_sync_data_t&){
+    return TIMESYNC;
+  }
+
+  /**
+   * @brief Messages sent to the lidar, never received from it
+   */
+  template <typename Packet>
+  MessageType handlePacket(const Packet&){
+    return NONE;
+  }
+
+  /**
+   * @brief Convert a matched range packet into points and append them to the cloud being cached
+   * @return Return true if the cached cloud is complete and has been published.
+   */
+  bool appendScan(const mavlink_ret_lidar_distance_data_packet_t& range){
+    double lidar_time = aux_.time_stamp_s_step + aux_.time_stamp_us_step * 1e-6;
+    uint64_t start = detail::statsNowNs();
+    if (scan_count_ == 0){
+      cloud_start_ns_ = start;
+      double stamp = (clock_sync_enabled_ && lidar_sync_.valid()) ? lidar_sync_.toHost(lidar_time) : messageStamp();
+      cloud_building_->stamp = stamp;
+      cloud_building_->points.clear();
+      cloud_soa_building_->stamp = stamp;
+      cloud_soa_building_->clear();
+      range_image_building_->stamp = stamp;
+      range_image_building_->clear();
+      cloud_first_lidar_time_ = lidar_time;
+    }
+    double packet_dt = lidar_time - last_lidar_time_;
+    if (packet_dt > 0 && packet_dt < 0.01){
+      point_dt_ = packet_dt / POINTS_NUM_OF_SCAN;
+    }
+    last_lidar_time_ = lidar_time;
+
+    float time_start = (float)(lidar_time - cloud_first_lidar_time_);
+    converter_.computeLanes(aux_, range.point_data, &lanes_, time_start, (float)point_dt_);
+    if (scan_filter_.isEnabled()){
+      ScanFilterCounts filtered = scan_filter_.apply(lanes_);
+      stats_.add(ReaderStatsCollector::FILTERED_INTENSITY, filtered.intensity);
+      stats_.add(ReaderStatsCollector::FILTERED_DUST, filtered.dust);
+      stats_.add(ReaderStatsCollector::FILTERED_ISOLATED, filtered.isolated);
+    }
+
+    if (cloud_layout_ & CLOUD_AOS){
+      std::vector<PointUnitree>& points = cloud_building_->points;
+      size_t size = points.size();
+      points.resize(size + POINTS_NUM_OF_SCAN);
+      points.resize(size + ScanConverter::compactLanes(lanes_, &points[size]));
+    }
+    if (cloud_layout_ & CLOUD_SOA){
+      ScanConverter::compactLanes(lanes_, *cloud_soa_building_);
+    }
+    if (range_image_enabled_){
+      range_image_building_->appendScan(aux_, lanes_, rotate_yaw_bias_);
+    }
+    stats_.stage(STAGE_CONVERT).recordSince(start);
+    stats_.add(ReaderStatsCollector::SCANS);
+
+    if (++scan_count_ < cloud_scan_num_){
+      return false;
+    }
+    scan_count_ = 0;
+    ++cloud_id_;
+
+    // if every buffer is held by consumers, the cloud is dropped and the same buffer refilled
+    bool published = false;
+    if (cloud_layout_ & CLOUD_AOS){
+      PoolHandle<PointCloudUnitree> next = acquireCloud();
+      if (next){
+        cloud_building_->id = cloud_id_;
+        cloud_ = std::move(cloud_building_);
+        cloud_building_ = std::move(next);
+        published = true;
+      }
+    }
+    if (cloud_layout_ & CLOUD_SOA){
+      PoolHandle<PointCloudUnitreeSoA> next = acquireCloudSoA();
+      if (next){
+        cloud_soa_building_->id = cloud_id_;
+        cloud_soa_ = std::move(cloud_soa_building_);
+        cloud_soa_building_ = std::move(next);
+        published = true;
+      }
+    }
+    if (range_image_enabled_){
+      PoolHandle<RangeImage> next = acquireRangeImage();
+      if (next){
+        range_image_building_->id = cloud_id_;
+        range_image_ = std::move(range_image_building_);
+        range_image_building_ = std::move(next);
+        published = true;
+      }
+    }
+    if (published){
+      stats_.add(ReaderStatsCollector::CLOUDS);
+      stats_.stage(STAGE_CLOUD).recordSince(cloud_start_ns_);
+    }
+    else{
+      stats_.add(ReaderStatsCollector::DROPPED_CLOUDS);
+    }
+    return published;
+  }
+
+  /**
+   * @brief Count the range packets missing between the previous packet_id and this one
+   * @note A packet_id going backwards or jumping by half the id range restarts the sequence.
+   * @return the number of missing packets, 1 when the sequence restarts
+   */
+  uint32_t countDroppedPackets(uint16_t packet_id){
+    uint32_t missing = 1;
+    if (packet_id_valid_){
+      uint16_t gap = (uint16_t)(packet_id - last_packet_id_ - 1);
+      if (gap < 0x8000){
+        stats_.add(ReaderStatsCollector::DROPPED_PACKETS, gap);
+        missing = gap;
+      }
+    }
+    last_packet_id_ = packet_id;
+    packet_id_valid_ = true;
+    return missing;
+  }
+
+  /**
+   * @brief Stamp of an IMU message: its packet_id is unwrapped into a counter fitted against the host time
+   */
+  double imuStamp(uint16_t packet_id){
+    if (!clock_sync_enabled_){
+      return messageStamp();
+    }
+    if (imu_count_valid_){
+      uint16_t delta = (uint16_t)(packet_id - last_imu_id_);
+      imu_count_ += delta < 0x8000 ? delta : -(int64_t)(uint16_t)-delta;
+    }
+    else{
+      imu_count_ = packet_id;
+      imu_count_valid_ = true;
+    }
+    last_imu_id_ = packet_id;
+    imu_sync_.addObservation((double)imu_count_, messageStamp());
+    return imu_sync_.valid() ? imu_sync_.toHost((double)imu_count_) : messageStamp();
+  }
+
+  void updateDecoderStats(){
+    const MavlinkDecoderStats& decoder = decoder_.getStats();
+    stats_.set(ReaderStatsCollector::FRAMES, decoder.frames);
+    stats_.set(ReaderStatsCollector::CRC_ERRORS, decoder.crc_errors);
+    stats_.set(ReaderStatsCollector::SKIPPED_BYTES, decoder.skipped_bytes);
+  }
+
+  /**
+   * @brief Get a free cloud buffer; only the first use of a buffer allocates its points
+   */
+  PoolHandle<PointCloudUnitree> acquireCloud(){
+    PoolHandle<PointCloudUnitree> cloud = cloud_pool_.acquire();
+    if (cloud){
+      cloud->ringNum = 1;
+      cloud->points.reserve(cloud_scan_num_ * POINTS_NUM_OF_SCAN);
+    }
+    return cloud;
+  }
+
+  PoolHandle<PointCloudUnitreeSoA> acquireCloudSoA(){
+    PoolHandle<PointCloudUnitreeSoA> cloud = cloud_soa_pool_.acquire();
+    if (cloud){
+      cloud->ringNum = 1;
+      if (cloud_layout_ & CLOUD_SOA){
+        cloud->reserve(cloud_scan_num_ * POINTS_NUM_OF_SCAN);
+      }
+    }
+    return cloud;
+  }
+
+  PoolHandle<RangeImage> acquireRangeImage(){
+    PoolHandle<RangeImage> image = range_image_pool_.acquire();
+    if (image && range_image_enabled_){
+      image->reserve(cloud_scan_num_);
+    }
+    return image;
+  }
+
+  void resetParser(){
+    read_pos_ = read_len_ = 0;
+    aux_valid_ = false;
+    scan_count_ = 0;
+    last_lidar_time_ = 0;
+    packet_id_valid_ = false;
+    imu_count_valid_ = false;
+  }
+
+  /**
+   * @brief The source has just been opened: ask the lidar its version, and the working mode requested last
+   */
+  void openLink(uint64_t now){
+    read_pos_ = read_len_ = 0;
+    link_.onOpened(now);
+    sendRequest(CMD_LIDAR_VERSION);
+    if (link_.getRequestedMode() != 0){
+      sendWorkingMode((LidarWorkingMode)link_.getRequestedMode());
+    }
+    publishLinkState();
+  }
+
+  /**
+   * @brief The source failed: drop the partial frame and cloud, keep everything else for the reconnection
+   */
+  void loseLink(){
+    if (link_.getState() == LINK_DISCONNECTED){
+      return;
+    }
+    link_.onError(detail::statsNowNs());
+    read_pos_ = read_len_ = 0;
+    aux_valid_ = false;
+    scan_count_ = 0;
+    publishLinkState();
+  }
+
+  /**
+   * @brief Apply the requested working mode and the due actions of the link supervisor
+   */
+  void superviseLink(){
+    uint64_t now = detail::statsNowNs();
+    if (reset_requested_.load(std::memory_order_relaxed) && reset_requested_.exchange(false, std::memory_order_acquire)){
+      resetParser();
+    }
+    if (requested_mode_.load(std::memory_order_relaxed) != 0){
+      link_.onModeRequested((LidarWorkingMode)requested_mode_.exchange(0, std::memory_order_acquire), now);
+    }
+    LinkState before = link_.getState();
+    int actions = link_.poll(now);
+    if (before == LINK_STREAMING && link_.getState() == LINK_WAITING){
+      stats_.add(ReaderStatsCollector::STALLS);
+    }
+    if ((actions & LINK_ACTION_REOPEN) && source_->reopen() == 0){
+      stats_.add(ReaderStatsCollector::RECONNECTS);
+      openLink(now);
+    }
+    if (actions & LINK_ACTION_REQUEST_VERSION){
+      sendRequest(CMD_LIDAR_VERSION);
+    }
+    if (actions & LINK_ACTION_SEND_MODE){
+      sendWorkingMode((LidarWorkingMode)link_.getRequestedMode());
+    }
+    publishLinkState();
+  }
+
+  void publishLinkState(){
+    LinkState state = link_.getState();
+    if ((int)state == link_state_.load(std::memory_order_relaxed)){
+      return;
+    }
+    link_state_.store(state, std::memory_order_release);
+    link_changes_++;
+    if (link_callback_){
+      link_callback_(state);
+    }
+  }
+
+  /**
+   * @brief Sleep on the wake descriptor only, while the source is closed
+   * @return true if woken up by stop()
+   */
+  bool waitWakeFd(int timeout_ms){
+    if (wake_fd_ < 0){
+      if (timeout_ms > 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+      }
+      return false;
+    }
+    struct pollfd pfd = {wake_fd_, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) > 0;
+  }
+
+  void sendWorkingMode(LidarWorkingMode mode){
+    mavlink_message_t msg;
+    mavlink_msg_config_lidar_working_mode_pack(0, 0, &msg, (uint8_t)mode);
+    sendMessage(msg);
+  }
+
+  void sendRequest(uint8_t request_type){
+    mavlink_message_t msg;
+    mavlink_msg_device_request_data_pack(0, 0, &msg, request_type);
+    sendMessage(msg);
+  }
+
+  void sendCommand(uint8_t cmd_type){
+    mavlink_message_t msg;
+    mavlink_msg_device_command_pack(0, 0, &msg, cmd_type);
+    sendMessage(msg);
+  }
+
+  void sendMessage(const mavlink_message_t& msg){
+    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+    uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
+    source_->write(buf, len);
+  }
+
+  // configuration
+  uint16_t cloud_scan_num_ = 18;
+  std::string port_;
+  uint32_t baudrate_ = 2000000;
+  float rotate_yaw_bias_ = 0;
+  float range_scale_ = 0.001;
+  float range_bias_ = 0;
+  float range_max_ = 50;
+  float range_min_ = 0;
+
+  // serial input
+  SerialPort serial_;
+  ByteSource* source_ = &serial_;
+  int wake_fd_ = -1;
+  uint8_t read_buf_[8192];
+  size_t read_pos_ = 0;
+  size_t read_len_ = 0;
+  MavlinkFrameDecoder decoder_;
+
+  // parsed data
+  mavlink_ret_lidar_auxiliary_data_packet_t aux_;
+  bool aux_valid_ = false;
+  IMUUnitree imu_;
+  ScanConverter converter_;
+  ScanLanes lanes_;
+  ScanFilter scan_filter_;
+  BufferPool<PointCloudUnitree> cloud_pool_;
+  PoolHandle<PointCloudUnitree> cloud_;
+  PoolHandle<PointCloudUnitree> cloud_building_;
+  PointCloudUnitree empty_cloud_;
+  CloudLayout cloud_layout_ = CLOUD_AOS;
+  BufferPool<PointCloudUnitreeSoA> cloud_soa_pool_;
+  PoolHandle<PointCloudUnitreeSoA> cloud_soa_;
+  PoolHandle<PointCloudUnitreeSoA> cloud_soa_building_;
+  bool range_image_enabled_ = false;
+  BufferPool<RangeImage> range_image_pool_;
+  PoolHandle<RangeImage> range_image_;
+  PoolHandle<RangeImage> range_image_building_;
+  uint16_t scan_count_ = 0;
+  uint32_t cloud_id_ = 0;
+  double cloud_first_lidar_time_ = 0;
+  double last_lidar_time_ = 0;
+  double point_dt_ = 0;
+  std::string version_firmware_;
+  uint32_t time_delay_ = 0;
+  float dirty_percentage_ = 0;
+
+  // clock sync
+  bool clock_sync_enabled_ = true;
+  double read_stamp_ = 0;         // host time at the end of the latest read
+  ClockSync lidar_sync_{1.0};     // lidar time of the auxiliary packets, in seconds
+  ClockSync imu_sync_{0.0};       // unwrapped packet_id of the IMU messages, rate unknown
+  int64_t imu_count_ = 0;
+  uint16_t last_imu_id_ = 0;
+  bool imu_count_valid_ = false;
+
+  // instrumentation
+  ReaderStatsCollector stats_;
+  uint64_t read_ns_ = 0;          // end of the latest read
+  uint64_t cloud_start_ns_ = 0;   // first scan of the cloud being cached
+  uint16_t last_packet_id_ = 0;
+  bool packet_id_valid_ = false;
+
+  // link supervision
+  LinkSupervisor link_;
+  std::atomic<int> link_state_{LINK_DISCONNECTED};
+  std::atomic<int> requested_mode_{0};  // set by setLidarWorkingMode(), applied on the parsing thread
+  std::atomic<bool> reset_requested_{false};  // set by reset(), applied on the parsing thread
+  uint64_t link_changes_ = 0;
+  LinkStateCallback link_callback_;
+
+  // thread mode
+  MessageCallback callback_;
+  RawDataCallback raw_callback_;
+  std::atomic<bool> running_{false};
+  std::thread thread_;
+};
+
+/**
+ * @brief Create an event-driven Unitree Lidar Reader object
+ * @return UnitreeLidarEventReader*
+ */
+inline UnitreeLidarEventReader* createUnitreeLidarEventReader(){
+  return new UnitreeLidarEventReader();
+}
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,405 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "mavlink/SysMavlink/mavlink.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Slice-by-4 lookup tables of the CRC16_MCRF4XX (X.25) checksum used by MavLink
+ */
+struct Crc16Tables{
+  uint16_t t[4][256];
+
+  constexpr Crc16Tables() : t(){
+    for (int i = 0; i < 256; i++){
+      uint16_t crc = (uint16_t)i;
+      for (int k = 0; k < 8; k++){
+        crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0x8408) : (uint16_t)(crc >> 1);
+      }
+      t[0][i] = crc;
+    }
+    for (int s = 1; s < 4; s++){
+      for (int i = 0; i < 256; i++){
+        t[s][i] = (uint16_t)((t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF]);
+      }
+    }
+  }
+};
+
+inline const Crc16Tables& crc16Tables(){
+  static constexpr Crc16Tables tables;
+  return tables;
+}
+
+/**
+ * @brief Accumulate the MCRF4XX CRC16 over a byte span, four bytes per step
+ * @note Gives the same result as crc_accumulate_buffer() in mavlink/checksum.h.
+ */
+inline uint16_t crc16AccumulateSpan(uint16_t crc, const uint8_t* data, size_t length){
+  const Crc16Tables& tb = crc16Tables();
+  while (length >= 4){
+    uint16_t low = crc ^ (uint16_t)(data[0] | (data[1] << 8));
+    crc = tb.t[3][low & 0xFF] ^ tb.t[2][low >> 8] ^ tb.t[1][data[2]] ^ tb.t[0][data[3]];
+    data += 4;
+    length -= 4;
+  }
+  while (length--){
+    crc = (crc >> 8) ^ tb.t[0][(crc ^ *data++) & 0xFF];
+  }
+  return crc;
+}
+
+/**
+ * @brief Zero-copy view of one complete MavLink frame inside a receive buffer
+ * @note The view stays valid only as long as the underlying buffer is not modified.
+ */
+typedef struct{
+  const uint8_t* frame;     // first byte of the frame (the magic)
+  const uint8_t* payload;   // first byte of the payload
+  uint32_t msgid;
+  uint16_t frame_len;       // total bytes of the frame, including crc and signature
+  uint8_t len;              // payload length on the wire (MavLink 2 trims trailing zeros)
+  uint8_t magic;            // MAVLINK_STX or MAVLINK_STX_MAVLINK1
+  uint8_t seq;
+  uint8_t sysid;
+  uint8_t compid;
+}MavlinkFrameView;
+
+/**
+ * @brief Copy the payload of a frame into a message struct, zero-filling a trimmed payload
+ */
+template <typename Packet>
+inline void decodeFrame(const MavlinkFrameView& view, Packet* packet){
+  size_t n = view.len < sizeof(Packet) ? view.len : sizeof(Packet);
+  memcpy(packet, view.payload, n);
+  if (n < sizeof(Packet)){
+    memset((uint8_t*)packet + n, 0, sizeof(Packet) - n);
+  }
+}
+
+/**
+ * @brief The messages of the SysMavlink dialect, as X(NAME, name) with the names of their headers
+ */
+#define UNITREE_SYSMAVLINK_MESSAGES(X) \
+  X(DEVICE_REQUEST_DATA, device_request_data) \
+  X(DEVICE_COMMAND, device_command) \
+  X(RET_LIDAR_VERSION, ret_lidar_version) \
+  X(CONFIG_LIDAR_WORKING_MODE, config_lidar_working_mode) \
+  X(CONFIG_LED_RING_TABLE_PACKET, config_led_ring_table_packet) \
+  X(RET_LIDAR_DISTANCE_DATA_PACKET, ret_lidar_distance_data_packet) \
+  X(RET_LIDAR_AUXILIARY_DATA_PACKET, ret_lidar_auxiliary_data_packet) \
+  X(RET_LIDAR_TIME_SYNC_DATA, ret_lidar_time_sync_data) \
+  X(RET_IMU_ATTITUDE_DATA_PACKET, ret_imu_attitude_data_packet)
+
+namespace detail{
+
+/**
+ * @brief Entry of a message in MAVLINK_MESSAGE_CRCS, all zero if the message is unknown
+ */
+constexpr mavlink_msg_entry_t mavlinkMsgEntry(uint32_t msgid){
+  const mavlink_msg_entry_t crcs[] = MAVLINK_MESSAGE_CRCS;
+  for (size_t i = 0; i < sizeof(crcs) / sizeof(crcs[0]); i++){
+    if (crcs[i].msgid == msgid){
+      return crcs[i];
+    }
+  }
+  return mavlink_msg_entry_t{0, 0, 0, 0, 0, 0, 0};
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Compile-time metadata of a SysMavlink message, by message id
+ */
+template <uint32_t MsgId>
+struct SysMavlinkMessage;
+
+/**
+ * @brief The same metadata, by message struct
+ */
+template <typename Packet>
+struct SysMavlinkPacket;
+
+#define UNITREE_SYSMAVLINK_TRAITS(NAME, name) \
+  template <> struct SysMavlinkMessage<MAVLINK_MSG_ID_##NAME>{ \
+    typedef mavlink_##name##_t Packet; \
+    static constexpr uint32_t id = MAVLINK_MSG_ID_##NAME; \
+    static constexpr uint8_t crc_extra = MAVLINK_MSG_ID_##NAME##_CRC; \
+    static constexpr uint8_t len = MAVLINK_MSG_ID_##NAME##_LEN; \
+    static constexpr uint8_t min_len = MAVLINK_MSG_ID_##NAME##_MIN_LEN; \
+    static_assert(detail::mavlinkMsgEntry(id).crc_extra == crc_extra && \
+                  detail::mavlinkMsgEntry(id).max_msg_len == len, \
+                  "mavlink_msg_" #name ".h does not match MAVLINK_MESSAGE_CRCS"); \
+    static_assert(sizeof(Packet) >= len, "mavlink_" #name "_t is shorter than its payload"); \
+  }; \
+  template <> struct SysMavlinkPacket<mavlink_##name##_t> : SysMavlinkMessage<MAVLINK_MSG_ID_##NAME>{};
+
+UNITREE_SYSMAVLINK_MESSAGES(UNITREE_SYSMAVLINK_TRAITS)
+
+#undef UNITREE_SYSMAVLINK_TRAITS
+
+/**
+ * @brief Access the payload of a frame as a message struct, without copying it when possible
+ *
+ * The frame is used in place if its payload is not trimmed and is aligned for the struct; the
+ * struct may then extend over the crc bytes, which only covers its tail padding. Otherwise the
+ * payload is decoded into scratch.
+ * @return the struct, valid as long as the frame's buffer and scratch are
+ */
+template <typename Packet>
+inline const Packet* viewFramePayload(const MavlinkFrameView& view, Packet* scratch){
+  if (view.len == SysMavlinkPacket<Packet>::len &&
+      (size_t)(view.frame + view.frame_len - view.payload) >= sizeof(Packet) &&
+      (uintptr_t)view.payload % alignof(Packet) == 0){
+    return reinterpret_cast<const Packet*>(view.payload);
+  }
+  decodeFrame(view, scratch);
+  return scratch;
+}
+
+/**
+ * @brief Hand the payload of a frame to the overload of a handler for its message struct
+ * @param handler callable as handler(const mavlink_*_t&) for every SysMavlink message, e.g. a
+ *  set of overloads with a template fallback
+ * @return false if the message is not part of the SysMavlink dialect
+ */
+template <typename Handler>
+inline bool dispatchSysMavlink(const MavlinkFrameView& view, Handler&& handler){
+  switch (view.msgid){
+#define UNITREE_SYSMAVLINK_CASE(NAME, name) \
+    case MAVLINK_MSG_ID_##NAME:{ \
+      mavlink_##name##_t scratch; \
+      handler(*viewFramePayload(view, &scratch)); \
+      return true; \
+    }
+    UNITREE_SYSMAVLINK_MESSAGES(UNITREE_SYSMAVLINK_CASE)
+#undef UNITREE_SYSMAVLINK_CASE
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Crc extra and maximum payload length of every message id below 256
+ */
+struct MavlinkMsgTable{
+  uint8_t known[256];
+  uint8_t crc_extra[256];
+  uint8_t max_len[256];
+
+  constexpr MavlinkMsgTable() : known(), crc_extra(), max_len(){
+    const mavlink_msg_entry_t crcs[] = MAVLINK_MESSAGE_CRCS;
+    for (size_t i = 0; i < sizeof(crcs) / sizeof(crcs[0]); i++){
+      if (crcs[i].msgid < 256){
+        known[crcs[i].msgid] = 1;
+        crc_extra[crcs[i].msgid] = crcs[i].crc_extra;
+        max_len[crcs[i].msgid] = crcs[i].max_msg_len;
+      }
+    }
+  }
+};
+
+inline const MavlinkMsgTable& mavlinkMsgTable(){
+  static constexpr MavlinkMsgTable table;
+  return table;
+}
+
+/**
+ * @brief Counters of a MavlinkFrameDecoder
+ */
+typedef struct{
+  uint64_t frames;          // frames with a valid crc
+  uint64_t crc_errors;      // candidate frames rejected by their crc or length
+  uint64_t skipped_bytes;   // bytes discarded while searching for a magic
+}MavlinkDecoderStats;
+
+/**
+ * @brief Bulk MavLink frame decoder
+ *
+ * Instead of feeding the stream byte by byte into mavlink_parse_char(), the decoder scans a whole
+ * read buffer for the 0xFD/0xFE magic, checks the length against the SysMavlink message table and
+ * verifies the crc over the header and payload spans at once.
+ * Complete frames are returned as views into the caller's buffer; incomplete trailing data is left
+ * unconsumed so that the caller can keep it and append the next read.
+ */
+class MavlinkFrameDecoder{
+
+public:
+
+  MavlinkFrameDecoder(){
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  /**
+   * @brief Find the next complete frame with a valid crc
+   * @param data start of the unconsumed bytes
+   * @param size number of unconsumed bytes
+   * @param view filled with the frame if one is found
+   * @param found set to true if a frame is found
+   * @return number of bytes the caller can discard: the end of the frame if found, otherwise
+   *  the start of a possible incomplete frame at the end of the buffer
+   */
+  size_t decodeNext(const uint8_t* data, size_t size, MavlinkFrameView* view, bool* found){
+    size_t pos = 0;
+    *found = false;
+    while (pos < size){
+      const uint8_t* hit = findMagic(data + pos, data + size);
+      if (hit == NULL){
+        stats_.skipped_bytes += size - pos;
+        return size;
+      }
+      stats_.skipped_bytes += hit - (data + pos);
+      pos = hit - data;
+
+      int ret = checkFrame(data + pos, size - pos, view);
+      if (ret > 0){
+        stats_.frames++;
+        *found = true;
+        return pos + view->frame_len;
+      }
+      if (ret == 0){
+        return pos;   // wait for the rest of this frame
+      }
+      stats_.crc_errors++;
+      stats_.skipped_bytes++;
+      pos++;   // not a frame: resynchronize on the next byte
+    }
+    return pos;
+  }
+
+  /**
+   * @brief Decode every complete frame in a buffer and hand it to a handler
+   * @param handler callable as handler(const MavlinkFrameView&)
+   * @return number of bytes consumed
+   */
+  template <typename Handler>
+  size_t decode(const uint8_t* data, size_t size, Handler&& handler){
+    size_t consumed = 0;
+    MavlinkFrameView view;
+    bool found = true;
+    while (found && consumed < size){
+      consumed += decodeNext(data + consumed, size - consumed, &view, &found);
+      if (found){
+        handler(view);
+      }
+    }
+    return consumed;
+  }
+
+  /**
+   * @brief Decode every complete frame in a buffer into a vector of views
+   * @note The vector is cleared first; reserve it once to avoid allocations.
+   * @return number of bytes consumed
+   */
+  size_t decode(const uint8_t* data, size_t size, std::vector<MavlinkFrameView>& views){
+    views.clear();
+    return decode(data, size, [&views](const MavlinkFrameView& view){ views.push_back(view); });
+  }
+
+  const MavlinkDecoderStats& getStats() const{
+    return stats_;
+  }
+
+  void resetStats(){
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+private:
+
+  static const uint8_t* findMagic(const uint8_t* p, const uint8_t* end){
+    for (; p < end; p++){
+      if (*p == MAVLINK_STX || *p == MAVLINK_STX_MAVLINK1){
+        return p;
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * @return 1 for a valid frame, 0 if more bytes are needed, -1 if this is not a frame
+   */
+  int checkFrame(const uint8_t* p, size_t avail, MavlinkFrameView* view) const{
+    size_t header_len;
+    uint8_t signature_len = 0;
+    if (p[0] == MAVLINK_STX){
+      header_len = MAVLINK_NUM_HEADER_BYTES;
+      if (avail < 3){
+        return 0;
+      }
+      if (p[2] & ~MAVLINK_IFLAG_MASK){
+        return -1;
+      }
+      if (p[2] & MAVLINK_IFLAG_SIGNED){
+        signature_len = MAVLINK_SIGNATURE_BLOCK_LEN;
+      }
+    }
+    else{
+      header_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+    }
+    if (avail < header_len){
+      return 0;
+    }
+
+    uint8_t len = p[1];
+    uint32_t msgid;
+    if (p[0] == MAVLINK_STX){
+      msgid = p[7] | (p[8] << 8) | ((uint32_t)p[9] << 16);
+    }
+    else{
+      msgid = p[5];
+    }
+
+    uint8_t crc_extra = 0;
+    if (msgid < 256){
+      const MavlinkMsgTable& table = mavlinkMsgTable();
+      if (table.known[msgid]){
+        if (len > table.max_len[msgid]){
+          return -1;
+        }
+        crc_extra = table.crc_extra[msgid];
+      }
+    }
+
+    size_t frame_len = header_len + len + MAVLINK_NUM_CHECKSUM_BYTES + signature_len;
+    if (avail < frame_len){
+      return 0;
+    }
+
+    uint16_t crc = crc16AccumulateSpan(X25_INIT_CRC, p + 1, header_len - 1 + len);
+    crc = crc16AccumulateSpan(crc, &crc_extra, 1);
+    const uint8_t* ck = p + header_len + len;
+    if (ck[0] != (crc & 0xFF) || ck[1] != (crc >> 8)){
+      return -1;
+    }
+
+    view->frame = p;
+    view->payload = p + header_len;
+    view->msgid = msgid;
+    view->frame_len = (uint16_t)frame_len;
+    view->len = len;
+    view->magic = p[0];
+    if (p[0] == MAVLINK_STX){
+      view->seq = p[4];
+      view->sysid = p[5];
+      view->compid = p[6];
+    }
+    else{
+      view->seq = p[2];
+      view->sysid = p[3];
+      view->compid = p[4];
+    }
+    return 1;
+  }
+
+  MavlinkDecoderStats stats_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,234 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "unitree_lidar_sdk.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of the supervision of the link to the lidar
+ * @note A timeout of 0 disables its check.
+ */
+typedef struct{
+  bool auto_reconnect;            // reopen the source after an error, e.g. a replugged /dev/ttyUSB*
+  uint32_t reopen_interval_ms;    // between two attempts to reopen it
+  uint32_t version_timeout_ms;    // the VERSION request is sent again when unanswered for this long...
+  uint32_t version_retries;       // ...at most this many times
+  uint32_t spinup_timeout_ms;     // NORMAL is sent again when no range packet arrives this long after it
+  uint32_t stall_timeout_ms;      // range packets missing this long while streaming: the lidar stalled
+}ConnectionConfig;
+
+inline ConnectionConfig defaultConnectionConfig(){
+  ConnectionConfig config = {true, 200, 500, 2, 5000, 1000};
+  return config;
+}
+
+/**
+ * @brief State of the link to the lidar
+ */
+enum LinkState{
+  LINK_DISCONNECTED = 0,  // source closed or broken
+  LINK_WAITING,           // source opened or NORMAL requested: waiting for the first range packet
+  LINK_STANDBY,           // STANDBY requested: no range packet is expected
+  LINK_STREAMING          // range packets arriving
+};
+
+inline const char* linkStateName(LinkState state){
+  static const char* const names[] = {"disconnected", "waiting", "standby", "streaming"};
+  return (state >= LINK_DISCONNECTED && state <= LINK_STREAMING) ? names[state] : "unknown";
+}
+
+/**
+ * @brief What a LinkSupervisor asks its reader to do, as returned by poll()
+ */
+enum LinkAction{
+  LINK_ACTION_REOPEN = 1,           // reopen the source, then call onOpened() if it succeeded
+  LINK_ACTION_REQUEST_VERSION = 2,  // send CMD_LIDAR_VERSION
+  LINK_ACTION_SEND_MODE = 4         // send the working mode getRequestedMode() again
+};
+
+/**
+ * @brief State machine replacing the fixed sleeps and the VERSION polling around initialize()
+ *
+ * Driven by the reader with the events of the link (source opened or broken, working mode
+ * requested, range packet or VERSION parsed) and polled for the actions that are due, so the
+ * reader never sleeps longer than timeoutMs():
+ * - DISCONNECTED: the source is reopened every reopen_interval_ms when auto_reconnect is set;
+ * - once opened the lidar is asked its version once, again after version_timeout_ms if needed,
+ *   and the working mode last requested is sent again, since a replugged lidar may have rebooted;
+ * - WAITING turns into STREAMING on the first range packet, so the first cloud comes as soon as
+ *   the motor has spun up; NORMAL is sent again after spinup_timeout_ms without one;
+ * - STREAMING without range packets for stall_timeout_ms falls back to WAITING;
+ * - STANDBY only changes on a request of NORMAL or an error.
+ * Times are steady nanoseconds, e.g. detail::statsNowNs(). Not thread-safe.
+ */
+class LinkSupervisor{
+
+public:
+
+  LinkSupervisor(const ConnectionConfig& config = defaultConnectionConfig()) : config_(config){}
+
+  void setConfig(const ConnectionConfig& config){
+    config_ = config;
+  }
+
+  const ConnectionConfig& getConfig() const{
+    return config_;
+  }
+
+  LinkState getState() const{
+    return state_;
+  }
+
+  /**
+   * @brief Working mode last requested, 0 if none was
+   */
+  int getRequestedMode() const{
+    return mode_;
+  }
+
+  /**
+   * @brief The source has been opened; it was asked the version and sent the requested mode
+   */
+  void onOpened(uint64_t now_ns){
+    state_ = mode_ == STANDBY ? LINK_STANDBY : LINK_WAITING;
+    version_pending_ = true;
+    version_retries_ = config_.version_retries;
+    version_deadline_ = now_ns + msToNs(config_.version_timeout_ms);
+    spinup_deadline_ = now_ns + msToNs(config_.spinup_timeout_ms);
+  }
+
+  /**
+   * @brief The source could not be read, or could not be reopened
+   */
+  void onError(uint64_t now_ns){
+    if (state_ != LINK_DISCONNECTED){
+      state_ = LINK_DISCONNECTED;
+      reopen_deadline_ = now_ns + msToNs(config_.reopen_interval_ms);
+    }
+  }
+
+  /**
+   * @brief A working mode has been sent to the lidar
+   */
+  void onModeRequested(LidarWorkingMode mode, uint64_t now_ns){
+    mode_ = mode;
+    if (state_ == LINK_DISCONNECTED){
+      return;
+    }
+    if (mode == STANDBY){
+      state_ = LINK_STANDBY;
+    }
+    else if (state_ != LINK_STREAMING){
+      state_ = LINK_WAITING;
+      spinup_deadline_ = now_ns + msToNs(config_.spinup_timeout_ms);
+    }
+  }
+
+  /**
+   * @brief A range packet has been parsed
+   * @return true if the link just turned STREAMING
+   */
+  bool onRange(uint64_t now_ns){
+    last_range_ = now_ns;
+    if (state_ == LINK_WAITING){
+      state_ = LINK_STREAMING;
+      return true;
+    }
+    return false;
+  }
+
+  void onVersion(){
+    version_pending_ = false;
+  }
+
+  /**
+   * @brief Advance the timeouts
+   * @return the LinkAction flags now due
+   */
+  int poll(uint64_t now_ns){
+    int actions = 0;
+    if (state_ == LINK_DISCONNECTED){
+      if (config_.auto_reconnect && now_ns >= reopen_deadline_){
+        reopen_deadline_ = now_ns + msToNs(config_.reopen_interval_ms);
+        actions |= LINK_ACTION_REOPEN;
+      }
+      return actions;
+    }
+
+    if (version_pending_ && config_.version_timeout_ms > 0 && now_ns >= version_deadline_){
+      if (version_retries_ > 0){
+        version_retries_--;
+        version_deadline_ = now_ns + msToNs(config_.version_timeout_ms);
+        actions |= LINK_ACTION_REQUEST_VERSION;
+      }
+      else{
+        version_pending_ = false;
+      }
+    }
+
+    if (state_ == LINK_STREAMING && config_.stall_timeout_ms > 0 &&
+        now_ns >= last_range_ + msToNs(config_.stall_timeout_ms)){
+      state_ = LINK_WAITING;
+      spinup_deadline_ = now_ns;
+    }
+    if (state_ == LINK_WAITING && config_.spinup_timeout_ms > 0 && now_ns >= spinup_deadline_){
+      spinup_deadline_ = now_ns + msToNs(config_.spinup_timeout_ms);
+      if (mode_ == NORMAL){
+        actions |= LINK_ACTION_SEND_MODE;
+      }
+    }
+    return actions;
+  }
+
+  /**
+   * @brief Milliseconds, rounded up, until poll() has something to check, -1 if nothing is scheduled
+   */
+  int timeoutMs(uint64_t now_ns) const{
+    uint64_t deadline = UINT64_MAX;
+    if (state_ == LINK_DISCONNECTED){
+      if (config_.auto_reconnect){
+        deadline = reopen_deadline_;
+      }
+    }
+    else{
+      if (version_pending_ && config_.version_timeout_ms > 0){
+        deadline = version_deadline_;
+      }
+      if (state_ == LINK_WAITING && config_.spinup_timeout_ms > 0 && spinup_deadline_ < deadline){
+        deadline = spinup_deadline_;
+      }
+      if (state_ == LINK_STREAMING && config_.stall_timeout_ms > 0){
+        uint64_t stall = last_range_ + msToNs(config_.stall_timeout_ms);
+        deadline = stall < deadline ? stall : deadline;
+      }
+    }
+    if (deadline == UINT64_MAX){
+      return -1;
+    }
+    return deadline > now_ns ? (int)((deadline - now_ns + 999999) / 1000000) : 0;
+  }
+
+private:
+
+  static uint64_t msToNs(uint32_t ms){
+    return (uint64_t)ms * 1000000ull;
+  }
+
+  ConnectionConfig config_;
+  LinkState state_ = LINK_DISCONNECTED;
+  int mode_ = 0;
+  bool version_pending_ = false;
+  uint32_t version_retries_ = 0;
+  uint64_t version_deadline_ = 0;
+  uint64_t spinup_deadline_ = 0;
+  uint64_t reopen_deadline_ = 0;
+  uint64_t last_range_ = 0;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,534 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "unitree_lidar_sdk_event_reader.h"
+#include "unitree_lidar_sdk_spsc_ring.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Pose of a lidar in the common frame of a site
+ * @note The points are rotated by roll about x, then pitch about y, then yaw about z (the axes of
+ *  the site), then translated. A yaw alone is the rotate_yaw_bias of UnitreeLidarReader::initialize().
+ */
+typedef struct{
+  float roll;           // degree
+  float pitch;          // degree
+  float yaw;            // degree
+  float x;              // meter, position of the lidar in the site frame
+  float y;
+  float z;
+}LidarExtrinsics;
+
+inline LidarExtrinsics identityExtrinsics(){
+  LidarExtrinsics extrinsics = {0, 0, 0, 0, 0, 0};
+  return extrinsics;
+}
+
+/**
+ * @brief One lidar of a MultiLidarEngine
+ */
+typedef struct{
+  std::string port;               // serial port, e.g. /dev/ttyUSB0
+  uint32_t baudrate;
+  uint16_t cloud_scan_num;        // scans per cloud of this lidar
+  float range_max;                // meter
+  float range_min;
+  LidarExtrinsics extrinsics;
+}LidarDeviceConfig;
+
+inline LidarDeviceConfig defaultLidarDeviceConfig(const std::string& port = "/dev/ttyUSB0"){
+  LidarDeviceConfig config = {port, 2000000, 18, 50, 0, identityExtrinsics()};
+  return config;
+}
+
+/**
+ * @brief Threads and merge policy of a MultiLidarEngine
+ */
+typedef struct{
+  uint32_t threads;               // worker threads, each parsing a share of the lidars; 0 for one per lidar up to the cores
+  float max_wait;                 // second, a merge waits at most this long for the lidars missing from it
+  int first_cpu;                  // worker i is pinned to core first_cpu + i, -1 to leave them unpinned
+}MultiLidarConfig;
+
+inline MultiLidarConfig defaultMultiLidarConfig(){
+  MultiLidarConfig config = {0, 0.1f, -1};
+  return config;
+}
+
+/**
+ * @brief Cloud merged from several lidars, in the site frame
+ */
+typedef struct{
+  double stamp;                   // host time of the earliest cloud merged
+  uint32_t id;                    // sequence id of the merged clouds
+  uint32_t device_mask;           // bit i set if lidar i contributed
+  std::vector<PointUnitree> points;   // time relative to stamp
+  std::vector<uint8_t> device;    // lidar of every point
+}MultiLidarCloud;
+
+/**
+ * @brief Counters of a MultiLidarEngine
+ */
+typedef struct{
+  uint64_t device_clouds;         // clouds received from the lidars
+  uint64_t merged_clouds;         // merged clouds handed to the callback
+  uint64_t partial_clouds;        // merged clouds missing at least one lidar
+  uint64_t dropped_clouds;        // clouds lost because every buffer was held
+}MultiLidarStats;
+
+namespace detail{
+
+/**
+ * @brief Row-major 3x4 matrix [R | t] of an extrinsic calibration
+ */
+inline void extrinsicsToMatrix(const LidarExtrinsics& e, float m[12]){
+  const double r = e.roll * M_PI / 180, p = e.pitch * M_PI / 180, y = e.yaw * M_PI / 180;
+  const double cr = cos(r), sr = sin(r), cp = cos(p), sp = sin(p), cy = cos(y), sy = sin(y);
+  // Rz(yaw) * Ry(pitch) * Rx(roll)
+  m[0] = (float)(cy * cp);  m[1] = (float)(cy * sp * sr - sy * cr);  m[2] = (float)(cy * sp * cr + sy * sr);  m[3] = e.x;
+  m[4] = (float)(sy * cp);  m[5] = (float)(sy * sp * sr + cy * cr);  m[6] = (float)(sy * sp * cr - cy * sr);  m[7] = e.y;
+  m[8] = (float)(-sp);      m[9] = (float)(cp * sr);                 m[10] = (float)(cp * cr);                m[11] = e.z;
+}
+
+/**
+ * @brief out = [R | t] * in for the coordinates; intensity, time and ring are copied
+ */
+inline void transformPoints(const float m[12], const PointUnitree* __restrict in, PointUnitree* __restrict out, size_t n){
+  for (size_t i = 0; i < n; i++){
+    const float x = in[i].x, y = in[i].y, z = in[i].z;
+    out[i].x = m[0] * x + m[1] * y + m[2] * z + m[3];
+    out[i].y = m[4] * x + m[5] * y + m[6] * z + m[7];
+    out[i].z = m[8] * x + m[9] * y + m[10] * z + m[11];
+    out[i].intensity = in[i].intensity;
+    out[i].time = in[i].time;
+    out[i].ring = in[i].ring;
+  }
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Several lidars read by one process and merged into clouds of a common frame
+ *
+ * Each lidar has its own UnitreeLidarEventReader. The readers are shared out among a few worker
+ * threads, each sleeping in one poll() on the serial ports of its lidars and parsing them with
+ * runParse(), so the link supervision, the clock sync and the reconnection work as with a single
+ * reader. A worker moves every cloud of its lidars into the site frame with their extrinsics;
+ * this, like the parsing, runs in parallel over the workers.
+ *
+ * A merge collects at most one cloud per lidar. It is handed over once every lidar has
+ * contributed, when a lidar delivers its next cloud, or max_wait after its first cloud, so that a
+ * silent lidar only delays the others by max_wait. The cloud stamps are host times (clock sync),
+ * so the point times of every lidar are shifted to the earliest stamp of the merge.
+ * Linux only.
+ */
+class MultiLidarEngine{
+
+public:
+
+  /**
+   * @brief Callback receiving the merged clouds
+   * @note Called on a worker thread, with the merge lock held: keep it short, e.g. move the
+   *  handle to another thread. The cloud must not be modified.
+   */
+  typedef std::function<void(const PoolHandle<MultiLidarCloud>&)> CloudCallback;
+
+  /**
+   * @brief Callback receiving every message of every lidar, on the worker thread parsing it
+   * @note The data is read with getReader(device), e.g. getIMU().
+   */
+  typedef std::function<void(int device, MessageType type)> MessageCallback;
+
+  static const int MAX_DEVICES = 32;
+
+  MultiLidarEngine(const MultiLidarConfig& config = defaultMultiLidarConfig()) : config_(config){
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+
+  ~MultiLidarEngine(){
+    stop();
+    if (wake_fd_ >= 0){
+      ::close(wake_fd_);
+    }
+  }
+
+  MultiLidarEngine(const MultiLidarEngine&) = delete;
+  MultiLidarEngine& operator=(const MultiLidarEngine&) = delete;
+
+  const MultiLidarConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Add a lidar; call before start()
+   * @return its device index, stored in MultiLidarCloud::device, or -1 if running or MAX_DEVICES are added
+   */
+  int addDevice(const LidarDeviceConfig& config){
+    if (running_ || devices_.size() >= (size_t)MAX_DEVICES){
+      return -1;
+    }
+    std::unique_ptr<Device> device(new Device());
+    device->config = config;
+    detail::extrinsicsToMatrix(config.extrinsics, device->matrix);
+    devices_.push_back(std::move(device));
+    return (int)devices_.size() - 1;
+  }
+
+  int deviceCount() const{
+    return (int)devices_.size();
+  }
+
+  /**
+   * @brief Change the extrinsics of a lidar; safe to call while running
+   */
+  void setExtrinsics(int device, const LidarExtrinsics& extrinsics){
+    float matrix[12];
+    detail::extrinsicsToMatrix(extrinsics, matrix);
+    std::lock_guard<std::mutex> lock(merge_mutex_);
+    devices_[device]->config.extrinsics = extrinsics;
+    memcpy(devices_[device]->matrix, matrix, sizeof(matrix));
+  }
+
+  /**
+   * @brief The reader of a lidar
+   * @note Configure it (byte source, connection, filters) before initialize(). While running,
+   *  use only its thread-safe calls from other threads: getStats(), resetLatencyStats() and the
+   *  commands to the lidar (setLidarWorkingMode(), setLEDDisplayMode(), reset()...), which apply
+   *  their effects on the parser in the reader's worker thread.
+   */
+  UnitreeLidarEventReader& getReader(int device){
+    return devices_[device]->reader;
+  }
+
+  void setCloudCallback(CloudCallback callback){
+    cloud_callback_ = callback;
+  }
+
+  void setMessageCallback(MessageCallback callback){
+    message_callback_ = callback;
+  }
+
+  /**
+   * @brief Open every lidar
+   * @return 0 if all of them were opened, otherwise the number that failed; these are reopened
+   *  by the link supervision once started, unless auto_reconnect is off
+   */
+  int initialize(){
+    if (running_){
+      return -1;
+    }
+    int failed = 0;
+    for (size_t i = 0; i < devices_.size(); i++){
+      const LidarDeviceConfig& c = devices_[i]->config;
+      if (devices_[i]->reader.initialize(c.cloud_scan_num, c.port, c.baudrate, 0, 0.001, 0, c.range_max, c.range_min) != 0){
+        failed++;
+      }
+    }
+    return failed;
+  }
+
+  /**
+   * @brief Send a working mode to every lidar, e.g. NORMAL after initialize()
+   */
+  void setLidarWorkingMode(LidarWorkingMode mode){
+    for (size_t i = 0; i < devices_.size(); i++){
+      devices_[i]->reader.setLidarWorkingMode(mode);
+    }
+  }
+
+  /**
+   * @brief Start the worker threads
+   * @return 0 on success, -1 if already running or without lidars; pinning failures are
+   *  reported on stderr and leave the thread unpinned
+   */
+  int start(){
+    if (running_ || devices_.empty()){
+      return -1;
+    }
+    uint32_t threads = config_.threads;
+    if (threads == 0){
+      threads = std::thread::hardware_concurrency();
+    }
+    threads = threads < 1 ? 1 : (threads > devices_.size() ? (uint32_t)devices_.size() : threads);
+
+    for (size_t i = 0; i < devices_.size(); i++){
+      devices_[i]->pending.reset();
+    }
+    pending_mask_ = 0;
+    running_ = true;
+    for (uint32_t w = 0; w < threads; w++){
+      workers_.push_back(std::thread([this, w, threads](){ workerLoop(w, threads); }));
+      int cpu = config_.first_cpu < 0 ? -1 : config_.first_cpu + (int)w;
+      if (pinThreadToCpu(workers_.back(), cpu) != 0){
+        fprintf(stderr, "MultiLidarEngine: cannot pin worker %u to cpu %d\n", w, cpu);
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Stop the workers; the clouds of a pending merge are discarded
+   */
+  void stop(){
+    if (!running_.exchange(false)){
+      return;
+    }
+    if (wake_fd_ >= 0){
+      uint64_t one = 1;
+      ssize_t ret = ::write(wake_fd_, &one, sizeof(one));
+      (void)ret;
+    }
+    for (size_t i = 0; i < workers_.size(); i++){
+      workers_[i].join();
+    }
+    workers_.clear();
+    if (wake_fd_ >= 0){
+      uint64_t count;
+      while (::read(wake_fd_, &count, sizeof(count)) > 0){}
+    }
+    for (size_t i = 0; i < devices_.size(); i++){
+      devices_[i]->pending.reset();
+    }
+  }
+
+  bool isRunning() const{
+    return running_;
+  }
+
+  /**
+   * @brief Snapshot of the counters; safe to call from any thread
+   */
+  MultiLidarStats getStats() const{
+    MultiLidarStats stats;
+    stats.device_clouds = device_clouds_.load(std::memory_order_relaxed);
+    stats.merged_clouds = merged_clouds_.load(std::memory_order_relaxed);
+    stats.partial_clouds = partial_clouds_.load(std::memory_order_relaxed);
+    stats.dropped_clouds = dropped_clouds_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+
+  struct Device{
+    LidarDeviceConfig config;
+    float matrix[12];
+    UnitreeLidarEventReader reader;
+    BufferPool<PointCloudUnitree> pool;     // clouds in the site frame
+    PoolHandle<PointCloudUnitree> pending;  // waiting for the merge, guarded by merge_mutex_
+  };
+
+  void workerLoop(uint32_t worker, uint32_t threads){
+    std::vector<int> mine;
+    for (size_t i = worker; i < devices_.size(); i += threads){
+      mine.push_back((int)i);
+    }
+    std::vector<struct pollfd> pfds(mine.size() + 1);
+
+    while (running_){
+      for (size_t k = 0; k < mine.size(); k++){
+        UnitreeLidarEventReader& reader = devices_[mine[k]]->reader;
+        MessageType type;
+        while ((type = reader.runParse()) != NONE){
+          handleMessage(mine[k], type);
+        }
+      }
+      flushIfDue();
+
+      // sleep until a port is readable or the next timeout of a link or of the merge
+      int timeout_ms = mergeTimeoutMs();
+      bool no_fd = false;
+      for (size_t k = 0; k < mine.size(); k++){
+        UnitreeLidarEventReader& reader = devices_[mine[k]]->reader;
+        int fd = reader.getLinkState() == LINK_DISCONNECTED ? -1 : reader.getSerialFd();
+        no_fd |= fd < 0 && reader.getLinkState() != LINK_DISCONNECTED;
+        pfds[k].fd = fd;
+        pfds[k].events = POLLIN;
+        pfds[k].revents = 0;
+        int link_ms = reader.getLinkTimeoutMs();
+        if (link_ms >= 0 && (timeout_ms < 0 || link_ms < timeout_ms)){
+          timeout_ms = link_ms;
+        }
+      }
+      if (no_fd && (timeout_ms < 0 || timeout_ms > 1)){
+        timeout_ms = 1;   // a byte source without descriptor is parsed every millisecond
+      }
+      pfds[mine.size()].fd = wake_fd_;
+      pfds[mine.size()].events = POLLIN;
+      pfds[mine.size()].revents = 0;
+      poll(pfds.data(), pfds.size(), timeout_ms);
+    }
+  }
+
+  void handleMessage(int index, MessageType type){
+    Device& device = *devices_[index];
+    if (type == POINTCLOUD){
+      PoolHandle<PointCloudUnitree> cloud = device.reader.getCloudHandle();
+      if (cloud){
+        addCloud(index, *cloud);
+      }
+    }
+    if (message_callback_){
+      message_callback_(index, type);
+    }
+  }
+
+  /**
+   * @brief Move a cloud of a lidar into the site frame, then into the merge
+   */
+  void addCloud(int index, const PointCloudUnitree& cloud){
+    Device& device = *devices_[index];
+    device_clouds_.fetch_add(1, std::memory_order_relaxed);
+    PoolHandle<PointCloudUnitree> site = device.pool.acquire();
+    if (!site){
+      dropped_clouds_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    float matrix[12];
+    {
+      std::lock_guard<std::mutex> lock(merge_mutex_);
+      memcpy(matrix, device.matrix, sizeof(matrix));
+    }
+    site->stamp = cloud.stamp;
+    site->id = cloud.id;
+    site->ringNum = cloud.ringNum;
+    site->points.resize(cloud.points.size());
+    detail::transformPoints(matrix, cloud.points.data(), site->points.data(), cloud.points.size());
+
+    std::lock_guard<std::mutex> lock(merge_mutex_);
+    if (!running_){
+      return;
+    }
+    const uint32_t bit = 1u << index;
+    if (pending_mask_ & bit){
+      // this lidar started its next cloud: the merge will not be completed
+      flushLocked();
+    }
+    if (pending_mask_ == 0){
+      merge_deadline_ = detail::statsNowNs() + (uint64_t)(config_.max_wait * 1e9);
+    }
+    device.pending = std::move(site);
+    pending_mask_ |= bit;
+    if (pending_mask_ == allMask()){
+      flushLocked();
+    }
+  }
+
+  void flushIfDue(){
+    std::lock_guard<std::mutex> lock(merge_mutex_);
+    if (pending_mask_ != 0 && detail::statsNowNs() >= merge_deadline_){
+      flushLocked();
+    }
+  }
+
+  int mergeTimeoutMs(){
+    std::lock_guard<std::mutex> lock(merge_mutex_);
+    if (pending_mask_ == 0){
+      return -1;
+    }
+    uint64_t now = detail::statsNowNs();
+    return merge_deadline_ > now ? (int)((merge_deadline_ - now + 999999) / 1000000) : 0;
+  }
+
+  uint32_t allMask() const{
+    return devices_.size() >= 32 ? 0xffffffffu : (1u << devices_.size()) - 1;
+  }
+
+  /**
+   * @brief Hand over the pending clouds as one merged cloud; merge_mutex_ is held
+   */
+  void flushLocked(){
+    PoolHandle<MultiLidarCloud> merged = merged_pool_.acquire();
+    if (!merged){
+      dropped_clouds_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else{
+      double stamp = 0;
+      bool first = true;
+      size_t total = 0;
+      for (size_t i = 0; i < devices_.size(); i++){
+        const PoolHandle<PointCloudUnitree>& cloud = devices_[i]->pending;
+        if (cloud){
+          stamp = first || cloud->stamp < stamp ? cloud->stamp : stamp;
+          first = false;
+          total += cloud->points.size();
+        }
+      }
+      merged->stamp = stamp;
+      merged->id = merge_id_++;
+      merged->device_mask = pending_mask_;
+      merged->points.resize(total);
+      merged->device.resize(total);
+      size_t offset = 0;
+      for (size_t i = 0; i < devices_.size(); i++){
+        const PoolHandle<PointCloudUnitree>& cloud = devices_[i]->pending;
+        if (!cloud){
+          continue;
+        }
+        const size_t n = cloud->points.size();
+        PointUnitree* out = merged->points.data() + offset;
+        memcpy(out, cloud->points.data(), n * sizeof(PointUnitree));
+        const float shift = (float)(cloud->stamp - stamp);
+        if (shift != 0){
+          for (size_t k = 0; k < n; k++){
+            out[k].time += shift;
+          }
+        }
+        memset(merged->device.data() + offset, (int)i, n);
+        offset += n;
+      }
+      merged_clouds_.fetch_add(1, std::memory_order_relaxed);
+      if (pending_mask_ != allMask()){
+        partial_clouds_.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (cloud_callback_){
+        cloud_callback_(merged);
+      }
+    }
+    for (size_t i = 0; i < devices_.size(); i++){
+      devices_[i]->pending.reset();
+    }
+    pending_mask_ = 0;
+  }
+
+  MultiLidarConfig config_;
+  std::vector<std::unique_ptr<Device> > devices_;
+  std::vector<std::thread> workers_;
+  std::atomic<bool> running_{false};
+  int wake_fd_ = -1;
+  CloudCallback cloud_callback_;
+  MessageCallback message_callback_;
+
+  // merge, guarded by merge_mutex_
+  std::mutex merge_mutex_;
+  BufferPool<MultiLidarCloud> merged_pool_;
+  uint32_t pending_mask_ = 0;
+  uint64_t merge_deadline_ = 0;
+  uint32_t merge_id_ = 0;
+
+  std::atomic<uint64_t> device_clouds_{0};
+  std::atomic<uint64_t> merged_clouds_{0};
+  std::atomic<uint64_t> partial_clouds_{0};
+  std::atomic<uint64_t> dropped_clouds_{0};
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -39,7 +39,12 @@
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
+#include <stddef.h>
+#include <string.h>
+
 #include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+#include "unitree_lidar_sdk_thread_pool.h"
 
 using namespace unitree_lidar_sdk;
 
@@ -61,26 +66,168 @@ POINT_CLOUD_REGISTER_POINT_STRUCT(PointType,
   (float, time, time)
 )
 
+// Explicit instantiations for PointType; define UNITREE_LIDAR_SDK_PCL_NO_INSTANTIATE in every
+// file but one when the header is included by several files of a program
+#ifndef UNITREE_LIDAR_SDK_PCL_NO_INSTANTIATE
 PCL_INSTANTIATE(VoxelGrid, PointType)
 PCL_INSTANTIATE(KdTree, PointType)
 PCL_INSTANTIATE(RadiusOutlierRemoval, PointType)
+#endif
+
+/**
+ * @brief PCL point type with the memory layout of PointUnitree
+ * @note A pcl::PointCloud<PointUnitreePCL> can be filled in place by any SDK function writing
+ *  PointUnitree arrays, see unitreePointsOf(). It suits the algorithms that read the registered
+ *  fields, e.g. pcl::KdTreeFLANN and pcl::io::savePCDFile(); the ones using getVector4fMap()
+ *  need the 16-byte aligned PointType.
+ */
+struct PointUnitreePCL
+{
+  float x;
+  float y;
+  float z;
+  float intensity;
+  float time;
+  std::uint32_t ring;
+};
+POINT_CLOUD_REGISTER_POINT_STRUCT(PointUnitreePCL,
+  (float, x, x)(float, y, y)(float, z, z)
+  (float, intensity, intensity)
+  (float, time, time)
+  (std::uint32_t, ring, ring)
+)
+
+static_assert(sizeof(PointUnitreePCL) == sizeof(PointUnitree) &&
+              offsetof(PointUnitreePCL, ring) == offsetof(PointUnitree, ring),
+              "PointUnitreePCL must have the layout of PointUnitree");
+
+namespace unitree_lidar_sdk{
+namespace detail{
+
+const size_t PCL_PARALLEL_MIN_POINTS = 20000;
+
+/**
+ * @brief Run func(begin, end) over [0, n), split over the pool for large clouds
+ */
+template <typename Func>
+inline void pclForRange(size_t n, ThreadPool* pool, Func func){
+  if (pool == nullptr || pool->size() == 1 || n < PCL_PARALLEL_MIN_POINTS){
+    func(0, n);
+    return;
+  }
+  pool->parallelFor(n, [&func](size_t begin, size_t end, uint32_t){ func(begin, end); });
+}
+
+/**
+ * @brief Resize a PCL cloud to an unorganized cloud of n points, keeping its capacity
+ */
+template <typename PointT>
+inline void resizePCLCloud(pcl::PointCloud<PointT>& cloud, size_t n){
+  cloud.points.resize(n);
+  cloud.width = (uint32_t)n;
+  cloud.height = 1;
+  cloud.is_dense = true;
+}
+
+} // end of namespace detail
+} // end of namespace unitree_lidar_sdk
 
 /**
  * @brief Transform a Unitree cloud to PCL cloud
- * 
+ * @note The output is resized, not cleared, so a cloud kept across frames does not reallocate
+ *  once it has reached its largest size. A pool splits the copy of large clouds over threads.
  * @param cloudIn 
  * @param cloudOut 
+ * @param pool optional, used for clouds of 20000 points or more
+ */
+inline void transformUnitreeCloudToPCL(const PointCloudUnitree& cloudIn, pcl::PointCloud<PointType>& cloudOut,
+                                       ThreadPool* pool = nullptr){
+  const size_t n = cloudIn.points.size();
+  detail::resizePCLCloud(cloudOut, n);
+  const PointUnitree* __restrict in = cloudIn.points.data();
+  PointType* __restrict out = cloudOut.points.data();
+  detail::pclForRange(n, pool, [in, out](size_t begin, size_t end){
+    for (size_t i = begin; i < end; i ++){
+      out[i].x = in[i].x;
+      out[i].y = in[i].y;
+      out[i].z = in[i].z;
+      out[i].data[3] = 1.0f;
+      out[i].intensity = in[i].intensity;
+      out[i].time = in[i].time;
+      out[i].ring = (std::uint16_t)in[i].ring;
+    }
+  });
+}
+
+inline void transformUnitreeCloudToPCL(const PointCloudUnitree& cloudIn, pcl::PointCloud<PointType>::Ptr cloudOut,
+                                       ThreadPool* pool = nullptr){
+  transformUnitreeCloudToPCL(cloudIn, *cloudOut, pool);
+}
+
+/**
+ * @brief Transform a Unitree SoA cloud to PCL cloud, with the same capacity reuse
+ * @note Each lane is read with one contiguous pass.
  */
-void transformUnitreeCloudToPCL(const PointCloudUnitree& cloudIn,  pcl::PointCloud<PointType>::Ptr cloudOut){
-  cloudOut->clear();
-  PointType pt;
-  for (size_t i = 0; i < cloudIn.points.size(); i ++){
-    pt.x = cloudIn.points[i].x;
-    pt.y = cloudIn.points[i].y;
-    pt.z = cloudIn.points[i].z;
-    pt.intensity = cloudIn.points[i].intensity;
-    pt.time = cloudIn.points[i].time;
-    pt.ring = cloudIn.points[i].ring;
-    cloudOut->push_back(pt);
+inline void transformUnitreeCloudToPCL(const PointCloudUnitreeSoA& cloudIn, pcl::PointCloud<PointType>& cloudOut,
+                                       ThreadPool* pool = nullptr){
+  const size_t n = cloudIn.size();
+  detail::resizePCLCloud(cloudOut, n);
+  const float* __restrict x = cloudIn.x.data();
+  const float* __restrict y = cloudIn.y.data();
+  const float* __restrict z = cloudIn.z.data();
+  const float* __restrict intensity = cloudIn.intensity.data();
+  const float* __restrict time = cloudIn.time.data();
+  const std::uint16_t* __restrict ring = cloudIn.ring.data();
+  PointType* __restrict out = cloudOut.points.data();
+  detail::pclForRange(n, pool, [=](size_t begin, size_t end){
+    for (size_t i = begin; i < end; i ++){
+      out[i].x = x[i];
+      out[i].y = y[i];
+      out[i].z = z[i];
+      out[i].data[3] = 1.0f;
+      out[i].intensity = intensity[i];
+      out[i].time = time[i];
+      out[i].ring = ring[i];
+    }
+  });
+}
+
+inline void transformUnitreeCloudToPCL(const PointCloudUnitreeSoA& cloudIn, pcl::PointCloud<PointType>::Ptr cloudOut,
+                                       ThreadPool* pool = nullptr){
+  transformUnitreeCloudToPCL(cloudIn, *cloudOut, pool);
+}
+
+/**
+ * @brief Storage of a PointUnitreePCL cloud seen as PointUnitree, to be filled in place
+ * @note E.g. resize the cloud to POINTS_NUM_OF_SCAN more points, write them with
+ *  ScanConverter::compactLanes() or udpBufferToCompactScan(), then resize it to the count
+ *  returned; PCL then reads the points without any copy.
+ */
+inline PointUnitree* unitreePointsOf(pcl::PointCloud<PointUnitreePCL>& cloud){
+  return reinterpret_cast<PointUnitree*>(cloud.points.data());
+}
+
+inline const PointUnitree* unitreePointsOf(const pcl::PointCloud<PointUnitreePCL>& cloud){
+  return reinterpret_cast<const PointUnitree*>(cloud.points.data());
+}
+
+/**
+ * @brief Copy a Unitree cloud into a PointUnitreePCL cloud with a single memcpy, keeping its capacity
+ */
+inline void transformUnitreeCloudToPCL(const PointCloudUnitree& cloudIn, pcl::PointCloud<PointUnitreePCL>& cloudOut){
+  detail::resizePCLCloud(cloudOut, cloudIn.points.size());
+  if (!cloudIn.points.empty()){
+    memcpy(unitreePointsOf(cloudOut), cloudIn.points.data(), cloudIn.points.size() * sizeof(PointUnitree));
   }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Coordinates of a Unitree cloud as a 3 x N Eigen matrix, without copying
+ * @note The map aliases cloud.points: it is valid until the points are reallocated.
+ */
+typedef Eigen::Map<const Eigen::Matrix<float, 3, Eigen::Dynamic>, Eigen::Unaligned,
+                   Eigen::OuterStride<sizeof(PointUnitree) / sizeof(float)> > UnitreeXYZMap;
+
+inline UnitreeXYZMap unitreeCloudXYZMap(const PointCloudUnitree& cloud){
+  return UnitreeXYZMap(cloud.points.empty() ? nullptr : &cloud.points[0].x, 3, (Eigen::Index)cloud.points.size());
+}
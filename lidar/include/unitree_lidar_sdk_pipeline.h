@@ -0,0 +1,469 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "unitree_lidar_sdk_event_reader.h"
+#include "unitree_lidar_sdk_spsc_ring.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Ring sizes, drop policies and cores of a LidarPipeline
+ */
+typedef struct{
+  uint32_t chunk_ring_size;       // serial reads queued between the reader and the decoder thread
+  uint32_t message_ring_size;     // messages queued between the decoder and the output thread
+  DropPolicy chunk_policy;
+  DropPolicy message_policy;
+  int reader_cpu;                 // core of each thread, -1 to leave it unpinned
+  int decoder_cpu;
+  int output_cpu;
+}PipelineConfig;
+
+inline PipelineConfig defaultPipelineConfig(){
+  PipelineConfig config = {512, 256, DROP_OLDEST, DROP_OLDEST, -1, -1, -1};
+  return config;
+}
+
+/**
+ * @brief Bytes of one read of the serial port, with the host time of the read
+ */
+typedef struct{
+  double stamp;
+  uint32_t size;
+  uint8_t data[2048];
+}SerialChunk;
+
+/**
+ * @brief Message handed from the decoder to the output thread
+ * @note The clouds are references on the reader buffers: releasing the message hands them back.
+ */
+typedef struct{
+  MessageType type;                           // IMU, POINTCLOUD or VERSION; TIMESYNC from a SinkFanout
+  IMUUnitree imu;                             // for IMU
+  PoolHandle<PointCloudUnitree> cloud;        // for POINTCLOUD, if the layout has CLOUD_AOS
+  PoolHandle<PointCloudUnitreeSoA> cloud_soa; // for POINTCLOUD, if the layout has CLOUD_SOA
+  PoolHandle<RangeImage> range_image;         // for POINTCLOUD, if the range image is enabled
+  ClockSyncState clock_sync;                  // for POINTCLOUD, mapping of the lidar clock when it was built; for TIMESYNC
+}PipelineMessage;
+
+/**
+ * @brief Counters of a LidarPipeline
+ */
+typedef struct{
+  RingStats chunks;           // serial reads; dropped ones lose bytes, the decoder then resynchronizes
+  RingStats messages;         // messages; dropped ones never reach the output callback
+  uint64_t read_errors;       // failed waits or reads of the serial port
+  uint64_t reopens;           // serial port reopened by the reader thread after an error
+  ReaderStats reader;         // parsing counters and latencies of the decoder thread
+}PipelineStats;
+
+namespace detail{
+
+/**
+ * @brief Byte source of the decoder thread, fed with the chunks read by the reader thread
+ * @note Commands are written straight to the serial port. The wake descriptor is not watched:
+ *  the pipeline closes the ring to wake the decoder thread. Once the reader thread has reopened
+ *  the port after an error, the source fails once, so that the decoder's reader reconnects too.
+ */
+class ChunkByteSource : public ByteSource{
+
+public:
+
+  ChunkByteSource(SpscRing<SerialChunk>& ring, ByteSource* port) : ring_(ring), port_(port){
+    chunk_.size = 0;
+    chunk_.stamp = 0;
+  }
+
+  virtual bool isOpen() const{
+    return port_->isOpen();
+  }
+
+  virtual int read(uint8_t* buf, size_t size){
+    if (reopened_.load(std::memory_order_relaxed)){
+      return -1;
+    }
+    if (pos_ >= chunk_.size){
+      if (!ring_.pop(&chunk_)){
+        chunk_.size = 0;
+        return ring_.isClosed() ? -1 : 0;
+      }
+      pos_ = 0;
+    }
+    size_t n = chunk_.size - pos_ < size ? chunk_.size - pos_ : size;
+    memcpy(buf, chunk_.data + pos_, n);
+    pos_ += n;
+    stamp_ = chunk_.stamp;
+    return (int)n;
+  }
+
+  virtual int write(const uint8_t* buf, size_t size){
+    return port_->write(buf, size);
+  }
+
+  virtual int waitReadable(int timeout_ms, int){
+    if (reopened_.load(std::memory_order_relaxed)){
+      return -1;
+    }
+    if (pos_ < chunk_.size){
+      return 1;
+    }
+    if (ring_.wait(timeout_ms)){
+      return 1;
+    }
+    return ring_.isClosed() ? -1 : 0;
+  }
+
+  /**
+   * @brief Reopened by the decoder's reader once the ring is open and the port is back
+   */
+  virtual int reopen(){
+    if (ring_.isClosed() || !port_->isOpen()){
+      return -1;
+    }
+    reopened_.store(false, std::memory_order_relaxed);
+    clear();
+    return 0;
+  }
+
+  /**
+   * @brief Called by the reader thread when it has reopened the port
+   */
+  void notifyReopened(){
+    reopened_.store(true, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Host time of the serial read that delivered the last bytes read
+   */
+  double stamp() const{
+    return stamp_;
+  }
+
+  void clear(){
+    chunk_.size = 0;
+    pos_ = 0;
+  }
+
+  void setPort(ByteSource* port){
+    port_ = port;
+  }
+
+private:
+
+  SpscRing<SerialChunk>& ring_;
+  ByteSource* port_;
+  SerialChunk chunk_;
+  size_t pos_ = 0;
+  double stamp_ = 0;
+  std::atomic<bool> reopened_{false};
+};
+
+/**
+ * @brief Event reader stamping messages with the time of the serial read instead of the time of parsing
+ */
+class PipelineLidarReader : public UnitreeLidarEventReader{
+
+public:
+
+  explicit PipelineLidarReader(ChunkByteSource& source) : chunks_(source){
+    setByteSource(&chunks_);
+  }
+
+protected:
+
+  virtual double messageStamp() const{
+    return chunks_.stamp();
+  }
+
+  ChunkByteSource& chunks_;
+};
+
+} // end of namespace detail
+
+/**
+ * @brief Pipelined runtime: serial reading, decoding and output on three threads
+ *
+ * - The reader thread sleeps in poll() on the serial port and queues every read, with its host
+ *   time, into a ring of SerialChunk. It never does anything else, so a slow output cannot make
+ *   the UART buffer overflow.
+ * - The decoder thread runs an UnitreeLidarEventReader on those chunks: MavLink decoding, scan
+ *   conversion, cloud caching and clock sync, with messages stamped at their serial read.
+ * - The output thread hands every IMU, POINTCLOUD and VERSION message to the output callback.
+ *
+ * Stages are connected by bounded lock-free SpscRing queues whose DropPolicy decides what a
+ * full ring does, and each thread can be pinned to a core. Clouds are passed as PoolHandle, so a
+ * callback that keeps them holds reader buffers; once all are held, the reader drops new clouds.
+ * The single-threaded runParse() / waitForMessage() path of UnitreeLidarEventReader is unchanged.
+ */
+class LidarPipeline{
+
+public:
+
+  /**
+   * @brief Callback invoked on the output thread for every message
+   */
+  typedef std::function<void(const PipelineMessage&)> OutputCallback;
+
+  LidarPipeline(const PipelineConfig& config = defaultPipelineConfig())
+    : config_(config),
+      chunks_(config.chunk_ring_size, config.chunk_policy),
+      messages_(config.message_ring_size, config.message_policy),
+      source_(chunks_, &serial_),
+      reader_(source_){
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  }
+
+  ~LidarPipeline(){
+    stop();
+    if (wake_fd_ >= 0){
+      ::close(wake_fd_);
+    }
+  }
+
+  LidarPipeline(const LidarPipeline&) = delete;
+  LidarPipeline& operator=(const LidarPipeline&) = delete;
+
+  const PipelineConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Open the serial port and initialize the reader, with the arguments of UnitreeLidarReader::initialize()
+   * @return 0 on success, -1 if the serial port cannot be opened
+   */
+  int initialize(
+      uint16_t cloud_scan_num = 18,
+      std::string port = "/dev/ttyUSB0",
+      uint32_t baudrate = 2000000,
+      float rotate_yaw_bias = 0,
+      float range_scale = 0.001,
+      float range_bias = 0,
+      float range_max = 50,
+      float range_min = 0
+  ){
+    if (running_ || (port_ == &serial_ ? serial_.open(port, baudrate) != 0 : !port_->isOpen())){
+      return -1;
+    }
+    return reader_.initialize(cloud_scan_num, port, baudrate, rotate_yaw_bias,
+                              range_scale, range_bias, range_max, range_min);
+  }
+
+  /**
+   * @brief Read another byte source than the serial port, e.g. a ReplaySource
+   * @note Call before initialize(), which then expects the source to be opened; nullptr
+   *  restores the serial port. The source must outlive the pipeline.
+   */
+  void setByteSource(ByteSource* source){
+    port_ = source ? source : &serial_;
+    source_.setPort(port_);
+  }
+
+  /**
+   * @brief The reader run by the decoder thread
+   * @note Configure it (cloud layout, clock sync) before start(). While running, only its
+   *  thread-safe calls may be used from other threads: getStats(), resetLatencyStats() and the
+   *  commands to the lidar (setLidarWorkingMode(), setLEDDisplayMode(), reset()...), whose
+   *  effects on the parser are deferred to the decoder thread.
+   */
+  UnitreeLidarEventReader& getReader(){
+    return reader_;
+  }
+
+  /**
+   * @brief Set the callback of the output thread; call before start()
+   */
+  void setOutputCallback(OutputCallback callback){
+    callback_ = callback;
+  }
+
+  /**
+   * @brief Start the reader, decoder and output threads
+   * @return 0 on success, -1 if already running or not initialized; pinning failures are
+   *  reported on stderr and leave the thread unpinned
+   */
+  int start(){
+    if (running_ || !port_->isOpen()){
+      return -1;
+    }
+    chunks_.reopen();
+    messages_.reopen();
+    source_.clear();
+    running_ = true;
+    output_ = std::thread([this](){ outputLoop(); });
+    decoder_ = std::thread([this](){ decodeLoop(); });
+    reader_thread_ = std::thread([this](){ readLoop(); });
+    pin(output_, config_.output_cpu, "output");
+    pin(decoder_, config_.decoder_cpu, "decoder");
+    pin(reader_thread_, config_.reader_cpu, "reader");
+    return 0;
+  }
+
+  /**
+   * @brief Stop the three threads; messages still queued are discarded
+   */
+  void stop(){
+    if (!running_.exchange(false)){
+      return;
+    }
+    if (wake_fd_ >= 0){
+      uint64_t one = 1;
+      ssize_t ret = ::write(wake_fd_, &one, sizeof(one));
+      (void)ret;
+    }
+    chunks_.close();
+    messages_.close();
+    reader_thread_.join();
+    decoder_.join();
+    output_.join();
+    if (wake_fd_ >= 0){
+      uint64_t count;
+      while (::read(wake_fd_, &count, sizeof(count)) > 0){}
+    }
+  }
+
+  bool isRunning() const{
+    return running_;
+  }
+
+  /**
+   * @brief Firmware version reported by the lidar, empty until a VERSION message is parsed
+   */
+  std::string getVersionOfFirmware() const{
+    std::lock_guard<std::mutex> lock(version_mutex_);
+    return version_firmware_;
+  }
+
+  /**
+   * @brief Snapshot of the counters; safe to call from any thread
+   */
+  PipelineStats getStats() const{
+    PipelineStats stats;
+    stats.chunks = chunks_.getStats();
+    stats.messages = messages_.getStats();
+    stats.read_errors = read_errors_.load(std::memory_order_relaxed);
+    stats.reopens = reopens_.load(std::memory_order_relaxed);
+    stats.reader = reader_.getStats();
+    return stats;
+  }
+
+private:
+
+  void pin(std::thread& thread, int cpu, const char* name){
+    if (pinThreadToCpu(thread, cpu) != 0){
+      fprintf(stderr, "LidarPipeline: cannot pin the %s thread to cpu %d\n", name, cpu);
+    }
+  }
+
+  void readLoop(){
+    SerialChunk chunk;
+    while (running_){
+      int ready = port_->waitReadable(100, wake_fd_);
+      if (ready == 0){
+        continue;
+      }
+      int n = ready > 0 ? port_->read(chunk.data, sizeof(chunk.data)) : -1;
+      if (n < 0){
+        // serial port broken, e.g. unplugged: avoid a hot loop on a dead descriptor, and reopen
+        // it once the device is back
+        read_errors_.fetch_add(1, std::memory_order_relaxed);
+        const ConnectionConfig& connection = reader_.getConnectionConfig();
+        std::this_thread::sleep_for(std::chrono::milliseconds(
+            connection.auto_reconnect ? connection.reopen_interval_ms : 100));
+        if (connection.auto_reconnect && running_ && port_->reopen() == 0){
+          reopens_.fetch_add(1, std::memory_order_relaxed);
+          source_.notifyReopened();
+        }
+        continue;
+      }
+      if (n == 0){
+        continue;
+      }
+      chunk.stamp = get_host_timestamp();
+      chunk.size = (uint32_t)n;
+      chunks_.push(chunk);
+    }
+  }
+
+  void decodeLoop(){
+    PipelineMessage msg;
+    msg.type = NONE;
+    memset(&msg.imu, 0, sizeof(msg.imu));
+    memset(&msg.clock_sync, 0, sizeof(msg.clock_sync));
+    while (running_){
+      MessageType result = reader_.waitForMessage(100);
+      if (result == IMU){
+        msg.imu = reader_.getIMU();
+      }
+      else if (result == POINTCLOUD){
+        msg.cloud = reader_.getCloudHandle();
+        msg.cloud_soa = reader_.getCloudSoAHandle();
+        msg.range_image = reader_.getRangeImageHandle();
+        msg.clock_sync = reader_.getClockSyncState();
+      }
+      else if (result == VERSION){
+        std::lock_guard<std::mutex> lock(version_mutex_);
+        version_firmware_ = reader_.getVersionOfFirmware();
+      }
+      else{
+        continue;
+      }
+      msg.type = result;
+      messages_.push(std::move(msg));
+      msg.cloud.reset();
+      msg.cloud_soa.reset();
+      msg.range_image.reset();
+    }
+  }
+
+  void outputLoop(){
+    PipelineMessage msg;
+    while (running_){
+      if (!messages_.waitPop(&msg, 100)){
+        continue;
+      }
+      if (callback_){
+        callback_(msg);
+      }
+      msg.cloud.reset();
+      msg.cloud_soa.reset();
+      msg.range_image.reset();
+    }
+  }
+
+  PipelineConfig config_;
+  SerialPort serial_;
+  ByteSource* port_ = &serial_;
+  SpscRing<SerialChunk> chunks_;
+  SpscRing<PipelineMessage> messages_;
+  detail::ChunkByteSource source_;
+  detail::PipelineLidarReader reader_;
+  int wake_fd_ = -1;
+
+  OutputCallback callback_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint64_t> read_errors_{0};
+  std::atomic<uint64_t> reopens_{0};
+  std::thread reader_thread_;
+  std::thread decoder_;
+  std::thread output_;
+
+  mutable std::mutex version_mutex_;
+  std::string version_firmware_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,453 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+#include "unitree_lidar_sdk_scan_kernel.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Cloud as a dense range image: one column per scan, one row per point of the scans
+ *
+ * The laser of a scan sweeps the vertical angles from sys_vertical_angle_start in steps of
+ * sys_vertical_angle_span while the head turns, so row j of every column holds point j of its
+ * scan and neighbouring columns are neighbouring azimuths. Pixel (row, col) is at index(row, col),
+ * columns being contiguous; a pixel without return has a range of 0. Every array has
+ * rows * cols entries and starts on a 32-byte boundary.
+ */
+struct RangeImage{
+  double stamp = 0;         // cloud timestamp
+  uint32_t id = 0;          // sequence id
+  uint32_t rows = POINTS_NUM_OF_SCAN;
+  uint32_t cols = 0;        // scans appended
+  float pitch_start = 0;    // radian, vertical angle of row 0
+  float pitch_step = 0;     // radian, between two rows
+  AlignedVector<float> range;       // meter, distance of the point to the lidar origin, 0 for no return
+  AlignedVector<float> intensity;
+  AlignedVector<float> x;
+  AlignedVector<float> y;
+  AlignedVector<float> z;
+  AlignedVector<float> time;        // relative time of each point from cloud stamp
+  std::vector<float> azimuth;       // radian, horizontal angle of each column
+
+  size_t size() const { return range.size(); }
+
+  bool empty() const { return cols == 0; }
+
+  uint32_t index(uint32_t row, uint32_t col) const { return col * rows + row; }
+
+  bool valid(uint32_t i) const { return range[i] > 0; }
+
+  void clear(){
+    cols = 0;
+    resizePixels(0);
+    azimuth.clear();
+  }
+
+  void reserve(uint32_t scans){
+    size_t n = (size_t)scans * rows;
+    range.reserve(n);
+    intensity.reserve(n);
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+    time.reserve(n);
+    azimuth.reserve(scans);
+  }
+
+  /**
+   * @brief Append the points of one scan as a new column, the ones failing the range gates as no return
+   * @param rotate_yaw_bias degree, as in ScanConvertConfig
+   */
+  void appendScan(const mavlink_ret_lidar_auxiliary_data_packet_t& aux, const ScanLanes& lanes,
+                  float rotate_yaw_bias = 0){
+    if (cols == 0){
+      pitch_start = aux.sys_vertical_angle_start * DEGREE_TO_RADIAN;
+      pitch_step = aux.sys_vertical_angle_span * DEGREE_TO_RADIAN;
+    }
+    size_t base = size();
+    resizePixels(base + POINTS_NUM_OF_SCAN);
+    memcpy(&intensity[base], lanes.intensity, sizeof(lanes.intensity));
+    memcpy(&x[base], lanes.x, sizeof(lanes.x));
+    memcpy(&y[base], lanes.y, sizeof(lanes.y));
+    memcpy(&z[base], lanes.z, sizeof(lanes.z));
+    memcpy(&time[base], lanes.time, sizeof(lanes.time));
+    float* r = &range[base];
+    for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+      float d = sqrtf(lanes.x[j] * lanes.x[j] + lanes.y[j] * lanes.y[j] + lanes.z[j] * lanes.z[j]);
+      r[j] = lanes.valid[j] ? d : 0.0f;
+    }
+    azimuth.push_back((aux.com_horizontal_angle_start + rotate_yaw_bias) * DEGREE_TO_RADIAN);
+    cols++;
+  }
+
+  /**
+   * @brief Points of the pixels with a return, column by column
+   * @param labels if given, only the pixels with a label >= 0 are kept, e.g. the clustered ones
+   */
+  void toCloud(PointCloudUnitree& cloud, const std::vector<int32_t>* labels = nullptr) const{
+    cloud.stamp = stamp;
+    cloud.id = id;
+    cloud.ringNum = 1;
+    cloud.points.clear();
+    for (uint32_t i = 0; i < (uint32_t)size(); i++){
+      if (!valid(i) || (labels && (*labels)[i] < 0)){
+        continue;
+      }
+      PointUnitree p = {x[i], y[i], z[i], intensity[i], time[i], 0};
+      cloud.points.push_back(p);
+    }
+  }
+
+private:
+
+  void resizePixels(size_t n){
+    range.resize(n);
+    intensity.resize(n);
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    time.resize(n);
+  }
+};
+
+/**
+ * @brief Parameters of a RangeImageFilter
+ */
+typedef struct{
+  uint32_t median_window;     // half size of the denoise window, 1 for 3 x 3
+  float median_max_diff;      // meter, a range further than this from the median of its window is replaced by it
+  uint32_t min_neighbors;     // returns with fewer returns in their window are removed as isolated
+  float ground_max_slope;     // degree, steepest slope between two neighbouring ground pixels
+  float ground_max_height;    // meter, z in the lidar frame above which no pixel is ground
+  float cluster_distance;     // meter, neighbouring pixels closer than this are in the same cluster
+  uint32_t cluster_window;    // half size of the neighbourhood searched for a cluster, 1 for 3 x 3
+  uint32_t min_cluster_size;  // pixels, smaller clusters are discarded
+}RangeImageFilterConfig;
+
+inline RangeImageFilterConfig defaultRangeImageFilterConfig(){
+  RangeImageFilterConfig config = {1, 0.2, 1, 10, -0.3, 0.3, 1, 3};
+  return config;
+}
+
+/**
+ * @brief Connected set of pixels found by RangeImageFilter::cluster()
+ */
+typedef struct{
+  float center[3];          // centroid of the points
+  float min_bound[3];       // axis-aligned bounding box
+  float max_bound[3];
+  uint32_t point_count;
+  int32_t label;            // value of its pixels in getLabels()
+}RangeImageCluster;
+
+/**
+ * @brief Counters of the latest image processed by a RangeImageFilter
+ */
+typedef struct{
+  uint32_t isolated;        // returns removed by denoise() for lack of neighbours
+  uint32_t smoothed;        // ranges replaced by the median of their window
+  uint32_t ground;          // pixels marked by markGround()
+  uint32_t clusters;
+  uint32_t clustered;       // pixels in the kept clusters
+}RangeImageFilterStats;
+
+/**
+ * @brief Image-space filters of a RangeImage
+ *
+ * Neighbours are found by moving by one row or one column instead of searching a kd-tree, so
+ * every filter is a linear pass over the contiguous columns. Buffers are kept across images:
+ * nothing is allocated once the first image of the largest size has been processed. Not
+ * thread-safe; use one filter per thread.
+ */
+class RangeImageFilter{
+
+public:
+
+  RangeImageFilter(const RangeImageFilterConfig& config = defaultRangeImageFilterConfig()){
+    setConfig(config);
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void setConfig(const RangeImageFilterConfig& config){
+    config_ = config;
+    if (config_.median_window > 3){
+      config_.median_window = 3;
+    }
+    if (config_.cluster_window < 1){
+      config_.cluster_window = 1;
+    }
+  }
+
+  const RangeImageFilterConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Median denoise: remove isolated returns and pull outlying ranges to the median of their window
+   * @note A replaced range moves its point along the same ray. Every pixel is judged on the ranges
+   *  of the input image, whatever the order.
+   * @return the number of pixels changed or removed
+   */
+  uint32_t denoise(RangeImage& image){
+    stats_.isolated = stats_.smoothed = 0;
+    source_.assign(image.range.begin(), image.range.end());
+    const int w = (int)config_.median_window;
+    const int rows = (int)image.rows, cols = (int)image.cols;
+    for (int c = 0; c < cols; c++){
+      for (int r = 0; r < rows; r++){
+        uint32_t i = image.index(r, c);
+        float range = source_[i];
+        if (range <= 0){
+          continue;
+        }
+        int n = 0;
+        for (int dc = -w; dc <= w; dc++){
+          int cc = c + dc;
+          if (cc < 0 || cc >= cols){
+            continue;
+          }
+          for (int dr = -w; dr <= w; dr++){
+            int rr = r + dr;
+            if (rr < 0 || rr >= rows){
+              continue;
+            }
+            float v = source_[cc * rows + rr];
+            if (v > 0){
+              window_[n++] = v;
+            }
+          }
+        }
+        if ((uint32_t)(n - 1) < config_.min_neighbors){
+          image.range[i] = 0;
+          stats_.isolated++;
+          continue;
+        }
+        float median = medianOf(window_, n);
+        if (fabsf(range - median) > config_.median_max_diff){
+          float k = median / range;
+          image.range[i] = median;
+          image.x[i] *= k;
+          image.y[i] *= k;
+          image.z[i] *= k;
+          stats_.smoothed++;
+        }
+      }
+    }
+    return stats_.isolated + stats_.smoothed;
+  }
+
+  /**
+   * @brief Mark the ground pixels in getGroundMask()
+   *
+   * Two successive returns of a column, i.e. of the vertical sweep of a scan, below
+   * ground_max_height and joined by a slope under ground_max_slope are ground. Rows are not
+   * compared: along a row even a wall is level. Use denoise() first against spikes.
+   * @return the number of ground pixels
+   */
+  uint32_t markGround(const RangeImage& image){
+    const uint32_t rows = image.rows, cols = image.cols;
+    ground_.assign(image.size(), 0);
+    const float tan_slope = tanf(config_.ground_max_slope * DEGREE_TO_RADIAN);
+    const float height = config_.ground_max_height;
+    auto flat = [&](uint32_t a, uint32_t b){
+      if (image.z[a] > height || image.z[b] > height){
+        return false;
+      }
+      float dx = image.x[a] - image.x[b], dy = image.y[a] - image.y[b], dz = image.z[a] - image.z[b];
+      return fabsf(dz) <= tan_slope * sqrtf(dx * dx + dy * dy);
+    };
+    for (uint32_t c = 0; c < cols; c++){
+      uint32_t prev = UINT32_MAX;    // previous return of the column
+      for (uint32_t r = 0; r < rows; r++){
+        uint32_t i = image.index(r, c);
+        if (!image.valid(i)){
+          continue;
+        }
+        if (prev != UINT32_MAX && flat(prev, i)){
+          ground_[prev] = ground_[i] = 1;
+        }
+        prev = i;
+      }
+    }
+    uint32_t count = 0;
+    for (size_t i = 0; i < ground_.size(); i++){
+      count += ground_[i];
+    }
+    stats_.ground = count;
+    return count;
+  }
+
+  /**
+   * @brief markGround(), then clear the ground pixels from the image
+   * @return the number of pixels removed
+   */
+  uint32_t removeGround(RangeImage& image){
+    uint32_t count = markGround(image);
+    for (size_t i = 0; i < image.size(); i++){
+      if (ground_[i]){
+        image.range[i] = 0;
+      }
+    }
+    return count;
+  }
+
+  /**
+   * @brief Connected components of the returns, skipping the ground marked by the latest markGround() on this image
+   *
+   * Pixels within cluster_window rows and columns of each other and closer than cluster_distance
+   * are connected. Clusters smaller than min_cluster_size are discarded, the other ones get the
+   * labels 0 to N - 1 in getLabels(), where the remaining pixels are -1.
+   * @return the number of clusters
+   */
+  uint32_t cluster(const RangeImage& image, std::vector<RangeImageCluster>& clusters){
+    const int rows = (int)image.rows, cols = (int)image.cols;
+    const int w = (int)config_.cluster_window;
+    const float d2 = config_.cluster_distance * config_.cluster_distance;
+    const bool use_ground = ground_.size() == image.size();
+    labels_.assign(image.size(), -1);
+    queue_.resize(image.size());
+    clusters.clear();
+    stats_.clustered = 0;
+
+    const int32_t PENDING = -2;
+    for (uint32_t seed = 0; seed < (uint32_t)image.size(); seed++){
+      if (labels_[seed] != -1 || !image.valid(seed) || (use_ground && ground_[seed])){
+        continue;
+      }
+      // breadth-first search, the queue ends up holding the whole component
+      size_t head = 0, tail = 0;
+      queue_[tail++] = seed;
+      labels_[seed] = PENDING;
+      while (head < tail){
+        uint32_t i = queue_[head++];
+        int c = (int)(i / rows), r = (int)(i % rows);
+        for (int dc = -w; dc <= w; dc++){
+          int cc = c + dc;
+          if (cc < 0 || cc >= cols){
+            continue;
+          }
+          for (int dr = -w; dr <= w; dr++){
+            int rr = r + dr;
+            if (rr < 0 || rr >= rows){
+              continue;
+            }
+            uint32_t j = (uint32_t)(cc * rows + rr);
+            if (labels_[j] != -1 || !image.valid(j) || (use_ground && ground_[j])){
+              continue;
+            }
+            float dx = image.x[i] - image.x[j], dy = image.y[i] - image.y[j], dz = image.z[i] - image.z[j];
+            if (dx * dx + dy * dy + dz * dz <= d2){
+              labels_[j] = PENDING;
+              queue_[tail++] = j;
+            }
+          }
+        }
+      }
+
+      if (tail < config_.min_cluster_size){
+        for (size_t k = 0; k < tail; k++){
+          labels_[queue_[k]] = DISCARDED;
+        }
+        continue;
+      }
+      RangeImageCluster cl;
+      cl.label = (int32_t)clusters.size();
+      cl.point_count = (uint32_t)tail;
+      double sum[3] = {0, 0, 0};
+      for (int a = 0; a < 3; a++){
+        cl.min_bound[a] = 1e30f;
+        cl.max_bound[a] = -1e30f;
+      }
+      for (size_t k = 0; k < tail; k++){
+        uint32_t i = queue_[k];
+        labels_[i] = cl.label;
+        const float p[3] = {image.x[i], image.y[i], image.z[i]};
+        for (int a = 0; a < 3; a++){
+          sum[a] += p[a];
+          cl.min_bound[a] = p[a] < cl.min_bound[a] ? p[a] : cl.min_bound[a];
+          cl.max_bound[a] = p[a] > cl.max_bound[a] ? p[a] : cl.max_bound[a];
+        }
+      }
+      for (int a = 0; a < 3; a++){
+        cl.center[a] = (float)(sum[a] / tail);
+      }
+      clusters.push_back(cl);
+      stats_.clustered += (uint32_t)tail;
+    }
+    for (size_t i = 0; i < labels_.size(); i++){
+      if (labels_[i] == DISCARDED){
+        labels_[i] = -1;
+      }
+    }
+    stats_.clusters = (uint32_t)clusters.size();
+    return stats_.clusters;
+  }
+
+  /**
+   * @brief Denoise, remove the ground and cluster
+   * @return the number of clusters
+   */
+  uint32_t process(RangeImage& image, std::vector<RangeImageCluster>& clusters){
+    denoise(image);
+    markGround(image);
+    return cluster(image, clusters);
+  }
+
+  /**
+   * @brief Cluster of each pixel of the latest clustered image, -1 for none
+   */
+  const std::vector<int32_t>& getLabels() const{
+    return labels_;
+  }
+
+  /**
+   * @brief 1 for the ground pixels of the latest image given to markGround()
+   */
+  const std::vector<uint8_t>& getGroundMask() const{
+    return ground_;
+  }
+
+  const RangeImageFilterStats& getStats() const{
+    return stats_;
+  }
+
+private:
+
+  static const int32_t DISCARDED = -3;
+
+  /**
+   * @brief Median of a few values, by insertion sort
+   */
+  static float medianOf(float* v, int n){
+    for (int i = 1; i < n; i++){
+      float t = v[i];
+      int j = i - 1;
+      while (j >= 0 && v[j] > t){
+        v[j + 1] = v[j];
+        j--;
+      }
+      v[j + 1] = t;
+    }
+    return (n & 1) ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+  }
+
+  RangeImageFilterConfig config_;
+  RangeImageFilterStats stats_;
+  std::vector<float> source_;       // ranges before denoise()
+  float window_[49];                // up to 7 x 7
+  std::vector<uint8_t> ground_;
+  std::vector<int32_t> labels_;
+  std::vector<uint32_t> queue_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,718 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Types of the records of a lidar log
+ */
+const uint32_t LOG_RECORD_IMU = 101;       // IMUUnitree, as in UDP messages
+const uint32_t LOG_RECORD_SCAN = 102;      // ScanUnitree up to its last valid point
+const uint32_t LOG_RECORD_CLOUD = 106;     // LogCloudHeader followed by the points
+const uint32_t LOG_RECORD_CLOCK_SYNC = 107; // ClockSyncMessage, as in UDP messages
+const uint32_t LOG_RECORD_MAVLINK = 110;   // raw bytes of the serial stream: MavLink frames
+
+namespace detail{
+
+const uint32_t LOG_FILE_MAGIC = 0x474f4c55;     // "ULOG"
+const uint32_t LOG_CHUNK_MAGIC = 0x48434c55;    // "ULCH"
+const uint32_t LOG_INDEX_MAGIC = 0x58494c55;    // "ULIX"
+const uint32_t LOG_VERSION = 1;
+
+/**
+ * @brief Start of a log file, followed by the chunks
+ */
+typedef struct{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;       // bytes of this header
+  uint32_t chunk_size;        // target data bytes of a chunk
+  double created;             // host time the log was created
+  uint8_t reserved[40];
+}LogFileHeader;
+
+/**
+ * @brief Start of a chunk, followed by data_size bytes of records
+ */
+typedef struct{
+  uint32_t magic;
+  uint32_t records;
+  uint64_t data_size;
+  double first_stamp;         // smallest record stamp
+  double last_stamp;          // largest record stamp
+  uint32_t first_id;          // smallest id of the scan and cloud records
+  uint32_t last_id;           // largest id of the scan and cloud records
+  uint32_t id_records;        // scan and cloud records
+  uint32_t reserved0;
+  uint64_t seq;               // position of the chunk in the log
+  uint8_t reserved[8];
+}LogChunkHeader;
+
+/**
+ * @brief Start of a record, followed by size bytes padded to 8 bytes
+ */
+typedef struct{
+  uint32_t type;
+  uint32_t size;
+  double stamp;
+  uint32_t id;                // scan, cloud or IMU id; 0 for MavLink bytes
+  uint32_t reserved;
+}LogRecordHeader;
+
+/**
+ * @brief Entry of the chunk index written when the log is closed
+ */
+typedef struct{
+  uint64_t offset;            // offset of the LogChunkHeader in the file
+  double first_stamp;
+  double last_stamp;
+  uint32_t first_id;
+  uint32_t last_id;
+  uint32_t records;
+  uint32_t id_records;
+  uint64_t reserved;
+}LogIndexEntry;
+
+/**
+ * @brief Last bytes of a closed log, locating the chunk index
+ */
+typedef struct{
+  uint32_t magic;
+  uint32_t chunks;
+  uint64_t index_offset;
+  uint64_t records;
+  uint64_t reserved;
+}LogIndexFooter;
+
+static_assert(sizeof(LogFileHeader) == 64 && sizeof(LogChunkHeader) == 64 && sizeof(LogRecordHeader) == 24
+              && sizeof(LogIndexEntry) == 48 && sizeof(LogIndexFooter) == 32, "log headers have fixed sizes");
+
+inline size_t logPadded(size_t size){
+  return (size + 7) & ~(size_t)7;
+}
+
+inline int writeAll(int fd, const void* data, size_t size){
+  const uint8_t* p = (const uint8_t*)data;
+  while (size > 0){
+    ssize_t n = ::write(fd, p, size);
+    if (n < 0){
+      if (errno == EINTR){
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Payload of a LOG_RECORD_CLOUD record, followed by num PointUnitree
+ */
+typedef struct{
+  double stamp;
+  uint32_t id;
+  uint32_t ringNum;
+  uint32_t num;
+  uint32_t reserved;
+}LogCloudHeader;
+
+/**
+ * @brief Parameters of a LogRecorder
+ */
+typedef struct{
+  uint32_t chunk_size;        // bytes of records buffered before a chunk is written
+  double flush_interval;      // second of record stamps after which a partial chunk is written, 0 to disable
+}LogRecorderConfig;
+
+inline LogRecorderConfig defaultLogRecorderConfig(){
+  LogRecorderConfig config = {1 << 20, 1.0};
+  return config;
+}
+
+/**
+ * @brief Streaming recorder of IMU messages, scans, clouds and raw MavLink bytes
+ *
+ * Records are appended to a chunk buffer of chunk_size bytes, allocated once; a full chunk, or a
+ * chunk older than flush_interval, is written with one write() behind a fixed-size header holding
+ * its stamp and scan id ranges. Memory stays bounded whatever the capture length, and a log
+ * whose recorder died keeps every chunk written so far. close() appends the index of the chunks
+ * so that a LogReader seeks without walking the file.
+ *
+ * File layout: LogFileHeader, then per chunk a LogChunkHeader and its records (LogRecordHeader
+ * plus payload padded to 8 bytes), then the LogIndexEntry array and a LogIndexFooter.
+ * Not thread-safe.
+ */
+class LogRecorder{
+
+public:
+
+  LogRecorder(const LogRecorderConfig& config = defaultLogRecorderConfig()) : config_(config){
+    if (config_.chunk_size < 4096){
+      config_.chunk_size = 4096;
+    }
+    chunk_.reserve(sizeof(detail::LogChunkHeader) + config_.chunk_size);
+  }
+
+  ~LogRecorder(){
+    close();
+  }
+
+  LogRecorder(const LogRecorder&) = delete;
+  LogRecorder& operator=(const LogRecorder&) = delete;
+
+  /**
+   * @brief Create or truncate a log file
+   * @return 0 on success, -1 on failure
+   */
+  int open(const std::string& path, double created = 0){
+    close();
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0){
+      return -1;
+    }
+    detail::LogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = detail::LOG_FILE_MAGIC;
+    header.version = detail::LOG_VERSION;
+    header.header_size = sizeof(header);
+    header.chunk_size = config_.chunk_size;
+    header.created = created;
+    if (detail::writeAll(fd_, &header, sizeof(header)) != 0){
+      ::close(fd_);
+      fd_ = -1;
+      return -1;
+    }
+    offset_ = sizeof(header);
+    index_.clear();
+    records_ = 0;
+    failed_ = false;
+    startChunk();
+    return 0;
+  }
+
+  bool isOpen() const{
+    return fd_ >= 0;
+  }
+
+  /**
+   * @brief Append a record
+   * @return 0 on success, -1 if the recorder is closed or a write failed
+   */
+  int write(uint32_t type, double stamp, uint32_t id, const void* data, size_t size){
+    if (fd_ < 0 || failed_ || size > UINT32_MAX){
+      return -1;
+    }
+    const size_t record = sizeof(detail::LogRecordHeader) + detail::logPadded(size);
+    if (chunk_header_.records > 0 && chunk_.size() + record > sizeof(detail::LogChunkHeader) + config_.chunk_size){
+      if (flush() != 0){
+        return -1;
+      }
+    }
+
+    detail::LogRecordHeader header = {type, (uint32_t)size, stamp, id, 0};
+    size_t pos = chunk_.size();
+    chunk_.resize(pos + record);
+    uint8_t* out = chunk_.data() + pos;
+    memcpy(out, &header, sizeof(header));
+    if (size > 0){
+      memcpy(out + sizeof(header), data, size);
+    }
+    memset(out + sizeof(header) + size, 0, detail::logPadded(size) - size);
+
+    detail::LogChunkHeader& c = chunk_header_;
+    if (c.records == 0){
+      c.first_stamp = c.last_stamp = stamp;
+    }
+    c.first_stamp = std::min(c.first_stamp, stamp);
+    c.last_stamp = std::max(c.last_stamp, stamp);
+    if (type == LOG_RECORD_SCAN || type == LOG_RECORD_CLOUD){
+      if (c.id_records == 0){
+        c.first_id = c.last_id = id;
+      }
+      c.first_id = std::min(c.first_id, id);
+      c.last_id = std::max(c.last_id, id);
+      c.id_records++;
+    }
+    c.records++;
+    records_++;
+
+    if (config_.flush_interval > 0 && c.last_stamp - c.first_stamp >= config_.flush_interval){
+      return flush();
+    }
+    return 0;
+  }
+
+  int writeIMU(const IMUUnitree& imu){
+    return write(LOG_RECORD_IMU, imu.stamp, imu.id, &imu, sizeof(imu));
+  }
+
+  /**
+   * @brief Append a scan, without its points past validPointsNum
+   */
+  int writeScan(const ScanUnitree& scan){
+    uint32_t num = std::min(scan.validPointsNum, (uint32_t)120);
+    return write(LOG_RECORD_SCAN, scan.stamp, scan.id, &scan,
+                 offsetof(ScanUnitree, points) + num * sizeof(PointUnitree));
+  }
+
+  int writeCloud(const PointCloudUnitree& cloud){
+    const size_t points = cloud.points.size() * sizeof(PointUnitree);
+    scratch_.resize(sizeof(LogCloudHeader) + points);
+    LogCloudHeader header = {cloud.stamp, cloud.id, cloud.ringNum, (uint32_t)cloud.points.size(), 0};
+    memcpy(scratch_.data(), &header, sizeof(header));
+    if (points > 0){
+      memcpy(scratch_.data() + sizeof(header), cloud.points.data(), points);
+    }
+    return write(LOG_RECORD_CLOUD, cloud.stamp, cloud.id, scratch_.data(), scratch_.size());
+  }
+
+  /**
+   * @brief Append raw bytes of the serial stream, e.g. each read() of the port
+   * @param stamp host time the bytes were received
+   */
+  int writeMavlink(double stamp, const uint8_t* data, size_t size){
+    return write(LOG_RECORD_MAVLINK, stamp, 0, data, size);
+  }
+
+  /**
+   * @brief Write the buffered records as a chunk
+   * @return 0 on success, -1 on failure
+   */
+  int flush(){
+    if (fd_ < 0 || failed_){
+      return -1;
+    }
+    if (chunk_header_.records == 0){
+      return 0;
+    }
+    chunk_header_.data_size = chunk_.size() - sizeof(detail::LogChunkHeader);
+    memcpy(chunk_.data(), &chunk_header_, sizeof(chunk_header_));
+    if (detail::writeAll(fd_, chunk_.data(), chunk_.size()) != 0){
+      failed_ = true;
+      return -1;
+    }
+    const detail::LogChunkHeader& c = chunk_header_;
+    detail::LogIndexEntry entry = {offset_, c.first_stamp, c.last_stamp, c.first_id, c.last_id,
+                                   c.records, c.id_records, 0};
+    index_.push_back(entry);
+    offset_ += chunk_.size();
+    startChunk();
+    return 0;
+  }
+
+  /**
+   * @brief Write the pending chunk and the index, and close the file
+   * @return 0 on success, -1 if some data could not be written
+   */
+  int close(){
+    if (fd_ < 0){
+      return 0;
+    }
+    int result = flush();
+    if (result == 0){
+      detail::LogIndexFooter footer = {detail::LOG_INDEX_MAGIC, (uint32_t)index_.size(), offset_, records_, 0};
+      if (detail::writeAll(fd_, index_.data(), index_.size() * sizeof(detail::LogIndexEntry)) != 0
+          || detail::writeAll(fd_, &footer, sizeof(footer)) != 0){
+        result = -1;
+      }
+    }
+    if (::close(fd_) != 0){
+      result = -1;
+    }
+    fd_ = -1;
+    return result;
+  }
+
+  /**
+   * @brief Records appended since open()
+   */
+  uint64_t recordCount() const{
+    return records_;
+  }
+
+  /**
+   * @brief Bytes written to the file so far, the buffered chunk excluded
+   */
+  uint64_t bytesWritten() const{
+    return offset_;
+  }
+
+private:
+
+  void startChunk(){
+    memset(&chunk_header_, 0, sizeof(chunk_header_));
+    chunk_header_.magic = detail::LOG_CHUNK_MAGIC;
+    chunk_header_.seq = index_.size();
+    chunk_.resize(sizeof(detail::LogChunkHeader));
+  }
+
+  LogRecorderConfig config_;
+  int fd_ = -1;
+  bool failed_ = false;
+  uint64_t offset_ = 0;
+  uint64_t records_ = 0;
+  std::vector<uint8_t> chunk_;            // chunk header and records being buffered
+  detail::LogChunkHeader chunk_header_;
+  std::vector<detail::LogIndexEntry> index_;
+  std::vector<uint8_t> scratch_;
+};
+
+/**
+ * @brief One record of a log, pointing into the mapped file
+ */
+typedef struct{
+  uint32_t type;
+  uint32_t size;              // bytes of data
+  double stamp;
+  uint32_t id;
+  const uint8_t* data;        // valid until the reader is closed
+}LogRecordView;
+
+/**
+ * @brief Memory-mapped reader of a log written by a LogRecorder
+ *
+ * The whole file is mapped read-only, so records are read in place and only the pages
+ * actually visited are loaded. seekTime() and seekScanId() binary-search the chunk index, then
+ * walk a single chunk. A log that was not closed has no index: it is rebuilt from the chunk
+ * headers, and a truncated last chunk is ignored.
+ */
+class LogReader{
+
+public:
+
+  LogReader(){}
+
+  ~LogReader(){
+    close();
+  }
+
+  LogReader(const LogReader&) = delete;
+  LogReader& operator=(const LogReader&) = delete;
+
+  /**
+   * @brief Map a log file
+   * @return 0 on success, -1 if the file cannot be mapped or is not a log
+   */
+  int open(const std::string& path){
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+      return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(detail::LogFileHeader)){
+      ::close(fd);
+      return -1;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED){
+      return -1;
+    }
+    data_ = (const uint8_t*)p;
+    size_ = st.st_size;
+    madvise(p, size_, MADV_SEQUENTIAL);
+
+    const detail::LogFileHeader* header = (const detail::LogFileHeader*)data_;
+    if (header->magic != detail::LOG_FILE_MAGIC || header->version != detail::LOG_VERSION
+        || header->header_size < sizeof(detail::LogFileHeader) || header->header_size > size_){
+      close();
+      return -1;
+    }
+    header_size_ = header->header_size;
+    if (loadIndex() != 0){
+      rebuildIndex();
+    }
+    rewind();
+    return 0;
+  }
+
+  void close(){
+    if (data_){
+      munmap((void*)data_, size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    index_.clear();
+    records_ = 0;
+    chunk_ = 0;
+    pos_ = end_ = 0;
+  }
+
+  bool isOpen() const{
+    return data_ != nullptr;
+  }
+
+  size_t chunkCount() const{
+    return index_.size();
+  }
+
+  uint64_t recordCount() const{
+    return records_;
+  }
+
+  /**
+   * @brief Smallest record stamp of the log, 0 if empty
+   */
+  double startStamp() const{
+    return index_.empty() ? 0 : index_.front().first_stamp;
+  }
+
+  /**
+   * @brief Largest record stamp of the log, 0 if empty
+   */
+  double endStamp() const{
+    double stamp = 0;
+    for (size_t i = 0; i < index_.size(); i++){
+      stamp = (i == 0) ? index_[i].last_stamp : std::max(stamp, index_[i].last_stamp);
+    }
+    return stamp;
+  }
+
+  /**
+   * @brief Go back to the first record
+   */
+  void rewind(){
+    enterChunk(0);
+  }
+
+  /**
+   * @brief Go to the first record with a stamp at or after stamp
+   * @note Stamps are expected to increase from chunk to chunk, as when recording live.
+   * @return 0 on success, -1 if every record is older
+   */
+  int seekTime(double stamp){
+    size_t c = 0;
+    while (c < index_.size()){
+      // first chunk ending at or after stamp
+      size_t lo = c, hi = index_.size();
+      while (lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if (index_[mid].last_stamp < stamp){
+          lo = mid + 1;
+        }
+        else{
+          hi = mid;
+        }
+      }
+      if (lo == index_.size()){
+        break;
+      }
+      enterChunk(lo);
+      size_t pos;
+      LogRecordView view;
+      while (pos = pos_, next(&view) == 0 && chunk_ == lo){
+        if (view.stamp >= stamp){
+          pos_ = pos;
+          return 0;
+        }
+      }
+      c = lo + 1;
+    }
+    enterChunk(index_.size());
+    return -1;
+  }
+
+  /**
+   * @brief Go to the first scan or cloud record with an id at or after id
+   * @note Ids are expected to increase through the log, without wrapping.
+   * @return 0 on success, -1 if no scan or cloud has such an id
+   */
+  int seekScanId(uint32_t id){
+    size_t lo = 0, hi = index_.size();
+    while (lo < hi){
+      size_t mid = (lo + hi) / 2;
+      if (index_[mid].id_records == 0 || index_[mid].last_id < id){
+        lo = mid + 1;
+      }
+      else{
+        hi = mid;
+      }
+    }
+    for (size_t c = lo; c < index_.size(); c++){
+      if (index_[c].id_records == 0 || index_[c].last_id < id){
+        continue;
+      }
+      enterChunk(c);
+      size_t pos;
+      LogRecordView view;
+      while (pos = pos_, next(&view) == 0 && chunk_ == c){
+        if ((view.type == LOG_RECORD_SCAN || view.type == LOG_RECORD_CLOUD) && view.id >= id){
+          pos_ = pos;
+          return 0;
+        }
+      }
+    }
+    enterChunk(index_.size());
+    return -1;
+  }
+
+  /**
+   * @brief Read the next record
+   * @return 0 on success, -1 at the end of the log
+   */
+  int next(LogRecordView* view){
+    while (pos_ >= end_){
+      if (chunk_ + 1 >= index_.size()){
+        chunk_ = index_.size();
+        return -1;
+      }
+      enterChunk(chunk_ + 1);
+    }
+    const detail::LogRecordHeader* header = (const detail::LogRecordHeader*)(data_ + pos_);
+    if (end_ - pos_ < sizeof(detail::LogRecordHeader)
+        || end_ - pos_ - sizeof(detail::LogRecordHeader) < detail::logPadded(header->size)){
+      pos_ = end_;    // corrupted chunk, skip the rest of it
+      return next(view);
+    }
+    view->type = header->type;
+    view->size = header->size;
+    view->stamp = header->stamp;
+    view->id = header->id;
+    view->data = data_ + pos_ + sizeof(detail::LogRecordHeader);
+    pos_ += sizeof(detail::LogRecordHeader) + detail::logPadded(header->size);
+    return 0;
+  }
+
+  /**
+   * @brief Copy a LOG_RECORD_SCAN record into a scan
+   * @return 0 on success, -1 if the record is not a valid scan
+   */
+  static int toScan(const LogRecordView& view, ScanUnitree& scan){
+    const size_t prefix = offsetof(ScanUnitree, points);
+    if (view.type != LOG_RECORD_SCAN || view.size < prefix || view.size > sizeof(ScanUnitree)){
+      return -1;
+    }
+    memcpy(&scan, view.data, view.size);
+    uint32_t num = (uint32_t)((view.size - prefix) / sizeof(PointUnitree));
+    if (scan.validPointsNum > num){
+      scan.validPointsNum = num;
+    }
+    return 0;
+  }
+
+  static int toIMU(const LogRecordView& view, IMUUnitree& imu){
+    if (view.type != LOG_RECORD_IMU || view.size != sizeof(IMUUnitree)){
+      return -1;
+    }
+    memcpy(&imu, view.data, sizeof(imu));
+    return 0;
+  }
+
+  /**
+   * @brief Copy a LOG_RECORD_CLOUD record into a cloud, reusing its capacity
+   */
+  static int toCloud(const LogRecordView& view, PointCloudUnitree& cloud){
+    if (view.type != LOG_RECORD_CLOUD || view.size < sizeof(LogCloudHeader)){
+      return -1;
+    }
+    LogCloudHeader header;
+    memcpy(&header, view.data, sizeof(header));
+    if (view.size < sizeof(header) + (size_t)header.num * sizeof(PointUnitree)){
+      return -1;
+    }
+    cloud.stamp = header.stamp;
+    cloud.id = header.id;
+    cloud.ringNum = header.ringNum;
+    cloud.points.resize(header.num);
+    if (header.num > 0){
+      memcpy(cloud.points.data(), view.data + sizeof(header), header.num * sizeof(PointUnitree));
+    }
+    return 0;
+  }
+
+private:
+
+  int loadIndex(){
+    if (size_ < header_size_ + sizeof(detail::LogIndexFooter)){
+      return -1;
+    }
+    detail::LogIndexFooter footer;
+    memcpy(&footer, data_ + size_ - sizeof(footer), sizeof(footer));
+    const size_t entries = (size_t)footer.chunks * sizeof(detail::LogIndexEntry);
+    if (footer.magic != detail::LOG_INDEX_MAGIC || footer.index_offset < header_size_
+        || footer.index_offset > size_ || footer.index_offset + entries + sizeof(footer) != size_){
+      return -1;
+    }
+    index_.resize(footer.chunks);
+    if (entries > 0){
+      memcpy(index_.data(), data_ + footer.index_offset, entries);
+    }
+    for (size_t i = 0; i < index_.size(); i++){
+      if (!validChunk(index_[i].offset, footer.index_offset)){
+        index_.clear();
+        return -1;
+      }
+    }
+    records_ = footer.records;
+    return 0;
+  }
+
+  /**
+   * @brief Walk the chunk headers of a log that was not closed
+   */
+  void rebuildIndex(){
+    index_.clear();
+    records_ = 0;
+    uint64_t offset = header_size_;
+    while (validChunk(offset, size_)){
+      const detail::LogChunkHeader* c = (const detail::LogChunkHeader*)(data_ + offset);
+      detail::LogIndexEntry entry = {offset, c->first_stamp, c->last_stamp, c->first_id, c->last_id,
+                                     c->records, c->id_records, 0};
+      index_.push_back(entry);
+      records_ += c->records;
+      offset += sizeof(detail::LogChunkHeader) + c->data_size;
+    }
+  }
+
+  bool validChunk(uint64_t offset, uint64_t limit) const{
+    if (offset + sizeof(detail::LogChunkHeader) > limit){
+      return false;
+    }
+    const detail::LogChunkHeader* c = (const detail::LogChunkHeader*)(data_ + offset);
+    return c->magic == detail::LOG_CHUNK_MAGIC && c->data_size <= limit - offset - sizeof(detail::LogChunkHeader);
+  }
+
+  void enterChunk(size_t c){
+    chunk_ = c;
+    if (c >= index_.size()){
+      pos_ = end_ = 0;
+      return;
+    }
+    const detail::LogChunkHeader* header = (const detail::LogChunkHeader*)(data_ + index_[c].offset);
+    pos_ = index_[c].offset + sizeof(detail::LogChunkHeader);
+    end_ = pos_ + header->data_size;
+  }
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t header_size_ = 0;
+  std::vector<detail::LogIndexEntry> index_;
+  uint64_t records_ = 0;
+  size_t chunk_ = 0;          // chunk being read
+  size_t pos_ = 0;            // offset of the next record
+  size_t end_ = 0;            // end of the records of the chunk
+};
+
+} // end of namespace unitree_lidar_sdk
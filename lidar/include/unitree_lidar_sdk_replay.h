@@ -0,0 +1,383 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "unitree_lidar_sdk_event_reader.h"
+#include "unitree_lidar_sdk_recorder.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a replay
+ */
+typedef struct{
+  double speed;           // 1 for real time, 2 for twice as fast, ...; 0 or less as fast as possible
+  bool loop;              // start again at the end, with stamps continuing after the last one
+  uint32_t baudrate;      // pace of raw byte files, which carry no stamps: baudrate / 10 bytes per second
+}ReplayConfig;
+
+inline ReplayConfig defaultReplayConfig(){
+  ReplayConfig config = {1.0, false, 2000000};
+  return config;
+}
+
+/**
+ * @brief Byte source replaying a recorded serial stream
+ *
+ * Reads either a LogRecorder log, whose LOG_RECORD_MAVLINK records are replayed at the pace of
+ * their stamps, or a raw dump of the serial port (e.g. `cat /dev/ttyUSB0 > dump.bin`), replayed
+ * at the byte rate of the baudrate with stamps counted from 0. Bytes only become readable once
+ * their recorded time is due, scaled by speed, and waitReadable() sleeps until then, so a reader
+ * waiting on this source behaves as it does on the port. Written commands are dropped.
+ */
+class ReplaySource : public ByteSource{
+
+public:
+
+  ReplaySource(const ReplayConfig& config = defaultReplayConfig()) : config_(config){
+    if (config_.baudrate == 0){
+      config_.baudrate = 2000000;
+    }
+  }
+
+  virtual ~ReplaySource(){
+    close();
+  }
+
+  /**
+   * @brief Open a log or a raw byte file
+   * @return 0 on success, -1 if the file cannot be read or a log holds no MavLink bytes
+   */
+  int open(const std::string& path){
+    close();
+    if (log_.open(path) == 0){
+      LogRecordView record;
+      bool raw = false;
+      while (!raw && log_.next(&record) == 0){
+        raw = (record.type == LOG_RECORD_MAVLINK);
+      }
+      if (!raw){
+        log_.close();
+        return -1;
+      }
+      is_log_ = true;
+    }
+    else{
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0){
+        return -1;
+      }
+      struct stat st;
+      if (fstat(fd, &st) != 0 || st.st_size == 0){
+        ::close(fd);
+        return -1;
+      }
+      void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED){
+        return -1;
+      }
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      raw_data_ = (const uint8_t*)p;
+      raw_size_ = st.st_size;
+      is_log_ = false;
+    }
+    open_ = true;
+    restart();
+    stamp_offset_ = 0;
+    return 0;
+  }
+
+  void close(){
+    log_.close();
+    if (raw_data_){
+      munmap((void*)raw_data_, raw_size_);
+    }
+    raw_data_ = nullptr;
+    raw_size_ = 0;
+    open_ = false;
+    finished_ = false;
+  }
+
+  virtual bool isOpen() const{
+    return open_;
+  }
+
+  virtual int read(uint8_t* buf, size_t size){
+    if (!open_ || (!available() && finished_)){
+      return -1;
+    }
+    if (!available() || !due()){
+      return 0;
+    }
+    size_t n = std::min(size, (size_t)(chunk_size_ - chunk_pos_));
+    if (!is_log_){
+      // raw bytes are due one by one at the byte rate; short reads keep their stamps close
+      n = std::min(n, (size_t)512);
+      if (config_.speed > 0){
+        n = std::min(n, (size_t)std::max(0.0, elapsed() * byteRate() - (double)chunk_pos_) + 1);
+      }
+    }
+    memcpy(buf, chunk_ + chunk_pos_, n);
+    chunk_pos_ += n;
+    stamp_ = chunkStamp() + stamp_offset_;
+    if (!is_log_){
+      stamp_ += chunk_pos_ / byteRate();
+    }
+    if (chunk_pos_ >= chunk_size_){
+      nextChunk();
+    }
+    return (int)n;
+  }
+
+  virtual int write(const uint8_t*, size_t size){
+    return (int)size;
+  }
+
+  virtual int waitReadable(int timeout_ms, int wake_fd = -1){
+    if (!open_ || (!available() && finished_)){
+      return -1;
+    }
+    double wait = available() ? std::max(0.0, dueIn()) : 0;
+    if (wait <= 0){
+      return 1;
+    }
+    int wait_ms = (int)ceil(wait * 1000);
+    bool due = true;
+    if (timeout_ms >= 0 && timeout_ms < wait_ms){
+      wait_ms = timeout_ms;
+      due = false;
+    }
+    struct pollfd pfd = {wake_fd, POLLIN, 0};
+    int n = poll(&pfd, wake_fd >= 0 ? 1 : 0, wait_ms);
+    if (n != 0){
+      return 0;     // woken up or interrupted
+    }
+    return due ? 1 : 0;
+  }
+
+  /**
+   * @brief Recorded time of the last bytes read; for raw files, seconds since the start of the file
+   */
+  double stamp() const{
+    return stamp_;
+  }
+
+  /**
+   * @brief True once every byte has been read, never when looping
+   */
+  bool isFinished() const{
+    return finished_ && !available();
+  }
+
+private:
+
+  /**
+   * @brief Go back to the start of the recording and restart the clock
+   */
+  void restart(){
+    chunk_ = nullptr;
+    chunk_size_ = chunk_pos_ = 0;
+    finished_ = false;
+    if (is_log_){
+      log_.rewind();
+      first_stamp_ = -1;
+    }
+    else{
+      first_stamp_ = 0;
+    }
+    nextChunk();
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  void nextChunk(){
+    chunk_pos_ = 0;
+    if (is_log_){
+      LogRecordView record;
+      while (log_.next(&record) == 0){
+        if (record.type == LOG_RECORD_MAVLINK && record.size > 0){
+          if (first_stamp_ < 0){
+            first_stamp_ = record.stamp;
+          }
+          chunk_ = record.data;
+          chunk_size_ = record.size;
+          chunk_stamp_ = record.stamp;
+          return;
+        }
+      }
+    }
+    else if (chunk_ == nullptr){
+      chunk_ = raw_data_;
+      chunk_size_ = raw_size_;
+      chunk_stamp_ = 0;
+      return;
+    }
+
+    // end of the recording
+    chunk_ = nullptr;
+    chunk_size_ = 0;
+    if (config_.loop){
+      stamp_offset_ = stamp_ + 1.0 / byteRate() - (is_log_ ? first_stamp_ : 0);
+      restart();
+      return;
+    }
+    finished_ = true;
+  }
+
+  bool available() const{
+    return chunk_ != nullptr && chunk_pos_ < chunk_size_;
+  }
+
+  double chunkStamp() const{
+    return chunk_stamp_;
+  }
+
+  double byteRate() const{
+    return config_.baudrate / 10.0;
+  }
+
+  double elapsed() const{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count() * config_.speed;
+  }
+
+  /**
+   * @brief Recorded seconds until the next byte is due, scaled to wall time
+   */
+  double dueIn() const{
+    if (config_.speed <= 0){
+      return 0;
+    }
+    double at = is_log_ ? chunk_stamp_ - first_stamp_ : chunk_pos_ / byteRate();
+    return (at - elapsed()) / config_.speed;
+  }
+
+  bool due() const{
+    return dueIn() <= 0;
+  }
+
+  ReplayConfig config_;
+  bool open_ = false;
+  bool is_log_ = false;
+  bool finished_ = false;
+  LogReader log_;
+  const uint8_t* raw_data_ = nullptr;
+  size_t raw_size_ = 0;
+  const uint8_t* chunk_ = nullptr;      // bytes being replayed
+  size_t chunk_size_ = 0;
+  size_t chunk_pos_ = 0;
+  double chunk_stamp_ = 0;
+  double first_stamp_ = 0;
+  double stamp_ = 0;
+  double stamp_offset_ = 0;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Unitree Lidar Reader replaying a recorded serial stream instead of the serial port
+ *
+ * The recorded bytes go through the same MavLink decoder and scan conversion as the live ones,
+ * so runParse(), waitForMessage(), getCloud() and getIMU() return the same messages, paced as
+ * configured by ReplayConfig. Clouds and IMU messages are stamped with the recorded host time
+ * of their bytes instead of the current time, so a replay as fast as possible gives the same
+ * stamps as one in real time. The port argument of initialize() is the file to replay, unless
+ * open() was called before. Commands sent to the lidar are dropped.
+ */
+class UnitreeLidarReplayReader : public UnitreeLidarEventReader{
+
+public:
+
+  UnitreeLidarReplayReader(const ReplayConfig& config = defaultReplayConfig()) : replay_(config){
+    setByteSource(&replay_);
+
+    // a recording has no link to supervise: commands are dropped and its pace is not the lidar's
+    ConnectionConfig connection = defaultConnectionConfig();
+    connection.auto_reconnect = false;
+    connection.version_retries = 0;
+    connection.spinup_timeout_ms = 0;
+    connection.stall_timeout_ms = 0;
+    setConnectionConfig(connection);
+  }
+
+  virtual ~UnitreeLidarReplayReader(){
+    stop();
+  }
+
+  /**
+   * @brief Open the log or raw byte file to replay
+   * @return 0 on success, -1 otherwise
+   */
+  int open(const std::string& path){
+    return replay_.open(path);
+  }
+
+  virtual int initialize(
+      uint16_t cloud_scan_num = 18,
+      std::string port = "",
+      uint32_t baudrate = 2000000,
+      float rotate_yaw_bias = 0,
+      float range_scale = 0.001,
+      float range_bias = 0,
+      float range_max = 50,
+      float range_min = 0
+  ){
+    if (!replay_.isOpen() && replay_.open(port) != 0){
+      return -1;
+    }
+    return UnitreeLidarEventReader::initialize(cloud_scan_num, port, baudrate, rotate_yaw_bias,
+                                               range_scale, range_bias, range_max, range_min);
+  }
+
+  virtual MessageType runParse(){
+    MessageType result = UnitreeLidarEventReader::runParse();
+    finished_ = (result == NONE && replay_.isFinished());
+    return result;
+  }
+
+  /**
+   * @brief True once the whole recording has been parsed, never when looping
+   */
+  bool isFinished() const{
+    return finished_;
+  }
+
+protected:
+
+  virtual double messageStamp() const{
+    return replay_.stamp();
+  }
+
+  ReplaySource replay_;
+  bool finished_ = false;
+};
+
+/**
+ * @brief Create a Unitree Lidar Reader replaying a recorded stream
+ * @param path log written by a LogRecorder, or raw bytes of the serial port
+ * @return UnitreeLidarReplayReader*, to be initialized like a live reader; nullptr if the file
+ *  cannot be replayed
+ */
+inline UnitreeLidarReplayReader* createUnitreeLidarReplayReader(const std::string& path,
+                                                                const ReplayConfig& config = defaultReplayConfig()){
+  UnitreeLidarReplayReader* reader = new UnitreeLidarReplayReader(config);
+  if (reader->open(path) != 0){
+    delete reader;
+    return nullptr;
+  }
+  return reader;
+}
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,202 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "unitree_lidar_sdk_scan_kernel.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a ScanFilter
+ * @note A stage whose threshold is 0 is skipped.
+ */
+typedef struct{
+  bool enabled;                   // false: the scans are left untouched
+  float min_intensity;            // returns with a weaker reflect_data are removed
+  float dust_max_range;           // meter, returns this close...
+  float dust_max_intensity;       // ...and at most this strong are dust on or near the cover
+  uint32_t isolated_min_neighbors;// returns with fewer close neighbours are removed, at most 5
+  float isolated_distance;        // meter, a neighbour closer than hypot(isolated_distance,...
+  float isolated_range_ratio;     // ...isolated_range_ratio * range) is close
+}ScanFilterConfig;
+
+inline ScanFilterConfig defaultScanFilterConfig(){
+  ScanFilterConfig config = {false, 0, 0.3, 20, 1, 0.1, 0.05};
+  return config;
+}
+
+/**
+ * @brief Points removed by a ScanFilter, by cause
+ */
+typedef struct{
+  uint32_t intensity;
+  uint32_t dust;
+  uint32_t isolated;
+}ScanFilterCounts;
+
+namespace detail{
+
+/**
+ * @brief Neighbours of the points of a scan, padded by one invalid lane on each side
+ */
+typedef struct{
+  alignas(16) float x[POINTS_NUM_OF_SCAN + 2];
+  alignas(16) float y[POINTS_NUM_OF_SCAN + 2];
+  alignas(16) float z[POINTS_NUM_OF_SCAN + 2];
+  alignas(16) int32_t valid[POINTS_NUM_OF_SCAN + 2];
+}ScanFilterNeighbors;
+
+inline __attribute__((always_inline)) int32_t closeNeighbor(const ScanFilterNeighbors& n, int k,
+                                                            float x, float y, float z, float limit2){
+  float dx = n.x[k] - x, dy = n.y[k] - y, dz = n.z[k] - z;
+  return n.valid[k] & (dx * dx + dy * dy + dz * dz <= limit2);
+}
+
+/**
+ * @brief Branch-free pass over the 120 lanes; cur holds this scan after the intensity and dust stages
+ */
+inline __attribute__((always_inline)) void filterScanLanesImpl(
+    const ScanFilterConfig& config, ScanLanes* __restrict lanes, ScanFilterNeighbors* __restrict cur,
+    const ScanFilterNeighbors* __restrict prev, ScanFilterCounts* counts){
+
+  const float min_intensity = config.min_intensity;
+  const float dust_range2 = config.dust_max_range * config.dust_max_range;
+  const float dust_intensity = config.dust_max_intensity;
+  const float distance2 = config.isolated_distance * config.isolated_distance;
+  const float ratio2 = config.isolated_range_ratio * config.isolated_range_ratio;
+  const int32_t min_neighbors = (int32_t)config.isolated_min_neighbors;
+
+  uint32_t weak = 0, dust = 0, isolated = 0;
+  for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+    float x = lanes->x[j], y = lanes->y[j], z = lanes->z[j];
+    float r2 = x * x + y * y + z * z;
+    int32_t valid = lanes->valid[j];
+    int32_t is_weak = valid & (lanes->intensity[j] < min_intensity);
+    int32_t is_dust = valid & (is_weak ^ 1) & (r2 <= dust_range2) & (lanes->intensity[j] <= dust_intensity);
+    weak += is_weak;
+    dust += is_dust;
+    valid &= (is_weak | is_dust) ^ 1;
+    lanes->valid[j] = valid;
+    cur->x[j + 1] = x;
+    cur->y[j + 1] = y;
+    cur->z[j + 1] = z;
+    cur->valid[j + 1] = valid;
+  }
+
+  if (min_neighbors > 0){
+    for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+      float x = lanes->x[j], y = lanes->y[j], z = lanes->z[j];
+      float limit2 = distance2 + ratio2 * (x * x + y * y + z * z);    // no sqrt: it would not vectorize
+      int k = j + 1;
+      int32_t n = closeNeighbor(*cur, k - 1, x, y, z, limit2) + closeNeighbor(*cur, k + 1, x, y, z, limit2)
+                + closeNeighbor(*prev, k - 1, x, y, z, limit2) + closeNeighbor(*prev, k, x, y, z, limit2)
+                + closeNeighbor(*prev, k + 1, x, y, z, limit2);
+      int32_t is_isolated = lanes->valid[j] & (n < min_neighbors);
+      isolated += is_isolated;
+      lanes->valid[j] &= is_isolated ^ 1;
+    }
+  }
+
+  counts->intensity = weak;
+  counts->dust = dust;
+  counts->isolated = isolated;
+}
+
+#ifdef UNITREE_SCAN_KERNEL_AVX2
+__attribute__((target("avx2,fma"))) inline void filterScanLanesAvx2(
+    const ScanFilterConfig& config, ScanLanes* lanes, ScanFilterNeighbors* cur,
+    const ScanFilterNeighbors* prev, ScanFilterCounts* counts){
+  filterScanLanesImpl(config, lanes, cur, prev, counts);
+}
+#endif
+
+inline void filterScanLanesBaseline(
+    const ScanFilterConfig& config, ScanLanes* lanes, ScanFilterNeighbors* cur,
+    const ScanFilterNeighbors* prev, ScanFilterCounts* counts){
+  filterScanLanesImpl(config, lanes, cur, prev, counts);
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Noise removal on the 120 lanes of each scan, before they are compacted into a cloud
+ *
+ * Three stages clear the valid flags of the lanes:
+ * - intensity: returns with a reflect_data under min_intensity;
+ * - dust: returns within dust_max_range of the lidar with a reflect_data of at most
+ *   dust_max_intensity, i.e. dirt on the cover or dust in front of it;
+ * - isolated returns: fewer than isolated_min_neighbors of the 5 neighbours of a point are
+ *   close to it, the neighbours being the previous and next points of its sweep (ring) and the
+ *   3 points around the same index in the previous scan (azimuth). Only the previous scan is
+ *   used, so no scan is delayed; after a lost packet, the first scan has its ring neighbours only.
+ *
+ * Each stage is a branch-free pass over the lanes, vectorized like the scan kernel. Not thread-safe.
+ */
+class ScanFilter{
+
+public:
+
+  ScanFilter(const ScanFilterConfig& config = defaultScanFilterConfig()){
+    setConfig(config);
+    reset();
+  }
+
+  void setConfig(const ScanFilterConfig& config){
+    config_ = config;
+    if (config_.isolated_min_neighbors > 5){
+      config_.isolated_min_neighbors = 5;
+    }
+  }
+
+  const ScanFilterConfig& getConfig() const{
+    return config_;
+  }
+
+  bool isEnabled() const{
+    return config_.enabled;
+  }
+
+  /**
+   * @brief Forget the previous scan, e.g. after a lost packet
+   */
+  void reset(){
+    memset(&neighbors_[0], 0, sizeof(neighbors_[0]));
+    memset(&neighbors_[1], 0, sizeof(neighbors_[1]));
+    current_ = 0;
+  }
+
+  /**
+   * @brief Filter the lanes of the next scan in place
+   * @return the points removed by each stage
+   */
+  ScanFilterCounts apply(ScanLanes& lanes){
+    ScanFilterCounts counts = {0, 0, 0};
+    if (!config_.enabled){
+      return counts;
+    }
+    current_ ^= 1;
+    detail::ScanFilterNeighbors* cur = &neighbors_[current_];
+    const detail::ScanFilterNeighbors* prev = &neighbors_[current_ ^ 1];
+#ifdef UNITREE_SCAN_KERNEL_AVX2
+    if (detail::cpuHasAvx2()){
+      detail::filterScanLanesAvx2(config_, &lanes, cur, prev, &counts);
+      return counts;
+    }
+#endif
+    detail::filterScanLanesBaseline(config_, &lanes, cur, prev, &counts);
+    return counts;
+  }
+
+private:
+
+  ScanFilterConfig config_;
+  detail::ScanFilterNeighbors neighbors_[2];   // this scan and the previous one, valid[0] and valid[121] stay 0
+  int current_ = 0;
+};
+
+} // end of namespace unitree_lidar_sdk
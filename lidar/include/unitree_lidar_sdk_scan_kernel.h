@@ -0,0 +1,288 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+#include "mavlink/SysMavlink/mavlink.h"
+
+namespace unitree_lidar_sdk{
+
+const int POINTS_NUM_OF_SCAN = 120;
+
+/**
+ * @brief Conversion parameters, with the same meaning as the ones of UnitreeLidarReader::initialize()
+ */
+typedef struct{
+  float rotate_yaw_bias;  // degree
+  float range_scale;
+  float range_bias;
+  float range_max;
+  float range_min;
+}ScanConvertConfig;
+
+inline ScanConvertConfig defaultScanConvertConfig(){
+  ScanConvertConfig config = {0, 0.001, 0, 50, 0};
+  return config;
+}
+
+/**
+ * @brief The 120 points of one range/auxiliary packet pair before compaction
+ * @note valid[j] is 1 if the point passes the range gates, 0 otherwise.
+ */
+typedef struct{
+  alignas(16) float x[POINTS_NUM_OF_SCAN];
+  alignas(16) float y[POINTS_NUM_OF_SCAN];
+  alignas(16) float z[POINTS_NUM_OF_SCAN];
+  alignas(16) float intensity[POINTS_NUM_OF_SCAN];
+  alignas(16) float time[POINTS_NUM_OF_SCAN];
+  alignas(16) int32_t valid[POINTS_NUM_OF_SCAN];
+}ScanLanes;
+
+namespace detail{
+
+/**
+ * @brief Branch-free single precision sin/cos (Cephes polynomials), vectorizable by the compiler
+ */
+inline __attribute__((always_inline)) void sincosLane(float x, float* s, float* c){
+  const float two_over_pi = 0.636619772367581343f;
+  int32_t q = (int32_t)(x * two_over_pi + (x >= 0 ? 0.5f : -0.5f));
+  float qf = (float)q;
+  float y = ((x - qf * 1.5703125f) - qf * 4.837512969970703125e-4f) - qf * 7.54978995489188216e-8f;
+  float y2 = y * y;
+
+  float ps = ((-1.9515295891e-4f * y2 + 8.3321608736e-3f) * y2 - 1.6666654611e-1f) * y2 * y + y;
+  float pc = ((2.443315711809948e-5f * y2 - 1.388731625493765e-3f) * y2 + 4.166664568298827e-2f) * y2 * y2
+             - 0.5f * y2 + 1.0f;
+
+  int32_t swap = q & 1;
+  float sv = swap ? pc : ps;
+  float cv = swap ? ps : pc;
+  *s = (q & 2) ? -sv : sv;
+  *c = ((q + 1) & 2) ? -cv : cv;
+}
+
+inline __attribute__((always_inline)) void computeScanLanesImpl(
+    const mavlink_ret_lidar_auxiliary_data_packet_t& aux, const uint8_t* point_data,
+    const ScanConvertConfig& config, float sin_theta, float cos_theta, float sin_ksi, float cos_ksi,
+    float time_start, float time_step, ScanLanes* __restrict lanes){
+
+  const float z_bias = 0.0445f;
+  const float bias_laser_beam = aux.b_axis_dist / 1000;
+  const float ax = -cos_theta * sin_ksi;
+  const float bx = sin_theta * cos_ksi;
+  const float az = sin_theta * sin_ksi;
+  const float bz = cos_theta * cos_ksi;
+
+  const float pitch_start = aux.sys_vertical_angle_start * DEGREE_TO_RADIAN;
+  const float pitch_step = aux.sys_vertical_angle_span * DEGREE_TO_RADIAN;
+  const float yaw_start = (aux.com_horizontal_angle_start + config.rotate_yaw_bias) * DEGREE_TO_RADIAN;
+  const float yaw_step = aux.com_horizontal_angle_step / POINTS_NUM_OF_SCAN * DEGREE_TO_RADIAN;
+  const float range_scale = config.range_scale;
+  const float range_bias = config.range_bias;
+  const float range_min = config.range_min;
+  const float range_max = config.range_max;
+
+  alignas(16) uint16_t raw[POINTS_NUM_OF_SCAN];
+  memcpy(raw, point_data, sizeof(raw));  // little endian, as the MavLink wire format
+
+  for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+    float jf = (float)j;
+    float range = range_scale * raw[j] + range_bias;
+
+    float sin_alpha, cos_alpha, sin_beta, cos_beta;
+    sincosLane(pitch_start + jf * pitch_step, &sin_alpha, &cos_alpha);
+    sincosLane(yaw_start + jf * yaw_step, &sin_beta, &cos_beta);
+
+    float A = (ax + bx * sin_alpha) * range + bias_laser_beam;
+    float B = cos_alpha * cos_ksi * range;
+
+    lanes->x[j] = cos_beta * A - sin_beta * B;
+    lanes->y[j] = sin_beta * A + cos_beta * B;
+    lanes->z[j] = (az + bz * sin_alpha) * range + z_bias;
+    lanes->intensity[j] = aux.reflect_data[j];
+    lanes->time[j] = time_start + jf * time_step;
+    lanes->valid[j] = (raw[j] != 0) & (range >= range_min) & (range <= range_max);
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UNITREE_SCAN_KERNEL_AVX2 1
+
+__attribute__((target("avx2,fma"))) inline void computeScanLanesAvx2(
+    const mavlink_ret_lidar_auxiliary_data_packet_t& aux, const uint8_t* point_data,
+    const ScanConvertConfig& config, float sin_theta, float cos_theta, float sin_ksi, float cos_ksi,
+    float time_start, float time_step, ScanLanes* lanes){
+  computeScanLanesImpl(aux, point_data, config, sin_theta, cos_theta, sin_ksi, cos_ksi,
+                       time_start, time_step, lanes);
+}
+
+inline bool cpuHasAvx2(){
+  static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return has;
+}
+#endif
+
+inline void computeScanLanesBaseline(
+    const mavlink_ret_lidar_auxiliary_data_packet_t& aux, const uint8_t* point_data,
+    const ScanConvertConfig& config, float sin_theta, float cos_theta, float sin_ksi, float cos_ksi,
+    float time_start, float time_step, ScanLanes* lanes){
+  computeScanLanesImpl(aux, point_data, config, sin_theta, cos_theta, sin_ksi, cos_ksi,
+                       time_start, time_step, lanes);
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Name of the instruction set used by the scan kernel on this machine
+ */
+inline const char* scanKernelIsa(){
+#ifdef UNITREE_SCAN_KERNEL_AVX2
+  if (detail::cpuHasAvx2()){
+    return "avx2";
+  }
+  return "sse2";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+/**
+ * @brief Convert range/auxiliary packet pairs into points
+ *
+ * All 120 lanes are computed in one branch-free pass: the range scale, bias and min/max gates and
+ * the yaw bias are applied with selects, and sin/cos are evaluated with polynomials so that the
+ * compiler emits SSE2/NEON code, plus an AVX2 variant selected at runtime on x86.
+ * The sin/cos of the laser calibration angles are cached across packets.
+ * No lidar is needed: the converter works on any decoded or recorded packets.
+ */
+class ScanConverter{
+
+public:
+
+  ScanConverter(const ScanConvertConfig& config = defaultScanConvertConfig()) : config_(config){}
+
+  void setConfig(const ScanConvertConfig& config){
+    config_ = config;
+  }
+
+  const ScanConvertConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Compute the 120 lanes of a packet pair without compaction
+   * @param point_data the 240 bytes of RET_LIDAR_DISTANCE_DATA_PACKET::point_data, may point into a frame
+   * @param time_start relative time of the first point
+   * @param time_step time between two consecutive points
+   */
+  void computeLanes(const mavlink_ret_lidar_auxiliary_data_packet_t& aux, const uint8_t* point_data,
+                    ScanLanes* lanes, float time_start = 0, float time_step = 0){
+    updateCalibration(aux);
+#ifdef UNITREE_SCAN_KERNEL_AVX2
+    if (detail::cpuHasAvx2()){
+      detail::computeScanLanesAvx2(aux, point_data, config_, sin_theta_, cos_theta_, sin_ksi_, cos_ksi_,
+                                   time_start, time_step, lanes);
+      return;
+    }
+#endif
+    detail::computeScanLanesBaseline(aux, point_data, config_, sin_theta_, cos_theta_, sin_ksi_, cos_ksi_,
+                                     time_start, time_step, lanes);
+  }
+
+  /**
+   * @brief Append the valid points of the lanes to an array, without branches
+   * @param out must have room for POINTS_NUM_OF_SCAN points
+   * @return number of points written
+   */
+  static uint32_t compactLanes(const ScanLanes& lanes, PointUnitree* out){
+    uint32_t n = 0;
+    for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+      PointUnitree& pt = out[n];
+      pt.x = lanes.x[j];
+      pt.y = lanes.y[j];
+      pt.z = lanes.z[j];
+      pt.intensity = lanes.intensity[j];
+      pt.time = lanes.time[j];
+      pt.ring = 0;
+      n += lanes.valid[j];
+    }
+    return n;
+  }
+
+  /**
+   * @brief Append the valid points of the lanes to a SoA cloud, without branches
+   * @return number of points appended
+   */
+  static uint32_t compactLanes(const ScanLanes& lanes, PointCloudUnitreeSoA& cloud){
+    size_t size = cloud.size();
+    cloud.resize(size + POINTS_NUM_OF_SCAN);
+    float* x = cloud.x.data() + size;
+    float* y = cloud.y.data() + size;
+    float* z = cloud.z.data() + size;
+    float* intensity = cloud.intensity.data() + size;
+    float* time = cloud.time.data() + size;
+    uint16_t* ring = cloud.ring.data() + size;
+    uint32_t n = 0;
+    for (int j = 0; j < POINTS_NUM_OF_SCAN; j++){
+      x[n] = lanes.x[j];
+      y[n] = lanes.y[j];
+      z[n] = lanes.z[j];
+      intensity[n] = lanes.intensity[j];
+      time[n] = lanes.time[j];
+      ring[n] = 0;
+      n += lanes.valid[j];
+    }
+    cloud.resize(size + n);
+    return n;
+  }
+
+  /**
+   * @brief Convert a matched packet pair into a scan
+   * @note scan.id is set to the packet id, scan.stamp is left to the caller.
+   * @return the number of valid points, or -1 if the packet ids do not match
+   */
+  int convert(const mavlink_ret_lidar_auxiliary_data_packet_t& aux,
+              const mavlink_ret_lidar_distance_data_packet_t& range,
+              ScanUnitree& scan, float time_start = 0, float time_step = 0){
+    if (aux.packet_id != range.packet_id){
+      return -1;
+    }
+    computeLanes(aux, range.point_data, &lanes_, time_start, time_step);
+    scan.id = range.packet_id;
+    scan.validPointsNum = compactLanes(lanes_, scan.points);
+    return (int)scan.validPointsNum;
+  }
+
+private:
+
+  void updateCalibration(const mavlink_ret_lidar_auxiliary_data_packet_t& aux){
+    if (aux.theta_angle != theta_ || aux.ksi_angle != ksi_){
+      theta_ = aux.theta_angle;
+      ksi_ = aux.ksi_angle;
+      sin_theta_ = sin(theta_);
+      cos_theta_ = cos(theta_);
+      sin_ksi_ = sin(ksi_);
+      cos_ksi_ = cos(ksi_);
+    }
+  }
+
+  ScanConvertConfig config_;
+  float theta_ = 0;
+  float ksi_ = 0;
+  float sin_theta_ = 0;
+  float cos_theta_ = 1;
+  float sin_ksi_ = 0;
+  float cos_ksi_ = 1;
+  ScanLanes lanes_;
+};
+
+} // end of namespace unitree_lidar_sdk
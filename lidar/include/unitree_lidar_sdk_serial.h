@@ -0,0 +1,243 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Stream of bytes read by a lidar reader: the serial port, or a recorded stream
+ */
+class ByteSource{
+
+public:
+
+  virtual ~ByteSource(){}
+
+  virtual bool isOpen() const = 0;
+
+  /**
+   * @brief Descriptor that can be waited on, -1 if there is none
+   */
+  virtual int fd() const { return -1; }
+
+  /**
+   * @brief Read the bytes currently available without blocking
+   * @return number of bytes read, 0 if nothing is available, -1 on error or at the end of the stream
+   */
+  virtual int read(uint8_t* buf, size_t size) = 0;
+
+  /**
+   * @brief Write the whole buffer
+   * @return number of bytes written, -1 on error
+   */
+  virtual int write(const uint8_t* buf, size_t size) = 0;
+
+  /**
+   * @brief Block until bytes are available, the wake descriptor is signalled or the timeout expires
+   * @return 1 if bytes are available, 0 on timeout or wake-up, -1 on error or at the end of the stream
+   */
+  virtual int waitReadable(int timeout_ms, int wake_fd = -1) = 0;
+
+  /**
+   * @brief Open the source again after an error, e.g. a serial device unplugged and plugged back
+   * @return 0 once reopened, -1 if it cannot be reopened (yet) or does not support it
+   */
+  virtual int reopen(){ return -1; }
+};
+
+/**
+ * @brief Raw 8N1 serial port opened in non-blocking mode.
+ * @note The descriptor can be waited on with poll(), so callers only wake up when bytes arrive.
+ *  read(), write(), open() and close() are serialized, so a command written from another thread
+ *  never reaches a descriptor that is being closed or has been reused by a reopen.
+ */
+class SerialPort : public ByteSource{
+
+public:
+
+  SerialPort(){}
+  virtual ~SerialPort(){ close(); }
+
+  SerialPort(const SerialPort&) = delete;
+  SerialPort& operator=(const SerialPort&) = delete;
+
+  /**
+   * @brief Open and configure the serial port
+   * @return Return 0 if the port is opened successfully; return -1 otherwise.
+   */
+  int open(const std::string& port, uint32_t baudrate){
+    std::lock_guard<std::mutex> lock(mutex_);
+    closeLocked();
+    if (&port != &port_){
+      port_ = port;
+    }
+    baudrate_ = baudrate;
+
+    int fd = ::open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0){
+      return -1;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0){
+      ::close(fd);
+      return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= (CLOCAL | CREAD);
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    speed_t speed = toSpeed(baudrate);
+    if (speed == B0 || cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0 ||
+        tcsetattr(fd, TCSANOW, &tio) != 0){
+      ::close(fd);
+      return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    fd_ = fd;
+    return 0;
+  }
+
+  /**
+   * @brief Close the serial port if it is opened
+   */
+  void close(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    closeLocked();
+  }
+
+  /**
+   * @brief Open the port last given to open() again, e.g. once a replugged device is back
+   * @return 0 on success, -1 if the device is not there (yet)
+   */
+  virtual int reopen(){
+    return port_.empty() ? -1 : open(port_, baudrate_);
+  }
+
+  virtual bool isOpen() const { return fd_ >= 0; }
+
+  virtual int fd() const { return fd_; }
+
+  /**
+   * @brief Read the bytes currently available without blocking
+   * @return number of bytes read, 0 if nothing is available, -1 on error (e.g. the device is unplugged)
+   */
+  virtual int read(uint8_t* buf, size_t size){
+    std::lock_guard<std::mutex> lock(mutex_);
+    int fd = fd_;
+    if (fd < 0){
+      return -1;
+    }
+    ssize_t n = ::read(fd, buf, size);
+    if (n < 0){
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    return (int)n;
+  }
+
+  /**
+   * @brief Write the whole buffer, waiting for the output queue when it is full
+   * @return number of bytes written, -1 on error
+   */
+  virtual int write(const uint8_t* buf, size_t size){
+    std::lock_guard<std::mutex> lock(mutex_);
+    int fd = fd_;
+    if (fd < 0){
+      return -1;
+    }
+    size_t written = 0;
+    while (written < size){
+      ssize_t n = ::write(fd, buf + written, size - written);
+      if (n < 0){
+        if (errno == EINTR){
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK){
+          struct pollfd pfd = {fd, POLLOUT, 0};
+          if (poll(&pfd, 1, 100) <= 0){
+            return -1;
+          }
+          continue;
+        }
+        return -1;
+      }
+      written += n;
+    }
+    return (int)written;
+  }
+
+  /**
+   * @brief Block until bytes are available, the wake descriptor is signalled or the timeout expires
+   * @param timeout_ms timeout in milliseconds, a negative value waits forever
+   * @param wake_fd optional descriptor (e.g. an eventfd) that interrupts the wait when readable
+   * @return 1 if the port is readable, 0 on timeout or wake-up, -1 on error or hang-up
+   * @note Not serialized with the other calls, so that commands are not held for the whole wait:
+   *  call it on the thread that reopens the port, as the readers do.
+   */
+  virtual int waitReadable(int timeout_ms, int wake_fd = -1){
+    int fd = fd_;
+    if (fd < 0){
+      return -1;
+    }
+    struct pollfd pfds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+    int n = poll(pfds, wake_fd >= 0 ? 2 : 1, timeout_ms);
+    if (n < 0){
+      return errno == EINTR ? 0 : -1;
+    }
+    if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL)){
+      return -1;
+    }
+    return (pfds[0].revents & POLLIN) ? 1 : 0;
+  }
+
+private:
+
+  void closeLocked(){
+    int fd = fd_.exchange(-1);
+    if (fd >= 0){
+      ::close(fd);
+    }
+  }
+
+  static speed_t toSpeed(uint32_t baudrate){
+    switch (baudrate){
+      case 9600: return B9600;
+      case 19200: return B19200;
+      case 38400: return B38400;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+      case 460800: return B460800;
+      case 921600: return B921600;
+      case 1000000: return B1000000;
+      case 1500000: return B1500000;
+      case 2000000: return B2000000;
+      case 3000000: return B3000000;
+      case 4000000: return B4000000;
+      default: return B0;
+    }
+  }
+
+  std::string port_;
+  uint32_t baudrate_ = 0;
+  std::mutex mutex_;            // held by read(), write(), open() and close()
+  std::atomic<int> fd_{-1};     // a LidarPipeline reopens the port while commands are written to it
+};
+
+} // end of namespace unitree_lidar_sdk
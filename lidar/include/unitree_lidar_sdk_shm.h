@@ -0,0 +1,466 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <string>
+
+#include "unitree_lidar_sdk.h"
+#include "udp_handler.h"
+
+namespace unitree_lidar_sdk{
+
+const char* const SHM_DEFAULT_NAME = "/unilidar";
+
+namespace detail{
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "the shared memory ring needs address-free atomics");
+
+const uint32_t SHM_RING_MAGIC = 0x554c5352;   // "ULSR"
+const uint32_t SHM_RING_VERSION = 1;
+
+/**
+ * @brief Layout of the shared memory segment: a ShmRingHeader followed by slot_num slots of
+ *  sizeof(ShmSlotHeader) + slot_size bytes
+ */
+struct ShmRingHeader{
+  std::atomic<uint32_t> magic;          // written last, once the segment is initialized
+  uint32_t version;
+  uint32_t slot_num;
+  uint32_t slot_size;
+  std::atomic<uint64_t> write_seq;      // number of messages published so far
+  std::atomic<uint32_t> notify_word;    // futex word, bumped on every publish
+  std::atomic<uint32_t> waiters;        // subscribers sleeping on notify_word
+  char pad[32];
+};
+
+/**
+ * @brief Header of one slot, guarded by a seqlock
+ * @note seq is 2 * ticket + 1 while the message of that ticket is written, 2 * ticket + 2 once done.
+ */
+struct ShmSlotHeader{
+  std::atomic<uint64_t> seq;
+  uint64_t publish_ns;    // CLOCK_MONOTONIC time of the publish
+  uint32_t msgType;       // UDP_MSG_TYPE_IMU or UDP_MSG_TYPE_SCAN
+  uint32_t size;          // bytes of data
+};
+
+inline uint64_t monotonicNs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+inline size_t shmSlotStride(uint32_t slot_size){
+  return (sizeof(ShmSlotHeader) + slot_size + 63) & ~(size_t)63;
+}
+
+inline size_t shmSegmentSize(uint32_t slot_num, uint32_t slot_size){
+  return sizeof(ShmRingHeader) + (size_t)slot_num * shmSlotStride(slot_size);
+}
+
+inline ShmSlotHeader* shmSlot(ShmRingHeader* ring, uint64_t ticket){
+  return (ShmSlotHeader*)((char*)ring + sizeof(ShmRingHeader) +
+                          (size_t)(ticket % ring->slot_num) * shmSlotStride(ring->slot_size));
+}
+
+inline int futexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms){
+  struct timespec ts;
+  struct timespec* pts = NULL;
+  if (timeout_ms >= 0){
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    pts = &ts;
+  }
+  return (int)syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, pts, NULL, 0);
+}
+
+inline void futexWakeAll(std::atomic<uint32_t>* word){
+  syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Information about a message received from a ShmRingSubscriber
+ */
+typedef struct{
+  uint32_t msgType;       // UDP_MSG_TYPE_IMU or UDP_MSG_TYPE_SCAN
+  uint32_t size;          // bytes copied into the caller's buffer
+  uint64_t sequence;      // index of the message in the stream
+  uint64_t publish_ns;    // CLOCK_MONOTONIC time of the publish, comparable across processes
+}ShmMessageInfo;
+
+/**
+ * @brief Single producer of a shared memory ring
+ *
+ * Messages are written into a POSIX shared memory segment with the same data layout as the UDP
+ * messages 101 / 102 (a scan only carries its valid points), so local subscribers read them with
+ * one user-space copy and no socket. Slots are overwritten in order: the producer never waits
+ * for subscribers, and a subscriber that falls more than slot_num messages behind loses the
+ * oldest ones. Linux only, as sleeping subscribers are woken with a futex.
+ */
+class ShmRingPublisher{
+
+public:
+
+  ShmRingPublisher(){}
+
+  ~ShmRingPublisher(){
+    close();
+  }
+
+  ShmRingPublisher(const ShmRingPublisher&) = delete;
+  ShmRingPublisher& operator=(const ShmRingPublisher&) = delete;
+
+  /**
+   * @brief Create the segment, or reuse an existing one with the same geometry
+   * @note A reused segment continues its message sequence, so running subscribers keep reading.
+   * @param slot_size max bytes of one message
+   * @return 0 on success, -1 on error
+   */
+  int open(const std::string& name = SHM_DEFAULT_NAME, uint32_t slot_num = 256,
+           uint32_t slot_size = sizeof(ScanUnitree)){
+    close();
+    if (slot_num < 2 || slot_size < sizeof(IMUUnitree)){
+      return -1;
+    }
+    size_t size = detail::shmSegmentSize(slot_num, slot_size);
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0666);
+    if (fd >= 0){
+      struct stat st;
+      detail::ShmRingHeader* ring = NULL;
+      if (fstat(fd, &st) == 0 && (size_t)st.st_size == size){
+        ring = (detail::ShmRingHeader*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ring = (ring == MAP_FAILED) ? NULL : ring;
+      }
+      if (ring && ring->magic.load() == detail::SHM_RING_MAGIC && ring->version == detail::SHM_RING_VERSION &&
+          ring->slot_num == slot_num && ring->slot_size == slot_size){
+        ::close(fd);
+        ring_ = ring;
+        size_ = size;
+        return 0;
+      }
+      if (ring){
+        munmap(ring, size);
+      }
+      ::close(fd);
+      shm_unlink(name.c_str());   // incompatible: subscribers have to reopen
+    }
+
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0){
+      return -1;
+    }
+    if (ftruncate(fd, size) != 0){
+      ::close(fd);
+      shm_unlink(name.c_str());
+      return -1;
+    }
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED){
+      shm_unlink(name.c_str());
+      return -1;
+    }
+
+    ring_ = (detail::ShmRingHeader*)p;   // the new segment is zero-filled
+    ring_->slot_num = slot_num;
+    ring_->slot_size = slot_size;
+    ring_->version = detail::SHM_RING_VERSION;
+    ring_->magic.store(detail::SHM_RING_MAGIC, std::memory_order_release);
+    size_ = size;
+    return 0;
+  }
+
+  /**
+   * @brief Unmap the segment; it stays available to subscribers until unlinked
+   */
+  void close(){
+    if (ring_){
+      munmap(ring_, size_);
+      ring_ = NULL;
+      size_ = 0;
+    }
+  }
+
+  /**
+   * @brief Remove the segment name, e.g. on shutdown
+   */
+  static int unlink(const std::string& name = SHM_DEFAULT_NAME){
+    return shm_unlink(name.c_str());
+  }
+
+  bool isOpen() const{
+    return ring_ != NULL;
+  }
+
+  /**
+   * @brief Publish a message
+   * @return 0 on success, -1 if the ring is not open or the message is larger than a slot
+   */
+  int publish(uint32_t msgType, const void* data, uint32_t size){
+    if (ring_ == NULL || size > ring_->slot_size){
+      return -1;
+    }
+    return publishParts(msgType, data, size, NULL, 0);
+  }
+
+  int publishIMU(const IMUUnitree& imu){
+    return publish(UDP_MSG_TYPE_IMU, &imu, sizeof(imu));
+  }
+
+  /**
+   * @brief Publish the valid points of a scan
+   */
+  int publishScan(const ScanUnitree& scan){
+    uint32_t n = scan.validPointsNum < 120 ? scan.validPointsNum : 120;
+    return publish(UDP_MSG_TYPE_SCAN, &scan, offsetof(ScanUnitree, points) + n * sizeof(PointUnitree));
+  }
+
+  /**
+   * @brief Publish a cloud as scan messages of at most as many points as a slot holds
+   */
+  int publishCloud(const PointCloudUnitree& cloud){
+    if (ring_ == NULL){
+      return -1;
+    }
+    const uint32_t header_size = offsetof(ScanUnitree, points);
+    const uint32_t capacity = (ring_->slot_size - header_size) / sizeof(PointUnitree);
+    const PointUnitree* points = cloud.points.data();
+    uint32_t num = (uint32_t)cloud.points.size();
+    do{
+      uint32_t part = num < capacity ? num : capacity;
+      ScanUnitree header;
+      header.stamp = cloud.stamp;
+      header.id = cloud.id;
+      header.validPointsNum = part;
+      publishParts(UDP_MSG_TYPE_SCAN, &header, header_size, points, part * sizeof(PointUnitree));
+      points += part;
+      num -= part;
+    }while (num > 0);
+    return 0;
+  }
+
+  /**
+   * @brief Number of messages published into the segment so far
+   */
+  uint64_t getSequence() const{
+    return ring_ ? ring_->write_seq.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+
+  int publishParts(uint32_t msgType, const void* head, uint32_t head_size, const void* body, uint32_t body_size){
+    uint64_t ticket = ring_->write_seq.load(std::memory_order_relaxed);
+    detail::ShmSlotHeader* slot = detail::shmSlot(ring_, ticket);
+
+    slot->seq.store(2 * ticket + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    char* data = (char*)(slot + 1);
+    memcpy(data, head, head_size);
+    if (body_size > 0){
+      memcpy(data + head_size, body, body_size);
+    }
+    slot->msgType = msgType;
+    slot->size = head_size + body_size;
+    slot->publish_ns = detail::monotonicNs();
+    slot->seq.store(2 * ticket + 2, std::memory_order_release);
+
+    ring_->write_seq.store(ticket + 1, std::memory_order_seq_cst);
+    ring_->notify_word.fetch_add(1, std::memory_order_seq_cst);
+    if (ring_->waiters.load(std::memory_order_seq_cst) > 0){
+      detail::futexWakeAll(&ring_->notify_word);
+    }
+    return 0;
+  }
+
+  detail::ShmRingHeader* ring_ = NULL;
+  size_t size_ = 0;
+};
+
+/**
+ * @brief One of any number of consumers of a shared memory ring
+ *
+ * A subscriber starts with the messages published after open(). It spins briefly before
+ * sleeping on the futex, so a message published while it waits is delivered within microseconds.
+ */
+class ShmRingSubscriber{
+
+public:
+
+  ShmRingSubscriber(){}
+
+  ~ShmRingSubscriber(){
+    close();
+  }
+
+  ShmRingSubscriber(const ShmRingSubscriber&) = delete;
+  ShmRingSubscriber& operator=(const ShmRingSubscriber&) = delete;
+
+  /**
+   * @brief Map an existing segment
+   * @return 0 on success, -1 if no compatible segment exists yet
+   */
+  int open(const std::string& name = SHM_DEFAULT_NAME){
+    close();
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0){
+      return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(detail::ShmRingHeader)){
+      ::close(fd);
+      return -1;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED){
+      return -1;
+    }
+    detail::ShmRingHeader* ring = (detail::ShmRingHeader*)p;
+    if (ring->magic.load(std::memory_order_acquire) != detail::SHM_RING_MAGIC || ring->version != detail::SHM_RING_VERSION ||
+        detail::shmSegmentSize(ring->slot_num, ring->slot_size) != (size_t)st.st_size){
+      munmap(p, st.st_size);
+      return -1;
+    }
+    ring_ = ring;
+    size_ = st.st_size;
+    read_seq_ = ring_->write_seq.load(std::memory_order_acquire);
+    lost_ = 0;
+    return 0;
+  }
+
+  void close(){
+    if (ring_){
+      munmap(ring_, size_);
+      ring_ = NULL;
+      size_ = 0;
+    }
+  }
+
+  bool isOpen() const{
+    return ring_ != NULL;
+  }
+
+  /**
+   * @brief Copy the next message into a buffer
+   * @param buffer receives the data, e.g. an IMUUnitree or a ScanUnitree
+   * @param timeout_ms time to wait for a message, -1 to wait forever
+   * @return 1 if a message is received, 0 on timeout, -1 on error or if the message does not fit
+   */
+  int receive(ShmMessageInfo* info, void* buffer, uint32_t buffer_size, int timeout_ms = -1){
+    if (ring_ == NULL){
+      return -1;
+    }
+    uint64_t deadline = timeout_ms >= 0 ? detail::monotonicNs() + (uint64_t)timeout_ms * 1000000ull : 0;
+    while (true){
+      int ret = tryReceive(info, buffer, buffer_size);
+      if (ret != 0){
+        return ret;
+      }
+
+      int spin = 0;
+      while (ring_->write_seq.load(std::memory_order_acquire) == read_seq_ && spin < SPIN_COUNT){
+        spin++;
+      }
+      if (spin < SPIN_COUNT){
+        continue;
+      }
+
+      int wait_ms = -1;
+      if (timeout_ms >= 0){
+        uint64_t now = detail::monotonicNs();
+        if (now >= deadline){
+          return 0;
+        }
+        wait_ms = (int)((deadline - now + 999999) / 1000000);
+      }
+      uint32_t word = ring_->notify_word.load(std::memory_order_seq_cst);
+      ring_->waiters.fetch_add(1, std::memory_order_seq_cst);
+      if (ring_->write_seq.load(std::memory_order_seq_cst) == read_seq_){
+        detail::futexWait(&ring_->notify_word, word, wait_ms);
+      }
+      ring_->waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+  }
+
+  /**
+   * @brief Copy the next message if there is one, without waiting
+   * @return 1 if a message is received, 0 if there is none, -1 on error
+   */
+  int tryReceive(ShmMessageInfo* info, void* buffer, uint32_t buffer_size){
+    if (ring_ == NULL){
+      return -1;
+    }
+    while (true){
+      uint64_t write_seq = ring_->write_seq.load(std::memory_order_acquire);
+      if (read_seq_ == write_seq){
+        return 0;
+      }
+      if (write_seq - read_seq_ > ring_->slot_num){
+        lost_ += write_seq - ring_->slot_num - read_seq_;   // lapped by the producer
+        read_seq_ = write_seq - ring_->slot_num;
+      }
+
+      detail::ShmSlotHeader* slot = detail::shmSlot(ring_, read_seq_);
+      uint64_t expected = 2 * read_seq_ + 2;
+      uint64_t seq1 = slot->seq.load(std::memory_order_acquire);
+      if (seq1 == expected){
+        uint32_t msgType = slot->msgType;
+        uint32_t size = slot->size;
+        uint64_t publish_ns = slot->publish_ns;
+        bool fits = size <= buffer_size && size <= ring_->slot_size;
+        if (fits){
+          memcpy(buffer, slot + 1, size);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) == expected){
+          info->msgType = msgType;
+          info->size = size;
+          info->sequence = read_seq_;
+          info->publish_ns = publish_ns;
+          read_seq_++;
+          return fits ? 1 : -1;
+        }
+      }
+      // the slot was overwritten while we read it: skip the message
+      lost_++;
+      read_seq_++;
+    }
+  }
+
+  /**
+   * @brief Number of messages overwritten before this subscriber could read them
+   */
+  uint64_t getLost() const{
+    return lost_;
+  }
+
+private:
+
+  static const int SPIN_COUNT = 20000;
+
+  detail::ShmRingHeader* ring_ = NULL;
+  size_t size_ = 0;
+  uint64_t read_seq_ = 0;
+  uint64_t lost_ = 0;
+};
+
+} // end of namespace unitree_lidar_sdk
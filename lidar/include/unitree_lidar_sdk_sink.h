@@ -0,0 +1,618 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "udp_handler.h"
+#include "unitree_lidar_sdk_pipeline.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+#include "unitree_lidar_sdk_shm.h"
+#include "unitree_lidar_sdk_recorder.h"
+#include "unitree_lidar_sdk_detector.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Consumer of the decoded lidar stream
+ *
+ * Clouds are handed over as PoolHandle references on the reader buffers, so every sink of a
+ * SinkFanout sees the same decoded points and a sink may keep a handle as long as it needs.
+ * The methods return 0 on success and -1 on failure, counted in SinkStats::errors. They are
+ * called from a single thread: the sink thread of a threaded sink, the publishing one otherwise.
+ */
+class Sink{
+
+public:
+
+  virtual ~Sink(){}
+
+  /**
+   * @brief Name used in the stats
+   */
+  virtual const char* name() const = 0;
+
+  virtual int onIMU(const IMUUnitree&){
+    return 0;
+  }
+
+  /**
+   * @param cloud never empty; the cloud must not be modified
+   */
+  virtual int onCloud(const PoolHandle<PointCloudUnitree>&){
+    return 0;
+  }
+
+  /**
+   * @brief Mapping of the lidar clock to the host clock, about once per clock_sync_interval
+   */
+  virtual int onClockSync(const ClockSyncState&){
+    return 0;
+  }
+
+  /**
+   * @brief Called when no message came for idleTimeoutMs(), and after every message of an inline sink
+   */
+  virtual int onIdle(){
+    return 0;
+  }
+
+  /**
+   * @brief Longest wait of a threaded sink for its next message before onIdle(), -1 for none
+   */
+  virtual int idleTimeoutMs() const{
+    return 100;
+  }
+
+  /**
+   * @brief Dispatch a message of the fan-out to the typed methods
+   */
+  int consume(const PipelineMessage& msg){
+    switch (msg.type){
+      case IMU:
+        return onIMU(msg.imu);
+      case POINTCLOUD:
+        return msg.cloud ? onCloud(msg.cloud) : 0;
+      case TIMESYNC:
+        return onClockSync(msg.clock_sync);
+      default:
+        return 0;
+    }
+  }
+};
+
+/**
+ * @brief How a SinkFanout runs a sink
+ */
+typedef struct{
+  bool threaded;          // own thread and queue, so a slow sink does not delay the others
+  uint32_t queue_size;    // messages queued for a threaded sink
+  DropPolicy policy;      // what a full queue does
+  int cpu;                // core of the sink thread, -1 to leave it unpinned
+}SinkConfig;
+
+inline SinkConfig defaultSinkConfig(){
+  SinkConfig config = {true, 256, DROP_OLDEST, -1};
+  return config;
+}
+
+/**
+ * @brief Counters of one sink of a SinkFanout
+ */
+typedef struct{
+  const char* name;
+  uint64_t messages;          // messages consumed
+  uint64_t errors;            // sink calls that returned -1
+  RingStats queue;            // zero for an inline sink
+  LatencySummary latency;     // time spent in the sink per message
+}SinkStats;
+
+/**
+ * @brief Fan one decoded stream out to several sinks
+ *
+ * publish() takes the messages of a reader, a LidarPipeline output callback or any other
+ * producer, on one thread. Threaded sinks get a SpscRing and a thread each: publishing one
+ * message costs one push per sink, clouds included since only their handle is copied. Inline
+ * sinks are called on the publishing thread, in the order they were added. Every
+ * clock_sync_interval seconds, the clock sync state carried by the clouds is also sent to the
+ * sinks as a TIMESYNC message.
+ */
+class SinkFanout{
+
+public:
+
+  SinkFanout(){}
+
+  ~SinkFanout(){
+    stop();
+  }
+
+  SinkFanout(const SinkFanout&) = delete;
+  SinkFanout& operator=(const SinkFanout&) = delete;
+
+  /**
+   * @brief Add a sink, which must outlive the fan-out; call before start()
+   * @return the index of the sink in getStats(), or -1 if running
+   */
+  int addSink(Sink* sink, const SinkConfig& config = defaultSinkConfig()){
+    if (running_ || sink == nullptr){
+      return -1;
+    }
+    sinks_.emplace_back(new Entry(sink, config));
+    return (int)sinks_.size() - 1;
+  }
+
+  size_t size() const{
+    return sinks_.size();
+  }
+
+  /**
+   * @brief Seconds between TIMESYNC messages, 0 to disable them; the default is 1
+   */
+  void setClockSyncInterval(double seconds){
+    clock_sync_interval_ = seconds;
+  }
+
+  /**
+   * @brief Start the threads of the threaded sinks
+   * @return 0 on success, -1 if already running
+   */
+  int start(){
+    if (running_){
+      return -1;
+    }
+    running_ = true;
+    for (size_t i = 0; i < sinks_.size(); i++){
+      Entry* e = sinks_[i].get();
+      if (e->config.threaded){
+        e->queue.reopen();
+        e->thread = std::thread([this, e](){ sinkLoop(e); });
+        if (pinThreadToCpu(e->thread, e->config.cpu) != 0){
+          fprintf(stderr, "SinkFanout: cannot pin the %s sink to cpu %d\n", e->sink->name(), e->config.cpu);
+        }
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Stop the sink threads; queued messages are discarded
+   */
+  void stop(){
+    if (!running_.exchange(false)){
+      return;
+    }
+    for (size_t i = 0; i < sinks_.size(); i++){
+      Entry* e = sinks_[i].get();
+      if (e->config.threaded){
+        e->queue.close();
+        e->thread.join();
+      }
+    }
+  }
+
+  bool isRunning() const{
+    return running_;
+  }
+
+  /**
+   * @brief Hand a message to every sink; IMU, POINTCLOUD and TIMESYNC messages are forwarded
+   */
+  void publish(const PipelineMessage& msg){
+    deliver(msg);
+    if (msg.type == POINTCLOUD && clock_sync_interval_ > 0 && msg.clock_sync.valid){
+      double now = get_host_timestamp();
+      if (now >= next_clock_sync_){
+        next_clock_sync_ = now + clock_sync_interval_;
+        sync_msg_.type = TIMESYNC;
+        sync_msg_.clock_sync = msg.clock_sync;
+        deliver(sync_msg_);
+      }
+    }
+  }
+
+  void publishIMU(const IMUUnitree& imu){
+    imu_msg_.type = IMU;
+    imu_msg_.imu = imu;
+    publish(imu_msg_);
+  }
+
+  /**
+   * @param clock_sync mapping of the lidar clock, e.g. UnitreeLidarEventReader::getClockSyncState()
+   */
+  void publishCloud(const PoolHandle<PointCloudUnitree>& cloud, const ClockSyncState& clock_sync){
+    cloud_msg_.type = POINTCLOUD;
+    cloud_msg_.cloud = cloud;
+    cloud_msg_.clock_sync = clock_sync;
+    publish(cloud_msg_);
+    cloud_msg_.cloud.reset();
+  }
+
+  /**
+   * @brief Snapshot of the counters of every sink, in the order they were added; safe from any thread
+   */
+  std::vector<SinkStats> getStats() const{
+    std::vector<SinkStats> stats(sinks_.size());
+    for (size_t i = 0; i < sinks_.size(); i++){
+      const Entry* e = sinks_[i].get();
+      stats[i].name = e->sink->name();
+      stats[i].messages = e->messages.load(std::memory_order_relaxed);
+      stats[i].errors = e->errors.load(std::memory_order_relaxed);
+      if (e->config.threaded){
+        stats[i].queue = e->queue.getStats();
+      }
+      else{
+        memset(&stats[i].queue, 0, sizeof(stats[i].queue));
+      }
+      stats[i].latency = e->latency.summary();
+    }
+    return stats;
+  }
+
+private:
+
+  struct Entry{
+    Entry(Sink* s, const SinkConfig& c) : sink(s), config(c), queue(c.queue_size, c.policy){}
+
+    // the ring counters are cache line aligned, which plain new does not honour before C++17
+    static void* operator new(size_t size){
+      void* p = nullptr;
+      if (posix_memalign(&p, 64, size) != 0){
+        throw std::bad_alloc();
+      }
+      return p;
+    }
+
+    static void operator delete(void* p){
+      free(p);
+    }
+
+    Sink* sink;
+    SinkConfig config;
+    SpscRing<PipelineMessage> queue;
+    std::thread thread;
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> errors{0};
+    LatencyHistogram latency;
+  };
+
+  void deliver(const PipelineMessage& msg){
+    for (size_t i = 0; i < sinks_.size(); i++){
+      Entry* e = sinks_[i].get();
+      if (e->config.threaded){
+        if (running_){
+          e->queue.push(msg);
+        }
+      }
+      else{
+        call(e, msg);
+        if (e->sink->onIdle() != 0){
+          e->errors.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+  void call(Entry* e, const PipelineMessage& msg){
+    uint64_t start = detail::statsNowNs();
+    if (e->sink->consume(msg) != 0){
+      e->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    e->latency.recordSince(start);
+    e->messages.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void sinkLoop(Entry* e){
+    PipelineMessage msg;
+    while (running_){
+      int timeout = e->sink->idleTimeoutMs();
+      if (e->queue.waitPop(&msg, timeout < 0 ? 100 : timeout)){
+        call(e, msg);
+        msg.cloud.reset();
+        msg.cloud_soa.reset();
+        msg.range_image.reset();
+        if (!e->queue.empty()){
+          continue;
+        }
+      }
+      if (timeout >= 0 && e->sink->onIdle() != 0){
+        e->errors.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Entry>> sinks_;
+  std::atomic<bool> running_{false};
+  double clock_sync_interval_ = 1.0;
+  double next_clock_sync_ = 0;
+  PipelineMessage imu_msg_;
+  PipelineMessage cloud_msg_;
+  PipelineMessage sync_msg_;
+};
+
+/**
+ * @brief Sink sending the stream as UDP messages, one datagram each or batched
+ *
+ * Without batching, IMU samples are sent as 101 (or 105 when compact) and clouds as scan messages
+ * 102 (or 104) of at most 120 points sharing the cloud stamp and id. With batching, messages are
+ * packed by a UDPBatchPublisher into 103 datagrams and flushed when due. Clock syncs are 107.
+ */
+class UDPSink : public Sink{
+
+public:
+
+  /**
+   * @param batch pack the messages with a UDPBatchPublisher
+   * @param config compact selects the 104 / 105 messages, the other fields only apply to batching
+   */
+  UDPSink(UDPHandler& udp, const std::string& ip, unsigned short port, bool batch = false,
+          const UDPBatchConfig& config = defaultUDPBatchConfig())
+    : udp_(udp), ip_(ip), port_(port), batch_(batch), compact_(config.compact), batcher_(udp, ip, port, config){
+    memset(&scan_, 0, sizeof(scan_));
+  }
+
+  virtual const char* name() const{
+    return batch_ ? "udp-batch" : "udp";
+  }
+
+  virtual int onIMU(const IMUUnitree& imu){
+    if (batch_){
+      return batcher_.addIMU(imu);
+    }
+    uint32_t length = compact_ ? compactIMUToUDPBuffer(imu, sequence_++, buffer_)
+                               : dataStructToUDPBuffer<IMUUnitree>(imu, UDP_MSG_TYPE_IMU, buffer_);
+    return send(length);
+  }
+
+  virtual int onCloud(const PoolHandle<PointCloudUnitree>& cloud){
+    if (batch_){
+      return batcher_.addCloud(*cloud);
+    }
+    int ret = 0;
+    const PointUnitree* points = cloud->points.data();
+    size_t num = cloud->points.size();
+    do{
+      uint32_t part = num < 120 ? (uint32_t)num : 120;
+      uint32_t length;
+      if (compact_){
+        length = compactScanToUDPBuffer(points, part, cloud->stamp, cloud->id, sequence_++, buffer_);
+      }
+      else{
+        scan_.stamp = cloud->stamp;
+        scan_.id = cloud->id;
+        scan_.validPointsNum = part;
+        memcpy(scan_.points, points, part * sizeof(PointUnitree));
+        length = dataStructToUDPBuffer<ScanUnitree>(scan_, UDP_MSG_TYPE_SCAN, buffer_);
+      }
+      if (send(length) != 0){
+        ret = -1;
+      }
+      points += part;
+      num -= part;
+    }while (num > 0);
+    return ret;
+  }
+
+  virtual int onClockSync(const ClockSyncState& state){
+    if (batch_){
+      return batcher_.addClockSync(state, clock_sync_sequence_++);
+    }
+    return send(clockSyncToUDPBuffer(state, clock_sync_sequence_++, buffer_));
+  }
+
+  virtual int onIdle(){
+    return batch_ && batcher_.flushIfDue() < 0 ? -1 : 0;
+  }
+
+  virtual int idleTimeoutMs() const{
+    if (!batch_){
+      return -1;
+    }
+    int timeout = batcher_.getFlushTimeoutMs();
+    return timeout < 0 ? 100 : timeout;
+  }
+
+  const UDPBatchPublisher& getBatchPublisher() const{
+    return batcher_;
+  }
+
+private:
+
+  int send(uint32_t length){
+    return udp_.Send(buffer_, length, (char*)ip_.c_str(), port_) < 0 ? -1 : 0;
+  }
+
+  UDPHandler& udp_;
+  std::string ip_;
+  unsigned short port_;
+  bool batch_;
+  bool compact_;
+  UDPBatchPublisher batcher_;
+  uint32_t sequence_ = 0;
+  uint32_t clock_sync_sequence_ = 0;
+  ScanUnitree scan_;
+  char buffer_[sizeof(ScanUnitree) + 64];
+};
+
+/**
+ * @brief Sink writing the stream into a shared memory ring, for local subscribers
+ */
+class ShmSink : public Sink{
+
+public:
+
+  /**
+   * @param shm an opened publisher, which must outlive the sink
+   */
+  explicit ShmSink(ShmRingPublisher& shm) : shm_(shm){}
+
+  virtual const char* name() const{
+    return "shm";
+  }
+
+  virtual int onIMU(const IMUUnitree& imu){
+    return shm_.publishIMU(imu);
+  }
+
+  virtual int onCloud(const PoolHandle<PointCloudUnitree>& cloud){
+    return shm_.publishCloud(*cloud);
+  }
+
+  virtual int onClockSync(const ClockSyncState& state){
+    uint32_t length = clockSyncToUDPBuffer(state, clock_sync_sequence_++, buffer_);
+    return shm_.publish(UDP_MSG_TYPE_CLOCK_SYNC, buffer_ + UDP_MSG_HEADER_SIZE, length - UDP_MSG_HEADER_SIZE);
+  }
+
+  virtual int idleTimeoutMs() const{
+    return -1;
+  }
+
+private:
+
+  ShmRingPublisher& shm_;
+  uint32_t clock_sync_sequence_ = 0;
+  char buffer_[UDP_MSG_HEADER_SIZE + sizeof(ClockSyncMessage)];
+};
+
+/**
+ * @brief Sink appending the stream to a LogRecorder: IMU and cloud records, clock syncs as LOG_RECORD_CLOCK_SYNC
+ */
+class RecorderSink : public Sink{
+
+public:
+
+  /**
+   * @param recorder an opened recorder, which must outlive the sink; it is not closed by the sink
+   */
+  explicit RecorderSink(LogRecorder& recorder) : recorder_(recorder){}
+
+  virtual const char* name() const{
+    return "recorder";
+  }
+
+  virtual int onIMU(const IMUUnitree& imu){
+    return recorder_.writeIMU(imu);
+  }
+
+  virtual int onCloud(const PoolHandle<PointCloudUnitree>& cloud){
+    return recorder_.writeCloud(*cloud);
+  }
+
+  virtual int onClockSync(const ClockSyncState& state){
+    clockSyncToUDPBuffer(state, clock_sync_sequence_, buffer_);
+    return recorder_.write(LOG_RECORD_CLOCK_SYNC, state.host_reference, clock_sync_sequence_++,
+                           buffer_ + UDP_MSG_HEADER_SIZE, sizeof(ClockSyncMessage));
+  }
+
+  virtual int idleTimeoutMs() const{
+    return -1;
+  }
+
+private:
+
+  LogRecorder& recorder_;
+  uint32_t clock_sync_sequence_ = 0;
+  char buffer_[UDP_MSG_HEADER_SIZE + sizeof(ClockSyncMessage)];
+};
+
+/**
+ * @brief Sink running a DroneDetector in process
+ *
+ * The clouds are gathered into frames of scans_per_frame clouds (1 to detect on every cloud, 18
+ * for one rotation of scans if the reader publishes every scan), and every frame goes through
+ * the detector. The callback receives the frame and its detections, on the thread of the sink.
+ */
+class DetectorSink : public Sink{
+
+public:
+
+  typedef std::function<void(const PointCloudUnitree& frame, const std::vector<Detection>& detections)> DetectionCallback;
+
+  /**
+   * @param detector must outlive the sink
+   */
+  DetectorSink(DroneDetector& detector, uint32_t scans_per_frame = 1, DetectionCallback callback = DetectionCallback())
+    : detector_(detector), scans_per_frame_(scans_per_frame > 0 ? scans_per_frame : 1), callback_(callback){
+    frame_.stamp = 0;
+    frame_.id = 0;
+    frame_.ringNum = 1;
+  }
+
+  virtual const char* name() const{
+    return "detector";
+  }
+
+  virtual int onCloud(const PoolHandle<PointCloudUnitree>& cloud){
+    if (scans_per_frame_ == 1){
+      return run(*cloud);
+    }
+    if (scan_count_ == 0){
+      frame_.stamp = cloud->stamp;
+      frame_.id = cloud->id;
+      frame_.ringNum = cloud->ringNum;
+      frame_.points.clear();
+    }
+    frame_.points.insert(frame_.points.end(), cloud->points.begin(), cloud->points.end());
+    if (++scan_count_ < scans_per_frame_){
+      return 0;
+    }
+    scan_count_ = 0;
+    return run(frame_);
+  }
+
+  virtual int idleTimeoutMs() const{
+    return -1;
+  }
+
+  /**
+   * @brief Detections of the latest frame; read them from the callback
+   */
+  const std::vector<Detection>& getDetections() const{
+    return detections_;
+  }
+
+private:
+
+  int run(const PointCloudUnitree& frame){
+    if (detector_.detect(frame, detections_) < 0){
+      return -1;
+    }
+    if (callback_){
+      callback_(frame, detections_);
+    }
+    return 0;
+  }
+
+  DroneDetector& detector_;
+  uint32_t scans_per_frame_;
+  DetectionCallback callback_;
+  uint32_t scan_count_ = 0;
+  PointCloudUnitree frame_;
+  std::vector<Detection> detections_;
+};
+
+/**
+ * @brief Print the counters of a fan-out, one line per sink
+ */
+inline void printSinkStats(const std::vector<SinkStats>& stats, FILE* out = stdout){
+  for (size_t i = 0; i < stats.size(); i++){
+    const SinkStats& s = stats[i];
+    fprintf(out, "sink %-10s messages = %lu, errors = %lu, dropped = %lu, queue high water = %u / %u, "
+            "p50 = %.1f us, p99 = %.1f us, max = %.1f us\n",
+            s.name, (unsigned long)s.messages, (unsigned long)s.errors, (unsigned long)s.queue.dropped,
+            s.queue.high_water, s.queue.capacity, s.latency.p50_us, s.latency.p99_us, s.latency.max_us);
+  }
+}
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,150 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Allocator returning memory aligned for SIMD loads (32 bytes by default)
+ */
+template <typename T, size_t Alignment = 32>
+struct AlignedAllocator{
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind{ typedef AlignedAllocator<U, Alignment> other; };
+
+  AlignedAllocator() noexcept {}
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+  T* allocate(size_t n){
+    void* p = nullptr;
+    if (posix_memalign(&p, Alignment, n * sizeof(T) > 0 ? n * sizeof(T) : Alignment) != 0){
+      throw std::bad_alloc();
+    }
+    return (T*)p;
+  }
+
+  void deallocate(T* p, size_t) noexcept{
+    free(p);
+  }
+};
+
+template <typename T, typename U, size_t A>
+inline bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&){ return true; }
+
+template <typename T, typename U, size_t A>
+inline bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&){ return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/**
+ * @brief Cloud Type in structure-of-arrays layout
+ * @note Point i is (x[i], y[i], z[i], intensity[i], time[i], ring[i]); all arrays have the same size
+ *  and start on a 32-byte boundary, so consumers that only need coordinates read contiguous floats.
+ */
+struct PointCloudUnitreeSoA{
+  double stamp = 0;       // cloud timestamp
+  uint32_t id = 0;        // sequence id
+  uint32_t ringNum = 1;
+  AlignedVector<float> x;
+  AlignedVector<float> y;
+  AlignedVector<float> z;
+  AlignedVector<float> intensity;
+  AlignedVector<float> time;     // relative time of each point from cloud stamp
+  AlignedVector<uint16_t> ring;
+
+  size_t size() const { return x.size(); }
+
+  bool empty() const { return x.empty(); }
+
+  void clear(){
+    resize(0);
+  }
+
+  void reserve(size_t n){
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+    intensity.reserve(n);
+    time.reserve(n);
+    ring.reserve(n);
+  }
+
+  void resize(size_t n){
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    intensity.resize(n);
+    time.resize(n);
+    ring.resize(n);
+  }
+};
+
+/**
+ * @brief Transform an AoS cloud into a SoA cloud, reusing the capacity of cloudOut
+ */
+inline void transformUnitreeCloudToSoA(const PointCloudUnitree& cloudIn, PointCloudUnitreeSoA& cloudOut){
+  const size_t n = cloudIn.points.size();
+  cloudOut.stamp = cloudIn.stamp;
+  cloudOut.id = cloudIn.id;
+  cloudOut.ringNum = cloudIn.ringNum;
+  cloudOut.resize(n);
+
+  const PointUnitree* in = cloudIn.points.data();
+  float* x = cloudOut.x.data();
+  float* y = cloudOut.y.data();
+  float* z = cloudOut.z.data();
+  float* intensity = cloudOut.intensity.data();
+  float* time = cloudOut.time.data();
+  uint16_t* ring = cloudOut.ring.data();
+  for (size_t i = 0; i < n; i++){
+    x[i] = in[i].x;
+    y[i] = in[i].y;
+    z[i] = in[i].z;
+    intensity[i] = in[i].intensity;
+    time[i] = in[i].time;
+    ring[i] = (uint16_t)in[i].ring;
+  }
+}
+
+/**
+ * @brief Transform a SoA cloud back into an AoS cloud, reusing the capacity of cloudOut
+ */
+inline void transformUnitreeCloudSoAToAoS(const PointCloudUnitreeSoA& cloudIn, PointCloudUnitree& cloudOut){
+  const size_t n = cloudIn.size();
+  cloudOut.stamp = cloudIn.stamp;
+  cloudOut.id = cloudIn.id;
+  cloudOut.ringNum = cloudIn.ringNum;
+  cloudOut.points.resize(n);
+
+  PointUnitree* out = cloudOut.points.data();
+  const float* x = cloudIn.x.data();
+  const float* y = cloudIn.y.data();
+  const float* z = cloudIn.z.data();
+  const float* intensity = cloudIn.intensity.data();
+  const float* time = cloudIn.time.data();
+  const uint16_t* ring = cloudIn.ring.data();
+  for (size_t i = 0; i < n; i++){
+    out[i].x = x[i];
+    out[i].y = y[i];
+    out[i].z = z[i];
+    out[i].intensity = intensity[i];
+    out[i].time = time[i];
+    out[i].ring = ring[i];
+  }
+}
+
+} // end of namespace unitree_lidar_sdk
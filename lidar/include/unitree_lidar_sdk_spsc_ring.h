@@ -0,0 +1,339 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief What a push into a full SpscRing does
+ */
+enum DropPolicy{
+  DROP_OLDEST = 0,    // discard the oldest queued item: the consumer always gets the freshest data
+  DROP_NEWEST,        // discard the pushed item
+  BLOCK               // wait for room: the producer is slowed down to the pace of the consumer
+};
+
+inline const char* dropPolicyName(DropPolicy policy){
+  switch (policy){
+    case DROP_OLDEST: return "drop-oldest";
+    case DROP_NEWEST: return "drop-newest";
+    case BLOCK: return "block";
+    default: return "unknown";
+  }
+}
+
+/**
+ * @brief Counters of a SpscRing
+ */
+typedef struct{
+  uint64_t pushed;        // items queued
+  uint64_t popped;        // items handed to the consumer
+  uint64_t dropped;       // items discarded by the drop policy
+  uint64_t blocked;       // pushes that waited for room
+  uint32_t high_water;    // most items queued at once
+  uint32_t capacity;
+}RingStats;
+
+/**
+ * @brief Bounded lock-free queue between one producer thread and one consumer thread
+ *
+ * Items live in a preallocated array of cells, each with a sequence number telling whether it is
+ * free or filled (Vyukov's bounded queue), so push() and pop() never lock or allocate. Under
+ * DROP_OLDEST the producer takes the oldest item out itself, which is why the consumer side
+ * claims cells with a compare-and-swap. Either side can sleep with wait() / waitPop() or a
+ * BLOCK push; they are woken through a condition variable only when the other side is waiting.
+ */
+template <typename T>
+class SpscRing{
+
+public:
+
+  /**
+   * @param capacity rounded up to a power of two, at least 2
+   */
+  explicit SpscRing(uint32_t capacity = 1024, DropPolicy policy = DROP_OLDEST) : policy_(policy){
+    uint32_t n = 2;
+    while (n < capacity){
+      n <<= 1;
+    }
+    capacity_ = n;
+    mask_ = n - 1;
+    cells_.reset(new Cell[n]);
+    for (uint32_t i = 0; i < n; i++){
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  uint32_t capacity() const{
+    return capacity_;
+  }
+
+  DropPolicy getDropPolicy() const{
+    return policy_;
+  }
+
+  /**
+   * @brief Queue an item, on the producer thread
+   * @return true if this item was queued, false if it was dropped or the ring is closed
+   */
+  bool push(const T& value){
+    return pushItem(value);
+  }
+
+  bool push(T&& value){
+    return pushItem(std::move(value));
+  }
+
+  /**
+   * @brief Take the oldest item without waiting, on the consumer thread
+   * @return false if the ring is empty
+   */
+  bool pop(T* value){
+    if (!take(value)){
+      return false;
+    }
+    popped_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (producer_waiting_.load(std::memory_order_relaxed)){
+      wake();
+    }
+    return true;
+  }
+
+  /**
+   * @brief Sleep until an item is queued, the ring is closed or the timeout expires
+   * @param timeout_ms a negative value waits forever
+   * @return true if an item is available
+   */
+  bool wait(int timeout_ms){
+    if (!empty()){
+      return true;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true){
+      consumer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!empty() || closed_.load(std::memory_order_relaxed)){
+        break;
+      }
+      if (timeout_ms < 0){
+        cv_.wait(lock);
+      }
+      else if (cv_.wait_until(lock, deadline) == std::cv_status::timeout){
+        break;
+      }
+    }
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+    return !empty();
+  }
+
+  /**
+   * @brief Take the oldest item, sleeping until one is queued
+   * @return false on timeout or once the ring is closed and empty
+   */
+  bool waitPop(T* value, int timeout_ms){
+    return wait(timeout_ms) && pop(value);
+  }
+
+  /**
+   * @brief Approximate number of queued items
+   */
+  uint32_t size() const{
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    return head > tail ? (uint32_t)(head - tail) : 0;
+  }
+
+  bool empty() const{
+    return size() == 0;
+  }
+
+  /**
+   * @brief Refuse further pushes and wake both sides; queued items can still be popped
+   */
+  void close(){
+    closed_.store(true);
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+
+  /**
+   * @brief Drop the queued items and accept pushes again; neither side may use the ring meanwhile
+   */
+  void reopen(){
+    T value;
+    while (take(&value)){}
+    closed_.store(false);
+  }
+
+  bool isClosed() const{
+    return closed_.load(std::memory_order_relaxed);
+  }
+
+  RingStats getStats() const{
+    RingStats stats;
+    stats.pushed = pushed_.load(std::memory_order_relaxed);
+    stats.popped = popped_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.blocked = blocked_.load(std::memory_order_relaxed);
+    stats.high_water = high_water_.load(std::memory_order_relaxed);
+    stats.capacity = capacity_;
+    return stats;
+  }
+
+private:
+
+  struct Cell{
+    std::atomic<uint64_t> seq;    // position + 1 once filled, position + capacity once taken
+    T value;
+  };
+
+  template <typename U>
+  bool pushItem(U&& value){
+    bool waited = false;
+    while (!closed_.load(std::memory_order_relaxed)){
+      uint64_t pos = head_.load(std::memory_order_relaxed);
+      Cell& cell = cells_[pos & mask_];
+      if (cell.seq.load(std::memory_order_acquire) == pos){
+        cell.value = std::forward<U>(value);
+        cell.seq.store(pos + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t queued = (uint32_t)(pos + 1 - tail_.load(std::memory_order_relaxed));
+        if (queued > high_water_.load(std::memory_order_relaxed)){
+          high_water_.store(queued, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumer_waiting_.load(std::memory_order_relaxed)){
+          wake();
+        }
+        return true;
+      }
+
+      // full
+      if (policy_ == DROP_NEWEST){
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (policy_ == DROP_OLDEST){
+        T oldest;
+        if (take(&oldest)){
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else{
+          std::this_thread::yield();    // the consumer is taking the oldest cell right now
+        }
+        continue;
+      }
+      if (!waited){
+        waited = true;
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      producer_waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (cell.seq.load(std::memory_order_relaxed) != pos && !closed_.load(std::memory_order_relaxed)){
+        cv_.wait_for(lock, std::chrono::milliseconds(100));
+      }
+      producer_waiting_.store(false, std::memory_order_relaxed);
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /**
+   * @brief Claim and move out the oldest item, from either side
+   */
+  bool take(T* value){
+    uint64_t pos = tail_.load(std::memory_order_relaxed);
+    while (true){
+      Cell& cell = cells_[pos & mask_];
+      uint64_t seq = cell.seq.load(std::memory_order_acquire);
+      int64_t diff = (int64_t)(seq - (pos + 1));
+      if (diff == 0){
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+          *value = std::move(cell.value);
+          cell.seq.store(pos + capacity_, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0){
+        return false;
+      }
+      else{
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void wake(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+
+  DropPolicy policy_;
+  uint32_t capacity_;
+  uint64_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+
+  // head and tail on separate cache lines, written by the producer and the consumer thread
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  alignas(64) std::atomic<bool> consumer_waiting_{false};
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<bool> closed_{false};
+
+  std::atomic<uint64_t> pushed_{0};
+  std::atomic<uint64_t> popped_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> blocked_{0};
+  std::atomic<uint32_t> high_water_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+/**
+ * @brief Pin a thread to one CPU core
+ * @param cpu index of the core, a negative value leaves the thread unpinned
+ * @return 0 on success or when not pinning, -1 if the core cannot be used
+ */
+inline int pinThreadToCpu(std::thread& thread, int cpu){
+  if (cpu < 0){
+    return 0;
+  }
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE){
+    return -1;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0 ? 0 : -1;
+#else
+  (void)thread;
+  return -1;
+#endif
+}
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,313 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+namespace unitree_lidar_sdk{
+
+namespace detail{
+
+inline uint64_t statsNowNs(){
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // end of namespace detail
+
+/**
+ * @brief Percentiles of a LatencyHistogram, in microseconds
+ */
+typedef struct{
+  uint64_t count;
+  double mean_us;
+  double p50_us;
+  double p90_us;
+  double p99_us;
+  double max_us;
+}LatencySummary;
+
+/**
+ * @brief Latency histogram with logarithmic buckets
+ *
+ * Every power of two of nanoseconds is split into 4 buckets, so a percentile is within 25% of
+ * the true value, from nanoseconds to hours, in a fixed 2KB. Recording is a few relaxed atomic
+ * increments: one thread records while any other reads a summary.
+ */
+class LatencyHistogram{
+
+public:
+
+  static const uint32_t SUB_BUCKETS = 4;
+  static const uint32_t BUCKET_NUM = 256;
+
+  LatencyHistogram(){
+    reset();
+  }
+
+  void record(uint64_t ns){
+    buckets_[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)){}
+  }
+
+  /**
+   * @brief Record the time elapsed since start_ns, a detail::statsNowNs() value
+   */
+  void recordSince(uint64_t start_ns){
+    record(detail::statsNowNs() - start_ns);
+  }
+
+  /**
+   * @brief Clear the histogram; records made while resetting may be lost
+   */
+  void reset(){
+    for (uint32_t i = 0; i < BUCKET_NUM; i++){
+      buckets_[i].store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t count() const{
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Value below which a fraction p of the records are, in nanoseconds
+   * @note Returns the middle of the bucket holding the percentile, capped by the max.
+   */
+  uint64_t percentile(double p) const{
+    uint64_t counts[BUCKET_NUM];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < BUCKET_NUM; i++){
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      total += counts[i];
+    }
+    if (total == 0){
+      return 0;
+    }
+    uint64_t rank = (uint64_t)(p * total + 0.5);
+    rank = rank < 1 ? 1 : (rank > total ? total : rank);
+    uint64_t seen = 0;
+    uint32_t i = 0;
+    for (; i < BUCKET_NUM - 1; i++){
+      seen += counts[i];
+      if (seen >= rank){
+        break;
+      }
+    }
+    uint64_t mid = (lowerBound(i) + lowerBound(i + 1)) / 2;
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    return mid < max ? mid : max;
+  }
+
+  LatencySummary summary() const{
+    LatencySummary s;
+    s.count = count();
+    s.mean_us = s.count ? sum_.load(std::memory_order_relaxed) * 1e-3 / s.count : 0;
+    s.p50_us = percentile(0.50) * 1e-3;
+    s.p90_us = percentile(0.90) * 1e-3;
+    s.p99_us = percentile(0.99) * 1e-3;
+    s.max_us = max_.load(std::memory_order_relaxed) * 1e-3;
+    return s;
+  }
+
+  /**
+   * @brief Bucket of a value: values below 4 have their own bucket, then 4 per power of two
+   */
+  static uint32_t bucketOf(uint64_t ns){
+    if (ns < SUB_BUCKETS){
+      return (uint32_t)ns;
+    }
+    uint32_t e = 63 - __builtin_clzll(ns);
+    uint32_t sub = (uint32_t)(ns >> (e - 2)) & (SUB_BUCKETS - 1);
+    return SUB_BUCKETS * (e - 1) + sub;
+  }
+
+  /**
+   * @brief Smallest value of a bucket
+   */
+  static uint64_t lowerBound(uint32_t bucket){
+    if (bucket < SUB_BUCKETS){
+      return bucket;
+    }
+    uint32_t e = bucket / SUB_BUCKETS + 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (e - 2);
+  }
+
+private:
+
+  std::atomic<uint64_t> buckets_[BUCKET_NUM];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+/**
+ * @brief Timed stages of the reader
+ */
+enum ReaderStage{
+  STAGE_READ = 0,     // one read() of the serial port that returned bytes
+  STAGE_CONVERT,      // conversion of one range packet into points
+  STAGE_PARSE,        // from the read that completed a message to runParse() returning it
+  STAGE_CLOUD,        // from the first scan of a cloud to its publication
+  STAGE_CALLBACK,     // the message callback of the thread started with start()
+  READER_STAGE_NUM
+};
+
+inline const char* readerStageName(int stage){
+  static const char* const names[READER_STAGE_NUM] = {"read", "convert", "parse", "cloud", "callback"};
+  return (stage >= 0 && stage < READER_STAGE_NUM) ? names[stage] : "unknown";
+}
+
+/**
+ * @brief Snapshot of the counters and stage latencies of a reader
+ */
+typedef struct{
+  uint64_t bytes_read;            // bytes read from the serial port
+  uint64_t reads;                 // read() calls that returned bytes
+  uint64_t frames;                // MavLink frames with a valid crc
+  uint64_t crc_errors;            // candidate frames rejected by their crc or length
+  uint64_t skipped_bytes;         // bytes discarded while searching for a frame
+  uint64_t imu_messages;
+  uint64_t scans;                 // range packets converted into points
+  uint64_t dropped_packets;       // range packets missing from the packet_id sequence
+  uint64_t unmatched_packets;     // range packets without the auxiliary packet of the same packet_id
+  uint64_t clouds;                // clouds published
+  uint64_t dropped_clouds;        // clouds dropped because every buffer was held by consumers
+  uint64_t filtered_intensity;    // points removed by the scan filter as too weak...
+  uint64_t filtered_dust;         // ...as dust on or near the cover...
+  uint64_t filtered_isolated;     // ...as isolated returns
+  uint64_t reconnects;            // times the source was reopened after an error
+  uint64_t stalls;                // times the range packets stopped while streaming
+  LatencySummary stages[READER_STAGE_NUM];
+}ReaderStats;
+
+/**
+ * @brief Counters and histograms updated by a reader on its parsing thread, readable from any thread
+ */
+class ReaderStatsCollector{
+
+public:
+
+  ReaderStatsCollector(){
+    reset();
+  }
+
+  /**
+   * @brief Clear the counters and the histograms
+   */
+  void reset(){
+    for (int i = 0; i < COUNTER_NUM; i++){
+      counters_[i].store(0, std::memory_order_relaxed);
+    }
+    resetLatencies();
+  }
+
+  /**
+   * @brief Clear the histograms only, e.g. after each periodic dump
+   */
+  void resetLatencies(){
+    for (int i = 0; i < READER_STAGE_NUM; i++){
+      stages_[i].reset();
+    }
+  }
+
+  enum Counter{
+    BYTES_READ = 0, READS, FRAMES, CRC_ERRORS, SKIPPED_BYTES, IMU_MESSAGES, SCANS,
+    DROPPED_PACKETS, UNMATCHED_PACKETS, CLOUDS, DROPPED_CLOUDS, FILTERED_INTENSITY, FILTERED_DUST,
+    FILTERED_ISOLATED, RECONNECTS, STALLS, COUNTER_NUM
+  };
+
+  void add(Counter counter, uint64_t n = 1){
+    counters_[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Overwrite a counter maintained elsewhere, e.g. by the frame decoder
+   */
+  void set(Counter counter, uint64_t value){
+    counters_[counter].store(value, std::memory_order_relaxed);
+  }
+
+  uint64_t get(Counter counter) const{
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  LatencyHistogram& stage(ReaderStage stage){
+    return stages_[stage];
+  }
+
+  const LatencyHistogram& stage(ReaderStage stage) const{
+    return stages_[stage];
+  }
+
+  void snapshot(ReaderStats* stats) const{
+    stats->bytes_read = get(BYTES_READ);
+    stats->reads = get(READS);
+    stats->frames = get(FRAMES);
+    stats->crc_errors = get(CRC_ERRORS);
+    stats->skipped_bytes = get(SKIPPED_BYTES);
+    stats->imu_messages = get(IMU_MESSAGES);
+    stats->scans = get(SCANS);
+    stats->dropped_packets = get(DROPPED_PACKETS);
+    stats->unmatched_packets = get(UNMATCHED_PACKETS);
+    stats->clouds = get(CLOUDS);
+    stats->dropped_clouds = get(DROPPED_CLOUDS);
+    stats->filtered_intensity = get(FILTERED_INTENSITY);
+    stats->filtered_dust = get(FILTERED_DUST);
+    stats->filtered_isolated = get(FILTERED_ISOLATED);
+    stats->reconnects = get(RECONNECTS);
+    stats->stalls = get(STALLS);
+    for (int i = 0; i < READER_STAGE_NUM; i++){
+      stats->stages[i] = stages_[i].summary();
+    }
+  }
+
+private:
+
+  std::atomic<uint64_t> counters_[COUNTER_NUM];
+  LatencyHistogram stages_[READER_STAGE_NUM];
+};
+
+/**
+ * @brief Print a snapshot: one line of counters, then one line per stage that has records
+ */
+inline void printReaderStats(const ReaderStats& stats, FILE* out = stdout){
+  fprintf(out, "reader stats: bytes = %lu, reads = %lu, frames = %lu, crc errors = %lu, skipped bytes = %lu, "
+          "imu = %lu, scans = %lu, dropped packets = %lu, unmatched packets = %lu, clouds = %lu, dropped clouds = %lu\n",
+          (unsigned long)stats.bytes_read, (unsigned long)stats.reads, (unsigned long)stats.frames,
+          (unsigned long)stats.crc_errors, (unsigned long)stats.skipped_bytes, (unsigned long)stats.imu_messages,
+          (unsigned long)stats.scans, (unsigned long)stats.dropped_packets, (unsigned long)stats.unmatched_packets,
+          (unsigned long)stats.clouds, (unsigned long)stats.dropped_clouds);
+  if (stats.filtered_intensity + stats.filtered_dust + stats.filtered_isolated > 0){
+    fprintf(out, "\tfiltered points: intensity = %lu, dust = %lu, isolated = %lu\n",
+            (unsigned long)stats.filtered_intensity, (unsigned long)stats.filtered_dust,
+            (unsigned long)stats.filtered_isolated);
+  }
+  if (stats.reconnects + stats.stalls > 0){
+    fprintf(out, "\tlink: reconnects = %lu, stalls = %lu\n",
+            (unsigned long)stats.reconnects, (unsigned long)stats.stalls);
+  }
+  for (int i = 0; i < READER_STAGE_NUM; i++){
+    const LatencySummary& s = stats.stages[i];
+    if (s.count == 0){
+      continue;
+    }
+    fprintf(out, "\t%-8s n = %lu, mean = %.1f us, p50 = %.1f us, p90 = %.1f us, p99 = %.1f us, max = %.1f us\n",
+            readerStageName(i), (unsigned long)s.count, s.mean_us, s.p50_us, s.p90_us, s.p99_us, s.max_us);
+  }
+}
+
+} // end of namespace unitree_lidar_sdk
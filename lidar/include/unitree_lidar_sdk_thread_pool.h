@@ -0,0 +1,129 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Fixed set of worker threads running blocking parallel loops
+ *
+ * parallelFor() splits a range into one chunk per thread, the calling thread included, and
+ * returns when every chunk is done. The workers sleep between loops. One loop runs at a time;
+ * calls from several threads are serialized.
+ */
+class ThreadPool{
+
+public:
+
+  typedef std::function<void(size_t begin, size_t end, uint32_t worker)> RangeFunc;
+
+  /**
+   * @param num_threads threads running a loop, the calling thread included; 0 for the number of cores
+   */
+  ThreadPool(uint32_t num_threads = 0){
+    if (num_threads == 0){
+      num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads == 0){
+      num_threads = 1;
+    }
+    for (uint32_t i = 1; i < num_threads; i++){
+      workers_.push_back(std::thread([this, i](){ workerLoop(i); }));
+    }
+  }
+
+  ~ThreadPool(){
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++){
+      workers_[i].join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief Threads running a loop, the calling thread included; worker indices are below this
+   */
+  uint32_t size() const{
+    return (uint32_t)workers_.size() + 1;
+  }
+
+  /**
+   * @brief Call func(begin, end, worker) on consecutive chunks of [0, n) in parallel and wait
+   */
+  void parallelFor(size_t n, const RangeFunc& func){
+    std::lock_guard<std::mutex> loop_lock(loop_mutex_);
+    const uint32_t threads = size();
+    if (threads == 1 || n < threads){
+      func(0, n, 0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      func_ = &func;
+      n_ = n;
+      pending_ = threads - 1;
+      generation_++;
+    }
+    start_cv_.notify_all();
+    func(0, n / threads, 0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this](){ return pending_ == 0; });
+    func_ = nullptr;
+  }
+
+private:
+
+  void workerLoop(uint32_t worker){
+    uint64_t seen = 0;
+    while (true){
+      const RangeFunc* func;
+      size_t n;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock, [&](){ return stop_ || generation_ != seen; });
+        if (stop_){
+          return;
+        }
+        seen = generation_;
+        func = func_;
+        n = n_;
+      }
+      const uint32_t threads = size();
+      (*func)(n * worker / threads, n * (worker + 1) / threads, worker);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_--;
+      }
+      done_cv_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex loop_mutex_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const RangeFunc* func_ = nullptr;
+  size_t n_ = 0;
+  uint32_t pending_ = 0;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,325 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "unitree_lidar_sdk_detector.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a DroneTracker
+ */
+typedef struct{
+  float gate_distance;          // meter, max distance between a predicted track and its detection
+  float acceleration_noise;     // m/s^2, standard deviation of the unmodelled acceleration
+  float measurement_noise;      // meter, standard deviation of a detection center
+  uint32_t confirm_hits;        // detections needed to confirm a track
+  double max_coast_time;        // second, a confirmed track without detection is dropped after this
+  uint32_t max_tracks;
+  bool drones_only;             // only detections flagged as drones are tracked
+  float roi_margin;             // meter, added around a track for its region of interest
+  double full_scan_interval;    // second, max time between two detections of the whole cloud
+}TrackerConfig;
+
+inline TrackerConfig defaultTrackerConfig(){
+  TrackerConfig config = {2.0, 4.0, 0.1, 3, 1.0, 32, true, 1.0, 1.0};
+  return config;
+}
+
+/**
+ * @brief One tracked target
+ */
+typedef struct{
+  uint32_t id;              // unique, starting from 1
+  float position[3];        // filtered position at last_stamp
+  float velocity[3];        // m/s
+  float size[3];            // extent of the last detection
+  float position_sigma;     // meter, largest standard deviation of the position
+  double first_stamp;       // stamp of the first detection
+  double last_hit_stamp;    // stamp of the last detection
+  double last_stamp;        // stamp of the last update, position and velocity are predicted to it
+  uint32_t hits;            // associated detections
+  uint32_t misses;          // updates without a detection since the last hit
+  int32_t detection;        // index of the detection associated by the last update, -1 if none
+  bool confirmed;
+}Track;
+
+/**
+ * @brief Multi-target tracker fed by the detections of a DroneDetector
+ *
+ * Every track runs a constant-velocity Kalman filter, one 2-state filter per axis as the axes are
+ * independent. On each update the tracks are predicted to the cloud stamp, then tracks and
+ * detections closer than gate_distance are paired by increasing distance (greedy global nearest
+ * neighbour); unpaired detections start tentative tracks, confirmed after confirm_hits detections.
+ *
+ * Once targets are confirmed, getRegionsOfInterest() returns boxes around their predicted
+ * positions so the detector only clusters there, with a full cloud every full_scan_interval to
+ * acquire new targets. Buffers are preallocated for max_tracks. Not thread-safe.
+ */
+class DroneTracker{
+
+public:
+
+  DroneTracker(const TrackerConfig& config = defaultTrackerConfig()) : config_(config){
+    tracks_.reserve(config_.max_tracks);
+    filters_.reserve(config_.max_tracks);
+    pairs_.reserve(config_.max_tracks * 16);
+    used_.reserve(config_.max_tracks * 16);
+  }
+
+  const TrackerConfig& getConfig() const{
+    return config_;
+  }
+
+  void reset(){
+    tracks_.clear();
+    filters_.clear();
+    last_full_scan_ = -1e300;
+  }
+
+  /**
+   * @brief Predict the tracks to stamp and correct them with the detections of a cloud
+   * @return the number of confirmed tracks
+   */
+  uint32_t update(double stamp, const std::vector<Detection>& detections){
+    for (size_t t = 0; t < tracks_.size(); t++){
+      predict(t, stamp);
+      tracks_[t].detection = -1;
+    }
+
+    // candidate pairs inside the gate, closest first
+    pairs_.clear();
+    const float gate2 = config_.gate_distance * config_.gate_distance;
+    for (size_t d = 0; d < detections.size(); d++){
+      if (config_.drones_only && !detections[d].is_drone){
+        continue;
+      }
+      for (size_t t = 0; t < tracks_.size(); t++){
+        float d2 = 0;
+        for (int a = 0; a < 3; a++){
+          float e = detections[d].center[a] - tracks_[t].position[a];
+          d2 += e * e;
+        }
+        if (d2 <= gate2){
+          Pair p = {d2, (uint32_t)t, (uint32_t)d};
+          pairs_.push_back(p);
+        }
+      }
+    }
+    std::sort(pairs_.begin(), pairs_.end(), lessPair);
+
+    used_.assign(detections.size(), 0);
+    for (size_t i = 0; i < pairs_.size(); i++){
+      const Pair& p = pairs_[i];
+      if (used_[p.detection] || tracks_[p.track].detection >= 0){
+        continue;
+      }
+      used_[p.detection] = 1;
+      correct(p.track, detections[p.detection]);
+      tracks_[p.track].detection = (int32_t)p.detection;
+    }
+
+    // drop lost tracks, in place
+    size_t kept = 0;
+    for (size_t t = 0; t < tracks_.size(); t++){
+      Track& track = tracks_[t];
+      if (track.detection < 0){
+        track.misses++;
+      }
+      bool lost = track.confirmed ? (stamp - track.last_hit_stamp > config_.max_coast_time)
+                                  : (track.misses > 0);
+      if (!lost){
+        tracks_[kept] = track;
+        filters_[kept] = filters_[t];
+        kept++;
+      }
+    }
+    tracks_.resize(kept);
+    filters_.resize(kept);
+
+    for (size_t d = 0; d < detections.size(); d++){
+      if (used_[d] || (config_.drones_only && !detections[d].is_drone) || tracks_.size() >= config_.max_tracks){
+        continue;
+      }
+      start(stamp, detections[d], (int32_t)d);
+    }
+
+    uint32_t confirmed = 0;
+    for (size_t t = 0; t < tracks_.size(); t++){
+      confirmed += tracks_[t].confirmed;
+    }
+    return confirmed;
+  }
+
+  /**
+   * @brief Tracks after the last update, tentative ones included
+   */
+  const std::vector<Track>& getTracks() const{
+    return tracks_;
+  }
+
+  /**
+   * @brief Position of a track extrapolated to stamp
+   */
+  void predictPosition(const Track& track, double stamp, float position[3]) const{
+    float dt = (float)(stamp - track.last_stamp);
+    for (int a = 0; a < 3; a++){
+      position[a] = track.position[a] + track.velocity[a] * dt;
+    }
+  }
+
+  /**
+   * @brief Boxes around the tracks predicted to stamp, tentative ones included so they can be confirmed
+   * @return false, with rois empty, when the whole cloud should be detected: no confirmed
+   *  track, or full_scan_interval elapsed since the last full detection
+   */
+  bool getRegionsOfInterest(double stamp, std::vector<RegionOfInterest>& rois){
+    rois.clear();
+    for (size_t t = 0; t < tracks_.size(); t++){
+      const Track& track = tracks_[t];
+      float center[3];
+      predictPosition(track, stamp, center);
+      float dt = (float)(stamp - track.last_stamp);
+      float speed = sqrtf(track.velocity[0] * track.velocity[0] + track.velocity[1] * track.velocity[1]
+                          + track.velocity[2] * track.velocity[2]);
+      float half = std::max(track.size[0], std::max(track.size[1], track.size[2])) / 2
+                   + 3 * track.position_sigma + speed * dt * 0.5f + config_.roi_margin;
+      RegionOfInterest roi;
+      for (int a = 0; a < 3; a++){
+        roi.min_bound[a] = center[a] - half;
+        roi.max_bound[a] = center[a] + half;
+      }
+      rois.push_back(roi);
+    }
+    bool confirmed = false;
+    for (size_t t = 0; t < tracks_.size(); t++){
+      confirmed = confirmed || tracks_[t].confirmed;
+    }
+    if (!confirmed || stamp - last_full_scan_ >= config_.full_scan_interval){
+      rois.clear();
+      last_full_scan_ = stamp;
+      return false;
+    }
+    return true;
+  }
+
+private:
+
+  typedef struct{
+    float p[3][4];      // per axis covariance of (position, velocity): p00, p01, p10, p11
+  }Filter;
+
+  typedef struct{
+    float distance2;
+    uint32_t track;
+    uint32_t detection;
+  }Pair;
+
+  static bool lessPair(const Pair& a, const Pair& b){
+    return a.distance2 < b.distance2;
+  }
+
+  void predict(size_t t, double stamp){
+    Track& track = tracks_[t];
+    float dt = (float)(stamp - track.last_stamp);
+    if (dt <= 0){
+      return;
+    }
+    const float q = config_.acceleration_noise * config_.acceleration_noise;
+    const float q00 = q * dt * dt * dt * dt / 4, q01 = q * dt * dt * dt / 2, q11 = q * dt * dt;
+    for (int a = 0; a < 3; a++){
+      float* P = filters_[t].p[a];
+      track.position[a] += track.velocity[a] * dt;
+      float p00 = P[0] + dt * (P[1] + P[2]) + dt * dt * P[3] + q00;
+      float p01 = P[1] + dt * P[3] + q01;
+      float p10 = P[2] + dt * P[3] + q01;
+      float p11 = P[3] + q11;
+      P[0] = p00;
+      P[1] = p01;
+      P[2] = p10;
+      P[3] = p11;
+    }
+    track.last_stamp = stamp;
+    track.position_sigma = sigma(t);
+  }
+
+  void correct(size_t t, const Detection& d){
+    Track& track = tracks_[t];
+    const float r = config_.measurement_noise * config_.measurement_noise;
+    for (int a = 0; a < 3; a++){
+      float* P = filters_[t].p[a];
+      float s = P[0] + r;
+      float k0 = P[0] / s, k1 = P[2] / s;
+      float y = d.center[a] - track.position[a];
+      track.position[a] += k0 * y;
+      track.velocity[a] += k1 * y;
+      float p00 = (1 - k0) * P[0], p01 = (1 - k0) * P[1];
+      float p10 = P[2] - k1 * P[0], p11 = P[3] - k1 * P[1];
+      P[0] = p00;
+      P[1] = p01;
+      P[2] = p10;
+      P[3] = p11;
+      track.size[a] = d.size[a];
+    }
+    track.hits++;
+    track.misses = 0;
+    track.last_hit_stamp = track.last_stamp;
+    if (track.hits >= config_.confirm_hits){
+      track.confirmed = true;
+    }
+    track.position_sigma = sigma(t);
+  }
+
+  void start(double stamp, const Detection& d, int32_t index){
+    Track track;
+    memset(&track, 0, sizeof(track));
+    track.id = next_id_++;
+    for (int a = 0; a < 3; a++){
+      track.position[a] = d.center[a];
+      track.size[a] = d.size[a];
+    }
+    track.first_stamp = stamp;
+    track.last_hit_stamp = stamp;
+    track.last_stamp = stamp;
+    track.hits = 1;
+    track.detection = index;
+    track.confirmed = (config_.confirm_hits <= 1);
+
+    // the velocity is unknown, up to about gate_distance per second
+    const float r = config_.measurement_noise * config_.measurement_noise;
+    const float v = config_.gate_distance * config_.gate_distance;
+    Filter f;
+    for (int a = 0; a < 3; a++){
+      f.p[a][0] = r;
+      f.p[a][1] = 0;
+      f.p[a][2] = 0;
+      f.p[a][3] = v;
+    }
+    tracks_.push_back(track);
+    filters_.push_back(f);
+    tracks_.back().position_sigma = sigma(tracks_.size() - 1);
+  }
+
+  float sigma(size_t t) const{
+    const Filter& f = filters_[t];
+    return sqrtf(std::max(f.p[0][0], std::max(f.p[1][0], f.p[2][0])));
+  }
+
+  TrackerConfig config_;
+  std::vector<Track> tracks_;
+  std::vector<Filter> filters_;     // indexed like tracks_
+  std::vector<Pair> pairs_;
+  std::vector<uint8_t> used_;
+  uint32_t next_id_ = 1;
+  double last_full_scan_ = -1e300;
+};
+
+} // end of namespace unitree_lidar_sdk
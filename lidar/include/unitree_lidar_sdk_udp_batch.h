@@ -0,0 +1,460 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "udp_handler.h"
+
+namespace unitree_lidar_sdk{
+
+const uint32_t UDP_SCAN_HEADER_SIZE = offsetof(ScanUnitree, points);   // bytes of a ScanUnitree before its points
+
+/**
+ * @brief Flush budgets of a UDPBatchPublisher
+ */
+typedef struct{
+  uint32_t datagram_size;   // max bytes of one datagram; 1472 fits a 1500 bytes Ethernet/Wi-Fi MTU
+  uint32_t max_datagrams;   // flush when this many datagrams are pending
+  double max_delay;         // second, flush when the oldest pending message is this old
+  bool compact;             // pack compact scan / IMU messages (104 / 105) instead of 101 / 102
+}UDPBatchConfig;
+
+inline UDPBatchConfig defaultUDPBatchConfig(){
+  UDPBatchConfig config = {1472, 16, 0.005, false};
+  return config;
+}
+
+/**
+ * @brief Counters of a UDPBatchPublisher
+ */
+typedef struct{
+  uint64_t messages;    // IMU and scan messages packed, a scan split over datagrams counts once per part
+  uint64_t points;      // points packed
+  uint64_t datagrams;   // datagrams sent
+  uint64_t bytes;       // bytes sent
+  uint64_t syscalls;    // send calls
+  uint64_t errors;      // failed send calls
+}UDPBatchStats;
+
+/**
+ * @brief Publisher packing IMU samples and scans into MTU-sized batch datagrams
+ *
+ * Only the valid points of a scan are packed, as raw or as compact messages
+ * (UDPBatchConfig::compact). A scan that does not fit into the current datagram is split into
+ * several scan messages with the same stamp and id. Pending datagrams are sent with one
+ * sendmmsg() call when max_datagrams are filled or when the oldest message is older than
+ * max_delay, whichever comes first. Call flushIfDue() regularly, e.g. after every
+ * UnitreeLidarEventReader::waitForMessage(getFlushTimeoutMs()).
+ */
+class UDPBatchPublisher{
+
+public:
+
+  UDPBatchPublisher(UDPHandler& udp, const std::string& ip, unsigned short port,
+                    const UDPBatchConfig& config = defaultUDPBatchConfig())
+    : udp_(udp), ip_(ip), port_(port), config_(config){
+    if (config_.datagram_size < MIN_DATAGRAM_SIZE){
+      config_.datagram_size = MIN_DATAGRAM_SIZE;
+    }
+    if (config_.datagram_size > MAX_DATAGRAM_SIZE){
+      config_.datagram_size = MAX_DATAGRAM_SIZE;
+    }
+    if (config_.max_datagrams < 1){
+      config_.max_datagrams = 1;
+    }
+    buffer_.resize((size_t)config_.datagram_size * config_.max_datagrams);
+    lengths_.resize(config_.max_datagrams);
+    memset(&stats_, 0, sizeof(stats_));
+
+#ifdef __linux__
+    memset(&dest_, 0, sizeof(dest_));
+    dest_.sin_family = AF_INET;
+    dest_.sin_port = htons(port_);
+    inet_pton(AF_INET, ip_.c_str(), &dest_.sin_addr);
+    iovecs_.resize(config_.max_datagrams);
+    msgs_.resize(config_.max_datagrams);
+    for (uint32_t i = 0; i < config_.max_datagrams; i++){
+      iovecs_[i].iov_base = datagram(i);
+      memset(&msgs_[i], 0, sizeof(msgs_[i]));
+      msgs_[i].msg_hdr.msg_name = &dest_;
+      msgs_[i].msg_hdr.msg_namelen = sizeof(dest_);
+      msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+      msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+  }
+
+  ~UDPBatchPublisher(){
+    flush();
+  }
+
+  UDPBatchPublisher(const UDPBatchPublisher&) = delete;
+  UDPBatchPublisher& operator=(const UDPBatchPublisher&) = delete;
+
+  const UDPBatchConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Pack an IMU sample
+   * @return 0 on success, -1 if a flush triggered by this call failed
+   */
+  int addIMU(const IMUUnitree& imu){
+    if (config_.compact){
+      int ret = reserve(UDP_MSG_HEADER_SIZE + sizeof(CompactIMUHeader) + sizeof(IMUUnitree));
+      lengths_[pending_ - 1] += compactIMUToUDPBuffer(imu, sequence_++, (char*)tail());
+      stats_.messages++;
+      return ret;
+    }
+    int ret = reserve(UDP_MSG_HEADER_SIZE + sizeof(IMUUnitree));
+    writeMessage(UDP_MSG_TYPE_IMU, &imu, sizeof(IMUUnitree));
+    return ret;
+  }
+
+  /**
+   * @brief Pack a clock sync message of the lidar clock
+   * @param sequence counter of the clock sync messages, kept by the caller
+   * @return 0 on success, -1 if a flush triggered by this call failed
+   */
+  int addClockSync(const ClockSyncState& state, uint32_t sequence){
+    int ret = reserve(UDP_MSG_HEADER_SIZE + sizeof(ClockSyncMessage));
+    lengths_[pending_ - 1] += clockSyncToUDPBuffer(state, sequence, (char*)tail());
+    stats_.messages++;
+    return ret;
+  }
+
+  /**
+   * @brief Pack the first validPointsNum points of a scan
+   * @return 0 on success, -1 if a flush triggered by this call failed
+   */
+  int addScan(const ScanUnitree& scan){
+    uint32_t n = scan.validPointsNum < 120 ? scan.validPointsNum : 120;
+    return addPoints(scan.stamp, scan.id, scan.points, n);
+  }
+
+  /**
+   * @brief Pack all points of a cloud as scan messages
+   * @return 0 on success, -1 if a flush triggered by this call failed
+   */
+  int addCloud(const PointCloudUnitree& cloud){
+    return addPoints(cloud.stamp, cloud.id, cloud.points.data(), (uint32_t)cloud.points.size());
+  }
+
+  /**
+   * @brief Pack points as one or more scan messages sharing the same stamp and id
+   * @note Nothing is packed when num is 0.
+   * @return 0 on success, -1 if a flush triggered by this call failed
+   */
+  int addPoints(double stamp, uint32_t id, const PointUnitree* points, uint32_t num){
+    if (num == 0){
+      return 0;
+    }
+    int ret = 0;
+    do{
+      if (pending_ == 0 && openDatagram() < 0){
+        ret = -1;
+      }
+      uint32_t fit = pointsFit(room());
+      uint32_t want = num < MIN_POINTS_PER_MESSAGE ? num : MIN_POINTS_PER_MESSAGE;
+      if (fit < want){
+        if (openDatagram() < 0){
+          ret = -1;
+        }
+        continue;
+      }
+
+      uint32_t part = num < fit ? num : fit;
+      if (config_.compact){
+        lengths_[pending_ - 1] += compactScanToUDPBuffer(points, part, stamp, id, sequence_++, (char*)tail());
+        stats_.messages++;
+        stats_.points += part;
+        points += part;
+        num -= part;
+        continue;
+      }
+
+      uint8_t scan_header[UDP_SCAN_HEADER_SIZE];
+      memset(scan_header, 0, sizeof(scan_header));
+      memcpy(scan_header + offsetof(ScanUnitree, stamp), &stamp, sizeof(stamp));
+      memcpy(scan_header + offsetof(ScanUnitree, id), &id, sizeof(id));
+      memcpy(scan_header + offsetof(ScanUnitree, validPointsNum), &part, sizeof(part));
+
+      uint32_t size = UDP_SCAN_HEADER_SIZE + part * sizeof(PointUnitree);
+      uint8_t* p = writeHeader(UDP_MSG_TYPE_SCAN, size);
+      memcpy(p, scan_header, UDP_SCAN_HEADER_SIZE);
+      memcpy(p + UDP_SCAN_HEADER_SIZE, points, part * sizeof(PointUnitree));
+      lengths_[pending_ - 1] += size;
+
+      stats_.messages++;
+      stats_.points += part;
+      points += part;
+      num -= part;
+    }while (num > 0);
+    return ret;
+  }
+
+  /**
+   * @brief Send all pending datagrams
+   * @return the number of datagrams sent, or -1 on error
+   */
+  int flush(){
+    if (pending_ == 0){
+      return 0;
+    }
+    for (uint32_t i = 0; i < pending_; i++){
+      uint32_t data_size = lengths_[i] - UDP_MSG_HEADER_SIZE;
+      memcpy(datagram(i) + 4, &data_size, 4);
+    }
+
+    int ret = 0;
+    uint32_t sent = 0;
+#ifdef __linux__
+    for (uint32_t i = 0; i < pending_; i++){
+      iovecs_[i].iov_len = lengths_[i];
+    }
+    while (sent < pending_){
+      int n = udp_.SendBatch(&msgs_[sent], pending_ - sent);
+      stats_.syscalls++;
+      if (n <= 0){
+        stats_.errors++;
+        ret = -1;
+        break;
+      }
+      sent += n;
+    }
+#else
+    for (; sent < pending_; sent++){
+      stats_.syscalls++;
+      if (udp_.Send((const char*)datagram(sent), lengths_[sent], (char*)ip_.c_str(), port_) < 0){
+        stats_.errors++;
+        ret = -1;
+        break;
+      }
+    }
+#endif
+    for (uint32_t i = 0; i < sent; i++){
+      stats_.bytes += lengths_[i];
+    }
+    stats_.datagrams += sent;
+    pending_ = 0;
+    return ret < 0 ? -1 : (int)sent;
+  }
+
+  /**
+   * @brief Send the pending datagrams if the oldest message exceeded max_delay
+   * @return the number of datagrams sent, or -1 on error
+   */
+  int flushIfDue(){
+    if (pending_ > 0 && getFlushTimeoutMs() == 0){
+      return flush();
+    }
+    return 0;
+  }
+
+  /**
+   * @brief Milliseconds until the pending datagrams are due, or -1 if nothing is pending
+   * @note Suitable as the timeout of UnitreeLidarEventReader::waitForMessage().
+   */
+  int getFlushTimeoutMs() const{
+    if (pending_ == 0){
+      return -1;
+    }
+    double age = std::chrono::duration<double>(Clock::now() - first_time_).count();
+    double remain = config_.max_delay - age;
+    return remain > 0 ? (int)(remain * 1000 + 0.999) : 0;
+  }
+
+  /**
+   * @brief Number of datagrams filled but not sent yet
+   */
+  uint32_t getPendingDatagrams() const{
+    return pending_;
+  }
+
+  const UDPBatchStats& getStats() const{
+    return stats_;
+  }
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  static const uint32_t MIN_DATAGRAM_SIZE = 256;
+  static const uint32_t MAX_DATAGRAM_SIZE = 65507;
+  static const uint32_t MIN_POINTS_PER_MESSAGE = 8;   // don't split a scan into tiny parts
+
+  uint8_t* datagram(uint32_t i){
+    return buffer_.data() + (size_t)i * config_.datagram_size;
+  }
+
+  uint8_t* tail(){
+    return datagram(pending_ - 1) + lengths_[pending_ - 1];
+  }
+
+  /**
+   * @brief Number of points of a scan message fitting into bytes
+   */
+  uint32_t pointsFit(uint32_t bytes) const{
+    if (config_.compact){
+      uint32_t header = UDP_MSG_HEADER_SIZE + sizeof(CompactScanHeader);
+      uint32_t n = bytes > header ? (bytes - header) / 9 : 0;
+      while (n > 0 && UDP_MSG_HEADER_SIZE + compactScanDataSize(n) > bytes){
+        n--;
+      }
+      return n < 65535 ? n : 65535;
+    }
+    uint32_t header = UDP_MSG_HEADER_SIZE + UDP_SCAN_HEADER_SIZE;
+    return bytes > header ? (bytes - header) / sizeof(PointUnitree) : 0;
+  }
+
+  uint32_t room() const{
+    return pending_ == 0 ? config_.datagram_size - UDP_MSG_HEADER_SIZE
+                         : config_.datagram_size - lengths_[pending_ - 1];
+  }
+
+  /**
+   * @brief Start a new datagram, flushing first if all of them are filled
+   */
+  int openDatagram(){
+    int ret = 0;
+    if (pending_ == config_.max_datagrams){
+      ret = flush() < 0 ? -1 : 0;
+    }
+    if (pending_ == 0){
+      first_time_ = Clock::now();
+    }
+    uint8_t* p = datagram(pending_);
+    memcpy(p, &UDP_MSG_TYPE_BATCH, 4);
+    memset(p + 4, 0, 4);
+    lengths_[pending_] = UDP_MSG_HEADER_SIZE;
+    pending_++;
+    return ret;
+  }
+
+  /**
+   * @brief Make sure the current datagram has room for size bytes
+   */
+  int reserve(uint32_t size){
+    if (pending_ == 0 || room() < size){
+      return openDatagram();
+    }
+    return 0;
+  }
+
+  uint8_t* writeHeader(uint32_t msgType, uint32_t size){
+    uint8_t* p = tail();
+    memcpy(p, &msgType, 4);
+    memcpy(p + 4, &size, 4);
+    lengths_[pending_ - 1] += UDP_MSG_HEADER_SIZE;
+    return p + UDP_MSG_HEADER_SIZE;
+  }
+
+  void writeMessage(uint32_t msgType, const void* data, uint32_t size){
+    uint8_t* p = writeHeader(msgType, size);
+    memcpy(p, data, size);
+    lengths_[pending_ - 1] += size;
+    stats_.messages++;
+  }
+
+  UDPHandler& udp_;
+  std::string ip_;
+  unsigned short port_;
+  UDPBatchConfig config_;
+
+  std::vector<uint8_t> buffer_;
+  std::vector<uint32_t> lengths_;
+  uint32_t pending_ = 0;
+  uint32_t sequence_ = 0;
+  Clock::time_point first_time_;
+  UDPBatchStats stats_;
+
+#ifdef __linux__
+  sockaddr_in dest_;
+  std::vector<struct iovec> iovecs_;
+  std::vector<struct mmsghdr> msgs_;
+#endif
+};
+
+/**
+ * @brief Visit every message of a received datagram
+ *
+ * A batch datagram is split into its messages; any other datagram is passed as a single message.
+ * @param handler callable as handler(uint32_t msgType, const char* data, uint32_t dataSize)
+ * @return the number of messages visited, or -1 if the datagram is truncated
+ */
+template <typename Handler>
+inline int forEachUDPMessage(const char* buffer, int size, Handler&& handler){
+  if (size < (int)UDP_MSG_HEADER_SIZE){
+    return -1;
+  }
+  uint32_t msgType, dataSize;
+  memcpy(&msgType, buffer, 4);
+  memcpy(&dataSize, buffer + 4, 4);
+  uint32_t avail = (uint32_t)size - UDP_MSG_HEADER_SIZE;
+
+  if (msgType != UDP_MSG_TYPE_BATCH){
+    handler(msgType, buffer + UDP_MSG_HEADER_SIZE, dataSize < avail ? dataSize : avail);
+    return 1;
+  }
+  if (dataSize > avail){
+    return -1;
+  }
+
+  int count = 0;
+  const char* p = buffer + UDP_MSG_HEADER_SIZE;
+  const char* end = p + dataSize;
+  while (end - p >= (long)UDP_MSG_HEADER_SIZE){
+    memcpy(&msgType, p, 4);
+    memcpy(&dataSize, p + 4, 4);
+    p += UDP_MSG_HEADER_SIZE;
+    if (dataSize > (uint32_t)(end - p)){
+      return -1;
+    }
+    handler(msgType, p, dataSize);
+    p += dataSize;
+    count++;
+  }
+  return count;
+}
+
+/**
+ * @brief Zero-copy view of a scan message inside a received datagram
+ */
+typedef struct{
+  double stamp;
+  uint32_t id;
+  uint32_t validPointsNum;
+  const PointUnitree* points;   // points inside the datagram buffer
+}UDPScanView;
+
+/**
+ * @brief Make a view of the valid points of a scan message, without copying them
+ * @note Messages start on 4-byte boundaries, which is the alignment of PointUnitree, as long as
+ *  the datagram buffer itself is 4-byte aligned.
+ * @return 0 on success, -1 if the data is too short
+ */
+inline int viewScanMessage(const char* data, uint32_t dataSize, UDPScanView* view){
+  if (dataSize < UDP_SCAN_HEADER_SIZE){
+    return -1;
+  }
+  memcpy(&view->stamp, data + offsetof(ScanUnitree, stamp), sizeof(view->stamp));
+  memcpy(&view->id, data + offsetof(ScanUnitree, id), sizeof(view->id));
+  memcpy(&view->validPointsNum, data + offsetof(ScanUnitree, validPointsNum), sizeof(view->validPointsNum));
+  uint32_t avail = (dataSize - UDP_SCAN_HEADER_SIZE) / sizeof(PointUnitree);
+  if (view->validPointsNum > avail){
+    view->validPointsNum = avail;
+  }
+  view->points = (const PointUnitree*)(data + UDP_SCAN_HEADER_SIZE);
+  return 0;
+}
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,257 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+
+#include "udp_handler.h"
+#include "unitree_lidar_sdk_buffer_pool.h"
+#include "unitree_lidar_sdk_scan_kernel.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Parameters of a UDPCloudAssembler
+ */
+typedef struct{
+  uint32_t scans_per_cloud;     // scans merged into one cloud, 1 to get every scan as its own cloud
+  uint32_t queue_size;          // complete clouds kept until popCloud(); the oldest is dropped when full
+}UDPCloudConfig;
+
+inline UDPCloudConfig defaultUDPCloudConfig(){
+  UDPCloudConfig config = {1, 8};
+  return config;
+}
+
+/**
+ * @brief Counters of a UDPCloudAssembler
+ */
+typedef struct{
+  uint64_t datagrams;
+  uint64_t truncated;           // datagrams or messages too short for their header
+  uint64_t scans;               // scan messages, plain (102) or compact (104)
+  uint64_t imu_messages;        // plain (101) or compact (105)
+  uint64_t clouds;              // complete clouds queued
+  uint64_t dropped_clouds;      // clouds dropped from a full queue, or because every buffer was held
+  uint64_t lost_messages;       // gaps in the sequence of the compact messages
+}UDPCloudStats;
+
+/**
+ * @brief Decoder of the publisher's datagrams into pooled clouds, without a per-point step
+ *
+ * Every datagram is visited with forEachUDPMessage(), so plain, compact and batched messages are
+ * all accepted. The points of each scan message are copied once, straight from the datagram into
+ * the PointCloudUnitree of a BufferPool being filled; after scans_per_cloud scans the cloud is
+ * queued and popCloud() hands it over as a PoolHandle, e.g. to be exposed to Python as an array
+ * over the pooled buffer. The time of the points stays relative to the stamp of the cloud, as in
+ * the reader's clouds. Not thread-safe.
+ */
+class UDPCloudAssembler{
+
+public:
+
+  UDPCloudAssembler(const UDPCloudConfig& config = defaultUDPCloudConfig()){
+    setConfig(config);
+    memset(&imu_, 0, sizeof(imu_));
+    memset(&clock_sync_, 0, sizeof(clock_sync_));
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void setConfig(const UDPCloudConfig& config){
+    config_ = config;
+    if (config_.scans_per_cloud < 1){
+      config_.scans_per_cloud = 1;
+    }
+    if (config_.queue_size < 1){
+      config_.queue_size = 1;
+    }
+    building_.reset();
+    scan_count_ = 0;
+  }
+
+  const UDPCloudConfig& getConfig() const{
+    return config_;
+  }
+
+  /**
+   * @brief Decode one received datagram
+   * @return the number of clouds it completed, -1 if it is truncated
+   */
+  int addDatagram(const char* data, int size){
+    stats_.datagrams++;
+    uint64_t clouds = stats_.clouds;
+    int n = forEachUDPMessage(data, size, [this](uint32_t msgType, const char* msg, uint32_t msgSize){
+      addMessage(msgType, msg, msgSize);
+    });
+    if (n < 0){
+      stats_.truncated++;
+      return -1;
+    }
+    return (int)(stats_.clouds - clouds);
+  }
+
+  /**
+   * @brief Take the oldest complete cloud
+   * @return false if none is queued
+   */
+  bool popCloud(PoolHandle<PointCloudUnitree>* cloud){
+    if (queue_.empty()){
+      return false;
+    }
+    *cloud = std::move(queue_.front());
+    queue_.pop_front();
+    return true;
+  }
+
+  size_t queuedClouds() const{
+    return queue_.size();
+  }
+
+  /**
+   * @brief Latest IMU message; imuCount() tells whether a new one arrived
+   */
+  const IMUUnitree& getIMU() const{
+    return imu_;
+  }
+
+  uint64_t imuCount() const{
+    return stats_.imu_messages;
+  }
+
+  /**
+   * @brief Latest clock sync message (msgType 107), all zero until one arrives
+   */
+  const ClockSyncMessage& getClockSync() const{
+    return clock_sync_;
+  }
+
+  const UDPCloudStats& getStats() const{
+    return stats_;
+  }
+
+private:
+
+  void addMessage(uint32_t msgType, const char* data, uint32_t size){
+    uint32_t sequence = 0;
+    if (msgType == UDP_MSG_TYPE_SCAN){
+      UDPScanView view;
+      if (viewScanMessage(data, size, &view) != 0){
+        stats_.truncated++;
+        return;
+      }
+      PointUnitree* points = beginScan(view.stamp, view.id, view.validPointsNum);
+      if (points){
+        memcpy(points, view.points, view.validPointsNum * sizeof(PointUnitree));
+        endScan(view.stamp);
+      }
+    }
+    else if (msgType == UDP_MSG_TYPE_COMPACT_SCAN){
+      CompactScanHeader header;
+      if (size < sizeof(header)){
+        stats_.truncated++;
+        return;
+      }
+      memcpy(&header, data, sizeof(header));
+      if (header.version != UDP_COMPACT_VERSION || size < sizeof(header) + header.point_num * 9u){
+        stats_.truncated++;
+        return;
+      }
+      lost(header.sequence);
+      PointUnitree* points = beginScan(header.stamp, header.id, header.point_num);
+      if (points){
+        udpBufferToCompactScan(data, size, &header, points, header.point_num);
+        endScan(header.stamp);
+      }
+    }
+    else if (msgType == UDP_MSG_TYPE_IMU){
+      if (size < sizeof(IMUUnitree)){
+        stats_.truncated++;
+        return;
+      }
+      memcpy(&imu_, data, sizeof(IMUUnitree));
+      stats_.imu_messages++;
+    }
+    else if (msgType == UDP_MSG_TYPE_COMPACT_IMU){
+      if (udpBufferToCompactIMU(data, size, imu_, &sequence) != 0){
+        stats_.truncated++;
+        return;
+      }
+      stats_.imu_messages++;
+      lost(sequence);
+    }
+    else if (msgType == UDP_MSG_TYPE_CLOCK_SYNC){
+      if (udpBufferToClockSync(data, size, clock_sync_) != 0){
+        stats_.truncated++;
+      }
+    }
+  }
+
+  /**
+   * @brief Make room for the points of the next scan in the cloud being filled
+   * @return where to write them, nullptr if every buffer of the pool is held
+   */
+  PointUnitree* beginScan(double stamp, uint32_t id, uint32_t points){
+    if (!building_){
+      building_ = pool_.acquire();
+      if (!building_){
+        stats_.dropped_clouds++;
+        return nullptr;
+      }
+      building_->points.clear();
+      building_->points.reserve(config_.scans_per_cloud * POINTS_NUM_OF_SCAN);
+      building_->ringNum = 1;
+      building_->stamp = stamp;
+      building_->id = id;
+      scan_count_ = 0;
+    }
+    std::vector<PointUnitree>& cloud = building_->points;
+    scan_start_ = cloud.size();
+    cloud.resize(scan_start_ + points);
+    return cloud.data() + scan_start_;
+  }
+
+  /**
+   * @brief Shift the times of the scan to the stamp of the cloud and queue the cloud once it is complete
+   */
+  void endScan(double stamp){
+    std::vector<PointUnitree>& cloud = building_->points;
+    float offset = (float)(stamp - building_->stamp);
+    if (offset != 0){
+      for (size_t i = scan_start_; i < cloud.size(); i++){
+        cloud[i].time += offset;
+      }
+    }
+    stats_.scans++;
+    if (++scan_count_ < config_.scans_per_cloud){
+      return;
+    }
+    if (queue_.size() >= config_.queue_size){
+      queue_.pop_front();
+      stats_.dropped_clouds++;
+    }
+    queue_.push_back(std::move(building_));
+    stats_.clouds++;
+  }
+
+  void lost(uint32_t sequence){
+    stats_.lost_messages += sequence_.update(sequence);
+  }
+
+  UDPCloudConfig config_;
+  BufferPool<PointCloudUnitree> pool_;
+  PoolHandle<PointCloudUnitree> building_;
+  std::deque<PoolHandle<PointCloudUnitree> > queue_;
+  uint32_t scan_count_ = 0;
+  size_t scan_start_ = 0;
+  IMUUnitree imu_;
+  ClockSyncMessage clock_sync_;
+  UDPSequenceTracker sequence_;
+  UDPCloudStats stats_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,301 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "udp_handler.h"
+#include "unitree_lidar_sdk_udp_batch.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief Sizes of a UDPBatchReceiver
+ */
+typedef struct{
+  uint32_t slot_num;          // datagrams the ring can hold, rounded up to a power of two
+  uint32_t slot_size;         // bytes of one slot; larger datagrams are dropped as truncated
+  uint32_t batch_size;        // max datagrams taken by one recvmmsg() call
+  int recv_buffer_size;       // SO_RCVBUF in bytes, 0 to keep the system default
+}UDPReceiverConfig;
+
+inline UDPReceiverConfig defaultUDPReceiverConfig(){
+  UDPReceiverConfig config = {1024, 4096, 64, 8 * 1024 * 1024};
+  return config;
+}
+
+/**
+ * @brief One received datagram, as seen by the consumer
+ * @note data points into a ring slot and is only valid during the callback.
+ */
+typedef struct{
+  const char* data;
+  uint32_t size;
+  sockaddr_in from;
+}UDPDatagram;
+
+/**
+ * @brief Counters of a UDPBatchReceiver
+ */
+typedef struct{
+  uint64_t datagrams;     // datagrams received into the ring
+  uint64_t consumed;      // datagrams handed to the consumer
+  uint64_t dropped;       // datagrams dropped because the ring was full
+  uint64_t truncated;     // datagrams dropped because they did not fit into a slot
+  uint64_t syscalls;      // recvmmsg() calls that returned data
+  int recv_buffer_size;   // SO_RCVBUF reported by the kernel
+}UDPReceiverStats;
+
+/**
+ * @brief Batched UDP receive path
+ *
+ * A receiver thread pulls up to batch_size datagrams per recvmmsg() call straight into the free
+ * slots of a preallocated single-producer/single-consumer ring. A consumer thread hands every
+ * filled slot to the callback in place, without copying, and releases the slots after the
+ * callback returns. When the ring is full, new datagrams are drained from the socket into a
+ * scratch slot and counted as dropped, so the consumer always sees the oldest data first.
+ * Linux only, as it relies on recvmmsg().
+ */
+class UDPBatchReceiver{
+
+public:
+
+  typedef std::function<void(const UDPDatagram&)> DatagramCallback;
+
+  UDPBatchReceiver(UDPHandler& udp, const UDPReceiverConfig& config = defaultUDPReceiverConfig())
+    : udp_(udp), config_(config){
+    uint32_t n = 1;
+    while (n < config_.slot_num){
+      n <<= 1;
+    }
+    config_.slot_num = n;
+    config_.slot_size = (config_.slot_size + 7) & ~7u;   // keep every slot 8-byte aligned
+    if (config_.batch_size < 1){
+      config_.batch_size = 1;
+    }
+
+    // one extra slot is the scratch slot used while the ring is full
+    storage_.resize((size_t)(config_.slot_num + 1) * config_.slot_size / sizeof(uint64_t));
+    sizes_.resize(config_.slot_num);
+    froms_.resize(config_.slot_num + 1);
+    iovecs_.resize(config_.batch_size);
+    msgs_.resize(config_.batch_size);
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  ~UDPBatchReceiver(){
+    stop();
+  }
+
+  UDPBatchReceiver(const UDPBatchReceiver&) = delete;
+  UDPBatchReceiver& operator=(const UDPBatchReceiver&) = delete;
+
+  /**
+   * @brief Start the receiver and the consumer threads
+   * @param callback called on the consumer thread for every datagram
+   * @return 0 on success, -1 if already running
+   */
+  int start(const DatagramCallback& callback){
+    if (running_.load()){
+      return -1;
+    }
+    callback_ = callback;
+    if (config_.recv_buffer_size > 0){
+      stats_.recv_buffer_size = udp_.SetRecvBufferSize(config_.recv_buffer_size);
+    }
+    running_.store(true);
+    receiver_ = std::thread([this](){ receiveLoop(); });
+    consumer_ = std::thread([this](){ consumeLoop(); });
+    return 0;
+  }
+
+  /**
+   * @brief Stop both threads; datagrams still in the ring are discarded
+   */
+  void stop(){
+    if (!running_.exchange(false)){
+      return;
+    }
+    wakeConsumer();
+    if (receiver_.joinable()){
+      receiver_.join();
+    }
+    if (consumer_.joinable()){
+      consumer_.join();
+    }
+  }
+
+  bool isRunning() const{
+    return running_.load();
+  }
+
+  /**
+   * @brief Snapshot of the counters
+   */
+  UDPReceiverStats getStats() const{
+    UDPReceiverStats stats = stats_;
+    stats.datagrams = datagrams_.load(std::memory_order_relaxed);
+    stats.consumed = consumed_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.truncated = truncated_.load(std::memory_order_relaxed);
+    stats.syscalls = syscalls_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  const UDPReceiverConfig& getConfig() const{
+    return config_;
+  }
+
+private:
+
+  char* slot(uint32_t index){
+    return (char*)storage_.data() + (size_t)index * config_.slot_size;
+  }
+
+  void receiveLoop(){
+    const uint32_t mask = config_.slot_num - 1;
+    const uint32_t scratch = config_.slot_num;
+    while (running_.load(std::memory_order_relaxed)){
+      uint32_t head = head_.load(std::memory_order_relaxed);
+      uint32_t tail = tail_.load(std::memory_order_acquire);
+      uint32_t free_slots = config_.slot_num - (head - tail);
+      uint32_t contiguous = config_.slot_num - (head & mask);
+      uint32_t count = free_slots < contiguous ? free_slots : contiguous;
+      if (count > config_.batch_size){
+        count = config_.batch_size;
+      }
+
+      bool full = (count == 0);
+      if (full){
+        count = 1;
+      }
+      for (uint32_t i = 0; i < count; i++){
+        uint32_t index = full ? scratch : ((head + i) & mask);
+        iovecs_[i].iov_base = slot(index);
+        iovecs_[i].iov_len = config_.slot_size;
+        memset(&msgs_[i], 0, sizeof(msgs_[i]));
+        msgs_[i].msg_hdr.msg_name = &froms_[index];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int n = udp_.RecvBatch(msgs_.data(), count, POLL_TIMEOUT_MS);
+      if (n <= 0){
+        continue;
+      }
+      syscalls_.fetch_add(1, std::memory_order_relaxed);
+      if (full){
+        dropped_.fetch_add(n, std::memory_order_relaxed);
+        continue;
+      }
+
+      // keep the accepted datagrams contiguous, so the consumer never sees a hole
+      uint32_t accepted = 0;
+      for (int i = 0; i < n; i++){
+        if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC){
+          truncated_.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
+        uint32_t dst = (head + accepted) & mask;
+        uint32_t src = (head + i) & mask;
+        if (dst != src){
+          memcpy(slot(dst), slot(src), msgs_[i].msg_len);
+          froms_[dst] = froms_[src];
+        }
+        sizes_[dst] = msgs_[i].msg_len;
+        accepted++;
+      }
+      if (accepted == 0){
+        continue;
+      }
+      datagrams_.fetch_add(accepted, std::memory_order_relaxed);
+      head_.store(head + accepted, std::memory_order_seq_cst);
+      if (consumer_waiting_.load(std::memory_order_seq_cst)){
+        wakeConsumer();
+      }
+    }
+  }
+
+  void consumeLoop(){
+    const uint32_t mask = config_.slot_num - 1;
+    UDPDatagram datagram;
+    while (true){
+      uint32_t tail = tail_.load(std::memory_order_relaxed);
+      uint32_t head = head_.load(std::memory_order_acquire);
+      if (head == tail){
+        if (!running_.load()){
+          return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        consumer_waiting_.store(true, std::memory_order_seq_cst);
+        if (head_.load(std::memory_order_seq_cst) == tail && running_.load()){
+          cv_.wait(lock);
+        }
+        consumer_waiting_.store(false, std::memory_order_relaxed);
+        continue;
+      }
+
+      uint32_t begin = tail;
+      for (; tail != head; tail++){
+        uint32_t index = tail & mask;
+        datagram.data = slot(index);
+        datagram.size = sizes_[index];
+        datagram.from = froms_[index];
+        if (callback_){
+          callback_(datagram);
+        }
+      }
+      consumed_.fetch_add(head - begin, std::memory_order_relaxed);
+      tail_.store(head, std::memory_order_release);
+    }
+  }
+
+  void wakeConsumer(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_one();
+  }
+
+  static const int POLL_TIMEOUT_MS = 100;   // bounds the latency of stop()
+
+  UDPHandler& udp_;
+  UDPReceiverConfig config_;
+
+  std::vector<uint64_t> storage_;
+  std::vector<uint32_t> sizes_;
+  std::vector<sockaddr_in> froms_;
+  std::vector<struct iovec> iovecs_;
+  std::vector<struct mmsghdr> msgs_;
+
+  // head and tail on separate cache lines, written by the receiver and the consumer thread
+  std::atomic<uint32_t> head_{0};
+  char head_pad_[64 - sizeof(std::atomic<uint32_t>)];
+  std::atomic<uint32_t> tail_{0};
+  char tail_pad_[64 - sizeof(std::atomic<uint32_t>)];
+  std::atomic<bool> consumer_waiting_{false};
+
+  std::atomic<uint64_t> datagrams_{0};
+  std::atomic<uint64_t> consumed_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> truncated_{0};
+  std::atomic<uint64_t> syscalls_{0};
+  UDPReceiverStats stats_;
+
+  DatagramCallback callback_;
+  std::atomic<bool> running_{false};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread receiver_;
+  std::thread consumer_;
+};
+
+} // end of namespace unitree_lidar_sdk
@@ -0,0 +1,392 @@
+/**********************************************************************
+ Copyright (c) 2020-2023, Unitree Robotics.Co.Ltd. All rights reserved.
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "unitree_lidar_sdk.h"
+#include "unitree_lidar_sdk_soa.h"
+
+namespace unitree_lidar_sdk{
+
+/**
+ * @brief One occupied voxel of a VoxelHashGrid
+ * @note After build(), x, y, z and intensity are the means of the points of the voxel; cells
+ *  created with findOrInsert() start with all fields at 0 but the coordinates.
+ */
+typedef struct{
+  int32_t ix, iy, iz;     // voxel coordinates, floor(x / voxel_size)
+  uint32_t count;         // number of points
+  float x, y, z;
+  float intensity;
+}VoxelCell;
+
+/**
+ * @brief Sparse voxel index with open addressing
+ *
+ * The hash table and the voxel arrays are allocated once for max_voxels voxels; clear() only
+ * bumps a generation counter, so a grid is reused from frame to frame at no cost. build() indexes
+ * a cloud in one pass: every point is hashed to its voxel, then the points are regrouped voxel by
+ * voxel with a counting sort, which makes neighbour queries read contiguous memory.
+ *
+ * Voxels are numbered 0 to voxelCount() - 1 in order of creation. When the table is full, new
+ * voxels are refused: their points get the voxel -1 and are counted by getDropped().
+ */
+class VoxelHashGrid{
+
+public:
+
+  /**
+   * @param voxel_size meter
+   * @param max_voxels voxels the grid can hold, the hash table has twice as many slots or more
+   */
+  VoxelHashGrid(float voxel_size = 0.05, uint32_t max_voxels = 65536)
+    : voxel_size_(voxel_size), inv_size_(1.0f / voxel_size), max_voxels_(max_voxels > 0 ? max_voxels : 1){
+    uint32_t n = 2;
+    shift_ = 63;
+    while (n < 2 * max_voxels_){
+      n <<= 1;
+      shift_--;
+    }
+    slots_.resize(n);
+    memset(slots_.data(), 0, slots_.size() * sizeof(Slot));
+    mask_ = n - 1;
+    cells_.reserve(max_voxels_);
+    voxel_begin_.reserve(max_voxels_ + 1);
+  }
+
+  /**
+   * @note Clears the grid.
+   */
+  void setVoxelSize(float voxel_size){
+    voxel_size_ = voxel_size;
+    inv_size_ = 1.0f / voxel_size;
+    clear();
+  }
+
+  float getVoxelSize() const{
+    return voxel_size_;
+  }
+
+  uint32_t getCapacity() const{
+    return max_voxels_;
+  }
+
+  /**
+   * @brief Remove all voxels and points, in constant time
+   */
+  void clear(){
+    if (++epoch_ == 0){
+      memset(slots_.data(), 0, slots_.size() * sizeof(Slot));
+      epoch_ = 1;
+    }
+    cells_.clear();
+    voxel_begin_.clear();
+    point_voxel_.clear();
+    point_index_.clear();
+    px_.clear();
+    py_.clear();
+    pz_.clear();
+    dropped_ = 0;
+  }
+
+  int32_t voxelCoord(float v) const{
+    return (int32_t)floorf(v * inv_size_);
+  }
+
+  /**
+   * @brief Index of the voxel (ix, iy, iz), -1 if it is empty
+   */
+  int32_t find(int32_t ix, int32_t iy, int32_t iz) const{
+    uint64_t key = packKey(ix, iy, iz);
+    for (uint32_t i = hash(key);; i = (i + 1) & mask_){
+      const Slot& s = slots_[i];
+      if (s.epoch != epoch_){
+        return -1;
+      }
+      if (s.key == key){
+        return (int32_t)s.voxel;
+      }
+    }
+  }
+
+  /**
+   * @brief Whether a point can be indexed: finite and within 2^20 voxels of the origin
+   */
+  bool isValidPoint(float x, float y, float z) const{
+    return inRange(x) && inRange(y) && inRange(z);
+  }
+
+  int32_t findPoint(float x, float y, float z) const{
+    if (!isValidPoint(x, y, z)){
+      return -1;
+    }
+    return find(voxelCoord(x), voxelCoord(y), voxelCoord(z));
+  }
+
+  /**
+   * @brief Index of the voxel (ix, iy, iz), created if needed
+   * @return -1 if the grid is full
+   */
+  int32_t findOrInsert(int32_t ix, int32_t iy, int32_t iz){
+    uint64_t key = packKey(ix, iy, iz);
+    for (uint32_t i = hash(key);; i = (i + 1) & mask_){
+      Slot& s = slots_[i];
+      if (s.epoch != epoch_){
+        if (cells_.size() >= max_voxels_){
+          return -1;
+        }
+        s.key = key;
+        s.epoch = epoch_;
+        s.voxel = (uint32_t)cells_.size();
+        VoxelCell c = {ix, iy, iz, 0, 0, 0, 0, 0};
+        cells_.push_back(c);
+        return (int32_t)s.voxel;
+      }
+      if (s.key == key){
+        return (int32_t)s.voxel;
+      }
+    }
+  }
+
+  /**
+   * @brief Clear the grid and index a cloud
+   * @return the number of voxels
+   */
+  uint32_t build(const PointCloudUnitree& cloud){
+    if (cloud.points.empty()){
+      return build(nullptr, nullptr, nullptr, 1, nullptr, 0);
+    }
+    const PointUnitree* p = cloud.points.data();
+    return build(&p->x, &p->y, &p->z, sizeof(PointUnitree) / sizeof(float), &p->intensity, cloud.points.size());
+  }
+
+  uint32_t build(const PointCloudUnitreeSoA& cloud){
+    return build(cloud.x.data(), cloud.y.data(), cloud.z.data(), 1, cloud.intensity.data(), cloud.size());
+  }
+
+  /**
+   * @brief Clear the grid and index n points read with a stride, counted in floats
+   * @param intensity read with the same stride, nullptr if there is no intensity
+   */
+  uint32_t build(const float* x, const float* y, const float* z, size_t stride, const float* intensity, size_t n){
+    clear();
+    point_voxel_.resize(n);
+    for (size_t i = 0; i < n; i++){
+      size_t k = i * stride;
+      int32_t v = -1;
+      if (inRange(x[k]) && inRange(y[k]) && inRange(z[k])){
+        v = findOrInsert(voxelCoord(x[k]), voxelCoord(y[k]), voxelCoord(z[k]));
+      }
+      point_voxel_[i] = v;
+      if (v < 0){
+        dropped_++;
+        continue;
+      }
+      VoxelCell& c = cells_[v];
+      c.count++;
+      c.x += x[k];
+      c.y += y[k];
+      c.z += z[k];
+      c.intensity += intensity ? intensity[k] : 0;
+    }
+
+    // counting sort of the points by voxel
+    const uint32_t num = (uint32_t)cells_.size();
+    voxel_begin_.resize(num + 1);
+    uint32_t offset = 0;
+    for (uint32_t v = 0; v < num; v++){
+      VoxelCell& c = cells_[v];
+      voxel_begin_[v] = offset;
+      offset += c.count;
+      float inv = 1.0f / c.count;
+      c.x *= inv;
+      c.y *= inv;
+      c.z *= inv;
+      c.intensity *= inv;
+    }
+    voxel_begin_[num] = offset;
+
+    point_index_.resize(offset);
+    px_.resize(offset);
+    py_.resize(offset);
+    pz_.resize(offset);
+    for (size_t i = 0; i < n; i++){
+      int32_t v = point_voxel_[i];
+      if (v < 0){
+        continue;
+      }
+      uint32_t j = voxel_begin_[v]++;
+      size_t k = i * stride;
+      point_index_[j] = (uint32_t)i;
+      px_[j] = x[k];
+      py_[j] = y[k];
+      pz_[j] = z[k];
+    }
+    for (uint32_t v = num; v > 0; v--){
+      voxel_begin_[v] = voxel_begin_[v - 1];
+    }
+    voxel_begin_[0] = 0;
+    return num;
+  }
+
+  uint32_t voxelCount() const{
+    return (uint32_t)cells_.size();
+  }
+
+  const VoxelCell& getVoxel(uint32_t v) const{
+    return cells_[v];
+  }
+
+  VoxelCell& getVoxel(uint32_t v){
+    return cells_[v];
+  }
+
+  /**
+   * @brief Points of the last build() that did not fit into the grid
+   */
+  size_t getDropped() const{
+    return dropped_;
+  }
+
+  /**
+   * @brief Voxel of the i-th point of the last build(), -1 if it was dropped
+   */
+  int32_t getPointVoxel(size_t i) const{
+    return point_voxel_[i];
+  }
+
+  /**
+   * @brief Indices, in the built cloud, of the points of a voxel
+   */
+  const uint32_t* getVoxelPoints(uint32_t v, uint32_t* count) const{
+    *count = voxel_begin_[v + 1] - voxel_begin_[v];
+    return point_index_.data() + voxel_begin_[v];
+  }
+
+  /**
+   * @brief Call f(voxel) for every occupied voxel of the 3 x 3 x 3 block around voxel v, v included
+   */
+  template <typename Func>
+  void forEachNeighbor(uint32_t v, Func f) const{
+    const VoxelCell& c = cells_[v];
+    for (int dx = -1; dx <= 1; dx++){
+      for (int dy = -1; dy <= 1; dy++){
+        for (int dz = -1; dz <= 1; dz++){
+          int32_t u = find(c.ix + dx, c.iy + dy, c.iz + dz);
+          if (u >= 0){
+            f((uint32_t)u);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Call f(point_index, squared_distance) for every built point within radius of (x, y, z)
+   */
+  template <typename Func>
+  void forEachPointInRadius(float x, float y, float z, float radius, Func f) const{
+    const float r2 = radius * radius;
+    const int32_t reach = (int32_t)ceilf(radius * inv_size_);
+    if (!inRange(x) || !inRange(y) || !inRange(z)){
+      return;
+    }
+    const int32_t ix = voxelCoord(x), iy = voxelCoord(y), iz = voxelCoord(z);
+    for (int32_t dx = -reach; dx <= reach; dx++){
+      for (int32_t dy = -reach; dy <= reach; dy++){
+        for (int32_t dz = -reach; dz <= reach; dz++){
+          int32_t u = find(ix + dx, iy + dy, iz + dz);
+          if (u < 0){
+            continue;
+          }
+          for (uint32_t j = voxel_begin_[u]; j < voxel_begin_[u + 1]; j++){
+            float ex = px_[j] - x, ey = py_[j] - y, ez = pz_[j] - z;
+            float d2 = ex * ex + ey * ey + ez * ez;
+            if (d2 <= r2){
+              f(point_index_[j], d2);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Number of built points within radius of (x, y, z)
+   */
+  uint32_t countPointsInRadius(float x, float y, float z, float radius) const{
+    uint32_t count = 0;
+    forEachPointInRadius(x, y, z, radius, [&](uint32_t, float){ count++; });
+    return count;
+  }
+
+  /**
+   * @brief One point per voxel, the mean of its points, reusing the capacity of cloudOut
+   * @note time and ring are the ones of the first point of the voxel.
+   */
+  void downsample(const PointCloudUnitree& cloudIn, PointCloudUnitree& cloudOut) const{
+    const uint32_t num = (uint32_t)cells_.size();
+    cloudOut.stamp = cloudIn.stamp;
+    cloudOut.id = cloudIn.id;
+    cloudOut.ringNum = cloudIn.ringNum;
+    cloudOut.points.resize(num);
+    for (uint32_t v = 0; v < num; v++){
+      const VoxelCell& c = cells_[v];
+      const PointUnitree& first = cloudIn.points[point_index_[voxel_begin_[v]]];
+      PointUnitree& p = cloudOut.points[v];
+      p.x = c.x;
+      p.y = c.y;
+      p.z = c.z;
+      p.intensity = c.intensity;
+      p.time = first.time;
+      p.ring = first.ring;
+    }
+  }
+
+private:
+
+  typedef struct{
+    uint64_t key;
+    uint32_t voxel;
+    uint32_t epoch;       // the slot is used if epoch is the epoch of the grid
+  }Slot;
+
+  static const int32_t KEY_OFFSET = 1 << 20;   // 21 bits per axis
+
+  bool inRange(float v) const{
+    float i = v * inv_size_;
+    return i > -(float)(KEY_OFFSET - 1) && i < (float)(KEY_OFFSET - 1);   // also false for NaN
+  }
+
+  static uint64_t packKey(int32_t x, int32_t y, int32_t z){
+    return ((uint64_t)(uint32_t)(x + KEY_OFFSET) << 42) | ((uint64_t)(uint32_t)(y + KEY_OFFSET) << 21)
+           | (uint64_t)(uint32_t)(z + KEY_OFFSET);
+  }
+
+  uint32_t hash(uint64_t key) const{
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> shift_);   // Fibonacci hashing, top bits
+  }
+
+  float voxel_size_;
+  float inv_size_;
+  uint32_t max_voxels_;
+  uint32_t mask_ = 0;
+  uint32_t shift_ = 63;
+  uint32_t epoch_ = 1;
+  size_t dropped_ = 0;
+
+  std::vector<Slot> slots_;
+  std::vector<VoxelCell> cells_;
+  std::vector<uint32_t> voxel_begin_;   // points of voxel v are [voxel_begin_[v], voxel_begin_[v + 1])
+  std::vector<int32_t> point_voxel_;
+  std::vector<uint32_t> point_index_;   // index in the built cloud, grouped by voxel
+  std::vector<float> px_, py_, pz_;     // coordinates, grouped by voxel
+};
+
+} // end of namespace unitree_lidar_sdk